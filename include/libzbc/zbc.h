@@ -56,6 +56,53 @@
  */
 extern void zbc_set_log_level(char const *log_level);
 
+/**
+ * @brief Memory allocator
+ *
+ * Functions used by the library to allocate and free the memory of device
+ * handles, command buffers and zone arrays returned to the application.
+ * \a za_memalign must return memory aligned to \a align bytes (a power of
+ * 2). \a za_free must accept memory allocated with both functions.
+ */
+struct zbc_allocator {
+	void		*(*za_malloc)(void *priv, size_t size);
+	void		*(*za_memalign)(void *priv, size_t align, size_t size);
+	void		(*za_free)(void *priv, void *ptr);
+	void		*za_priv;
+};
+
+/**
+ * Maximum number of zones that can be reported by \a zbc_report_zones
+ * without allocating memory.
+ */
+#define ZBC_REPORT_NOALLOC_NR_ZONES	1024
+
+/**
+ * @brief Set the library memory allocator
+ * @param[in] alloc	Allocator (NULL for the C library allocator)
+ *
+ * Set the allocator used by the library. The buffers needed by the commands
+ * of a device are allocated when the device is opened: once \a zbc_open
+ * returns, \a zbc_pread, \a zbc_pwrite, \a zbc_flush, \a zbc_zone_operation
+ * on a single zone and \a zbc_report_zones for at most
+ * ZBC_REPORT_NOALLOC_NR_ZONES zones do not allocate memory, unless they are
+ * executed concurrently by more threads than the number of preallocated
+ * buffers of the device handle.
+ *
+ * @return Returns 0 on success, -EINVAL if a function of \a alloc is NULL
+ * and -EBUSY if a device is open or being opened.
+ */
+extern int zbc_set_allocator(const struct zbc_allocator *alloc);
+
+/**
+ * @brief Free memory allocated by the library
+ * @param[in] ptr	Memory to free
+ *
+ * Free memory returned by the library to the application (e.g. the zone
+ * array allocated by \a zbc_list_zones) with the library allocator.
+ */
+extern void zbc_free(void *ptr);
+
 /**
  * @brief Zone type definitions
  *
@@ -333,6 +380,11 @@ enum zbc_dev_type {
 	 */
 	ZBC_DT_FAKE	= 0x04,
 
+	/**
+	 * zonefs file system mount point.
+	 */
+	ZBC_DT_ZONEFS	= 0x05,
+
 };
 
 /**
@@ -679,6 +731,22 @@ enum zbc_oflags {
 	/** Allow use of the fake device backend driver */
 	ZBC_O_DRV_FAKE		= 0x08000000,
 
+	/** Allow use of the zonefs backend driver */
+	ZBC_O_DRV_ZONEFS	= 0x10000000,
+
+	/**
+	 * Do not report zones on open: the zone information is cached by the
+	 * device handle and reported by ranges the first time it is needed
+	 * (see \a zbc_get_zone).
+	 */
+	ZBC_O_LAZY_ZONES	= 0x00800000,
+
+	/**
+	 * With ZBC_O_LAZY_ZONES, cache the information of all zones in the
+	 * background, using low priority executor tasks.
+	 */
+	ZBC_O_ZONE_BGFILL	= 0x00400000,
+
 };
 
 /**
@@ -691,7 +759,8 @@ enum zbc_oflags {
  * at the address specified by \a dev if the device is a zoned block device
  * supporting the ZBC or ZAC command set. \a filename may specify the path to
  * a regular block device file or a regular file to be used with libzbc
- * emulation mode (ZBC_DT_FAKE device type).
+ * emulation mode (ZBC_DT_FAKE device type). \a filename may also specify
+ * the mount point of a zonefs file system (ZBC_DT_ZONEFS device type).
  * \a flags specifies the device access mode flags.O_RDONLY, O_WRONLY and O_RDWR
  * can be specified. Other POSIX defined O_xxx flags are ignored. Additionally,
  * if \a filename specifies the path to a zoned block device file or an emulated
@@ -716,6 +785,101 @@ extern int zbc_open(const char *filename, int flags, struct zbc_device **dev);
  */
 extern int zbc_close(struct zbc_device *dev);
 
+/**
+ * Maximum number of backend drivers and of phases recorded in an open
+ * trace, and length of the names and of the path in an open trace.
+ */
+#define ZBC_OPEN_MAX_DRVS	8
+#define ZBC_OPEN_MAX_PHASES	32
+#define ZBC_OPEN_NAME_LEN	48
+#define ZBC_OPEN_PATH_LEN	128
+
+/**
+ * @brief Device open phase
+ */
+struct zbc_open_phase {
+
+	/**
+	 * Phase name (e.g. "test unit ready") and ZBC_O_DRV_xxx flag of
+	 * the backend driver executing the phase.
+	 */
+	char			zop_name[ZBC_OPEN_NAME_LEN];
+	uint32_t		zop_drv;
+
+	/**
+	 * Phase result (0 or a negative error code) and duration.
+	 */
+	int32_t			zop_ret;
+	uint64_t		zop_ns;
+
+};
+
+/**
+ * @brief Backend driver open attempt
+ */
+struct zbc_open_drv {
+
+	/**
+	 * Driver name and ZBC_O_DRV_xxx flag.
+	 */
+	char			zod_name[16];
+	uint32_t		zod_drv;
+
+	/**
+	 * Result (0 if the driver accepted the device) and duration.
+	 */
+	int32_t			zod_ret;
+	uint64_t		zod_ns;
+
+	/**
+	 * Reason for rejecting the device (empty if accepted).
+	 */
+	char			zod_reason[ZBC_OPEN_NAME_LEN];
+
+};
+
+/**
+ * @brief Device open trace
+ *
+ * Timing of the backend drivers tried and of the phases they executed
+ * during the last call to \a zbc_open or \a zbc_device_is_zoned.
+ */
+struct zbc_open_trace {
+
+	/**
+	 * Device path, result and total duration.
+	 */
+	char			zot_filename[ZBC_OPEN_PATH_LEN];
+	int32_t			zot_ret;
+	uint64_t		zot_ns;
+
+	/**
+	 * Drivers tried, in order.
+	 */
+	uint32_t		zot_nr_drvs;
+	struct zbc_open_drv	zot_drvs[ZBC_OPEN_MAX_DRVS];
+
+	/**
+	 * Phases executed, in order (phases beyond ZBC_OPEN_MAX_PHASES
+	 * are not recorded).
+	 */
+	uint32_t		zot_nr_phases;
+	struct zbc_open_phase	zot_phases[ZBC_OPEN_MAX_PHASES];
+
+};
+
+/**
+ * @brief Get the trace of the last device open
+ * @param[out] trace	Open trace
+ *
+ * Get the timing of the last call to \a zbc_open or \a zbc_device_is_zoned
+ * executed by the calling thread, whether it succeeded or not. Each phase
+ * is also logged at the debug log level and, if the library is compiled
+ * with static tracepoints support (sys/sdt.h), fires the libzbc:open_phase
+ * and libzbc:open_drv tracepoints.
+ */
+extern void zbc_get_open_trace(struct zbc_open_trace *trace);
+
 /**
  * @brief Get a ZBC device information
  * @param[in] dev	Device handle obtained with \a zbc_open
@@ -830,7 +994,9 @@ enum zbc_reporting_options {
  * The array \a zones must be allocated by the caller and \a nr_zones
  * must point to the size of the allocated array (number of zone information
  * structures in the array). The first zone reported will be the zone
- * containing or after \a sector.
+ * containing or after \a sector. If the device was opened with
+ * ZBC_O_LAZY_ZONES, reports of all zones (ZBC_RO_ALL) are served from the
+ * zone information cached by the device handle.
  *
  * @return Returns -EIO if an error happened when communicating with the device.
  */
@@ -872,7 +1038,9 @@ static inline int zbc_report_nr_zones(struct zbc_device *dev, uint64_t sector,
  * at the address specified by \a zones. The size of the array allocated and
  * filled is returned at the address specified by \a nr_zones. Freeing of the
  * memory used by the array of zone information strcutrues allocated by this
- * function is the responsability of the caller.
+ * function is the responsability of the caller: the array must be freed with
+ * \a zbc_free, and not with free(), since the library allocator may have
+ * been changed with \a zbc_set_allocator.
  *
  * @return Returns -EIO if an error happened when communicating with the device.
  * Returns -ENOMEM if memory could not be allocated for \a zones.
@@ -881,6 +1049,26 @@ extern int zbc_list_zones(struct zbc_device *dev,
 			  uint64_t sector, enum zbc_reporting_options ro,
 			  struct zbc_zone **zones, unsigned int *nr_zones);
 
+/**
+ * @brief Get the information of a zone
+ * @param[in] dev	Device handle obtained with \a zbc_open
+ * @param[in] sector	Sector of the zone
+ * @param[out] zone	Information of the zone containing \a sector
+ *
+ * If the device was opened with ZBC_O_LAZY_ZONES, the zone information is
+ * obtained from the zone information cached by the device handle. The
+ * cache is filled by ranges of zones with a report command the first time
+ * a range is accessed and is updated by the writes and zone operations
+ * executed with the device handle. Changes made to the device zones
+ * through other device handles are not seen. Otherwise, the zone
+ * information is obtained with a report command.
+ *
+ * @return Returns 0 on success, -EINVAL if \a sector is not a valid sector
+ * and a negative error code otherwise.
+ */
+extern int zbc_get_zone(struct zbc_device *dev, uint64_t sector,
+			struct zbc_zone *zone);
+
 /**
  * @brief Zone operation codes definitions
  *
@@ -1095,6 +1283,105 @@ extern ssize_t zbc_pread(struct zbc_device *dev, void *buf,
 extern ssize_t zbc_pwrite(struct zbc_device *dev, const void *buf,
 			  size_t count, uint64_t offset);
 
+/**
+ * @brief I/O priority classes
+ */
+enum zbc_io_prio {
+
+	/**
+	 * Default priority.
+	 */
+	ZBC_IO_PRIO_NORMAL	= 0,
+
+	/**
+	 * Latency critical I/Os: SCSI commands are queued at the head of
+	 * the device queue, ATA commands use NCQ high priority and file
+	 * backed devices use the real-time I/O scheduling class.
+	 */
+	ZBC_IO_PRIO_HIGH	= 1,
+
+	/**
+	 * Background I/Os: file backed devices use the idle I/O scheduling
+	 * class.
+	 */
+	ZBC_IO_PRIO_LOW		= 2,
+
+};
+
+/**
+ * @brief I/O cache hint flags
+ */
+enum zbc_io_flags {
+
+	/**
+	 * Disable page out: the data read or written should not replace
+	 * other data in the device cache (SCSI DPO bit).
+	 */
+	ZBC_IO_DPO		= 0x01,
+
+	/**
+	 * Force unit access: the data is read from or written to the
+	 * media, bypassing the device write cache.
+	 */
+	ZBC_IO_FUA		= 0x02,
+
+};
+
+/**
+ * @brief I/O priority and cache hints
+ */
+struct zbc_io_hints {
+
+	/**
+	 * Priority class.
+	 */
+	enum zbc_io_prio	zih_prio;
+
+	/**
+	 * Cache hint flags (enum zbc_io_flags).
+	 */
+	unsigned int		zih_flags;
+
+};
+
+/**
+ * @brief Read sectors form a device with priority and cache hints
+ * @param[in] dev	Device handle obtained with \a zbc_open
+ * @param[in] buf	Caller supplied buffer to read into
+ * @param[in] count	Number of 512B sectors to read
+ * @param[in] offset	Offset where to start reading (512B sector unit)
+ * @param[in] hints	Priority and cache hints (NULL for defaults)
+ *
+ * Same as \a zbc_pread, with the commands issued to the device using
+ * the priority and cache hints \a hints. Hints not supported by the
+ * device or the driver are ignored.
+ *
+ * @return Same as \a zbc_pread. -EINVAL is returned if \a hints is
+ * invalid.
+ */
+extern ssize_t zbc_pread_hints(struct zbc_device *dev, void *buf,
+			       size_t count, uint64_t offset,
+			       const struct zbc_io_hints *hints);
+
+/**
+ * @brief Write sectors to a device with priority and cache hints
+ * @param[in] dev	Device handle obtained with \a zbc_open
+ * @param[in] buf	Caller supplied buffer to write from
+ * @param[in] count	Number of 512B sectors to write
+ * @param[in] offset	Offset where to start writing (512B sector unit)
+ * @param[in] hints	Priority and cache hints (NULL for defaults)
+ *
+ * Same as \a zbc_pwrite, with the commands issued to the device using
+ * the priority and cache hints \a hints. Hints not supported by the
+ * device or the driver are ignored.
+ *
+ * @return Same as \a zbc_pwrite. -EINVAL is returned if \a hints is
+ * invalid.
+ */
+extern ssize_t zbc_pwrite_hints(struct zbc_device *dev, const void *buf,
+				size_t count, uint64_t offset,
+				const struct zbc_io_hints *hints);
+
 /**
  * @brief Flush a device write cache
  * @param[in] dev	Device handle obtained with \a zbc_open
@@ -1106,6 +1393,333 @@ extern ssize_t zbc_pwrite(struct zbc_device *dev, const void *buf,
  */
 extern int zbc_flush(struct zbc_device *dev);
 
+/**
+ * @brief Command classes of device statistics
+ */
+enum zbc_stat_class {
+	ZBC_STAT_READ		= 0,
+	ZBC_STAT_WRITE,
+	ZBC_STAT_FLUSH,
+	ZBC_STAT_REPORT_ZONES,
+	ZBC_STAT_RESET_ZONE,
+	ZBC_STAT_OPEN_ZONE,
+	ZBC_STAT_CLOSE_ZONE,
+	ZBC_STAT_FINISH_ZONE,
+
+	ZBC_STAT_NR_CLASSES,
+};
+
+/**
+ * @brief Get a command class name
+ * @param[in] cls	Command class
+ *
+ * @return A string describing the command class.
+ */
+extern const char *zbc_stat_class_str(enum zbc_stat_class cls);
+
+/**
+ * Number of latency histogram buckets. Bucket 0 counts commands that
+ * completed in less than 1 microsecond and bucket n (n > 0) counts
+ * commands with a latency in the range [2^(n-1), 2^n[ microseconds.
+ * The last bucket also counts all commands slower than that.
+ */
+#define ZBC_STAT_LAT_BUCKETS	32
+
+/**
+ * @brief Command class statistics
+ */
+struct zbc_cmd_stats {
+
+	/**
+	 * Number of commands executed.
+	 */
+	uint64_t		zbs_nr_cmds;
+
+	/**
+	 * Number of commands that failed.
+	 */
+	uint64_t		zbs_nr_errors;
+
+	/**
+	 * Number of 512B sectors transferred (read and write only).
+	 */
+	uint64_t		zbs_sectors;
+
+	/**
+	 * Total latency of all commands in nanoseconds.
+	 */
+	uint64_t		zbs_lat_ns;
+
+	/**
+	 * Command latency histogram.
+	 */
+	uint64_t		zbs_lat_hist[ZBC_STAT_LAT_BUCKETS];
+
+};
+
+/**
+ * If the environment variable ZBC_STATS_ENV is set to a non-zero value
+ * when a device is opened, the device statistics are exported in a file
+ * named ZBC_STATS_DIR/ZBC_STATS_PREFIX<pid>-<n>, readable only by the
+ * process user, so that monitoring tools (e.g. zbc_top) can map them
+ * without interacting with the process using the device.
+ */
+#define ZBC_STATS_ENV		"ZBC_STATS_EXPORT"
+#define ZBC_STATS_DIR		"/dev/shm"
+#define ZBC_STATS_PREFIX	"libzbc-"
+#define ZBC_STATS_MAGIC		0x5a424353
+#define ZBC_STATS_VERSION	2
+#define ZBC_STATS_PATH_LEN	128
+
+/**
+ * @brief Device statistics
+ *
+ * Statistics maintained by the library for an open device. Counters are
+ * updated for every command issued to the device backend driver. The zone
+ * condition counters are a snapshot taken whenever the application reports
+ * all zones of the device.
+ */
+struct zbc_device_stats {
+
+	/**
+	 * Segment magic (ZBC_STATS_MAGIC) and version (ZBC_STATS_VERSION).
+	 */
+	uint32_t		zbs_magic;
+	uint32_t		zbs_version;
+
+	/**
+	 * ID of the process that opened the device.
+	 */
+	uint32_t		zbs_pid;
+
+	/**
+	 * Maximum number of explicitly open sequential write required zones
+	 * (copied from the device information).
+	 */
+	uint32_t		zbs_max_nr_open;
+
+	/**
+	 * Device path, type and model.
+	 */
+	char			zbs_filename[ZBC_STATS_PATH_LEN];
+	uint32_t		zbs_type;
+	uint32_t		zbs_model;
+
+	/**
+	 * Capacity of the device in 512B sectors.
+	 */
+	uint64_t		zbs_sectors;
+
+	/**
+	 * Time (seconds since the Epoch) of the device open and of the
+	 * last zone condition snapshot (0 if no snapshot was taken).
+	 */
+	uint64_t		zbs_open_time;
+	uint64_t		zbs_zones_time;
+
+	/**
+	 * Number of zones and number of zones in each condition
+	 * (indexed by enum zbc_zone_condition) at the last snapshot.
+	 */
+	uint32_t		zbs_nr_zones;
+	uint32_t		zbs_zone_cond[16];
+
+	/**
+	 * Per command class statistics.
+	 */
+	struct zbc_cmd_stats	zbs_cmd[ZBC_STAT_NR_CLASSES];
+
+	/**
+	 * Adaptive queue depth controller state (all 0 if the controller
+	 * is not enabled): current limit and number of read and write
+	 * commands in flight, baseline and last interval latencies
+	 * (normalized to 128 KiB commands), last interval IOPS and
+	 * throughput in 512B sectors per second, number of commands that
+	 * waited for a slot and total time spent waiting.
+	 */
+	uint32_t		zbs_qd_limit;
+	uint32_t		zbs_qd_inflight;
+	uint64_t		zbs_qd_lat_min_ns;
+	uint64_t		zbs_qd_lat_ns;
+	uint64_t		zbs_qd_iops;
+	uint64_t		zbs_qd_bw;
+	uint64_t		zbs_qd_nr_waits;
+	uint64_t		zbs_qd_wait_ns;
+
+};
+
+/**
+ * @brief Get a device statistics
+ * @param[in] dev	Device handle obtained with \a zbc_open
+ * @param[out] stats	Device statistics
+ *
+ * Copy the current value of the statistics of the device \a dev into
+ * \a stats. Counters are updated concurrently with the copy, so individual
+ * classes may be slightly inconsistent with each other.
+ */
+extern void zbc_get_stats(struct zbc_device *dev,
+			  struct zbc_device_stats *stats);
+
+/**
+ * @brief Adaptive queue depth controller parameters
+ */
+struct zbc_qd_params {
+
+	/**
+	 * Minimum and maximum number of read and write commands in flight
+	 * (0 for the defaults of 1 and 64).
+	 */
+	unsigned int		zqp_min_qd;
+	unsigned int		zqp_max_qd;
+
+	/**
+	 * Latency increase over the baseline latency tolerated before
+	 * the queue depth is reduced, in percent (0 for the default of 50).
+	 */
+	unsigned int		zqp_tolerance;
+
+};
+
+/**
+ * @brief Enable or disable the adaptive queue depth controller
+ * @param[in] dev	Device handle obtained with \a zbc_open
+ * @param[in] params	Controller parameters (NULL to disable)
+ *
+ * The controller limits the number of read and write commands issued
+ * concurrently to the device by the threads of the application. It
+ * measures the device latency and throughput and adjusts the limit to
+ * stay at the point where throughput stops increasing: the limit is
+ * increased by one while the latency stays within the tolerance of the
+ * baseline latency and the limit is reached, and decreased
+ * proportionally to the latency increase otherwise, so that latency
+ * stays bounded when the device slows down (e.g. during internal
+ * housekeeping). Threads issuing a command above the limit wait for
+ * a slot. The controller state is exported with the device statistics.
+ * This function must not be called while commands are in flight.
+ *
+ * @return Returns 0 on success, -EINVAL if the parameters are invalid
+ * and -ENOMEM if memory could not be allocated.
+ */
+extern int zbc_set_qd_control(struct zbc_device *dev,
+			      struct zbc_qd_params *params);
+
+/**
+ * @brief Slow region information
+ */
+struct zbc_slow_region {
+
+	/**
+	 * First sector and number of sectors of the region.
+	 */
+	uint64_t		zsr_sector;
+	uint64_t		zsr_nr_sectors;
+
+	/**
+	 * Command class found slow (ZBC_STAT_READ or ZBC_STAT_WRITE), number
+	 * of commands of that class measured in the region, region average
+	 * latency and device average latency for that class when the region
+	 * was found slow. Latencies are normalized to 128 KiB commands.
+	 */
+	enum zbc_stat_class	zsr_class;
+	uint64_t		zsr_nr_cmds;
+	uint64_t		zsr_lat_ns;
+	uint64_t		zsr_dev_lat_ns;
+
+};
+
+/**
+ * @brief Slow region detection parameters
+ */
+struct zbc_slow_params {
+
+	/**
+	 * Size of regions in number of zones (0 for 1). Regions are aligned
+	 * ranges of sectors of this number of times the size of the first
+	 * zone of the device.
+	 */
+	unsigned int		zsp_region_zones;
+
+	/**
+	 * Minimum number of commands of a class measured in a region before
+	 * the region latency is compared to the device latency (0 for the
+	 * default of 64).
+	 */
+	unsigned int		zsp_min_cmds;
+
+	/**
+	 * Number of standard errors by which the region average latency
+	 * must exceed the device average latency (0 for the default of 3).
+	 */
+	unsigned int		zsp_sigma;
+
+	/**
+	 * Minimum latency increase of the region over the device average
+	 * latency, in percent (0 for the default of 50).
+	 */
+	unsigned int		zsp_min_increase;
+
+	/**
+	 * Function called when a region is found slow (may be NULL). The
+	 * function is called by the thread that completed the last command
+	 * measured and must not issue commands to \a dev.
+	 */
+	void			(*zsp_callback)(struct zbc_device *dev,
+					const struct zbc_slow_region *region,
+					void *priv);
+	void			*zsp_priv;
+
+};
+
+/**
+ * @brief Enable or disable slow region detection
+ * @param[in] dev	Device handle obtained with \a zbc_open
+ * @param[in] params	Detection parameters (NULL to disable)
+ *
+ * Keep the latency statistics of the read and write commands completed
+ * for each region of the device and compare them with the statistics of
+ * the whole device. A region is found slow when its average latency
+ * exceeds the device average latency by at least \a zsp_sigma standard
+ * errors and by at least \a zsp_min_increase percent. Slow regions are
+ * reported once, with the callback, and listed with
+ * \a zbc_get_slow_regions until cleared with \a zbc_clear_slow_region.
+ * This function must not be called while commands are in flight.
+ *
+ * @return Returns 0 on success, -EINVAL if the parameters are invalid
+ * and another negative error code otherwise.
+ */
+extern int zbc_set_slow_detection(struct zbc_device *dev,
+				  struct zbc_slow_params *params);
+
+/**
+ * @brief Get the slow regions of a device
+ * @param[in] dev	Device handle obtained with \a zbc_open
+ * @param[out] regions	Array of region information to fill (may be NULL)
+ * @param[in,out] nr_regions Size of \a regions, number of slow regions
+ *
+ * Fill \a regions with the information of the slow regions of \a dev, in
+ * increasing sector order. If \a regions is NULL, the number of slow
+ * regions is returned at the address specified by \a nr_regions.
+ *
+ * @return Returns 0 on success and -ENXIO if slow region detection is not
+ * enabled.
+ */
+extern int zbc_get_slow_regions(struct zbc_device *dev,
+				struct zbc_slow_region *regions,
+				unsigned int *nr_regions);
+
+/**
+ * @brief Clear the statistics of a region
+ * @param[in] dev	Device handle obtained with \a zbc_open
+ * @param[in] sector	A sector of the region
+ *
+ * Clear the latency statistics and the slow state of the region containing
+ * \a sector, e.g. after the region data was verified or relocated.
+ *
+ * @return Returns 0 on success, -ENXIO if slow region detection is not
+ * enabled and -EINVAL if \a sector is not a valid sector.
+ */
+extern int zbc_clear_slow_region(struct zbc_device *dev, uint64_t sector);
+
 /**
  * @}
  */
@@ -0,0 +1,240 @@
+/*
+ * This file is part of libzbc.
+ *
+ * Copyright (C) 2009-2014, HGST, Inc. All rights reserved.
+ * Copyright (C) 2016, Western Digital. All rights reserved.
+ *
+ * This software is distributed under the terms of the BSD 2-clause license,
+ * "as is," without technical support, and WITHOUT ANY WARRANTY, without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE. You should have received a copy of the BSD 2-clause license along
+ * with libzbc. If not, see  <http://opensource.org/licenses/BSD-2-Clause>.
+ *
+ * Author: Damien Le Moal (damien.lemoal@wdc.com)
+ */
+
+#ifndef _LIBZBC_BTREE_H_
+#define _LIBZBC_BTREE_H_
+
+#include <libzbc/zbc.h>
+
+/**
+ * \addtogroup libzbc
+ *  @{
+ */
+
+/**
+ * @brief Append-only copy-on-write B+tree
+ *
+ * A B+tree maps 64-bits keys to fixed size values. The tree pages are
+ * stored in the sequential zones of a range of sectors of a device and are
+ * never overwritten: pages modified since the last commit are kept in
+ * memory and written at commit time to the tail of the zone being written,
+ * together with the pages on their path to the root. The tree root is then
+ * committed atomically by alternately writing one of two root blocks stored
+ * in conventional zones, each root block holding a sequence number, a CRC
+ * and the number of live pages of each zone. Clean pages are kept in a page
+ * cache in which inner nodes are evicted last, so that a lookup usually
+ * needs a single read. Zones without live pages are reset after a commit
+ * and zone cleaning relocates the live pages of the zones with the fewest
+ * live pages.
+ */
+struct zbc_btree;
+
+/**
+ * @brief B+tree parameters
+ */
+struct zbc_btree_params {
+
+	/**
+	 * Range of sectors of the device holding the tree pages. Only
+	 * sequential zones within this range are used.
+	 */
+	uint64_t		ztp_sector;
+	uint64_t		ztp_nr_sectors;
+
+	/**
+	 * First sector of the 2 root blocks. The root blocks must be within
+	 * conventional zones. If none of the root blocks is valid, a new
+	 * empty tree is created and all zones of the range are reset.
+	 */
+	uint64_t		ztp_root_sector;
+
+	/**
+	 * Page size in bytes (0 for 4 KiB). This must be a multiple of
+	 * the device physical block size.
+	 */
+	size_t			ztp_page_size;
+
+	/**
+	 * Value size in bytes (0 for 8 B).
+	 */
+	size_t			ztp_val_size;
+
+	/**
+	 * Page cache size in bytes (0 for 16 MiB).
+	 */
+	size_t			ztp_cache_size;
+
+	/**
+	 * Minimum number of empty zones (0 for 2). A zone is cleaned
+	 * after a commit if the number of empty zones is lower.
+	 */
+	unsigned int		ztp_min_free_zones;
+
+};
+
+/**
+ * @brief B+tree statistics
+ */
+struct zbc_btree_stats {
+
+	/**
+	 * Number of keys, tree height and number of live pages.
+	 */
+	uint64_t		zts_nr_keys;
+	uint32_t		zts_height;
+	uint64_t		zts_nr_pages;
+
+	/**
+	 * Number of commits.
+	 */
+	uint64_t		zts_nr_commits;
+
+	/**
+	 * Number of pages read from the device, number of page cache hits
+	 * and number of pages written.
+	 */
+	uint64_t		zts_page_reads;
+	uint64_t		zts_cache_hits;
+	uint64_t		zts_page_writes;
+
+	/**
+	 * Number of zones cleaned, number of live pages relocated by
+	 * cleaning and number of zones reset.
+	 */
+	uint64_t		zts_nr_cleaned_zones;
+	uint64_t		zts_nr_relocated;
+	uint64_t		zts_nr_reset_zones;
+
+};
+
+/**
+ * @brief Open a B+tree
+ * @param[in] dev	Device handle obtained with \a zbc_open
+ * @param[in] params	B+tree parameters
+ * @param[out] ptree	B+tree handle
+ *
+ * Load the last committed root of the tree, or create an empty tree if
+ * there is none. Zones without live pages are reset.
+ *
+ * @return Returns 0 on success and a negative error code otherwise.
+ */
+extern int zbc_btree_open(struct zbc_device *dev,
+			  struct zbc_btree_params *params,
+			  struct zbc_btree **ptree);
+
+/**
+ * @brief Close a B+tree
+ * @param[in] tree	B+tree handle
+ *
+ * Commit the tree and free its resources.
+ *
+ * @return Returns 0 on success and a negative error code if the
+ * commit failed.
+ */
+extern int zbc_btree_close(struct zbc_btree *tree);
+
+/**
+ * @brief Lookup a key
+ * @param[in] tree	B+tree handle
+ * @param[in] key	Key
+ * @param[out] val	Value of the key
+ *
+ * @return Returns 0 on success, -ENOENT if the key is not in the tree
+ * and a negative error code otherwise.
+ */
+extern int zbc_btree_get(struct zbc_btree *tree, uint64_t key, void *val);
+
+/**
+ * @brief Lookup the first key greater than or equal to a key
+ * @param[in] tree	B+tree handle
+ * @param[in] key	Key
+ * @param[out] next	First key of the tree greater than or equal to \a key
+ * @param[out] val	Value of \a next
+ *
+ * This allows scanning a range of keys.
+ *
+ * @return Returns 0 on success, -ENOENT if there is no such key and a
+ * negative error code otherwise.
+ */
+extern int zbc_btree_next(struct zbc_btree *tree, uint64_t key,
+			  uint64_t *next, void *val);
+
+/**
+ * @brief Insert or update a key
+ * @param[in] tree	B+tree handle
+ * @param[in] key	Key
+ * @param[in] val	Value of the key
+ *
+ * The modification is persistent only after the next commit.
+ *
+ * @return Returns 0 on success and a negative error code otherwise.
+ */
+extern int zbc_btree_put(struct zbc_btree *tree, uint64_t key,
+			 const void *val);
+
+/**
+ * @brief Delete a key
+ * @param[in] tree	B+tree handle
+ * @param[in] key	Key
+ *
+ * Nodes are not merged: a node is only removed from the tree when it
+ * becomes empty. The modification is persistent only after the next
+ * commit.
+ *
+ * @return Returns 0 on success, -ENOENT if the key is not in the tree
+ * and a negative error code otherwise.
+ */
+extern int zbc_btree_delete(struct zbc_btree *tree, uint64_t key);
+
+/**
+ * @brief Commit a B+tree
+ * @param[in] tree	B+tree handle
+ *
+ * Write the modified pages sequentially, flush the device write cache,
+ * write the root block and flush the device write cache again. The zones
+ * left without live pages are then reset. If a commit fails, all further
+ * operations fail and the tree must be closed and reopened.
+ *
+ * @return Returns 0 on success and a negative error code otherwise.
+ */
+extern int zbc_btree_commit(struct zbc_btree *tree);
+
+/**
+ * @brief Clean zones of a B+tree
+ * @param[in] tree	B+tree handle
+ * @param[in] nr_zones	Maximum number of zones to clean
+ *
+ * Relocate the live pages of up to \a nr_zones zones with the fewest live
+ * pages (the zone being written excluded), commit the tree and reset the
+ * cleaned zones.
+ *
+ * @return Returns the number of zones cleaned on success and a negative
+ * error code otherwise.
+ */
+extern int zbc_btree_clean(struct zbc_btree *tree, unsigned int nr_zones);
+
+/**
+ * @brief Get a B+tree statistics
+ * @param[in] tree	B+tree handle
+ * @param[out] stats	Statistics
+ */
+extern void zbc_btree_get_stats(struct zbc_btree *tree,
+				struct zbc_btree_stats *stats);
+
+/**
+ * @}
+ */
+
+#endif /* _LIBZBC_BTREE_H_ */
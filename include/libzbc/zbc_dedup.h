@@ -0,0 +1,271 @@
+/*
+ * This file is part of libzbc.
+ *
+ * Copyright (C) 2009-2014, HGST, Inc. All rights reserved.
+ * Copyright (C) 2016, Western Digital. All rights reserved.
+ *
+ * This software is distributed under the terms of the BSD 2-clause license,
+ * "as is," without technical support, and WITHOUT ANY WARRANTY, without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE. You should have received a copy of the BSD 2-clause license along
+ * with libzbc. If not, see  <http://opensource.org/licenses/BSD-2-Clause>.
+ *
+ * Author: Damien Le Moal (damien.lemoal@wdc.com)
+ */
+
+#ifndef _LIBZBC_DEDUP_H_
+#define _LIBZBC_DEDUP_H_
+
+#include <libzbc/zbc.h>
+
+/**
+ * \addtogroup libzbc
+ *  @{
+ */
+
+/**
+ * @brief Deduplicating blob store
+ *
+ * A dedup store splits the data streams (blobs) written to it into
+ * variable size chunks using content-defined chunking (gear rolling hash).
+ * Each chunk is identified by its SHA-256 fingerprint. Chunks already
+ * stored are only referenced, new chunks are appended to the sequential
+ * zones of a range of sectors of the device. The fingerprint index is
+ * kept in memory, behind a bloom filter, and is rebuilt from the chunk
+ * headers stored on the device when the store is opened.
+ *
+ * Writing a blob returns its recipe: the list of references to the
+ * chunks of the blob. Recipes are owned by the application, which must
+ * store them to be able to read blobs back. Each chunk has a reference
+ * count incremented for every recipe using it. A zone in which all chunks
+ * are unreferenced is reset by \a zbc_dedup_gc.
+ */
+struct zbc_dedup;
+
+/**
+ * @brief Blob writer
+ */
+struct zbc_dedup_writer;
+
+/**
+ * @brief Dedup store parameters
+ */
+struct zbc_dedup_params {
+
+	/**
+	 * Range of sectors of the device holding the chunks.
+	 * Only sequential zones within this range are used.
+	 */
+	uint64_t		zdp_sector;
+	uint64_t		zdp_nr_sectors;
+
+	/**
+	 * Minimum, average and maximum chunk sizes in bytes (0 for the
+	 * defaults of 2 KiB, 8 KiB and 64 KiB). The average size must be a
+	 * power of 2.
+	 */
+	unsigned int		zdp_min_chunk;
+	unsigned int		zdp_avg_chunk;
+	unsigned int		zdp_max_chunk;
+
+	/**
+	 * Maximum number of fingerprinting jobs run in parallel by the
+	 * library executor (0 for the number of CPUs, 1 to fingerprint
+	 * chunks in the writing thread only).
+	 */
+	unsigned int		zdp_nr_threads;
+
+};
+
+/**
+ * Length of a chunk fingerprint.
+ */
+#define ZBC_DEDUP_FP_LEN	32
+
+/**
+ * @brief Chunk reference
+ */
+struct zbc_dedup_ref {
+	uint64_t		zdr_sector;
+	uint32_t		zdr_len;
+	uint32_t		zdr_sectors;
+	uint8_t			zdr_fp[ZBC_DEDUP_FP_LEN];
+};
+
+/**
+ * @brief Blob recipe
+ */
+struct zbc_dedup_recipe {
+	uint64_t		zdp_len;
+	unsigned int		zdp_nr_chunks;
+	struct zbc_dedup_ref	*zdp_chunks;
+};
+
+/**
+ * @brief Dedup store statistics
+ */
+struct zbc_dedup_stats {
+
+	/**
+	 * Number of bytes written by applications and number of bytes
+	 * of unique chunks stored.
+	 */
+	uint64_t		zds_logical_bytes;
+	uint64_t		zds_stored_bytes;
+
+	/**
+	 * Number of chunks written and number of duplicate chunks.
+	 */
+	uint64_t		zds_nr_chunks;
+	uint64_t		zds_nr_dup_chunks;
+
+	/**
+	 * Number of index lookups avoided by the bloom filter and
+	 * number of bloom filter false positives.
+	 */
+	uint64_t		zds_bloom_negatives;
+	uint64_t		zds_bloom_false_positives;
+
+	/**
+	 * Number of chunks in the index and number of zones
+	 * reset by garbage collection.
+	 */
+	uint64_t		zds_nr_index_chunks;
+	uint64_t		zds_nr_gc_zones;
+
+};
+
+/**
+ * @brief Open a dedup store
+ * @param[in] dev	Device handle obtained with \a zbc_open
+ * @param[in] params	Store parameters
+ * @param[out] pdd	Store handle
+ *
+ * Open the dedup store using the zones of the range of sectors specified
+ * in \a params. The fingerprint index is rebuilt from the chunks found in
+ * non-empty zones. All chunks have a zero reference count after open: the
+ * application must register the recipes of all its live blobs using
+ * \a zbc_dedup_ref before calling \a zbc_dedup_gc.
+ *
+ * @return Returns 0 on success and a negative error code otherwise.
+ */
+extern int zbc_dedup_open(struct zbc_device *dev,
+			  struct zbc_dedup_params *params,
+			  struct zbc_dedup **pdd);
+
+/**
+ * @brief Close a dedup store
+ * @param[in] dd	Store handle
+ *
+ * @return Returns 0 on success and a negative error code if writing
+ * buffered chunks failed.
+ */
+extern int zbc_dedup_close(struct zbc_dedup *dd);
+
+/**
+ * @brief Start writing a blob
+ * @param[in] dd	Store handle
+ * @param[out] pw	Writer handle
+ *
+ * @return Returns 0 on success and -ENOMEM otherwise.
+ */
+extern int zbc_dedup_writer_open(struct zbc_dedup *dd,
+				 struct zbc_dedup_writer **pw);
+
+/**
+ * @brief Write data to a blob
+ * @param[in] w		Writer handle
+ * @param[in] buf	Data
+ * @param[in] len	Number of bytes to write
+ *
+ * @return Returns 0 on success and a negative error code otherwise.
+ */
+extern int zbc_dedup_write(struct zbc_dedup_writer *w,
+			   const void *buf, size_t len);
+
+/**
+ * @brief Finish writing a blob
+ * @param[in] w		Writer handle
+ * @param[out] recipe	Recipe of the blob (NULL to abort the blob)
+ *
+ * Write the remaining data of the blob, make all its chunks durable and
+ * return its recipe. The writer is freed. The recipe chunk array must be
+ * freed with \a zbc_dedup_recipe_free.
+ *
+ * @return Returns 0 on success and a negative error code otherwise.
+ */
+extern int zbc_dedup_writer_close(struct zbc_dedup_writer *w,
+				  struct zbc_dedup_recipe *recipe);
+
+/**
+ * @brief Free a recipe chunk array
+ * @param[in] recipe	Recipe
+ */
+extern void zbc_dedup_recipe_free(struct zbc_dedup_recipe *recipe);
+
+/**
+ * @brief Read data from a blob
+ * @param[in] dd	Store handle
+ * @param[in] recipe	Blob recipe
+ * @param[in] buf	Buffer to read into
+ * @param[in] len	Number of bytes to read
+ * @param[in] offset	Offset in the blob in bytes
+ *
+ * Adjacent chunks are read with a single command.
+ *
+ * @return Returns the number of bytes read and a negative error code
+ * otherwise.
+ */
+extern ssize_t zbc_dedup_read(struct zbc_dedup *dd,
+			      struct zbc_dedup_recipe *recipe,
+			      void *buf, size_t len, uint64_t offset);
+
+/**
+ * @brief Reference the chunks of a recipe
+ * @param[in] dd	Store handle
+ * @param[in] recipe	Blob recipe
+ *
+ * Increment the reference count of all chunks of \a recipe.
+ *
+ * @return Returns 0 on success and -ENOENT if a chunk is not stored.
+ */
+extern int zbc_dedup_ref(struct zbc_dedup *dd,
+			 struct zbc_dedup_recipe *recipe);
+
+/**
+ * @brief Release the chunks of a recipe
+ * @param[in] dd	Store handle
+ * @param[in] recipe	Blob recipe
+ *
+ * Decrement the reference count of all chunks of \a recipe, e.g. when
+ * the blob is deleted.
+ *
+ * @return Returns 0 on success and -ENOENT if a chunk is not stored.
+ */
+extern int zbc_dedup_unref(struct zbc_dedup *dd,
+			   struct zbc_dedup_recipe *recipe);
+
+/**
+ * @brief Reclaim the zones of unreferenced chunks
+ * @param[in] dd	Store handle
+ *
+ * Reset all zones in which all chunks are unreferenced.
+ *
+ * @return Returns the number of zones reset on success and a negative
+ * error code otherwise.
+ */
+extern int zbc_dedup_gc(struct zbc_dedup *dd);
+
+/**
+ * @brief Get a dedup store statistics
+ * @param[in] dd	Store handle
+ * @param[out] stats	Statistics
+ */
+extern void zbc_dedup_get_stats(struct zbc_dedup *dd,
+				struct zbc_dedup_stats *stats);
+
+/**
+ * @}
+ */
+
+#endif /* _LIBZBC_DEDUP_H_ */
@@ -0,0 +1,204 @@
+/*
+ * This file is part of libzbc.
+ *
+ * Copyright (C) 2009-2014, HGST, Inc. All rights reserved.
+ * Copyright (C) 2016, Western Digital. All rights reserved.
+ *
+ * This software is distributed under the terms of the BSD 2-clause license,
+ * "as is," without technical support, and WITHOUT ANY WARRANTY, without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE. You should have received a copy of the BSD 2-clause license along
+ * with libzbc. If not, see  <http://opensource.org/licenses/BSD-2-Clause>.
+ *
+ * Author: Damien Le Moal (damien.lemoal@wdc.com)
+ */
+
+#ifndef _LIBZBC_DEVSET_H_
+#define _LIBZBC_DEVSET_H_
+
+#include <libzbc/zbc.h>
+
+/**
+ * \addtogroup libzbc
+ *  @{
+ */
+
+/**
+ * @brief Device set
+ *
+ * A device set executes requests on many devices asynchronously and
+ * returns their completions through a single completion queue. The
+ * completion queue is signaled with a single file descriptor that can be
+ * used with poll or epoll: it is readable whenever completions are
+ * available. Completions of all devices are reaped in batches with
+ * \a zbc_devset_reap, so the cost of an event loop iteration does not
+ * depend on the number of devices.
+ *
+ * Each device added to a set is served by its own threads: requests
+ * to a device served by a single thread are executed in submission
+ * order, which is required for sequential zone writes. All the memory
+ * used by requests is allocated when the set is created.
+ */
+struct zbc_devset;
+
+/**
+ * @brief Device set request operations
+ */
+enum zbc_devset_op {
+	ZBC_DEVSET_READ		= 0,
+	ZBC_DEVSET_WRITE	= 1,
+	ZBC_DEVSET_FLUSH	= 2,
+	ZBC_DEVSET_ZONE_OP	= 3,
+};
+
+/**
+ * @brief Device set request
+ */
+struct zbc_devset_req {
+
+	/**
+	 * Target device (must be added to the set).
+	 */
+	struct zbc_device	*zdr_dev;
+
+	/**
+	 * Operation.
+	 */
+	enum zbc_devset_op	zdr_op;
+
+	/**
+	 * I/O buffer and number of 512B sectors (read and write).
+	 */
+	void			*zdr_buf;
+	size_t			zdr_count;
+
+	/**
+	 * First sector of the I/O or of the target zone.
+	 */
+	uint64_t		zdr_sector;
+
+	/**
+	 * Zone operation and flags (ZBC_DEVSET_ZONE_OP).
+	 */
+	enum zbc_zone_op	zdr_zone_op;
+	unsigned int		zdr_flags;
+
+	/**
+	 * User data returned with the completion.
+	 */
+	void			*zdr_data;
+
+};
+
+/**
+ * @brief Device set completion
+ */
+struct zbc_devset_cqe {
+
+	/**
+	 * Device and user data of the request.
+	 */
+	struct zbc_device	*zdc_dev;
+	void			*zdc_data;
+
+	/**
+	 * Number of sectors transferred (read and write), 0 for other
+	 * operations, or a negative error code.
+	 */
+	ssize_t			zdc_ret;
+
+};
+
+/**
+ * @brief Create a device set
+ * @param[in] max_reqs	Maximum number of requests in flight (0 for 1024)
+ * @param[out] pset	Device set handle
+ *
+ * @return Returns 0 on success and a negative error code otherwise.
+ */
+extern int zbc_devset_create(unsigned int max_reqs, struct zbc_devset **pset);
+
+/**
+ * @brief Destroy a device set
+ * @param[in] set	Device set handle
+ *
+ * Wait for the requests in flight to complete, remove all devices and
+ * free the set. Unreaped completions are discarded. The devices are not
+ * closed.
+ */
+extern void zbc_devset_destroy(struct zbc_devset *set);
+
+/**
+ * @brief Add a device to a device set
+ * @param[in] set	Device set handle
+ * @param[in] dev	Device handle obtained with \a zbc_open
+ * @param[in] nr_threads Number of threads executing the device requests
+ *
+ * @return Returns 0 on success, -EEXIST if \a dev is already in the set
+ * and another negative error code otherwise.
+ */
+extern int zbc_devset_add(struct zbc_devset *set, struct zbc_device *dev,
+			  unsigned int nr_threads);
+
+/**
+ * @brief Remove a device from a device set
+ * @param[in] set	Device set handle
+ * @param[in] dev	Device handle
+ *
+ * Wait for the requests of \a dev in flight to complete and remove it
+ * from the set. Completions not yet reaped remain in the queue.
+ *
+ * @return Returns 0 on success and -ENOENT if \a dev is not in the set.
+ */
+extern int zbc_devset_remove(struct zbc_devset *set, struct zbc_device *dev);
+
+/**
+ * @brief Submit requests
+ * @param[in] set	Device set handle
+ * @param[in] reqs	Requests
+ * @param[in] nr_reqs	Number of requests
+ *
+ * Queue requests for execution. Requests are copied: \a reqs can be
+ * reused when this function returns.
+ *
+ * @return Returns the number of requests submitted, which is less than
+ * \a nr_reqs if the maximum number of requests in flight is reached, or
+ * a negative error code: -EAGAIN if no request could be submitted and
+ * -ENOENT if the device of the first request not submitted is not in
+ * the set.
+ */
+extern int zbc_devset_submit(struct zbc_devset *set,
+			     struct zbc_devset_req *reqs,
+			     unsigned int nr_reqs);
+
+/**
+ * @brief Reap completions
+ * @param[in] set	Device set handle
+ * @param[out] cqes	Completions
+ * @param[in] max_cqes	Maximum number of completions to reap
+ * @param[in] min_cqes	Number of completions to wait for
+ *
+ * Reap up to \a max_cqes completions of any device of the set, waiting
+ * until at least \a min_cqes are available (0 to not wait).
+ *
+ * @return Returns the number of completions reaped.
+ */
+extern unsigned int zbc_devset_reap(struct zbc_devset *set,
+				    struct zbc_devset_cqe *cqes,
+				    unsigned int max_cqes,
+				    unsigned int min_cqes);
+
+/**
+ * @brief Get the completion file descriptor of a device set
+ * @param[in] set	Device set handle
+ *
+ * @return Returns a file descriptor which is readable when completions
+ * are available. It must not be read nor closed by the application.
+ */
+extern int zbc_devset_fd(struct zbc_devset *set);
+
+/**
+ * @}
+ */
+
+#endif /* _LIBZBC_DEVSET_H_ */
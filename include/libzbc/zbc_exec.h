@@ -0,0 +1,161 @@
+/*
+ * This file is part of libzbc.
+ *
+ * Copyright (C) 2009-2014, HGST, Inc. All rights reserved.
+ * Copyright (C) 2016, Western Digital. All rights reserved.
+ *
+ * This software is distributed under the terms of the BSD 2-clause license,
+ * "as is," without technical support, and WITHOUT ANY WARRANTY, without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE. You should have received a copy of the BSD 2-clause license along
+ * with libzbc. If not, see  <http://opensource.org/licenses/BSD-2-Clause>.
+ *
+ * Author: Damien Le Moal (damien.lemoal@wdc.com)
+ */
+
+#ifndef _LIBZBC_EXEC_H_
+#define _LIBZBC_EXEC_H_
+
+#include <libzbc/zbc.h>
+
+/**
+ * \addtogroup libzbc
+ *  @{
+ */
+
+/**
+ * @brief Background task executor
+ *
+ * The library executes all its background work (e.g. the fingerprinting
+ * of dedup store chunks) with a single executor shared by all devices,
+ * using a fixed number of threads started when the first task is
+ * submitted. Applications can use it for their own tasks.
+ *
+ * Each thread has a queue with one lane per priority. Tasks are queued
+ * on the queue of the thread selected by their device affinity hint, so
+ * that the tasks of a device tend to run on the same thread, and idle
+ * threads steal tasks from the other queues, highest priority first.
+ * Cancellation is cooperative: a cancelled task that did not start is
+ * not executed and a running task can poll \a zbc_exec_cancelled.
+ */
+struct zbc_exec_task;
+
+/**
+ * @brief Task priority lanes
+ */
+enum zbc_exec_prio {
+	ZBC_EXEC_PRIO_HIGH	= 0,
+	ZBC_EXEC_PRIO_NORMAL	= 1,
+	ZBC_EXEC_PRIO_LOW	= 2,
+};
+
+/**
+ * Number of priority lanes.
+ */
+#define ZBC_EXEC_NR_PRIO	3
+
+/**
+ * @brief Task function
+ */
+typedef void (*zbc_exec_fn)(struct zbc_exec_task *task, void *arg);
+
+/**
+ * @brief Application scheduler
+ *
+ * If an application scheduler is set, tasks are not executed by the
+ * executor threads but passed to \a zes_submit, which must arrange for
+ * \a run to be called with \a data, exactly once, from any thread.
+ * \a zes_submit returns 0 on success and a negative error code otherwise.
+ */
+struct zbc_exec_sched {
+	int		(*zes_submit)(void *priv, struct zbc_device *dev,
+				      enum zbc_exec_prio prio,
+				      void (*run)(void *), void *data);
+	void		*zes_priv;
+};
+
+/**
+ * @brief Executor parameters
+ */
+struct zbc_exec_params {
+
+	/**
+	 * Number of threads (0 for the number of CPUs).
+	 */
+	unsigned int		zep_nr_threads;
+
+	/**
+	 * Maximum number of pending tasks (0 for the default of 4096).
+	 */
+	unsigned int		zep_max_tasks;
+
+	/**
+	 * Application scheduler (NULL to use the executor threads).
+	 */
+	struct zbc_exec_sched	*zep_sched;
+
+};
+
+/**
+ * @brief Configure the executor
+ * @param[in] params	Executor parameters
+ *
+ * Set the executor parameters. This must be called before any task is
+ * submitted, by the application or by the library.
+ *
+ * @return Returns 0 on success and -EBUSY if the executor is already
+ * started.
+ */
+extern int zbc_exec_setup(struct zbc_exec_params *params);
+
+/**
+ * @brief Submit a task
+ * @param[in] dev	Device affinity hint (may be NULL)
+ * @param[in] prio	Priority lane
+ * @param[in] fn	Task function
+ * @param[in] arg	Task function argument
+ * @param[out] ptask	Task handle (NULL for a detached task)
+ *
+ * Queue a task for execution. A task with a handle must be waited for
+ * with \a zbc_exec_wait, which frees it. A detached task is freed when
+ * it completes.
+ *
+ * @return Returns 0 on success, -EAGAIN if the maximum number of
+ * pending tasks is reached and another negative error code otherwise.
+ */
+extern int zbc_exec_submit(struct zbc_device *dev, enum zbc_exec_prio prio,
+			   zbc_exec_fn fn, void *arg,
+			   struct zbc_exec_task **ptask);
+
+/**
+ * @brief Request the cancellation of a task
+ * @param[in] task	Task handle
+ */
+extern void zbc_exec_cancel(struct zbc_exec_task *task);
+
+/**
+ * @brief Test if the cancellation of a task was requested
+ * @param[in] task	Task handle
+ *
+ * @return Returns true if \a zbc_exec_cancel was called for \a task.
+ */
+extern bool zbc_exec_cancelled(struct zbc_exec_task *task);
+
+/**
+ * @brief Wait for a task completion
+ * @param[in] task	Task handle
+ *
+ * Wait for \a task to complete and free it. When called from an executor
+ * thread or when the executor threads are busy, the calling thread runs
+ * pending tasks while waiting.
+ *
+ * @return Returns 0 if the task was executed and -ECANCELED if it was
+ * cancelled before starting.
+ */
+extern int zbc_exec_wait(struct zbc_exec_task *task);
+
+/**
+ * @}
+ */
+
+#endif /* _LIBZBC_EXEC_H_ */
@@ -0,0 +1,215 @@
+/*
+ * This file is part of libzbc.
+ *
+ * Copyright (C) 2009-2014, HGST, Inc. All rights reserved.
+ * Copyright (C) 2016, Western Digital. All rights reserved.
+ *
+ * This software is distributed under the terms of the BSD 2-clause license,
+ * "as is," without technical support, and WITHOUT ANY WARRANTY, without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE. You should have received a copy of the BSD 2-clause license along
+ * with libzbc. If not, see  <http://opensource.org/licenses/BSD-2-Clause>.
+ *
+ * Author: Damien Le Moal (damien.lemoal@wdc.com)
+ */
+
+#ifndef _LIBZBC_HYBRID_H_
+#define _LIBZBC_HYBRID_H_
+
+#include <libzbc/zbc.h>
+
+/**
+ * \addtogroup libzbc
+ *  @{
+ */
+
+/**
+ * @brief Hybrid device
+ *
+ * A hybrid device is a virtual device combining a zoned device (the
+ * backing device) with a regular file or block device (the cache), used as
+ * a write-back cache. The sectors of a range of zones of the backing device
+ * can be written at any offset, regardless of the zone types and write
+ * pointers. Written blocks land in the cache, writes to blocks already
+ * cached overwrite them in place, and the dirty blocks of a zone are later
+ * destaged together: they are merged with the zone data and the zone is
+ * written sequentially, appending only if all dirty blocks are after the
+ * zone write pointer, or after reset otherwise. Reads are served from the
+ * cache for dirty blocks and from the backing device otherwise, sectors
+ * never written reading as zeros.
+ *
+ * The cache holds the map of its dirty blocks, written when the hybrid
+ * device is flushed. Zones rewritten after reset are first written to a
+ * staging area of the cache, so that a zone rewrite interrupted by a crash
+ * is replayed when the hybrid device is opened again.
+ */
+struct zbc_hybrid;
+
+/**
+ * @brief Hybrid device parameters
+ */
+struct zbc_hybrid_params {
+
+	/**
+	 * Path of the cache file or block device.
+	 */
+	const char		*zyp_cache_path;
+
+	/**
+	 * Range of sectors of the backing device (0 sectors for the end of
+	 * the device). The range must start and end on zone boundaries.
+	 */
+	uint64_t		zyp_sector;
+	uint64_t		zyp_nr_sectors;
+
+	/**
+	 * Cache block size in bytes (0 for 4 KiB). This must be a multiple
+	 * of the backing device physical block size and reads and writes
+	 * must be aligned to it.
+	 */
+	size_t			zyp_block_size;
+
+	/**
+	 * Percentage of the cache blocks kept free (0 for 10 %). Writes
+	 * destage zones when the number of free cache blocks gets lower.
+	 */
+	unsigned int		zyp_free_pct;
+
+};
+
+/**
+ * @brief Hybrid device statistics
+ */
+struct zbc_hybrid_stats {
+
+	/**
+	 * Number of cache blocks and number of dirty cache blocks.
+	 */
+	uint32_t		zys_nr_blocks;
+	uint32_t		zys_nr_dirty;
+
+	/**
+	 * Number of blocks read from the cache and from the backing
+	 * device (or returned as zeros).
+	 */
+	uint64_t		zys_read_hits;
+	uint64_t		zys_read_misses;
+
+	/**
+	 * Number of blocks written and number of blocks written that
+	 * overwrote a dirty block.
+	 */
+	uint64_t		zys_write_blocks;
+	uint64_t		zys_write_hits;
+
+	/**
+	 * Number of zones destaged, number of zones destaged by appending
+	 * and number of blocks destaged.
+	 */
+	uint64_t		zys_nr_destages;
+	uint64_t		zys_nr_appends;
+	uint64_t		zys_destage_blocks;
+
+	/**
+	 * Number of sectors written to the backing device.
+	 */
+	uint64_t		zys_destage_sectors;
+
+};
+
+/**
+ * @brief Open a hybrid device
+ * @param[in] dev	Backing device handle obtained with \a zbc_open
+ * @param[in] params	Hybrid device parameters
+ * @param[out] phy	Hybrid device handle
+ *
+ * Open the cache and load its dirty block map, or initialize the cache if
+ * it was never used. A zone rewrite interrupted by a crash is replayed.
+ * The zones of the backing device range must not be modified with other
+ * functions while the hybrid device is open.
+ *
+ * @return Returns 0 on success and a negative error code otherwise.
+ * -EINVAL is returned if the cache was initialized with different
+ * parameters.
+ */
+extern int zbc_hybrid_open(struct zbc_device *dev,
+			   struct zbc_hybrid_params *params,
+			   struct zbc_hybrid **phy);
+
+/**
+ * @brief Close a hybrid device
+ * @param[in] hy	Hybrid device handle
+ *
+ * Flush the hybrid device and free its resources. Dirty blocks are not
+ * destaged and remain in the cache.
+ *
+ * @return Returns 0 on success and a negative error code if the flush
+ * failed.
+ */
+extern int zbc_hybrid_close(struct zbc_hybrid *hy);
+
+/**
+ * @brief Read sectors from a hybrid device
+ * @param[in] hy	Hybrid device handle
+ * @param[in] buf	Caller supplied buffer to read into
+ * @param[in] count	Number of 512B sectors to read
+ * @param[in] offset	Offset where to start reading (512B sector unit)
+ *
+ * @return Returns the number of 512B sectors read or a negative error
+ * code.
+ */
+extern ssize_t zbc_hybrid_pread(struct zbc_hybrid *hy, void *buf,
+				size_t count, uint64_t offset);
+
+/**
+ * @brief Write sectors to a hybrid device
+ * @param[in] hy	Hybrid device handle
+ * @param[in] buf	Caller supplied buffer to write from
+ * @param[in] count	Number of 512B sectors to write
+ * @param[in] offset	Offset where to start writing (512B sector unit)
+ *
+ * The data is written to the cache. Zones are destaged first if the
+ * number of free cache blocks is too low. The data is durable only after
+ * the next flush.
+ *
+ * @return Returns the number of 512B sectors written or a negative error
+ * code. -ENOSPC is returned if the write is larger than the cache.
+ */
+extern ssize_t zbc_hybrid_pwrite(struct zbc_hybrid *hy, const void *buf,
+				 size_t count, uint64_t offset);
+
+/**
+ * @brief Flush a hybrid device
+ * @param[in] hy	Hybrid device handle
+ *
+ * Write the modified blocks of the dirty block map and flush the cache.
+ *
+ * @return Returns 0 on success and a negative error code otherwise.
+ */
+extern int zbc_hybrid_flush(struct zbc_hybrid *hy);
+
+/**
+ * @brief Destage zones of a hybrid device
+ * @param[in] hy	Hybrid device handle
+ * @param[in] nr_zones	Maximum number of zones to destage (0 for all)
+ *
+ * Destage the zones with the most dirty blocks first.
+ *
+ * @return Returns the number of zones destaged on success and a negative
+ * error code otherwise.
+ */
+extern int zbc_hybrid_destage(struct zbc_hybrid *hy, unsigned int nr_zones);
+
+/**
+ * @brief Get a hybrid device statistics
+ * @param[in] hy	Hybrid device handle
+ * @param[out] stats	Statistics
+ */
+extern void zbc_hybrid_get_stats(struct zbc_hybrid *hy,
+				 struct zbc_hybrid_stats *stats);
+
+/**
+ * @}
+ */
+
+#endif /* _LIBZBC_HYBRID_H_ */
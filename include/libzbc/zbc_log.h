@@ -0,0 +1,282 @@
+/*
+ * This file is part of libzbc.
+ *
+ * Copyright (C) 2009-2014, HGST, Inc. All rights reserved.
+ * Copyright (C) 2016, Western Digital. All rights reserved.
+ *
+ * This software is distributed under the terms of the BSD 2-clause license,
+ * "as is," without technical support, and WITHOUT ANY WARRANTY, without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE. You should have received a copy of the BSD 2-clause license along
+ * with libzbc. If not, see  <http://opensource.org/licenses/BSD-2-Clause>.
+ *
+ * Author: Damien Le Moal (damien.lemoal@wdc.com)
+ */
+
+#ifndef _LIBZBC_LOG_H_
+#define _LIBZBC_LOG_H_
+
+#include <libzbc/zbc.h>
+
+/**
+ * \addtogroup libzbc
+ *  @{
+ */
+
+/**
+ * @brief Partitioned append log
+ *
+ * A log is made of a number of partitions. Each partition is an append
+ * stream of messages stored in a chain of sequential zones taken from a
+ * range of sectors of the device. Every message appended to a partition
+ * gets an offset, starting from 0 and incremented by one for every message.
+ * Messages are buffered and written in batches. Each zone of a chain starts
+ * with a zone header block and each batch starts with a batch header, so
+ * that the zone chains and the sparse offset index of each zone (one entry
+ * per batch) can be rebuilt when the log is reopened.
+ * Consumer cursors (one offset per partition for each cursor) are stored
+ * durably in a range of sectors of conventional zones.
+ */
+struct zbc_log;
+
+/**
+ * @brief Log parameters
+ */
+struct zbc_log_params {
+
+	/**
+	 * Range of sectors of the device holding the partitions zone chains.
+	 * Only sequential zones within this range are used.
+	 */
+	uint64_t		zlp_sector;
+	uint64_t		zlp_nr_sectors;
+
+	/**
+	 * Number of partitions of the log.
+	 */
+	unsigned int		zlp_nr_partitions;
+
+	/**
+	 * Number of consumer cursors and first sector of the cursors
+	 * storage area. The cursors area must be within conventional zones.
+	 */
+	unsigned int		zlp_nr_cursors;
+	uint64_t		zlp_cursor_sector;
+
+	/**
+	 * Maximum size in bytes of a batch of messages (0 for the default
+	 * of 256 KiB). This is also the per partition write buffer size.
+	 */
+	size_t			zlp_batch_size;
+
+	/**
+	 * Maximum number of zones of a partition chain (0 for no limit).
+	 * The oldest zone of a chain is reset when this limit is exceeded.
+	 */
+	unsigned int		zlp_max_zones;
+
+};
+
+/**
+ * Batch header magic number.
+ */
+#define ZBC_LOG_BATCH_MAGIC	0x424c425a
+
+/**
+ * @brief Batch header
+ *
+ * On-disk format of a batch of messages, as transferred by
+ * \a zbc_log_splice. A batch header is followed by \a zlb_nr_msgs messages,
+ * each made of a 32-bits message length followed by the message data.
+ * The batch is padded with zeroes up to \a zlb_sectors 512B sectors.
+ * \a zlb_crc is the CRC32C of the first \a zlb_len bytes of the batch,
+ * computed with \a zlb_crc set to 0. All fields are in host byte order.
+ */
+struct zbc_log_batch_hdr {
+	uint32_t		zlb_magic;
+	uint32_t		zlb_crc;
+	uint64_t		zlb_offset;
+	uint32_t		zlb_nr_msgs;
+	uint32_t		zlb_len;
+	uint32_t		zlb_sectors;
+	uint32_t		zlb_reserved;
+};
+
+/**
+ * @brief Fetched message
+ */
+struct zbc_log_msg {
+	uint64_t		zlm_offset;
+	void			*zlm_data;
+	size_t			zlm_len;
+};
+
+/**
+ * @brief Open a log
+ * @param[in] dev	Device handle obtained with \a zbc_open
+ * @param[in] params	Log parameters
+ * @param[out] plog	Log handle
+ *
+ * Open the log stored on \a dev using the parameters \a params. If the
+ * sequential zones of the log range of sectors are all empty, a new empty
+ * log is created. Otherwise, the partitions zone chains, message offsets
+ * and consumer cursors are recovered from the device. The number of
+ * partitions must be the same as when the log was created.
+ *
+ * @return Returns 0 on success and a negative error code otherwise.
+ * -EINVAL is returned if the parameters are invalid or if a zone of the
+ * log range contains data that does not belong to a log.
+ */
+extern int zbc_log_open(struct zbc_device *dev, struct zbc_log_params *params,
+			struct zbc_log **plog);
+
+/**
+ * @brief Close a log
+ * @param[in] log	Log handle
+ *
+ * Write the buffered messages of all partitions and release the log.
+ *
+ * @return Returns 0 on success and a negative error code if writing
+ * buffered messages failed.
+ */
+extern int zbc_log_close(struct zbc_log *log);
+
+/**
+ * @brief Append a message to a partition
+ * @param[in] log	Log handle
+ * @param[in] part	Partition number
+ * @param[in] msg	Message data
+ * @param[in] len	Message length in bytes
+ * @param[out] offset	Offset of the message (may be NULL)
+ *
+ * Add a message to the write buffer of partition \a part. The buffer
+ * is written to the device when full or when \a zbc_log_flush is called.
+ *
+ * @return Returns 0 on success and a negative error code otherwise.
+ * -EMSGSIZE is returned if the message does not fit in a batch.
+ * -ENOSPC is returned if there are no more empty zones available.
+ */
+extern int zbc_log_append(struct zbc_log *log, unsigned int part,
+			  const void *msg, size_t len, uint64_t *offset);
+
+/**
+ * @brief Write buffered messages of a partition
+ * @param[in] log	Log handle
+ * @param[in] part	Partition number
+ *
+ * Write the messages buffered for partition \a part as a single batch.
+ * Messages are visible to \a zbc_log_fetch and \a zbc_log_splice only
+ * once written.
+ *
+ * @return Returns 0 on success and a negative error code otherwise.
+ */
+extern int zbc_log_flush(struct zbc_log *log, unsigned int part);
+
+/**
+ * @brief Get a partition offsets range
+ * @param[in] log	Log handle
+ * @param[in] part	Partition number
+ * @param[out] first	Offset of the oldest message retained
+ * @param[out] next	Offset of the next message written
+ *
+ * @return Returns 0 on success and -EINVAL if \a part is invalid.
+ */
+extern int zbc_log_offsets(struct zbc_log *log, unsigned int part,
+			   uint64_t *first, uint64_t *next);
+
+/**
+ * @brief Fetch messages from a partition
+ * @param[in] log	Log handle
+ * @param[in] part	Partition number
+ * @param[in] offset	Offset of the first message to fetch
+ * @param[in] buf	Buffer aligned on the device physical block size
+ * @param[in] bufsz	Size of \a buf in bytes
+ * @param[out] msgs	Array of fetched messages
+ * @param[in,out] nr_msgs Size of \a msgs as input, number of messages
+ *			fetched as output
+ *
+ * Fetch the messages starting at \a offset with a single read of as many
+ * complete batches as fit in \a buf, without crossing a zone boundary.
+ * The data of the fetched messages point into \a buf. A fetch returning
+ * no message indicates that \a offset is the next offset of the partition.
+ *
+ * @return Returns 0 on success and a negative error code otherwise.
+ * -ERANGE is returned if \a offset is not retained anymore and -ENOBUFS
+ * if \a buf is too small to hold the batch containing \a offset.
+ */
+extern int zbc_log_fetch(struct zbc_log *log, unsigned int part,
+			 uint64_t offset, void *buf, size_t bufsz,
+			 struct zbc_log_msg *msgs, unsigned int *nr_msgs);
+
+/**
+ * @brief Transfer batches of messages to a file descriptor
+ * @param[in] log	Log handle
+ * @param[in] part	Partition number
+ * @param[in] offset	Offset of the first message to transfer
+ * @param[in] fd	Destination file descriptor (socket, pipe or file)
+ * @param[in] max_bytes	Maximum number of bytes to transfer
+ * @param[out] next	Offset following the last message transferred
+ *
+ * Transfer the raw batches (see struct zbc_log_batch_hdr) starting with
+ * the batch containing \a offset to \a fd. At least one batch is
+ * transferred, even if larger than \a max_bytes. The first batch may
+ * contain messages preceding \a offset. When the device backend driver
+ * allows it, data is transferred with splice(2) without copy to user
+ * space. Otherwise, data is read and written to \a fd.
+ *
+ * @return Returns the number of bytes transferred on success and a
+ * negative error code otherwise.
+ */
+extern ssize_t zbc_log_splice(struct zbc_log *log, unsigned int part,
+			      uint64_t offset, int fd, size_t max_bytes,
+			      uint64_t *next);
+
+/**
+ * @brief Get a consumer cursor offset for a partition
+ * @param[in] log	Log handle
+ * @param[in] cursor	Cursor number
+ * @param[in] part	Partition number
+ * @param[out] offset	Committed offset
+ *
+ * @return Returns 0 on success and -EINVAL if \a cursor or \a part
+ * is invalid.
+ */
+extern int zbc_log_cursor_get(struct zbc_log *log, unsigned int cursor,
+			      unsigned int part, uint64_t *offset);
+
+/**
+ * @brief Commit a consumer cursor offset for a partition
+ * @param[in] log	Log handle
+ * @param[in] cursor	Cursor number
+ * @param[in] part	Partition number
+ * @param[in] offset	Offset to commit
+ *
+ * Durably record \a offset as the position of cursor \a cursor in
+ * partition \a part. The device write cache is flushed.
+ *
+ * @return Returns 0 on success and a negative error code otherwise.
+ */
+extern int zbc_log_cursor_commit(struct zbc_log *log, unsigned int cursor,
+				 unsigned int part, uint64_t offset);
+
+/**
+ * @brief Discard the oldest messages of a partition
+ * @param[in] log	Log handle
+ * @param[in] part	Partition number
+ * @param[in] offset	Offset of the oldest message to retain
+ *
+ * Reset all zones of partition \a part that contain only messages
+ * with an offset lower than \a offset. Reset zones are reused for new
+ * messages. The zone being written is never reset.
+ *
+ * @return Returns the number of zones reset on success and a negative
+ * error code otherwise.
+ */
+extern int zbc_log_retain(struct zbc_log *log, unsigned int part,
+			  uint64_t offset);
+
+/**
+ * @}
+ */
+
+#endif /* _LIBZBC_LOG_H_ */
@@ -0,0 +1,196 @@
+/*
+ * This file is part of libzbc.
+ *
+ * Copyright (C) 2009-2014, HGST, Inc. All rights reserved.
+ * Copyright (C) 2016, Western Digital. All rights reserved.
+ *
+ * This software is distributed under the terms of the BSD 2-clause license,
+ * "as is," without technical support, and WITHOUT ANY WARRANTY, without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE. You should have received a copy of the BSD 2-clause license along
+ * with libzbc. If not, see  <http://opensource.org/licenses/BSD-2-Clause>.
+ *
+ * Author: Damien Le Moal (damien.lemoal@wdc.com)
+ */
+
+#ifndef _LIBZBC_PROFILE_H_
+#define _LIBZBC_PROFILE_H_
+
+#include <libzbc/zbc.h>
+
+/**
+ * \addtogroup libzbc
+ *  @{
+ */
+
+/**
+ * @brief Throughput profile sample
+ *
+ * Sequential throughput and average I/O latency measured on one zone.
+ * Values that were not measured are 0.
+ */
+struct zbc_profile_sample {
+
+	/**
+	 * First sector of the sampled zone.
+	 */
+	uint64_t		zps_sector;
+
+	/**
+	 * Read and write throughput in KiB/s.
+	 */
+	uint32_t		zps_read_kbps;
+	uint32_t		zps_write_kbps;
+
+	/**
+	 * Read and write average I/O latency in microseconds.
+	 */
+	uint32_t		zps_read_lat_us;
+	uint32_t		zps_write_lat_us;
+
+};
+
+/**
+ * @brief Throughput profile of a device
+ *
+ * Samples are sorted in increasing sector order.
+ */
+struct zbc_profile {
+
+	/**
+	 * Device capacity in 512B sectors.
+	 */
+	uint64_t			zp_sectors;
+
+	/**
+	 * Size in bytes of the I/Os used for measurements.
+	 */
+	uint32_t			zp_io_size;
+
+	/**
+	 * Number of samples.
+	 */
+	uint32_t			zp_nr_samples;
+
+	/**
+	 * Samples.
+	 */
+	struct zbc_profile_sample	*zp_samples;
+
+};
+
+/**
+ * @brief Profiling flags
+ */
+enum zbc_profile_flags {
+
+	/**
+	 * Measure write throughput. The data of the sampled zones is
+	 * destroyed and the sampled sequential zones are left empty.
+	 */
+	ZBC_PROFILE_WRITE	= 0x01,
+
+};
+
+/**
+ * @brief Profiling parameters
+ */
+struct zbc_profile_params {
+
+	/**
+	 * Sample one zone out of every \a zpp_zone_step zones (0 to
+	 * sample about 256 zones of the device).
+	 */
+	unsigned int		zpp_zone_step;
+
+	/**
+	 * Size in bytes of I/Os (0 for 1 MiB).
+	 */
+	size_t			zpp_io_size;
+
+	/**
+	 * Number of bytes read and written per sampled zone (0 for
+	 * 32 MiB). This is limited to the zone size.
+	 */
+	size_t			zpp_sample_size;
+
+	/**
+	 * Profiling flags (enum zbc_profile_flags).
+	 */
+	unsigned int		zpp_flags;
+
+	/**
+	 * Progress callback called after each sample (may be NULL).
+	 */
+	void			(*zpp_progress)(void *priv, unsigned int done,
+						unsigned int total);
+	void			*zpp_priv;
+
+};
+
+/**
+ * @brief Profile the throughput of a device
+ * @param[in] dev	Device handle obtained with \a zbc_open
+ * @param[in] params	Profiling parameters (NULL for defaults)
+ * @param[out] pprof	Profile
+ *
+ * Measure the sequential read throughput, and the write throughput if
+ * ZBC_PROFILE_WRITE is set, and the I/O latency on one zone out of every
+ * \a zpp_zone_step zones. Without ZBC_PROFILE_WRITE, only the written
+ * space of sequential zones is read and empty sequential zones have no
+ * read measurement. With ZBC_PROFILE_WRITE, sampled sequential zones are
+ * reset, written from their start, read and reset again. Offline and read
+ * only zones are not sampled. For meaningful results, the device should
+ * be opened with O_DIRECT. The profile must be freed with
+ * \a zbc_profile_free.
+ *
+ * @return Returns 0 on success and a negative error code otherwise.
+ */
+extern int zbc_profile_run(struct zbc_device *dev,
+			   struct zbc_profile_params *params,
+			   struct zbc_profile **pprof);
+
+/**
+ * @brief Free a profile
+ * @param[in] prof	Profile
+ */
+extern void zbc_profile_free(struct zbc_profile *prof);
+
+/**
+ * @brief Save a profile to a file
+ * @param[in] prof	Profile
+ * @param[in] path	File path
+ *
+ * @return Returns 0 on success and a negative error code otherwise.
+ */
+extern int zbc_profile_save(struct zbc_profile *prof, const char *path);
+
+/**
+ * @brief Load a profile from a file
+ * @param[in] path	File path
+ * @param[out] pprof	Profile
+ *
+ * The profile must be freed with \a zbc_profile_free.
+ *
+ * @return Returns 0 on success and a negative error code otherwise.
+ * -EINVAL is returned if the file is not a valid profile.
+ */
+extern int zbc_profile_load(const char *path, struct zbc_profile **pprof);
+
+/**
+ * @brief Get the profile sample of a sector
+ * @param[in] prof	Profile
+ * @param[in] sector	512B sector
+ *
+ * @return Returns the sample of the last sampled zone starting at or
+ * before \a sector, or the first sample if \a sector is before all
+ * samples. NULL is returned if the profile has no samples.
+ */
+extern const struct zbc_profile_sample *
+zbc_profile_lookup(struct zbc_profile *prof, uint64_t sector);
+
+/**
+ * @}
+ */
+
+#endif /* _LIBZBC_PROFILE_H_ */
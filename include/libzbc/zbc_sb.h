@@ -0,0 +1,198 @@
+/*
+ * This file is part of libzbc.
+ *
+ * Copyright (C) 2009-2014, HGST, Inc. All rights reserved.
+ * Copyright (C) 2016, Western Digital. All rights reserved.
+ *
+ * This software is distributed under the terms of the BSD 2-clause license,
+ * "as is," without technical support, and WITHOUT ANY WARRANTY, without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE. You should have received a copy of the BSD 2-clause license along
+ * with libzbc. If not, see  <http://opensource.org/licenses/BSD-2-Clause>.
+ *
+ * Author: Damien Le Moal (damien.lemoal@wdc.com)
+ */
+
+#ifndef _LIBZBC_SB_H_
+#define _LIBZBC_SB_H_
+
+#include <libzbc/zbc.h>
+
+/**
+ * \addtogroup libzbc
+ *  @{
+ */
+
+/**
+ * @brief Superblock manager
+ *
+ * A superblock is a small block of application defined data (e.g. the
+ * checkpoint pointers and allocator state of a zoned storage engine) that
+ * must be updated atomically. It is stored in a number of slots in a range
+ * of conventional zones sectors, each slot holding a generation number, a
+ * CRC and a copy of the superblock data. Commits write a single slot, using
+ * the slots in turn so that the previous versions of the superblock are not
+ * overwritten, with a FUA write or a write followed by a device write cache
+ * flush. Opening a superblock reads all slots once and selects the valid
+ * slot with the highest generation.
+ *
+ * Updates are only applied in memory and several updates can be made
+ * durable by a single commit. Concurrent commits are grouped: while a slot
+ * is written, the threads committing wait for the write to complete and
+ * a single write then makes durable all updates done in the mean time.
+ */
+struct zbc_sb;
+
+/**
+ * @brief Superblock flags
+ */
+enum zbc_sb_flags {
+
+	/**
+	 * Write slots with the FUA hint instead of flushing the device
+	 * write cache after writing a slot.
+	 */
+	ZBC_SB_FUA		= 0x01,
+
+};
+
+/**
+ * @brief Superblock parameters
+ */
+struct zbc_sb_params {
+
+	/**
+	 * First sector of the slots. The slots must be within conventional
+	 * zones and \a zkp_sector must be aligned to the device physical
+	 * block size.
+	 */
+	uint64_t		zkp_sector;
+
+	/**
+	 * Number of slots (0 for 2).
+	 */
+	unsigned int		zkp_nr_slots;
+
+	/**
+	 * Maximum size in bytes of the superblock data (0 for the device
+	 * physical block size minus the slot header size). Slots are sized
+	 * to a multiple of the device physical block size.
+	 */
+	size_t			zkp_data_size;
+
+	/**
+	 * Flags (enum zbc_sb_flags).
+	 */
+	unsigned int		zkp_flags;
+
+};
+
+/**
+ * @brief Superblock statistics
+ */
+struct zbc_sb_stats {
+
+	/**
+	 * Version of the last update and version of the last commit
+	 * (0 if the superblock was never updated or committed).
+	 */
+	uint64_t		zks_version;
+	uint64_t		zks_committed;
+
+	/**
+	 * Number of updates, number of calls to \a zbc_sb_commit and
+	 * number of slots written.
+	 */
+	uint64_t		zks_nr_updates;
+	uint64_t		zks_nr_commits;
+	uint64_t		zks_nr_writes;
+
+	/**
+	 * Number of device write cache flushes.
+	 */
+	uint64_t		zks_nr_flushes;
+
+};
+
+/**
+ * @brief Open a superblock
+ * @param[in] dev	Device handle obtained with \a zbc_open
+ * @param[in] params	Superblock parameters
+ * @param[out] psb	Superblock handle
+ *
+ * Read the superblock slots and load the valid slot with the highest
+ * generation. If there is none, the superblock is empty (version 0).
+ *
+ * @return Returns 0 on success and a negative error code otherwise.
+ * -EINVAL is returned if the slots are not in conventional zones or if the
+ * parameters do not match the parameters the slots were written with.
+ */
+extern int zbc_sb_open(struct zbc_device *dev, struct zbc_sb_params *params,
+		       struct zbc_sb **psb);
+
+/**
+ * @brief Close a superblock
+ * @param[in] sb	Superblock handle
+ *
+ * Commit the last update and free the superblock resources.
+ *
+ * @return Returns 0 on success and a negative error code if the
+ * commit failed.
+ */
+extern int zbc_sb_close(struct zbc_sb *sb);
+
+/**
+ * @brief Get the superblock data
+ * @param[in] sb	Superblock handle
+ * @param[out] buf	Buffer for the data
+ * @param[in] len	Size in bytes of \a buf
+ * @param[out] version	Version of the data (may be NULL)
+ *
+ * Copy up to \a len bytes of the data of the last update.
+ *
+ * @return Returns the size in bytes of the superblock data.
+ */
+extern size_t zbc_sb_get(struct zbc_sb *sb, void *buf, size_t len,
+			 uint64_t *version);
+
+/**
+ * @brief Update the superblock data
+ * @param[in] sb	Superblock handle
+ * @param[in] buf	Superblock data
+ * @param[in] len	Size in bytes of \a buf
+ * @param[out] version	Version of the update (may be NULL)
+ *
+ * Replace the superblock data in memory. The update is durable only once
+ * a commit of its version or of a later version completes.
+ *
+ * @return Returns 0 on success and a negative error code otherwise.
+ * -ENOSPC is returned if \a len is larger than the maximum data size.
+ */
+extern int zbc_sb_update(struct zbc_sb *sb, const void *buf, size_t len,
+			 uint64_t *version);
+
+/**
+ * @brief Commit the superblock
+ * @param[in] sb	Superblock handle
+ * @param[in] version	Version to make durable (0 for the last update)
+ *
+ * Return once the superblock data of version \a version, or of a later
+ * version, is durable. No slot is written if this is already the case, and
+ * a single slot write serves all the threads committing concurrently.
+ *
+ * @return Returns 0 on success and a negative error code otherwise.
+ */
+extern int zbc_sb_commit(struct zbc_sb *sb, uint64_t version);
+
+/**
+ * @brief Get a superblock statistics
+ * @param[in] sb	Superblock handle
+ * @param[out] stats	Statistics
+ */
+extern void zbc_sb_get_stats(struct zbc_sb *sb, struct zbc_sb_stats *stats);
+
+/**
+ * @}
+ */
+
+#endif /* _LIBZBC_SB_H_ */
@@ -0,0 +1,235 @@
+/*
+ * This file is part of libzbc.
+ *
+ * Copyright (C) 2009-2014, HGST, Inc. All rights reserved.
+ * Copyright (C) 2016, Western Digital. All rights reserved.
+ *
+ * This software is distributed under the terms of the BSD 2-clause license,
+ * "as is," without technical support, and WITHOUT ANY WARRANTY, without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE. You should have received a copy of the BSD 2-clause license along
+ * with libzbc. If not, see  <http://opensource.org/licenses/BSD-2-Clause>.
+ *
+ * Author: Damien Le Moal (damien.lemoal@wdc.com)
+ */
+
+#ifndef _LIBZBC_SHUFFLE_H_
+#define _LIBZBC_SHUFFLE_H_
+
+#include <libzbc/zbc.h>
+
+/**
+ * \addtogroup libzbc
+ *  @{
+ */
+
+/**
+ * @brief Partitioned shuffle writer
+ *
+ * A shuffle writer stores the data of a large number of partitions, many
+ * more than the number of zones that the device can keep open, in the
+ * sequential zones of a range of sectors of a device. Data written to a
+ * partition is buffered in memory. Each time a partition buffer is full,
+ * its content is appended to the write buffer of one of a small number of
+ * streams, and the stream buffers are written sequentially to one zone per
+ * stream with large aligned writes. The number of streams, and so the
+ * number of zones being written, is kept under the device open zone limit.
+ * Each partition is mapped to a single stream, so that the zones of a
+ * stream only hold the data of a fraction of the partitions. The location
+ * of the data of each partition is recorded in an extent index.
+ */
+struct zbc_shuffle;
+
+/**
+ * @brief Shuffle writer parameters
+ */
+struct zbc_shuffle_params {
+
+	/**
+	 * Range of sectors of the device used to store the partitions data.
+	 * Only sequential zones within this range are used, and the zones
+	 * that are not empty are reset when the writer is created.
+	 */
+	uint64_t		zhp_sector;
+	uint64_t		zhp_nr_sectors;
+
+	/**
+	 * Number of partitions.
+	 */
+	unsigned int		zhp_nr_partitions;
+
+	/**
+	 * Total size in bytes of the partitions buffers (0 for 64 MiB).
+	 * Each partition buffer gets an equal share, rounded down to the
+	 * device physical block size, and of at most \a zhp_io_size bytes.
+	 */
+	size_t			zhp_mem_size;
+
+	/**
+	 * Size in bytes of stream writes (0 for 1 MiB). This is rounded
+	 * down to the device physical block size. Each stream uses 2 write
+	 * buffers of this size.
+	 */
+	size_t			zhp_io_size;
+
+	/**
+	 * Maximum number of streams (0 for the device optimal or maximum
+	 * number of open zones, or 8 if the device has no limit).
+	 */
+	unsigned int		zhp_max_open;
+
+};
+
+/**
+ * @brief Partition extent
+ *
+ * Location on the device of \a zhe_length bytes of data of a partition,
+ * starting at byte offset \a zhe_offset of the partition data.
+ */
+struct zbc_shuffle_extent {
+
+	/**
+	 * Byte offset of the extent in the partition data.
+	 */
+	uint64_t		zhe_offset;
+
+	/**
+	 * Sector holding the first byte of the extent, and offset of that
+	 * byte in the sector.
+	 */
+	uint64_t		zhe_sector;
+	uint32_t		zhe_sector_offset;
+
+	/**
+	 * Length of the extent in bytes.
+	 */
+	uint32_t		zhe_length;
+
+};
+
+/**
+ * @brief Shuffle writer statistics
+ */
+struct zbc_shuffle_stats {
+
+	/**
+	 * Number of bytes written to partitions.
+	 */
+	uint64_t		zhs_bytes;
+
+	/**
+	 * Number of writes and number of bytes written to the device,
+	 * including the padding of flushed stream buffers.
+	 */
+	uint64_t		zhs_nr_writes;
+	uint64_t		zhs_dev_bytes;
+
+	/**
+	 * Number of extents of all partitions.
+	 */
+	uint64_t		zhs_nr_extents;
+
+	/**
+	 * Number of zones used and number of streams.
+	 */
+	uint64_t		zhs_nr_zones;
+	uint32_t		zhs_nr_streams;
+
+};
+
+/**
+ * @brief Create a shuffle writer
+ * @param[in] dev	Device handle obtained with \a zbc_open
+ * @param[in] params	Shuffle writer parameters
+ * @param[out] pshuf	Shuffle writer handle
+ *
+ * @return Returns 0 on success and a negative error code otherwise.
+ */
+extern int zbc_shuffle_open(struct zbc_device *dev,
+			    struct zbc_shuffle_params *params,
+			    struct zbc_shuffle **pshuf);
+
+/**
+ * @brief Free a shuffle writer
+ * @param[in] shuf	Shuffle writer handle
+ *
+ * Wait for the stream writes in flight and reset all the zones used.
+ * Data that was not flushed is lost.
+ */
+extern void zbc_shuffle_close(struct zbc_shuffle *shuf);
+
+/**
+ * @brief Write data to a partition
+ * @param[in] shuf	Shuffle writer handle
+ * @param[in] part	Partition number
+ * @param[in] buf	Data buffer
+ * @param[in] count	Number of bytes to write
+ *
+ * Append \a count bytes to the data of the partition \a part.
+ *
+ * @return Returns 0 on success and a negative error code otherwise.
+ * -ENOSPC is returned if there is no empty zone left.
+ */
+extern int zbc_shuffle_write(struct zbc_shuffle *shuf, unsigned int part,
+			     const void *buf, size_t count);
+
+/**
+ * @brief Flush a shuffle writer
+ * @param[in] shuf	Shuffle writer handle
+ *
+ * Append the data buffered for all partitions to the stream buffers and
+ * write the stream buffers, padding them to the device physical block
+ * size, and wait for all writes to complete.
+ *
+ * @return Returns 0 on success and a negative error code otherwise.
+ */
+extern int zbc_shuffle_flush(struct zbc_shuffle *shuf);
+
+/**
+ * @brief Get the extents of a partition
+ * @param[in] shuf	Shuffle writer handle
+ * @param[in] part	Partition number
+ * @param[out] extents	Array of extents (may be NULL)
+ * @param[in,out] nr_extents Size of \a extents / Number of extents
+ *
+ * Get the extents of the data of the partition \a part written with the
+ * last call to \a zbc_shuffle_flush. If \a extents is NULL, only the
+ * number of extents is returned.
+ *
+ * @return Returns 0 on success and a negative error code otherwise.
+ */
+extern int zbc_shuffle_get_extents(struct zbc_shuffle *shuf,
+				   unsigned int part,
+				   struct zbc_shuffle_extent *extents,
+				   unsigned int *nr_extents);
+
+/**
+ * @brief Read data from a partition
+ * @param[in] shuf	Shuffle writer handle
+ * @param[in] part	Partition number
+ * @param[in] buf	Data buffer
+ * @param[in] count	Number of bytes to read
+ * @param[in] offset	Byte offset in the partition data
+ *
+ * Read data of the partition \a part written with the last call to
+ * \a zbc_shuffle_flush.
+ *
+ * @return Returns the number of bytes read, 0 if \a offset is past the
+ * end of the partition data, and a negative error code otherwise.
+ */
+extern ssize_t zbc_shuffle_read(struct zbc_shuffle *shuf, unsigned int part,
+				void *buf, size_t count, uint64_t offset);
+
+/**
+ * @brief Get a shuffle writer statistics
+ * @param[in] shuf	Shuffle writer handle
+ * @param[out] stats	Statistics
+ */
+extern void zbc_shuffle_get_stats(struct zbc_shuffle *shuf,
+				  struct zbc_shuffle_stats *stats);
+
+/**
+ * @}
+ */
+
+#endif /* _LIBZBC_SHUFFLE_H_ */
@@ -0,0 +1,232 @@
+/*
+ * This file is part of libzbc.
+ *
+ * Copyright (C) 2009-2014, HGST, Inc. All rights reserved.
+ * Copyright (C) 2016, Western Digital. All rights reserved.
+ *
+ * This software is distributed under the terms of the BSD 2-clause license,
+ * "as is," without technical support, and WITHOUT ANY WARRANTY, without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE. You should have received a copy of the BSD 2-clause license along
+ * with libzbc. If not, see  <http://opensource.org/licenses/BSD-2-Clause>.
+ *
+ * Author: Damien Le Moal (damien.lemoal@wdc.com)
+ */
+
+#ifndef _LIBZBC_SLAB_H_
+#define _LIBZBC_SLAB_H_
+
+#include <libzbc/zbc.h>
+
+/**
+ * \addtogroup libzbc
+ *  @{
+ */
+
+/**
+ * @brief Slab allocator of metadata blocks
+ *
+ * A slab allocator manages a range of sectors of conventional zones, the
+ * only zones in which metadata can be updated in place. Blocks of a power
+ * of two multiple of the device physical block size (size classes) are
+ * allocated from slabs, each slab holding blocks of a single size class.
+ * The size class of each slab and the bitmap of its allocated blocks are
+ * stored at the beginning of the range of sectors, in metadata blocks of
+ * one physical block each. Two copies of the metadata are kept and written
+ * alternately, each with a generation number and CRCs, so that an
+ * interrupted sync leaves the previous copy intact. Allocations and frees
+ * only modify the metadata in memory, and \a zbc_slab_sync writes the
+ * metadata blocks modified since the copy written was last synced.
+ *
+ * The slabs with free blocks of each size class and the free slabs are
+ * kept in lists, so that allocating and freeing a block takes constant
+ * time, regardless of the number of slabs.
+ */
+struct zbc_slab;
+
+/**
+ * @brief Slab allocator flags
+ */
+enum zbc_slab_flags {
+
+	/**
+	 * Initialize the metadata of the range of sectors, discarding the
+	 * metadata of a previous slab allocator.
+	 */
+	ZBC_SLAB_FORMAT		= 0x01,
+
+};
+
+/**
+ * @brief Slab allocator parameters
+ */
+struct zbc_slab_params {
+
+	/**
+	 * Range of sectors managed. The range must be within conventional
+	 * zones and \a zcp_sector must be aligned to the device physical
+	 * block size. If \a zcp_nr_sectors is 0, the range extends to the
+	 * end of the conventional zones starting at \a zcp_sector.
+	 */
+	uint64_t		zcp_sector;
+	uint64_t		zcp_nr_sectors;
+
+	/**
+	 * Slab size in bytes (0 for 1 MiB). This must be a power of 2
+	 * multiple of the device physical block size.
+	 */
+	size_t			zcp_slab_size;
+
+	/**
+	 * Maximum size of the blocks allocated in bytes (0 for 64 KiB).
+	 * This must be a power of 2 multiple of the device physical block
+	 * size, not larger than the slab size.
+	 */
+	size_t			zcp_max_size;
+
+	/**
+	 * Flags (enum zbc_slab_flags).
+	 */
+	unsigned int		zcp_flags;
+
+};
+
+/**
+ * @brief Slab allocator statistics
+ */
+struct zbc_slab_stats {
+
+	/**
+	 * Number of slabs and number of free slabs.
+	 */
+	uint32_t		zcs_nr_slabs;
+	uint32_t		zcs_nr_free_slabs;
+
+	/**
+	 * Total and free space of the slabs in 512B sectors (the free space
+	 * includes the free blocks of the slabs in use).
+	 */
+	uint64_t		zcs_nr_sectors;
+	uint64_t		zcs_nr_free_sectors;
+
+	/**
+	 * Number of allocations and of frees.
+	 */
+	uint64_t		zcs_nr_allocs;
+	uint64_t		zcs_nr_frees;
+
+	/**
+	 * Number of syncs and number of metadata blocks written.
+	 */
+	uint64_t		zcs_nr_syncs;
+	uint64_t		zcs_meta_writes;
+
+};
+
+/**
+ * @brief Open a slab allocator
+ * @param[in] dev	Device handle obtained with \a zbc_open
+ * @param[in] params	Slab allocator parameters
+ * @param[out] pslab	Slab allocator handle
+ *
+ * Load the valid metadata copy of the newest generation of the range of
+ * sectors, or initialize the metadata if \a ZBC_SLAB_FORMAT is set.
+ *
+ * @return Returns 0 on success and a negative error code otherwise.
+ * -EINVAL is returned if the range is not within conventional zones, if
+ * the range has no slab allocator metadata and \a ZBC_SLAB_FORMAT is not
+ * set, or if the parameters do not match the parameters of the existing
+ * metadata. -EIO is returned if no metadata copy is valid.
+ */
+extern int zbc_slab_open(struct zbc_device *dev,
+			 struct zbc_slab_params *params,
+			 struct zbc_slab **pslab);
+
+/**
+ * @brief Close a slab allocator
+ * @param[in] slab	Slab allocator handle
+ *
+ * Sync the slab allocator and free its resources.
+ *
+ * @return Returns 0 on success and a negative error code if the sync
+ * failed.
+ */
+extern int zbc_slab_close(struct zbc_slab *slab);
+
+/**
+ * @brief Allocate a block
+ * @param[in] slab	Slab allocator handle
+ * @param[in] size	Size in bytes
+ * @param[out] sector	First sector of the block allocated
+ *
+ * Allocate a block of the smallest size class larger than or equal to
+ * \a size. The allocation is persistent only after the next sync.
+ *
+ * @return Returns the size in bytes of the block allocated on success and
+ * a negative error code otherwise. -ENOSPC is returned if there is no
+ * free block of the size class and no free slab.
+ */
+extern ssize_t zbc_slab_alloc(struct zbc_slab *slab, size_t size,
+			      uint64_t *sector);
+
+/**
+ * @brief Free a block
+ * @param[in] slab	Slab allocator handle
+ * @param[in] sector	First sector of the block
+ *
+ * The free is persistent only after the next sync, which should be done
+ * only once the application state not referencing the block is durable.
+ *
+ * @return Returns 0 on success and a negative error code otherwise.
+ * -EINVAL is returned if \a sector is not an allocated block.
+ */
+extern int zbc_slab_free(struct zbc_slab *slab, uint64_t sector);
+
+/**
+ * @brief Read a block
+ * @param[in] slab	Slab allocator handle
+ * @param[in] sector	First sector of the block
+ * @param[out] buf	Buffer of the size of the block
+ *
+ * @return Returns 0 on success and a negative error code otherwise.
+ */
+extern int zbc_slab_read(struct zbc_slab *slab, uint64_t sector, void *buf);
+
+/**
+ * @brief Write a block
+ * @param[in] slab	Slab allocator handle
+ * @param[in] sector	First sector of the block
+ * @param[in] buf	Buffer of the size of the block
+ *
+ * The data is durable only after the next sync.
+ *
+ * @return Returns 0 on success and a negative error code otherwise.
+ */
+extern int zbc_slab_write(struct zbc_slab *slab, uint64_t sector,
+			  const void *buf);
+
+/**
+ * @brief Sync a slab allocator
+ * @param[in] slab	Slab allocator handle
+ *
+ * Write the metadata blocks modified to the copy not holding the last
+ * synced metadata, contiguous blocks being written together, and flush
+ * the device write cache.
+ *
+ * @return Returns 0 on success and a negative error code otherwise.
+ */
+extern int zbc_slab_sync(struct zbc_slab *slab);
+
+/**
+ * @brief Get a slab allocator statistics
+ * @param[in] slab	Slab allocator handle
+ * @param[out] stats	Statistics
+ */
+extern void zbc_slab_get_stats(struct zbc_slab *slab,
+			       struct zbc_slab_stats *stats);
+
+/**
+ * @}
+ */
+
+#endif /* _LIBZBC_SLAB_H_ */
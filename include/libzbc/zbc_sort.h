@@ -0,0 +1,205 @@
+/*
+ * This file is part of libzbc.
+ *
+ * Copyright (C) 2009-2014, HGST, Inc. All rights reserved.
+ * Copyright (C) 2016, Western Digital. All rights reserved.
+ *
+ * This software is distributed under the terms of the BSD 2-clause license,
+ * "as is," without technical support, and WITHOUT ANY WARRANTY, without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE. You should have received a copy of the BSD 2-clause license along
+ * with libzbc. If not, see  <http://opensource.org/licenses/BSD-2-Clause>.
+ *
+ * Author: Damien Le Moal (damien.lemoal@wdc.com)
+ */
+
+#ifndef _LIBZBC_SORT_H_
+#define _LIBZBC_SORT_H_
+
+#include <libzbc/zbc.h>
+
+/**
+ * \addtogroup libzbc
+ *  @{
+ */
+
+/**
+ * @brief External merge sort
+ *
+ * A sorter sorts fixed size records that do not fit in memory. Records
+ * added to the sorter are accumulated in a memory buffer. When the buffer
+ * is full, it is split in partitions sorted in parallel by the library
+ * executor, and the partitions are merged into a sorted run written
+ * sequentially to zones allocated from a range of sectors of the device.
+ * Once all records are added, the runs and the records remaining in memory
+ * are merged and read back in order, each run being read ahead
+ * asynchronously. The zones of a run are reset as soon as all their
+ * records are consumed.
+ */
+struct zbc_sort;
+
+/**
+ * @brief Record comparison function
+ *
+ * Returns a negative value, 0 or a positive value if the record \a a
+ * is respectively lower than, equal to or greater than the record \a b.
+ */
+typedef int (*zbc_sort_cmp_fn)(const void *a, const void *b, void *priv);
+
+/**
+ * @brief Sorter parameters
+ */
+struct zbc_sort_params {
+
+	/**
+	 * Range of sectors of the device used to store runs. Only
+	 * sequential zones within this range are used, and the zones
+	 * that are not empty are reset when the sorter is created.
+	 */
+	uint64_t		zsp_sector;
+	uint64_t		zsp_nr_sectors;
+
+	/**
+	 * Record size in bytes. This must not exceed \a zsp_io_size.
+	 */
+	size_t			zsp_rec_size;
+
+	/**
+	 * Record comparison function and its private argument.
+	 */
+	zbc_sort_cmp_fn		zsp_cmp;
+	void			*zsp_priv;
+
+	/**
+	 * Size in bytes of the memory buffer of records, which is also
+	 * the maximum size of runs (0 for 256 MiB).
+	 */
+	size_t			zsp_mem_size;
+
+	/**
+	 * Size in bytes of run writes and read ahead I/Os (0 for 1 MiB).
+	 * This is rounded down to the device physical block size. Merging
+	 * uses 2 buffers of this size per run.
+	 */
+	size_t			zsp_io_size;
+
+	/**
+	 * Number of partitions of the memory buffer sorted in parallel
+	 * (0 for the number of CPUs).
+	 */
+	unsigned int		zsp_nr_threads;
+
+};
+
+/**
+ * @brief Sorter statistics
+ */
+struct zbc_sort_stats {
+
+	/**
+	 * Number of records added and number of records read.
+	 */
+	uint64_t		zss_nr_recs;
+	uint64_t		zss_nr_read_recs;
+
+	/**
+	 * Number of runs written to the device.
+	 */
+	uint64_t		zss_nr_runs;
+
+	/**
+	 * Number of bytes written to and read from runs.
+	 */
+	uint64_t		zss_spill_bytes;
+	uint64_t		zss_merge_bytes;
+
+	/**
+	 * Time spent sorting the memory buffer and writing runs, in
+	 * nanoseconds.
+	 */
+	uint64_t		zss_sort_ns;
+	uint64_t		zss_spill_ns;
+
+	/**
+	 * Number of zones used by runs and reset after merging.
+	 */
+	uint64_t		zss_nr_zones;
+	uint64_t		zss_nr_reset_zones;
+
+};
+
+/**
+ * @brief Create a sorter
+ * @param[in] dev	Device handle obtained with \a zbc_open
+ * @param[in] params	Sorter parameters
+ * @param[out] psort	Sorter handle
+ *
+ * @return Returns 0 on success and a negative error code otherwise.
+ */
+extern int zbc_sort_open(struct zbc_device *dev,
+			 struct zbc_sort_params *params,
+			 struct zbc_sort **psort);
+
+/**
+ * @brief Free a sorter
+ * @param[in] sort	Sorter handle
+ *
+ * The zones of the runs not entirely read are reset.
+ */
+extern void zbc_sort_close(struct zbc_sort *sort);
+
+/**
+ * @brief Add records to a sorter
+ * @param[in] sort	Sorter handle
+ * @param[in] recs	Records
+ * @param[in] nr_recs	Number of records
+ *
+ * Copy records to the memory buffer of \a sort, writing a run each time
+ * the buffer is full. Records cannot be added after \a zbc_sort_finish.
+ *
+ * @return Returns 0 on success and a negative error code otherwise.
+ * -ENOSPC is returned if there is no empty zone left for a run.
+ */
+extern int zbc_sort_add(struct zbc_sort *sort, const void *recs,
+			size_t nr_recs);
+
+/**
+ * @brief Finish adding records to a sorter
+ * @param[in] sort	Sorter handle
+ *
+ * Sort the records remaining in memory and prepare the merge of the
+ * runs and of the records in memory, which are not written to the device.
+ *
+ * @return Returns 0 on success and a negative error code otherwise.
+ */
+extern int zbc_sort_finish(struct zbc_sort *sort);
+
+/**
+ * @brief Read sorted records
+ * @param[in] sort	Sorter handle
+ * @param[in] recs	Buffer for the records
+ * @param[in] nr_recs	Maximum number of records to read
+ *
+ * Read the next records in sorted order. Records comparing equal are
+ * returned in no particular order. This can only be called after
+ * \a zbc_sort_finish.
+ *
+ * @return Returns the number of records read, 0 once all records were
+ * read, and a negative error code otherwise.
+ */
+extern ssize_t zbc_sort_read(struct zbc_sort *sort, void *recs,
+			     size_t nr_recs);
+
+/**
+ * @brief Get a sorter statistics
+ * @param[in] sort	Sorter handle
+ * @param[out] stats	Statistics
+ */
+extern void zbc_sort_get_stats(struct zbc_sort *sort,
+			       struct zbc_sort_stats *stats);
+
+/**
+ * @}
+ */
+
+#endif /* _LIBZBC_SORT_H_ */
@@ -0,0 +1,149 @@
+/*
+ * This file is part of libzbc.
+ *
+ * Copyright (C) 2009-2014, HGST, Inc. All rights reserved.
+ * Copyright (C) 2016, Western Digital. All rights reserved.
+ *
+ * This software is distributed under the terms of the BSD 2-clause license,
+ * "as is," without technical support, and WITHOUT ANY WARRANTY, without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE. You should have received a copy of the BSD 2-clause license along
+ * with libzbc. If not, see  <http://opensource.org/licenses/BSD-2-Clause>.
+ *
+ * Author: Damien Le Moal (damien.lemoal@wdc.com)
+ */
+
+#ifndef _LIBZBC_ZGROUP_H_
+#define _LIBZBC_ZGROUP_H_
+
+#include <libzbc/zbc.h>
+
+/**
+ * \addtogroup libzbc
+ *  @{
+ */
+
+/**
+ * @brief Zone groups of a device
+ *
+ * A zone group is a fixed number of adjacent sequential zones of the same
+ * size used as a single logical zone: the group has a single write pointer
+ * and writes crossing the boundary between two member zones are split
+ * internally. Resetting or finishing a group operates on all its member
+ * zones, with a single command if the device driver supports zone range
+ * operations.
+ *
+ * Groups are addressed with the device sector of their first member zone
+ * and their sectors are device sectors. Sequential zones that cannot be
+ * part of a complete group (conventional zones or zones of a different
+ * size in between) are not used.
+ *
+ * The state of the member zones is cached when the groups are set up and
+ * updated by the group operations: the device zones used by groups must
+ * not be modified with other functions while the groups are in use. As
+ * for zones, writes to the same group must be serialized by the caller.
+ */
+struct zbc_zgroups;
+
+/**
+ * @brief Set up the zone groups of a device
+ * @param[in] dev		Device handle obtained with \a zbc_open
+ * @param[in] nr_group_zones	Number of zones per group
+ * @param[out] pzg		Zone groups handle
+ *
+ * @return Returns 0 on success and a negative error code otherwise.
+ * -EINVAL is returned if the device has no group of \a nr_group_zones
+ * adjacent sequential zones.
+ */
+extern int zbc_zgroup_open(struct zbc_device *dev,
+			   unsigned int nr_group_zones,
+			   struct zbc_zgroups **pzg);
+
+/**
+ * @brief Free the zone groups of a device
+ * @param[in] zg	Zone groups handle
+ */
+extern void zbc_zgroup_close(struct zbc_zgroups *zg);
+
+/**
+ * @brief Get the number of zone groups
+ * @param[in] zg	Zone groups handle
+ *
+ * @return Returns the number of zone groups.
+ */
+extern unsigned int zbc_zgroup_nr_groups(struct zbc_zgroups *zg);
+
+/**
+ * @brief Get zone group information
+ * @param[in] zg	Zone groups handle
+ * @param[in] sector	Sector from which to report groups
+ * @param[in] groups	Pointer to the array of group information to fill
+ * @param[out] nr_groups Number of groups in the array \a groups
+ *
+ * Each group is described as a zone: its start is the start of the
+ * first member zone, its length the sum of the member zone lengths and
+ * its write pointer the write pointer of the first member zone that is
+ * not full. The group condition is empty if all members are empty, full
+ * if all members are full and otherwise the condition of that member
+ * (closed if it is empty). An offline or read-only member zone makes
+ * the whole group offline or read-only. The first group reported is the
+ * group containing or after \a sector.
+ *
+ * @return Returns 0 on success and a negative error code otherwise.
+ */
+extern int zbc_zgroup_report(struct zbc_zgroups *zg, uint64_t sector,
+			     struct zbc_zone *groups,
+			     unsigned int *nr_groups);
+
+/**
+ * @brief Read from a zone group
+ * @param[in] zg	Zone groups handle
+ * @param[in] buf	Caller supplied buffer to read into
+ * @param[in] count	Number of 512B sectors to read
+ * @param[in] offset	Device sector from which to read
+ *
+ * The read may not cross the end of the group containing \a offset.
+ *
+ * @return Returns the number of sectors read or a negative error code.
+ */
+extern ssize_t zbc_zgroup_pread(struct zbc_zgroups *zg, void *buf,
+				size_t count, uint64_t offset);
+
+/**
+ * @brief Write to a zone group
+ * @param[in] zg	Zone groups handle
+ * @param[in] buf	Caller supplied buffer to write from
+ * @param[in] count	Number of 512B sectors to write
+ * @param[in] offset	Device sector from which to write
+ *
+ * \a offset must be the write pointer of the group containing it. The
+ * write is truncated to the end of the group.
+ *
+ * @return Returns the number of sectors written or a negative error code.
+ */
+extern ssize_t zbc_zgroup_pwrite(struct zbc_zgroups *zg, const void *buf,
+				 size_t count, uint64_t offset);
+
+/**
+ * @brief Reset the write pointer of a zone group
+ * @param[in] zg	Zone groups handle
+ * @param[in] sector	Start sector of the group
+ *
+ * @return Returns 0 on success and a negative error code otherwise.
+ */
+extern int zbc_zgroup_reset(struct zbc_zgroups *zg, uint64_t sector);
+
+/**
+ * @brief Transition a zone group to the full condition
+ * @param[in] zg	Zone groups handle
+ * @param[in] sector	Start sector of the group
+ *
+ * @return Returns 0 on success and a negative error code otherwise.
+ */
+extern int zbc_zgroup_finish(struct zbc_zgroups *zg, uint64_t sector);
+
+/**
+ * @}
+ */
+
+#endif /* _LIBZBC_ZGROUP_H_ */
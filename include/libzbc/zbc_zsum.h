@@ -0,0 +1,246 @@
+/*
+ * This file is part of libzbc.
+ *
+ * Copyright (C) 2009-2014, HGST, Inc. All rights reserved.
+ * Copyright (C) 2016, Western Digital. All rights reserved.
+ *
+ * This software is distributed under the terms of the BSD 2-clause license,
+ * "as is," without technical support, and WITHOUT ANY WARRANTY, without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE. You should have received a copy of the BSD 2-clause license along
+ * with libzbc. If not, see  <http://opensource.org/licenses/BSD-2-Clause>.
+ *
+ * Author: Damien Le Moal (damien.lemoal@wdc.com)
+ */
+
+#ifndef _LIBZBC_ZSUM_H_
+#define _LIBZBC_ZSUM_H_
+
+#include <libzbc/zbc.h>
+
+/**
+ * \addtogroup libzbc
+ *  @{
+ */
+
+/**
+ * @brief Zone summary footers
+ *
+ * Zone summaries allow a log-structured layer to recover without reading
+ * all the data of its zones. Data is appended to the sequential zones of a
+ * range of sectors together with application defined summary records
+ * (e.g. the keys and locations of the records written), which are
+ * accumulated in memory. When a zone data area fills up, or when a zone is
+ * finished with \a zbc_zsum_finish, the summary is written with a checksum
+ * in a footer at the end of the zone, and the zone is sealed. The first
+ * block of each zone is a header holding a random identifier of the zone
+ * content, also stored in the footer, so that stale footers left by a
+ * previous use of a zone are never used.
+ *
+ * When finishing a zone before its data area is full, the footer is written
+ * at the end of a slot of the zone (slots are counted from the end of the
+ * zone), after padding the data area up to the footer, and the zone is then
+ * finished with \a zbc_finish_zone. Recovery thus only needs to read the
+ * header and the possible footer locations of a full zone, while the data
+ * of partially written zones must be scanned by the application.
+ */
+struct zbc_zsum;
+
+/**
+ * @brief Zone summary parameters
+ */
+struct zbc_zsum_params {
+
+	/**
+	 * Range of sectors of the zones. Only sequential zones within
+	 * this range are used.
+	 */
+	uint64_t		zmp_sector;
+	uint64_t		zmp_nr_sectors;
+
+	/**
+	 * Maximum size in bytes of the summary of a zone (0 for 64 KiB).
+	 * This determines the size of the zone footers.
+	 */
+	size_t			zmp_summary_size;
+
+	/**
+	 * Size in 512B sectors of the slots in which footers are written
+	 * when zones are finished early (0 for 1/64 of the zone size).
+	 * This is the maximum amount of padding written when finishing a
+	 * zone, and recovery reads at most one block per slot of a zone
+	 * finished early.
+	 */
+	uint64_t		zmp_slot_sectors;
+
+};
+
+/**
+ * @brief Zone summary state of a zone
+ */
+enum zbc_zsum_state {
+
+	/**
+	 * Empty zone.
+	 */
+	ZBC_ZSUM_EMPTY		= 0,
+
+	/**
+	 * Partially written zone: data can be appended.
+	 */
+	ZBC_ZSUM_OPEN		= 1,
+
+	/**
+	 * Zone with a valid footer.
+	 */
+	ZBC_ZSUM_SEALED		= 2,
+
+	/**
+	 * Zone written without summary (invalid zone header), full zone
+	 * without a valid footer, or zone with an incomplete footer.
+	 * Data cannot be appended.
+	 */
+	ZBC_ZSUM_UNSEALED	= 3,
+
+};
+
+/**
+ * @brief Zone summary information of a zone
+ */
+struct zbc_zsum_zone {
+
+	/**
+	 * Zone start sector and zone summary state.
+	 */
+	uint64_t		zsz_start;
+	enum zbc_zsum_state	zsz_state;
+
+	/**
+	 * Data area of the zone: data written in [zsz_data_start,
+	 * zsz_data_end[, and maximum end of the data area.
+	 */
+	uint64_t		zsz_data_start;
+	uint64_t		zsz_data_end;
+	uint64_t		zsz_data_limit;
+
+	/**
+	 * Size in bytes of the zone summary.
+	 */
+	size_t			zsz_summary_len;
+
+};
+
+/**
+ * @brief Recovery callback
+ *
+ * Called for each zone that is not empty. For sealed zones, \a summary is
+ * the zone summary read from the zone footer. For other zones, \a summary
+ * is NULL and the data area of the zone must be scanned. The summary of an
+ * open zone can then be set with \a zbc_zsum_set_summary. Returning a
+ * non-zero value stops the recovery.
+ */
+typedef int (*zbc_zsum_recover_fn)(struct zbc_zsum *zs,
+				   struct zbc_zsum_zone *zone,
+				   const void *summary, void *priv);
+
+/**
+ * @brief Open zone summaries
+ * @param[in] dev	Device handle obtained with \a zbc_open
+ * @param[in] params	Zone summary parameters
+ * @param[out] pzs	Zone summary handle
+ *
+ * @return Returns 0 on success and a negative error code otherwise.
+ */
+extern int zbc_zsum_open(struct zbc_device *dev,
+			 struct zbc_zsum_params *params,
+			 struct zbc_zsum **pzs);
+
+/**
+ * @brief Close zone summaries
+ * @param[in] zs	Zone summary handle
+ *
+ * The summaries of the zones that are not sealed are lost.
+ */
+extern void zbc_zsum_close(struct zbc_zsum *zs);
+
+/**
+ * @brief Append data to a zone
+ * @param[in] zs	Zone summary handle
+ * @param[in] zone	Zone start sector
+ * @param[in] buf	Data buffer
+ * @param[in] count	Number of 512B sectors to write
+ * @param[in] summary	Summary record of the data (may be NULL)
+ * @param[in] summary_len Size in bytes of \a summary
+ * @param[out] sector	Sector where the data was written (may be NULL)
+ *
+ * Write \a count sectors at the end of the data area of the zone and
+ * append \a summary to the zone summary. The zone header is written first
+ * if the zone is empty. If the data area of the zone becomes full, the
+ * zone footer is written.
+ *
+ * @return Returns 0 on success and a negative error code otherwise.
+ * -ENOSPC is returned if the data or the summary does not fit in the zone.
+ */
+extern int zbc_zsum_append(struct zbc_zsum *zs, uint64_t zone,
+			   const void *buf, size_t count,
+			   const void *summary, size_t summary_len,
+			   uint64_t *sector);
+
+/**
+ * @brief Set the summary of an open zone
+ * @param[in] zs	Zone summary handle
+ * @param[in] zone	Zone start sector
+ * @param[in] summary	Zone summary
+ * @param[in] summary_len Size in bytes of \a summary
+ *
+ * Replace the summary of an open zone, typically after scanning the
+ * zone data during recovery.
+ *
+ * @return Returns 0 on success and a negative error code otherwise.
+ */
+extern int zbc_zsum_set_summary(struct zbc_zsum *zs, uint64_t zone,
+				const void *summary, size_t summary_len);
+
+/**
+ * @brief Seal a zone
+ * @param[in] zs	Zone summary handle
+ * @param[in] zone	Zone start sector
+ *
+ * Pad the data area of an open zone up to the next footer location,
+ * write the zone footer and finish the zone.
+ *
+ * @return Returns 0 on success and a negative error code otherwise.
+ */
+extern int zbc_zsum_finish(struct zbc_zsum *zs, uint64_t zone);
+
+/**
+ * @brief Get the zone summary information of a zone
+ * @param[in] zs	Zone summary handle
+ * @param[in] zone	Zone start sector
+ * @param[out] info	Zone summary information
+ *
+ * @return Returns 0 on success and a negative error code otherwise.
+ */
+extern int zbc_zsum_get_zone(struct zbc_zsum *zs, uint64_t zone,
+			     struct zbc_zsum_zone *info);
+
+/**
+ * @brief Recover zone summaries
+ * @param[in] zs	Zone summary handle
+ * @param[in] cb	Recovery callback
+ * @param[in] priv	Private argument of \a cb
+ *
+ * Determine the state of all zones, reading only the header and footer
+ * blocks of full zones, and call \a cb for each zone that is not empty.
+ *
+ * @return Returns 0 on success, the non-zero value returned by \a cb if
+ * the recovery was stopped, and a negative error code otherwise.
+ */
+extern int zbc_zsum_recover(struct zbc_zsum *zs, zbc_zsum_recover_fn cb,
+			    void *priv);
+
+/**
+ * @}
+ */
+
+#endif /* _LIBZBC_ZSUM_H_ */
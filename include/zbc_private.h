@@ -65,4 +65,114 @@ extern int zbc_set_zones(struct zbc_device *dev,
 extern int zbc_set_write_pointer(struct zbc_device *dev,
 				 uint64_t sector, uint64_t wp_sector);
 
+/**
+ * zbc_set_write_pointers - Change the write pointers of a range of zones
+ * @dev:	(IN) ZBC device handle of the device to configure
+ * @sector:	(IN) The starting 512B sector of the first zone to configure
+ * @nr_zones:	(IN) Number of consecutive zones to configure
+ * @wp_sectors:	(IN) New 512B sector values of the zones write pointer
+ *
+ * Description:
+ * Same as zbc_set_write_pointer for @nr_zones consecutive zones starting
+ * with the zone identified by @sector, with a single update of the emulated
+ * device metadata. Conventional zones of the range are ignored.
+ */
+extern int zbc_set_write_pointers(struct zbc_device *dev, uint64_t sector,
+				  unsigned int nr_zones,
+				  const uint64_t *wp_sectors);
+
+/**
+ * zbc_set_stripes - Stripe the data of an emulated device
+ * @dev:	(IN) ZBC device handle of the device to configure
+ * @stripe_size:(IN) Stripe unit in bytes
+ * @nr_files:	(IN) Number of additional backing files or block devices
+ * @files:	(IN) Paths of the additional backing files or block devices
+ *
+ * Description:
+ * This function only affects devices operating with the emulation (fake)
+ * backend driver. The data of the emulated device is striped in units of
+ * @stripe_size bytes across the device file and the @nr_files files,
+ * which are accessed in parallel. The capacity becomes the size of the
+ * smallest file times the number of files. The configuration is saved
+ * with the device metadata and used by subsequent opens. Since the
+ * capacity changes, the zone configuration is dropped and must be set
+ * again with zbc_set_zones. A @nr_files of 0 removes the striping.
+ */
+extern int zbc_set_stripes(struct zbc_device *dev, size_t stripe_size,
+			   unsigned int nr_files, const char **files);
+
+/**
+ * zbc_file_io - Test if the device data can be read with file I/Os
+ * @dev:	(IN) ZBC device handle
+ *
+ * Description:
+ * Return true if the data of the device is stored linearly in the device
+ * file, so that sector @n can be read at byte offset @n * 512 of the file
+ * or block device used to open @dev. This is the case of the block device
+ * driver and of the emulation driver, unless the emulated device data is
+ * striped (see zbc_set_stripes).
+ */
+extern bool zbc_file_io(struct zbc_device *dev);
+
+/**
+ * @brief Aging flags
+ */
+enum zbc_age_flags {
+
+	/** Write pattern data in the written space of zones */
+	ZBC_AGE_PATTERN		= 0x01,
+
+};
+
+/**
+ * @brief Aging parameters
+ */
+struct zbc_age_params {
+
+	/** Percentage of full sequential zones */
+	unsigned int	zap_full_pct;
+
+	/** Percentage of partially written (closed) sequential zones */
+	unsigned int	zap_partial_pct;
+
+	/** Number of partially written zones to explicitly open */
+	unsigned int	zap_nr_open;
+
+	/** Seed of the zone selection and write pointer positions */
+	unsigned int	zap_seed;
+
+	/** Aging flags (enum zbc_age_flags) */
+	unsigned int	zap_flags;
+
+};
+
+/**
+ * zbc_age_zones - Make an emulated device look aged
+ * @dev:	(IN) ZBC device handle of the device to age
+ * @params:	(IN) Fill distribution of the sequential zones
+ *
+ * Description:
+ * This function only affects devices operating with the emulation (fake)
+ * backend driver. All sequential zones are set to be either full,
+ * partially written or empty according to the percentages of @params,
+ * with zones and write pointer positions chosen randomly, and all write
+ * pointers are changed with a single metadata update. The written space
+ * of zones is left sparse (holes are punched in the backing file) unless
+ * the ZBC_AGE_PATTERN flag is set, in which case each written sector is
+ * filled with its sector number, using parallel writes.
+ */
+extern int zbc_age_zones(struct zbc_device *dev,
+			 struct zbc_age_params *params);
+
+/**
+ * zbc_scsi_rw_cdb_flags - Get the cache bits of SCSI read and write CDBs
+ * @hints:	(IN) I/O hints
+ *
+ * Description:
+ * Return byte 1 of the READ 16 and WRITE 16 CDBs issued by the SCSI
+ * backend driver for an I/O with the hints @hints, that is, the DPO bit
+ * (0x10), always set, and the FUA bit (0x08).
+ */
+extern uint8_t zbc_scsi_rw_cdb_flags(const struct zbc_io_hints *hints);
+
 #endif /* _LIBZBC_PRIVATE_H_ */
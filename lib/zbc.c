@@ -17,6 +17,20 @@
 #include "zbc.h"
 
 #include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#define zbc_trace_open_phase(f, n, r, ns)	\
+	DTRACE_PROBE4(libzbc, open_phase, f, n, r, ns)
+#define zbc_trace_open_drv(f, n, r, ns)	\
+	DTRACE_PROBE4(libzbc, open_drv, f, n, r, ns)
+#else
+#define zbc_trace_open_phase(f, n, r, ns)	do { } while (0)
+#define zbc_trace_open_drv(f, n, r, ns)		do { } while (0)
+#endif
 
 /*
  * Log level.
@@ -28,6 +42,7 @@ int zbc_log_level = ZBC_LOG_WARNING;
  */
 static struct zbc_drv *zbc_drv[] = {
 	&zbc_block_drv,
+	&zbc_zonefs_drv,
 	&zbc_scsi_drv,
 	&zbc_ata_drv,
 	&zbc_fake_drv,
@@ -98,6 +113,11 @@ static struct zbc_sg_asc_ascq_s {
  */
 __thread struct zbc_errno zerrno;
 
+/**
+ * Per-thread I/O hints.
+ */
+__thread struct zbc_io_hints zhints;
+
 /**
  * zbc_set_log_level - Set the library log level
  */
@@ -138,6 +158,8 @@ const char *zbc_device_type_str(enum zbc_dev_type type)
 		return "ATA ZAC device";
 	case ZBC_DT_FAKE:
 		return "Emulated zoned block device";
+	case ZBC_DT_ZONEFS:
+		return "zonefs file system";
 	case ZBC_DT_UNKNOWN:
 	default:
 		return "Unknown-device-type";
@@ -257,6 +279,149 @@ const char *zbc_asc_ascq_str(enum zbc_asc_ascq asc_ascq)
 	return asc_buf;
 }
 
+/*
+ * Trace of the last device open of the calling thread, driver being
+ * tried and reason for that driver to reject the device.
+ */
+static __thread struct zbc_open_trace zbc_otrace;
+static __thread uint32_t zbc_otrace_drv;
+static __thread char zbc_otrace_reason[ZBC_OPEN_NAME_LEN];
+
+/**
+ * Get a backend driver name.
+ */
+static const char *zbc_drv_name(struct zbc_drv *drv)
+{
+	switch (drv->flag) {
+	case ZBC_O_DRV_BLOCK:
+		return "block";
+	case ZBC_O_DRV_SCSI:
+		return "scsi";
+	case ZBC_O_DRV_ATA:
+		return "ata";
+	case ZBC_O_DRV_FAKE:
+		return "fake";
+	case ZBC_O_DRV_ZONEFS:
+		return "zonefs";
+	default:
+		return "unknown";
+	}
+}
+
+/**
+ * Record an open phase.
+ */
+void zbc_open_phase(const char *filename, const char *name,
+		    unsigned long long start, int ret)
+{
+	struct zbc_open_trace *t = &zbc_otrace;
+	unsigned long long ns = zbc_time_ns() - start;
+	struct zbc_open_phase *p;
+
+	zbc_debug("%s: Open phase \"%s\" %d, %llu us\n",
+		  filename, name, ret, ns / 1000);
+	zbc_trace_open_phase(filename, name, ret, ns);
+
+	if (ret && !zbc_otrace_reason[0])
+		snprintf(zbc_otrace_reason, ZBC_OPEN_NAME_LEN, "%s: %s",
+			 name, strerror(-ret));
+
+	if (t->zot_nr_phases >= ZBC_OPEN_MAX_PHASES)
+		return;
+
+	p = &t->zot_phases[t->zot_nr_phases++];
+	strncpy(p->zop_name, name, ZBC_OPEN_NAME_LEN - 1);
+	p->zop_drv = zbc_otrace_drv;
+	p->zop_ret = ret;
+	p->zop_ns = ns;
+}
+
+/**
+ * Record the reason for a driver to reject a device.
+ */
+void zbc_open_reject(const char *filename, const char *reason)
+{
+	zbc_debug("%s: %s\n", filename, reason);
+
+	if (!zbc_otrace_reason[0])
+		strncpy(zbc_otrace_reason, reason, ZBC_OPEN_NAME_LEN - 1);
+}
+
+/**
+ * Start tracing a device open.
+ */
+static unsigned long long zbc_open_trace_start(const char *filename)
+{
+	memset(&zbc_otrace, 0, sizeof(struct zbc_open_trace));
+	strncpy(zbc_otrace.zot_filename, filename, ZBC_OPEN_PATH_LEN - 1);
+
+	return zbc_time_ns();
+}
+
+/**
+ * Try to open a device with a backend driver, tracing the attempt.
+ */
+static int zbc_open_drv(struct zbc_drv *drv, const char *filename,
+			int flags, struct zbc_device **pdev)
+{
+	struct zbc_open_trace *t = &zbc_otrace;
+	unsigned long long start;
+	struct zbc_open_drv *d;
+	int ret;
+
+	zbc_otrace_drv = drv->flag;
+	zbc_otrace_reason[0] = '\0';
+
+	start = zbc_time_ns();
+	ret = drv->zbd_open(filename, flags, pdev);
+	if (ret && !zbc_otrace_reason[0])
+		strncpy(zbc_otrace_reason,
+			ret == -ENXIO ? "not handled" : strerror(-ret),
+			ZBC_OPEN_NAME_LEN - 1);
+
+	zbc_trace_open_drv(filename, zbc_drv_name(drv), ret,
+			   zbc_time_ns() - start);
+
+	if (t->zot_nr_drvs < ZBC_OPEN_MAX_DRVS) {
+		d = &t->zot_drvs[t->zot_nr_drvs++];
+		strncpy(d->zod_name, zbc_drv_name(drv), sizeof(d->zod_name) - 1);
+		d->zod_drv = drv->flag;
+		d->zod_ret = ret;
+		d->zod_ns = zbc_time_ns() - start;
+		if (ret)
+			memcpy(d->zod_reason, zbc_otrace_reason,
+			       ZBC_OPEN_NAME_LEN);
+	}
+
+	zbc_otrace_drv = 0;
+
+	return ret;
+}
+
+/**
+ * End tracing a device open.
+ */
+static int zbc_open_trace_end(const char *filename,
+			      unsigned long long start, int ret)
+{
+	zbc_otrace.zot_ret = ret;
+	zbc_otrace.zot_ns = zbc_time_ns() - start;
+
+	zbc_debug("%s: Open %d, %llu us\n",
+		  filename, ret,
+		  (unsigned long long)zbc_otrace.zot_ns / 1000);
+
+	return ret;
+}
+
+/**
+ * zbc_get_open_trace - Get the trace of the last device open
+ */
+void zbc_get_open_trace(struct zbc_open_trace *trace)
+{
+	memcpy(trace, &zbc_otrace, sizeof(struct zbc_open_trace));
+}
+
 /**
  * zbc_device_is_zoned - Test if a physical device is zoned.
  */
@@ -265,18 +430,25 @@ int zbc_device_is_zoned(const char *filename,
 			struct zbc_device_info *info)
 {
 	struct zbc_device *dev = NULL;
+	unsigned long long start;
 	int ret = -ENODEV, i;
 
+	start = zbc_open_trace_start(filename);
+
+	zbc_alloc_get();
+
 	/* Test all backends until one accepts the drive. */
 	for (i = 0; zbc_drv[i]; i++) {
-		ret = zbc_drv[i]->zbd_open(filename, O_RDONLY, &dev);
+		ret = zbc_open_drv(zbc_drv[i], filename, O_RDONLY, &dev);
 		if (ret == 0) {
 			/* This backend accepted the device */
 			dev->zbd_drv = zbc_drv[i];
 			break;
 		}
-		if (ret != -ENXIO)
-			return ret;
+		if (ret != -ENXIO) {
+			zbc_alloc_put();
+			return zbc_open_trace_end(filename, start, ret);
+		}
 	}
 
 	if (dev && dev->zbd_drv) {
@@ -294,7 +466,9 @@ int zbc_device_is_zoned(const char *filename,
 			ret = 0;
 	}
 
-	return ret;
+	zbc_alloc_put();
+
+	return zbc_open_trace_end(filename, start, ret);
 }
 
 /**
@@ -304,8 +478,11 @@ int zbc_open(const char *filename, int flags, struct zbc_device **pdev)
 {
 	struct zbc_device *dev = NULL;
 	unsigned int allowed_drv;
+	unsigned long long start;
 	int ret, i;
 
+	start = zbc_open_trace_start(filename);
+
 	allowed_drv = flags & ZBC_O_DRV_MASK;
 	if (!allowed_drv)
 		allowed_drv = ZBC_O_DRV_MASK;
@@ -313,28 +490,56 @@ int zbc_open(const char *filename, int flags, struct zbc_device **pdev)
 	allowed_drv &= ~ZBC_O_DRV_BLOCK;
 #endif
 
+	/* The allocator cannot change once the handle allocates memory */
+	zbc_alloc_get();
+
 	/* Test all backends until one accepts the drive */
+	ret = -ENODEV;
 	for (i = 0; zbc_drv[i] != NULL; i++) {
 
 		if (!(zbc_drv[i]->flag & allowed_drv))
 			continue;
 
-		ret = zbc_drv[i]->zbd_open(filename, flags, &dev);
+		ret = zbc_open_drv(zbc_drv[i], filename, flags, &dev);
 		switch (ret) {
 		case 0:
 			/* This backend accepted the drive */
 			dev->zbd_drv = zbc_drv[i];
+			ret = zbc_stats_init(dev);
+			if (ret) {
+				dev->zbd_drv->zbd_close(dev);
+				goto out;
+			}
+			ret = zbc_arena_init(dev);
+			if (ret) {
+				zbc_stats_exit(dev);
+				dev->zbd_drv->zbd_close(dev);
+				goto out;
+			}
+			if (flags & ZBC_O_LAZY_ZONES) {
+				ret = zbc_ztab_init(dev, flags);
+				if (ret) {
+					zbc_arena_exit(dev);
+					zbc_stats_exit(dev);
+					dev->zbd_drv->zbd_close(dev);
+					goto out;
+				}
+			}
 			*pdev = dev;
-			return 0;
+			return zbc_open_trace_end(filename, start, 0);
 		case -ENXIO:
+			ret = -ENODEV;
 			continue;
 		default:
-			return ret;
+			goto out;
 		}
 
 	}
 
-	return -ENODEV;
+out:
+	zbc_alloc_put();
+
+	return zbc_open_trace_end(filename, start, ret);
 }
 
 /**
@@ -342,7 +547,19 @@ int zbc_open(const char *filename, int flags, struct zbc_device **pdev)
  */
 int zbc_close(struct zbc_device *dev)
 {
-	return dev->zbd_drv->zbd_close(dev);
+	int ret;
+
+	zbc_ztab_exit(dev);
+	zbc_slow_exit(dev);
+	zbc_qd_exit(dev);
+	zbc_stats_exit(dev);
+	zbc_arena_exit(dev);
+
+	ret = dev->zbd_drv->zbd_close(dev);
+	if (ret == 0)
+		zbc_alloc_put();
+
+	return ret;
 }
 
 /**
@@ -440,24 +657,35 @@ int zbc_report_zones(struct zbc_device *dev, uint64_t sector,
 		     struct zbc_zone *zones, unsigned int *nr_zones)
 {
         unsigned int n, nz = 0;
+	uint64_t start_sector = sector;
+	unsigned long long start;
 	uint64_t last_sector;
 	int ret;
 
 	if (!zones) {
 		/* Get the number of zones */
 		*nr_zones = 0;
-		return (dev->zbd_drv->zbd_report_zones)(dev, sector,
-							zbc_ro_mask(ro),
-							NULL, nr_zones);
+		start = zbc_time_ns();
+		ret = (dev->zbd_drv->zbd_report_zones)(dev, sector,
+						       zbc_ro_mask(ro),
+						       NULL, nr_zones);
+		zbc_stats_account(dev, ZBC_STAT_REPORT_ZONES, start, 0, ret);
+		return ret;
 	}
 
+	/* Zone table of a device opened with ZBC_O_LAZY_ZONES */
+	if (dev->zbd_ztab && zbc_ro_mask(ro) == ZBC_RO_ALL)
+		return zbc_ztab_report_zones(dev, sector, zones, nr_zones);
+
         /* Get zones information */
         while (nz < *nr_zones) {
 
 		n = *nr_zones - nz;
+		start = zbc_time_ns();
 		ret = (dev->zbd_drv->zbd_report_zones)(dev, sector,
 					zbc_ro_mask(ro) | ZBC_RO_PARTIAL,
 					&zones[nz], &n);
+		zbc_stats_account(dev, ZBC_STAT_REPORT_ZONES, start, 0, ret);
 		if (ret != 0) {
 			zbc_error("%s: Get zones from sector %llu failed %d (%s)\n",
 				  dev->zbd_filename,
@@ -482,6 +710,12 @@ int zbc_report_zones(struct zbc_device *dev, uint64_t sector,
 
 	*nr_zones = nz;
 
+	/* Take a zone condition snapshot if all zones were reported */
+	if (start_sector == 0 && zbc_ro_mask(ro) == ZBC_RO_ALL && nz &&
+	    zones[nz - 1].zbz_start + zones[nz - 1].zbz_length >=
+	    dev->zbd_info.zbd_sectors)
+		zbc_stats_zones(dev, zones, nz);
+
 	return 0;
 }
 
@@ -506,7 +740,7 @@ int zbc_list_zones(struct zbc_device *dev, uint64_t sector,
 		  nr_zones);
 
 	/* Allocate zone array */
-	zones = (struct zbc_zone *) calloc(nr_zones, sizeof(struct zbc_zone));
+	zones = (struct zbc_zone *) zbc_calloc(nr_zones, sizeof(struct zbc_zone));
 	if (!zones)
 		return -ENOMEM;
 
@@ -515,7 +749,7 @@ int zbc_list_zones(struct zbc_device *dev, uint64_t sector,
 	if (ret != 0) {
 		zbc_error("%s: zbc_report_zones failed %d\n",
 			  dev->zbd_filename, ret);
-		free(zones);
+		zbc_free(zones);
 		return ret;
 	}
 
@@ -525,12 +759,44 @@ int zbc_list_zones(struct zbc_device *dev, uint64_t sector,
 	return 0;
 }
 
+/**
+ * zbc_get_zone - Get the information of a zone
+ */
+int zbc_get_zone(struct zbc_device *dev, uint64_t sector,
+		 struct zbc_zone *zone)
+{
+	unsigned int nr_zones = 1;
+	int ret;
+
+	if (sector >= dev->zbd_info.zbd_sectors)
+		return -EINVAL;
+
+	if (dev->zbd_ztab)
+		return zbc_ztab_get_zone(dev, sector, zone);
+
+	ret = zbc_report_zones(dev, sector, ZBC_RO_ALL, zone, &nr_zones);
+	if (ret)
+		return ret;
+	if (!nr_zones)
+		return -EINVAL;
+
+	return 0;
+}
+
 /**
  * zbc_zone_operation - Execute an operation on a zone
  */
 int zbc_zone_operation(struct zbc_device *dev, uint64_t sector,
 		       enum zbc_zone_op op, unsigned int flags)
 {
+	static const enum zbc_stat_class op_class[] = {
+		[ZBC_OP_RESET_ZONE]	= ZBC_STAT_RESET_ZONE,
+		[ZBC_OP_OPEN_ZONE]	= ZBC_STAT_OPEN_ZONE,
+		[ZBC_OP_CLOSE_ZONE]	= ZBC_STAT_CLOSE_ZONE,
+		[ZBC_OP_FINISH_ZONE]	= ZBC_STAT_FINISH_ZONE,
+	};
+	unsigned long long start;
+	int ret;
 
 	if (!zbc_test_mode(dev) &&
 	    (!(flags & ZBC_OP_ALL_ZONES)) &&
@@ -538,7 +804,68 @@ int zbc_zone_operation(struct zbc_device *dev, uint64_t sector,
 		return -EINVAL;
 
 	/* Execute the operation */
-	return (dev->zbd_drv->zbd_zone_op)(dev, sector, op, flags);
+	start = zbc_time_ns();
+	ret = (dev->zbd_drv->zbd_zone_op)(dev, sector, op, flags);
+	if (op >= ZBC_OP_RESET_ZONE && op <= ZBC_OP_FINISH_ZONE)
+		zbc_stats_account(dev, op_class[op], start, 0, ret);
+	if (dev->zbd_ztab)
+		zbc_ztab_zone_op(dev, sector, 0, op, flags, ret);
+
+	return ret;
+}
+
+/**
+ * zbc_zone_op_range - Execute an operation on contiguous zones
+ *
+ * The zones array must describe adjacent sequential zones. If the backend
+ * driver can operate on a range of zones with a single command, use it.
+ * Otherwise, fallback to one operation per zone.
+ */
+int zbc_zone_op_range(struct zbc_device *dev, struct zbc_zone *zones,
+		      unsigned int nr_zones, enum zbc_zone_op op)
+{
+	static const enum zbc_stat_class op_class[] = {
+		[ZBC_OP_RESET_ZONE]	= ZBC_STAT_RESET_ZONE,
+		[ZBC_OP_OPEN_ZONE]	= ZBC_STAT_OPEN_ZONE,
+		[ZBC_OP_CLOSE_ZONE]	= ZBC_STAT_CLOSE_ZONE,
+		[ZBC_OP_FINISH_ZONE]	= ZBC_STAT_FINISH_ZONE,
+	};
+	uint64_t sector, nr_sectors = 0;
+	unsigned long long start;
+	unsigned int i;
+	int ret;
+
+	if (!nr_zones)
+		return 0;
+
+	sector = zbc_zone_start(&zones[0]);
+	for (i = 0; i < nr_zones; i++)
+		nr_sectors += zbc_zone_length(&zones[i]);
+
+	if (dev->zbd_drv->zbd_zone_op_range) {
+		start = zbc_time_ns();
+		ret = (dev->zbd_drv->zbd_zone_op_range)(dev, sector,
+							nr_sectors, op);
+		if (ret != -ENOTSUP) {
+			if (op >= ZBC_OP_RESET_ZONE &&
+			    op <= ZBC_OP_FINISH_ZONE)
+				zbc_stats_account(dev, op_class[op], start,
+						  0, ret);
+			if (dev->zbd_ztab)
+				zbc_ztab_zone_op(dev, sector, nr_sectors, op,
+						 0, ret);
+			return ret;
+		}
+	}
+
+	for (i = 0; i < nr_zones; i++) {
+		ret = zbc_zone_operation(dev, zbc_zone_start(&zones[i]),
+					 op, 0);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
 }
 
 /**
@@ -549,6 +876,7 @@ ssize_t zbc_pread(struct zbc_device *dev, void *buf,
 {
 	size_t max_count = dev->zbd_info.zbd_max_rw_sectors;
 	size_t sz, rd_count = 0;
+	unsigned long long start;
 	ssize_t ret;
 
 	if (zbc_test_mode(dev)) {
@@ -595,7 +923,14 @@ ssize_t zbc_pread(struct zbc_device *dev, void *buf,
 		else
 			sz = count;
 
+		start = dev->zbd_qd ? zbc_qd_get(dev) : zbc_time_ns();
 		ret = (dev->zbd_drv->zbd_pread)(dev, buf, sz, offset);
+		zbc_stats_account(dev, ZBC_STAT_READ, start,
+				  ret > 0 ? ret : 0, ret <= 0);
+		if (dev->zbd_qd)
+			zbc_qd_put(dev, start, ret > 0 ? ret : 0);
+		if (dev->zbd_slow && ret > 0)
+			zbc_slow_account(dev, ZBC_STAT_READ, offset, ret, start);
 		if (ret <= 0) {
 			zbc_error("%s: Read %zu sectors at sector %llu failed %zd (%s)\n",
 				  dev->zbd_filename,
@@ -622,6 +957,7 @@ ssize_t zbc_pwrite(struct zbc_device *dev, const void *buf,
 {
 	size_t max_count = dev->zbd_info.zbd_max_rw_sectors;
 	size_t sz, wr_count = 0;
+	unsigned long long start;
 	ssize_t ret;
 
 	if (zbc_test_mode(dev)) {
@@ -668,7 +1004,18 @@ ssize_t zbc_pwrite(struct zbc_device *dev, const void *buf,
 		else
 			sz = count;
 
+		start = dev->zbd_qd ? zbc_qd_get(dev) : zbc_time_ns();
 		ret = (dev->zbd_drv->zbd_pwrite)(dev, buf, sz, offset);
+		zbc_stats_account(dev, ZBC_STAT_WRITE, start,
+				  ret > 0 ? ret : 0, ret <= 0);
+		if (dev->zbd_qd)
+			zbc_qd_put(dev, start, ret > 0 ? ret : 0);
+		if (dev->zbd_slow && ret > 0)
+			zbc_slow_account(dev, ZBC_STAT_WRITE, offset, ret,
+					 start);
+		if (dev->zbd_ztab)
+			zbc_ztab_write(dev, offset, ret > 0 ? (size_t)ret : sz,
+				       ret <= 0);
 		if (ret <= 0) {
 			zbc_error("%s: Write %zu sectors at sector %llu failed %zd (%s)\n",
 				  dev->zbd_filename,
@@ -687,12 +1034,195 @@ ssize_t zbc_pwrite(struct zbc_device *dev, const void *buf,
 	return wr_count;
 }
 
+/**
+ * I/O scheduling classes (see ioprio_set(2)).
+ */
+#define ZBC_IOPRIO_CLASS_SHIFT	13
+#define ZBC_IOPRIO_CLASS_RT	1
+#define ZBC_IOPRIO_CLASS_BE	2
+#define ZBC_IOPRIO_CLASS_IDLE	3
+#define ZBC_IOPRIO_WHO_PROCESS	1
+#define zbc_ioprio(c, d)	(((c) << ZBC_IOPRIO_CLASS_SHIFT) | (d))
+
+/**
+ * I/O priority of the calling thread, read with the first I/O with a
+ * priority hint (-1 if not known yet), and whether the thread can use the
+ * real-time class, which needs CAP_SYS_ADMIN.
+ */
+static __thread int zbc_ioprio_cur = -1;
+static __thread bool zbc_ioprio_no_rt;
+
+/**
+ * Set the I/O scheduling class of the calling thread for the current
+ * hints. Return the previous class to restore, or -1 if unchanged.
+ */
+static int zbc_ioprio_enter(void)
+{
+	int prio;
+
+	switch (zbc_hint_prio()) {
+	case ZBC_IO_PRIO_HIGH:
+		if (zbc_ioprio_no_rt)
+			prio = zbc_ioprio(ZBC_IOPRIO_CLASS_BE, 0);
+		else
+			prio = zbc_ioprio(ZBC_IOPRIO_CLASS_RT, 4);
+		break;
+	case ZBC_IO_PRIO_LOW:
+		prio = zbc_ioprio(ZBC_IOPRIO_CLASS_IDLE, 0);
+		break;
+	default:
+		return -1;
+	}
+
+	if (zbc_ioprio_cur < 0) {
+		zbc_ioprio_cur = syscall(SYS_ioprio_get,
+					 ZBC_IOPRIO_WHO_PROCESS, 0);
+		if (zbc_ioprio_cur < 0)
+			return -1;
+	}
+
+	if (prio == zbc_ioprio_cur)
+		return -1;
+
+	if (syscall(SYS_ioprio_set, ZBC_IOPRIO_WHO_PROCESS, 0, prio) < 0) {
+		if (zbc_hint_prio() != ZBC_IO_PRIO_HIGH || zbc_ioprio_no_rt)
+			return -1;
+		zbc_ioprio_no_rt = true;
+		prio = zbc_ioprio(ZBC_IOPRIO_CLASS_BE, 0);
+		if (prio == zbc_ioprio_cur ||
+		    syscall(SYS_ioprio_set, ZBC_IOPRIO_WHO_PROCESS, 0,
+			    prio) < 0)
+			return -1;
+	}
+
+	return zbc_ioprio_cur;
+}
+
+static void zbc_ioprio_exit(int old)
+{
+	if (old >= 0)
+		syscall(SYS_ioprio_set, ZBC_IOPRIO_WHO_PROCESS, 0, old);
+}
+
+static int zbc_check_hints(struct zbc_device *dev,
+			   const struct zbc_io_hints *hints)
+{
+	if (hints->zih_prio > ZBC_IO_PRIO_LOW ||
+	    hints->zih_flags & ~(ZBC_IO_DPO | ZBC_IO_FUA)) {
+		zbc_error("%s: Invalid I/O hints (prio %d, flags 0x%x)\n",
+			  dev->zbd_filename,
+			  hints->zih_prio, hints->zih_flags);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/**
+ * zbc_pread_hints - Read sectors form a device with hints
+ */
+ssize_t zbc_pread_hints(struct zbc_device *dev, void *buf,
+			size_t count, uint64_t offset,
+			const struct zbc_io_hints *hints)
+{
+	struct zbc_io_hints saved = zhints;
+	ssize_t ret;
+	int ioprio;
+
+	if (!hints)
+		return zbc_pread(dev, buf, count, offset);
+
+	ret = zbc_check_hints(dev, hints);
+	if (ret)
+		return ret;
+
+	zhints = *hints;
+	ioprio = zbc_ioprio_enter();
+	ret = zbc_pread(dev, buf, count, offset);
+	zbc_ioprio_exit(ioprio);
+	zhints = saved;
+
+	return ret;
+}
+
+/**
+ * zbc_pwrite_hints - Write sectors to a device with hints
+ */
+ssize_t zbc_pwrite_hints(struct zbc_device *dev, const void *buf,
+			 size_t count, uint64_t offset,
+			 const struct zbc_io_hints *hints)
+{
+	struct zbc_io_hints saved = zhints;
+	ssize_t ret;
+	int ioprio;
+
+	if (!hints)
+		return zbc_pwrite(dev, buf, count, offset);
+
+	ret = zbc_check_hints(dev, hints);
+	if (ret)
+		return ret;
+
+	zhints = *hints;
+	ioprio = zbc_ioprio_enter();
+	ret = zbc_pwrite(dev, buf, count, offset);
+	zbc_ioprio_exit(ioprio);
+	zhints = saved;
+
+	return ret;
+}
+
+/**
+ * Write to a file, with a per-I/O data sync if @fua is true.
+ */
+ssize_t zbc_file_pwritev(int fd, const struct iovec *iov, int iovcnt,
+			 off_t offset, bool fua)
+{
+	ssize_t ret;
+
+#ifdef RWF_DSYNC
+	if (fua) {
+		ret = pwritev2(fd, iov, iovcnt, offset, RWF_DSYNC);
+		if (ret >= 0 || errno != EOPNOTSUPP)
+			return ret;
+	}
+#endif
+
+	ret = pwritev(fd, iov, iovcnt, offset);
+	if (ret > 0 && fua && fdatasync(fd) < 0)
+		return -1;
+
+	return ret;
+}
+
+/**
+ * Write to a file, honoring the FUA hint.
+ */
+ssize_t zbc_file_pwrite(int fd, const void *buf, size_t count, off_t offset)
+{
+	struct iovec iov = {
+		.iov_base = (void *)buf,
+		.iov_len = count,
+	};
+
+	if (!zbc_hint_fua())
+		return pwrite(fd, buf, count, offset);
+
+	return zbc_file_pwritev(fd, &iov, 1, offset, true);
+}
+
 /**
  * zbc_flush - flush a device write cache
  */
 int zbc_flush(struct zbc_device *dev)
 {
-	return (dev->zbd_drv->zbd_flush)(dev);
+	unsigned long long start = zbc_time_ns();
+	int ret;
+
+	ret = (dev->zbd_drv->zbd_flush)(dev);
+	zbc_stats_account(dev, ZBC_STAT_FLUSH, start, 0, ret);
+
+	return ret;
 }
 
 /**
@@ -701,6 +1231,7 @@ int zbc_flush(struct zbc_device *dev)
 int zbc_set_zones(struct zbc_device *dev,
 		  uint64_t conv_sz, uint64_t zone_sz)
 {
+	int ret;
 
 	/* Do this only if supported */
 	if (!dev->zbd_drv->zbd_set_zones)
@@ -710,7 +1241,11 @@ int zbc_set_zones(struct zbc_device *dev,
 	    !zbc_dev_sect_paligned(dev, zone_sz))
 		return -EINVAL;
 
-	return (dev->zbd_drv->zbd_set_zones)(dev, conv_sz, zone_sz);
+	ret = (dev->zbd_drv->zbd_set_zones)(dev, conv_sz, zone_sz);
+	if (dev->zbd_ztab)
+		zbc_ztab_invalidate(dev);
+
+	return ret;
 }
 
 /**
@@ -719,6 +1254,7 @@ int zbc_set_zones(struct zbc_device *dev,
 int zbc_set_write_pointer(struct zbc_device *dev,
 			  uint64_t sector, uint64_t wp_sector)
 {
+	int ret;
 
 	/* Do this only if supported */
 	if (!dev->zbd_drv->zbd_set_wp)
@@ -728,6 +1264,66 @@ int zbc_set_write_pointer(struct zbc_device *dev,
 	    !zbc_dev_sect_paligned(dev, wp_sector))
 		return -EINVAL;
 
-	return (dev->zbd_drv->zbd_set_wp)(dev, sector, wp_sector);
+	ret = (dev->zbd_drv->zbd_set_wp)(dev, sector, wp_sector);
+	if (dev->zbd_ztab)
+		zbc_ztab_invalidate(dev);
+
+	return ret;
+}
+
+/**
+ * zbc_set_write_pointers - Change the write pointers of a range of zones
+ */
+int zbc_set_write_pointers(struct zbc_device *dev, uint64_t sector,
+			   unsigned int nr_zones, const uint64_t *wp_sectors)
+{
+	unsigned int i;
+	int ret;
+
+	/* Do this only if supported */
+	if (!dev->zbd_drv->zbd_set_wps)
+		return -ENXIO;
+
+	if (!zbc_dev_sect_paligned(dev, sector))
+		return -EINVAL;
+
+	for (i = 0; i < nr_zones; i++) {
+		if (!zbc_dev_sect_paligned(dev, wp_sectors[i]))
+			return -EINVAL;
+	}
+
+	ret = (dev->zbd_drv->zbd_set_wps)(dev, sector, nr_zones, wp_sectors);
+	if (dev->zbd_ztab)
+		zbc_ztab_invalidate(dev);
+
+	return ret;
+}
+
+/**
+ * zbc_set_stripes - Stripe the data of an emulated device
+ */
+int zbc_set_stripes(struct zbc_device *dev, size_t stripe_size,
+		    unsigned int nr_files, const char **files)
+{
+	int ret;
+
+	/* Do this only if supported */
+	if (!dev->zbd_drv->zbd_set_stripes)
+		return -ENXIO;
+
+	ret = (dev->zbd_drv->zbd_set_stripes)(dev, stripe_size,
+					      nr_files, files);
+	if (dev->zbd_ztab)
+		zbc_ztab_invalidate(dev);
+
+	return ret;
+}
+
+/**
+ * zbc_file_io - Test if the device data can be read with file I/Os
+ */
+bool zbc_file_io(struct zbc_device *dev)
+{
+	return zbc_dev_has_file_io(dev);
 }
 
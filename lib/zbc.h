@@ -19,11 +19,15 @@
 
 #include "config.h"
 #include "libzbc/zbc.h"
+#include "libzbc/zbc_exec.h"
 #include "zbc_private.h"
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
 #include <sys/ioctl.h>
+#include <sys/uio.h>
 #include <scsi/scsi.h>
 #include <scsi/sg.h>
 
@@ -91,6 +95,27 @@ struct zbc_drv {
 	int		(*zbd_set_wp)(struct zbc_device *,
 				      uint64_t, uint64_t);
 
+	/**
+	 * Change the write pointers of a range of zones in a single
+	 * metadata update. For emulated drives only (optional).
+	 */
+	int		(*zbd_set_wps)(struct zbc_device *, uint64_t,
+				       unsigned int, const uint64_t *);
+
+	/**
+	 * Change the backing files the data is striped across.
+	 * For emulated drives only (optional).
+	 */
+	int		(*zbd_set_stripes)(struct zbc_device *, size_t,
+					   unsigned int, const char **);
+
+	/**
+	 * Execute a zone operation on a range of contiguous
+	 * sequential zones with a single command (optional).
+	 */
+	int		(*zbd_zone_op_range)(struct zbc_device *, uint64_t,
+					     uint64_t, enum zbc_zone_op);
+
 };
 
 /**
@@ -134,6 +159,39 @@ struct zbc_device {
 	 */
 	unsigned int		zbd_drv_flags;
 
+	/**
+	 * Device statistics and path of the file exporting them
+	 * (NULL if the statistics are not exported).
+	 */
+	struct zbc_device_stats	*zbd_stats;
+	char			*zbd_stats_path;
+
+	/**
+	 * Adaptive queue depth controller (NULL if not enabled).
+	 */
+	struct zbc_qd		*zbd_qd;
+
+	/**
+	 * Slow region detector (NULL if not enabled).
+	 */
+	struct zbc_slow		*zbd_slow;
+
+	/**
+	 * Command buffers preallocated at open.
+	 */
+	struct zbc_arena	*zbd_arena;
+
+	/**
+	 * Zone table (NULL if not opened with ZBC_O_LAZY_ZONES).
+	 */
+	struct zbc_ztab		*zbd_ztab;
+
+	/**
+	 * Set if the device data is not stored linearly in zbd_fd
+	 * (emulated device striped across several backing files).
+	 */
+	bool			zbd_striped;
+
 };
 
 /**
@@ -148,6 +206,22 @@ static inline void zbc_set_errno(enum zbc_sk sk, enum zbc_asc_ascq asc_ascq)
 }
 #define zbc_clear_errno()	zbc_set_errno(0, 0)
 
+/**
+ * Per-thread hints of the read or write being executed.
+ */
+extern __thread struct zbc_io_hints zhints;
+
+#define zbc_hint_prio()		(zhints.zih_prio)
+#define zbc_hint_fua()		(zhints.zih_flags & ZBC_IO_FUA)
+
+/**
+ * pwrite(2) for file backed drivers, honoring the FUA hint, and
+ * pwritev(2) with an explicit FUA flag.
+ */
+ssize_t zbc_file_pwrite(int fd, const void *buf, size_t count, off_t offset);
+ssize_t zbc_file_pwritev(int fd, const struct iovec *iov, int iovcnt,
+			 off_t offset, bool fua);
+
 /**
  * Test if a device is zoned.
  */
@@ -160,8 +234,10 @@ static inline void zbc_set_errno(enum zbc_sk sk, enum zbc_asc_ascq asc_ascq)
  */
 #define ZBC_O_MODE_MASK		(O_RDONLY | O_WRONLY | O_RDWR)
 #define ZBC_O_DMODE_MASK	(ZBC_O_MODE_MASK | O_DIRECT)
+#define ZBC_O_ZONES_MASK	(ZBC_O_LAZY_ZONES | ZBC_O_ZONE_BGFILL)
 #define ZBC_O_DRV_MASK		(ZBC_O_DRV_BLOCK | ZBC_O_DRV_SCSI | \
-				 ZBC_O_DRV_ATA | ZBC_O_DRV_FAKE)
+				 ZBC_O_DRV_ATA | ZBC_O_DRV_FAKE | \
+				 ZBC_O_DRV_ZONEFS)
 
 /**
  * Test if a device is in test mode.
@@ -192,6 +268,11 @@ struct zbc_drv zbc_scsi_drv;
  */
 struct zbc_drv zbc_fake_drv;
 
+/**
+ * zonefs driver (zone files of a zonefs mount point).
+ */
+struct zbc_drv zbc_zonefs_drv;
+
 #define container_of(ptr, type, member) \
     ((type *)((char *)(ptr)-(unsigned long)(&((type *)0)->member)))
 
@@ -235,6 +316,174 @@ ssize_t zbc_scsi_pwrite(struct zbc_device *dev, const void *buf,
 			size_t count, uint64_t offset);
 int zbc_scsi_flush(struct zbc_device *dev);
 
+/**
+ * Execute a zone operation on contiguous zones (batched if the
+ * backend driver supports it).
+ */
+int zbc_zone_op_range(struct zbc_device *dev, struct zbc_zone *zones,
+		      unsigned int nr_zones, enum zbc_zone_op op);
+
+/**
+ * Monotonic time in nanoseconds.
+ */
+static inline unsigned long long zbc_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Device statistics.
+ */
+int zbc_stats_init(struct zbc_device *dev);
+void zbc_stats_exit(struct zbc_device *dev);
+void zbc_stats_account(struct zbc_device *dev, enum zbc_stat_class cls,
+		       unsigned long long start, size_t sectors, bool error);
+void zbc_stats_zones(struct zbc_device *dev,
+		     struct zbc_zone *zones, unsigned int nr_zones);
+
+/**
+ * Device open tracing: zbc_open_phase records the duration and result of
+ * an open phase of a backend driver started at @start (zbc_time_ns()).
+ * zbc_open_reject records the reason for a driver to reject a device.
+ */
+void zbc_open_phase(const char *filename, const char *name,
+		    unsigned long long start, int ret);
+void zbc_open_reject(const char *filename, const char *reason);
+
+/**
+ * Adaptive queue depth controller: zbc_qd_get waits for a command slot
+ * and returns the command start time, zbc_qd_put releases the slot.
+ */
+unsigned long long zbc_qd_get(struct zbc_device *dev);
+void zbc_qd_put(struct zbc_device *dev, unsigned long long start,
+		size_t sectors);
+void zbc_qd_exit(struct zbc_device *dev);
+
+/**
+ * Slow region detector: zbc_slow_account accounts a completed read or
+ * write command started at @start.
+ */
+void zbc_slow_account(struct zbc_device *dev, enum zbc_stat_class cls,
+		      uint64_t sector, size_t sectors,
+		      unsigned long long start);
+void zbc_slow_exit(struct zbc_device *dev);
+
+/**
+ * Memory allocation with the application allocator (see zbc_set_allocator).
+ */
+void *zbc_malloc(size_t size);
+void *zbc_calloc(size_t nmemb, size_t size);
+void *zbc_memalign(size_t align, size_t size);
+void *zbc_realloc(void *ptr, size_t old_size, size_t size);
+char *zbc_strdup(const char *str);
+
+/**
+ * Allocator users: the allocator cannot be changed while a device
+ * handle is open or being opened.
+ */
+void zbc_alloc_get(void);
+void zbc_alloc_put(void);
+
+/**
+ * Per-handle arena of page aligned command buffers, used so that the
+ * I/O, flush, single zone operation and bounded report paths do not
+ * allocate memory. zbc_arena_get falls back to zbc_memalign if the
+ * request is larger than ZBC_ARENA_BUFSZ or if all buffers are in use.
+ */
+#define ZBC_ARENA_NR_BUFS	4
+#define ZBC_ARENA_BUFSZ		(68 * 1024)
+
+int zbc_arena_init(struct zbc_device *dev);
+void zbc_arena_exit(struct zbc_device *dev);
+void *zbc_arena_get(struct zbc_device *dev, size_t size);
+void zbc_arena_put(struct zbc_device *dev, void *buf);
+
+/**
+ * Executor task. The library can embed tasks in its own memory to run
+ * jobs with zbc_exec_run_all without allocating memory.
+ */
+struct zbc_exec_task {
+	struct zbc_exec_task	*next;
+	zbc_exec_fn		fn;
+	void			*arg;
+	enum zbc_exec_prio	prio;
+	bool			detached;
+	bool			embedded;
+	int			cancel;
+	int			state;
+};
+
+/**
+ * Run @nr_jobs jobs of @job_size bytes each in parallel with @fn, using
+ * the caller task slots @tasks (one per job).
+ */
+void zbc_exec_run_all(struct zbc_device *dev, enum zbc_exec_prio prio,
+		      zbc_exec_fn fn, void *jobs, size_t job_size,
+		      struct zbc_exec_task *tasks, unsigned int nr_jobs);
+
+/**
+ * Zone table of a device opened with ZBC_O_LAZY_ZONES: chunks of the table
+ * are filled with a report the first time they are accessed and kept up to
+ * date by the writes and zone operations executed with the device handle.
+ */
+int zbc_ztab_init(struct zbc_device *dev, int flags);
+void zbc_ztab_exit(struct zbc_device *dev);
+int zbc_ztab_get_zone(struct zbc_device *dev, uint64_t sector,
+		      struct zbc_zone *zone);
+int zbc_ztab_report_zones(struct zbc_device *dev, uint64_t sector,
+			  struct zbc_zone *zones, unsigned int *nr_zones);
+void zbc_ztab_write(struct zbc_device *dev, uint64_t sector, size_t count,
+		    bool error);
+void zbc_ztab_zone_op(struct zbc_device *dev, uint64_t sector,
+		      uint64_t count, enum zbc_zone_op op, unsigned int flags,
+		      bool error);
+void zbc_ztab_invalidate(struct zbc_device *dev);
+
+/**
+ * CRC32C of a buffer (crc is 0 or the CRC of the preceding data).
+ */
+uint32_t zbc_crc32c(uint32_t crc, const void *buf, size_t len);
+
+/**
+ * SHA-256 digest (32 bytes) of a buffer.
+ */
+#define ZBC_SHA256_LEN	32
+void zbc_sha256(const void *buf, size_t len, uint8_t *digest);
+
+/**
+ * Test if the device data can be accessed directly with file I/Os on
+ * the device file descriptor (block and emulation drivers).
+ */
+#define zbc_dev_has_file_io(dev)	\
+	(((dev)->zbd_drv->flag & (ZBC_O_DRV_BLOCK | ZBC_O_DRV_FAKE)) && \
+	 !(dev)->zbd_striped)
+
+/**
+ * Pool of the sequential zones of a range of sectors of a device, used by
+ * the storage modules built on top of the zone API to allocate empty zones
+ * and to recycle reset zones. The zone array is the result of a zone report
+ * at initialization and is maintained by the pool users.
+ */
+struct zbc_zpool {
+	struct zbc_device	*zp_dev;
+	struct zbc_zone		*zp_zones;
+	unsigned int		zp_nr_zones;
+	unsigned int		*zp_free;
+	unsigned int		zp_nr_free;
+	pthread_mutex_t		zp_lock;
+};
+
+int zbc_zpool_init(struct zbc_zpool *zp, struct zbc_device *dev,
+		   uint64_t sector, uint64_t nr_sectors);
+void zbc_zpool_destroy(struct zbc_zpool *zp);
+struct zbc_zone *zbc_zpool_get(struct zbc_zpool *zp);
+int zbc_zpool_put(struct zbc_zpool *zp, struct zbc_zone *zone);
+struct zbc_zone *zbc_zpool_lookup(struct zbc_zpool *zp, uint64_t sector);
+
 /**
  * Log levels.
  */
@@ -0,0 +1,275 @@
+/*
+ * This file is part of libzbc.
+ *
+ * Copyright (C) 2009-2014, HGST, Inc. All rights reserved.
+ * Copyright (C) 2016, Western Digital. All rights reserved.
+ *
+ * This software is distributed under the terms of the BSD 2-clause license,
+ * "as is," without technical support, and WITHOUT ANY WARRANTY, without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE. You should have received a copy of the BSD 2-clause license along
+ * with libzbc. If not, see  <http://opensource.org/licenses/BSD-2-Clause>.
+ *
+ * Author: Damien Le Moal (damien.lemoal@wdc.com)
+ */
+
+#include "zbc.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <linux/falloc.h>
+
+/**
+ * Maximum number of parallel pattern writers and size of their buffer.
+ */
+#define ZBC_AGE_NR_JOBS		16
+#define ZBC_AGE_BUFSZ		(1024 * 1024)
+
+/**
+ * Pattern writer: writes the zones first, first + stride, ...
+ */
+struct zbc_age_job {
+	struct zbc_device	*dev;
+	struct zbc_zone		*zones;
+	const uint64_t		*wps;
+	unsigned int		nr_zones;
+	unsigned int		first;
+	unsigned int		stride;
+	int			ret;
+};
+
+/**
+ * Pseudo random number generator (xorshift).
+ */
+static uint32_t zbc_age_rand(uint32_t *state)
+{
+	uint32_t x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+
+	return x;
+}
+
+/**
+ * Fill a buffer with the pattern of the sectors starting at @sector:
+ * each sector is filled with its number.
+ */
+static void zbc_age_fill(uint64_t *buf, uint64_t sector, size_t count)
+{
+	size_t i, j;
+
+	for (i = 0; i < count; i++, sector++)
+		for (j = 0; j < 512 / sizeof(uint64_t); j++)
+			*buf++ = sector;
+}
+
+static void zbc_age_write_job(struct zbc_age_job *job)
+{
+	struct zbc_device *dev = job->dev;
+	uint64_t sector, end;
+	size_t count;
+	ssize_t ret;
+	void *buf;
+	unsigned int i;
+
+	buf = zbc_memalign(sysconf(_SC_PAGESIZE), ZBC_AGE_BUFSZ);
+	if (!buf) {
+		job->ret = -ENOMEM;
+		return;
+	}
+
+	for (i = job->first; i < job->nr_zones; i += job->stride) {
+		if (zbc_zone_conventional(&job->zones[i]))
+			continue;
+		sector = zbc_zone_start(&job->zones[i]);
+		end = job->wps[i];
+		while (sector < end) {
+			count = end - sector;
+			if (count > ZBC_AGE_BUFSZ >> 9)
+				count = ZBC_AGE_BUFSZ >> 9;
+			zbc_age_fill(buf, sector, count);
+			ret = pwrite(dev->zbd_fd, buf, count << 9, sector << 9);
+			if (ret <= 0) {
+				job->ret = ret < 0 ? -errno : -EIO;
+				zbc_error("%s: Write pattern at sector %llu failed %d (%s)\n",
+					  dev->zbd_filename,
+					  (unsigned long long)sector,
+					  -job->ret, strerror(-job->ret));
+				goto out;
+			}
+			sector += ret >> 9;
+		}
+	}
+
+out:
+	zbc_free(buf);
+}
+
+static void zbc_age_write_task(struct zbc_exec_task *task, void *arg)
+{
+	zbc_age_write_job(arg);
+}
+
+/**
+ * Write the pattern data of the written space of zones in parallel.
+ */
+static int zbc_age_write_pattern(struct zbc_device *dev,
+				 struct zbc_zone *zones, const uint64_t *wps,
+				 unsigned int nr_zones, unsigned int nr_written)
+{
+	struct zbc_age_job jobs[ZBC_AGE_NR_JOBS];
+	struct zbc_exec_task tasks[ZBC_AGE_NR_JOBS];
+	unsigned int i, nr_jobs = ZBC_AGE_NR_JOBS;
+	int ret = 0;
+
+	if (nr_jobs > nr_written)
+		nr_jobs = nr_written;
+
+	memset(jobs, 0, sizeof(jobs));
+	for (i = 0; i < nr_jobs; i++) {
+		jobs[i].dev = dev;
+		jobs[i].zones = zones;
+		jobs[i].wps = wps;
+		jobs[i].nr_zones = nr_zones;
+		jobs[i].first = i;
+		jobs[i].stride = nr_jobs;
+	}
+
+	zbc_exec_run_all(dev, ZBC_EXEC_PRIO_LOW, zbc_age_write_task,
+			 jobs, sizeof(struct zbc_age_job), tasks, nr_jobs);
+
+	for (i = 0; i < nr_jobs; i++) {
+		if (jobs[i].ret && !ret)
+			ret = jobs[i].ret;
+	}
+
+	return ret;
+}
+
+/**
+ * Drop the data of the sequential zones of the backing file.
+ */
+static void zbc_age_punch(struct zbc_device *dev,
+			  struct zbc_zone *zones, unsigned int nr_zones)
+{
+	unsigned int i;
+
+	for (i = 0; i < nr_zones; i++) {
+		if (zbc_zone_conventional(&zones[i]))
+			continue;
+		if (fallocate(dev->zbd_fd,
+			      FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+			      zbc_zone_start(&zones[i]) << 9,
+			      zbc_zone_length(&zones[i]) << 9) < 0) {
+			if (errno != EOPNOTSUPP)
+				zbc_warning("%s: Punch hole failed %d (%s)\n",
+					    dev->zbd_filename,
+					    errno, strerror(errno));
+			return;
+		}
+	}
+}
+
+/**
+ * zbc_age_zones - Make an emulated device look aged
+ */
+int zbc_age_zones(struct zbc_device *dev, struct zbc_age_params *params)
+{
+	uint64_t pbs = dev->zbd_info.zbd_pblock_size >> 9;
+	unsigned int i, j, tmp, nr_zones, nr_seq = 0, nr_full, nr_partial;
+	unsigned int nr_open, max_open;
+	struct zbc_zone *zones = NULL, *z;
+	unsigned int *seq = NULL;
+	uint64_t *wps = NULL;
+	uint64_t nr_pblocks;
+	uint32_t state;
+	int ret;
+
+	if (!params ||
+	    params->zap_full_pct > 100 || params->zap_partial_pct > 100 ||
+	    params->zap_full_pct + params->zap_partial_pct > 100)
+		return -EINVAL;
+
+	if (!dev->zbd_drv->zbd_set_wps)
+		return -ENXIO;
+
+	ret = zbc_list_zones(dev, 0, ZBC_RO_ALL, &zones, &nr_zones);
+	if (ret)
+		return ret;
+
+	seq = zbc_calloc(nr_zones, sizeof(unsigned int));
+	wps = zbc_calloc(nr_zones, sizeof(uint64_t));
+	if (!seq || !wps) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < nr_zones; i++) {
+		wps[i] = zbc_zone_start(&zones[i]);
+		if (!zbc_zone_conventional(&zones[i]))
+			seq[nr_seq++] = i;
+	}
+
+	/* Scatter full and partial zones over the device (Fisher-Yates) */
+	state = params->zap_seed ? params->zap_seed : 0x9e3779b9;
+	for (i = nr_seq; i > 1; i--) {
+		j = zbc_age_rand(&state) % i;
+		tmp = seq[i - 1];
+		seq[i - 1] = seq[j];
+		seq[j] = tmp;
+	}
+
+	nr_full = (uint64_t)nr_seq * params->zap_full_pct / 100;
+	nr_partial = (uint64_t)nr_seq * params->zap_partial_pct / 100;
+
+	for (i = 0; i < nr_full; i++) {
+		z = &zones[seq[i]];
+		wps[seq[i]] = zbc_zone_start(z) + zbc_zone_length(z);
+	}
+
+	for (i = nr_full; i < nr_full + nr_partial; i++) {
+		z = &zones[seq[i]];
+		nr_pblocks = zbc_zone_length(z) / pbs;
+		if (nr_pblocks < 2)
+			continue;
+		wps[seq[i]] = zbc_zone_start(z) +
+			(1 + zbc_age_rand(&state) % (nr_pblocks - 1)) * pbs;
+	}
+
+	ret = zbc_set_write_pointers(dev, zbc_zone_start(&zones[0]),
+				     nr_zones, wps);
+	if (ret)
+		goto out;
+
+	/* Explicitly open some of the partially written zones */
+	nr_open = params->zap_nr_open;
+	if (nr_open > nr_partial)
+		nr_open = nr_partial;
+	max_open = dev->zbd_info.zbd_max_nr_open_seq_req;
+	if (max_open != ZBC_NO_LIMIT && nr_open > max_open)
+		nr_open = max_open;
+	for (i = nr_full; i < nr_full + nr_open; i++) {
+		ret = zbc_open_zone(dev, zbc_zone_start(&zones[seq[i]]), 0);
+		if (ret)
+			goto out;
+	}
+
+	if (!zbc_dev_has_file_io(dev))
+		goto out;
+
+	zbc_age_punch(dev, zones, nr_zones);
+	if ((params->zap_flags & ZBC_AGE_PATTERN) && nr_full + nr_partial)
+		ret = zbc_age_write_pattern(dev, zones, wps, nr_zones,
+					    nr_full + nr_partial);
+
+out:
+	zbc_free(wps);
+	zbc_free(seq);
+	zbc_free(zones);
+
+	return ret;
+}
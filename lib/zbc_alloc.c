@@ -0,0 +1,260 @@
+/*
+ * This file is part of libzbc.
+ *
+ * Copyright (C) 2009-2014, HGST, Inc. All rights reserved.
+ * Copyright (C) 2016, Western Digital. All rights reserved.
+ *
+ * This software is distributed under the terms of the BSD 2-clause license,
+ * "as is," without technical support, and WITHOUT ANY WARRANTY, without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE. You should have received a copy of the BSD 2-clause license along
+ * with libzbc. If not, see  <http://opensource.org/licenses/BSD-2-Clause>.
+ *
+ * Author: Damien Le Moal (damien.lemoal@wdc.com)
+ */
+
+#include "zbc.h"
+
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * C library allocator.
+ */
+static void *zbc_libc_malloc(void *priv, size_t size)
+{
+	return malloc(size);
+}
+
+static void *zbc_libc_memalign(void *priv, size_t align, size_t size)
+{
+	void *ptr;
+
+	if (posix_memalign(&ptr, align, size))
+		return NULL;
+
+	return ptr;
+}
+
+static void zbc_libc_free(void *priv, void *ptr)
+{
+	free(ptr);
+}
+
+static struct zbc_allocator zbc_allocator = {
+	.za_malloc	= zbc_libc_malloc,
+	.za_memalign	= zbc_libc_memalign,
+	.za_free	= zbc_libc_free,
+};
+
+/**
+ * Number of users of the allocator (open device handles and device
+ * probes), protected by zbc_alloc_lock.
+ */
+static pthread_mutex_t zbc_alloc_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int zbc_nr_devs;
+
+/**
+ * Command buffer arena of a device handle.
+ */
+struct zbc_arena {
+	/* Bitmap of the free buffers */
+	unsigned long	free;
+	uint8_t		*bufs;
+};
+
+/**
+ * zbc_set_allocator - Set the library memory allocator
+ */
+int zbc_set_allocator(const struct zbc_allocator *alloc)
+{
+	if (alloc &&
+	    (!alloc->za_malloc || !alloc->za_memalign || !alloc->za_free))
+		return -EINVAL;
+
+	pthread_mutex_lock(&zbc_alloc_lock);
+
+	if (zbc_nr_devs) {
+		pthread_mutex_unlock(&zbc_alloc_lock);
+		return -EBUSY;
+	}
+
+	if (alloc) {
+		zbc_allocator = *alloc;
+	} else {
+		zbc_allocator.za_malloc = zbc_libc_malloc;
+		zbc_allocator.za_memalign = zbc_libc_memalign;
+		zbc_allocator.za_free = zbc_libc_free;
+		zbc_allocator.za_priv = NULL;
+	}
+
+	pthread_mutex_unlock(&zbc_alloc_lock);
+
+	return 0;
+}
+
+/**
+ * Count a user of the allocator: called before a device handle
+ * allocates any memory, so that the allocator cannot be changed under it.
+ */
+void zbc_alloc_get(void)
+{
+	pthread_mutex_lock(&zbc_alloc_lock);
+	zbc_nr_devs++;
+	pthread_mutex_unlock(&zbc_alloc_lock);
+}
+
+/**
+ * Release a user of the allocator, after all its memory was freed.
+ */
+void zbc_alloc_put(void)
+{
+	pthread_mutex_lock(&zbc_alloc_lock);
+	zbc_nr_devs--;
+	pthread_mutex_unlock(&zbc_alloc_lock);
+}
+
+void *zbc_malloc(size_t size)
+{
+	return zbc_allocator.za_malloc(zbc_allocator.za_priv, size);
+}
+
+void *zbc_calloc(size_t nmemb, size_t size)
+{
+	void *ptr;
+
+	if (size && nmemb > (size_t)-1 / size)
+		return NULL;
+
+	ptr = zbc_malloc(nmemb * size);
+	if (ptr)
+		memset(ptr, 0, nmemb * size);
+
+	return ptr;
+}
+
+void *zbc_memalign(size_t align, size_t size)
+{
+	return zbc_allocator.za_memalign(zbc_allocator.za_priv, align, size);
+}
+
+void *zbc_realloc(void *ptr, size_t old_size, size_t size)
+{
+	void *p;
+
+	p = zbc_malloc(size);
+	if (!p)
+		return NULL;
+
+	if (ptr) {
+		memcpy(p, ptr, old_size < size ? old_size : size);
+		zbc_free(ptr);
+	}
+
+	return p;
+}
+
+char *zbc_strdup(const char *str)
+{
+	size_t len = strlen(str) + 1;
+	char *s;
+
+	s = zbc_malloc(len);
+	if (s)
+		memcpy(s, str, len);
+
+	return s;
+}
+
+/**
+ * zbc_free - Free memory allocated by the library
+ */
+void zbc_free(void *ptr)
+{
+	if (ptr)
+		zbc_allocator.za_free(zbc_allocator.za_priv, ptr);
+}
+
+/**
+ * Allocate the command buffers of a device.
+ */
+int zbc_arena_init(struct zbc_device *dev)
+{
+	struct zbc_arena *arena;
+
+	arena = zbc_calloc(1, sizeof(struct zbc_arena));
+	if (!arena)
+		return -ENOMEM;
+
+	arena->bufs = zbc_memalign(sysconf(_SC_PAGESIZE),
+				   ZBC_ARENA_NR_BUFS * ZBC_ARENA_BUFSZ);
+	if (!arena->bufs) {
+		zbc_error("%s: No memory for command buffers\n",
+			  dev->zbd_filename);
+		zbc_free(arena);
+		return -ENOMEM;
+	}
+	arena->free = (1UL << ZBC_ARENA_NR_BUFS) - 1;
+
+	dev->zbd_arena = arena;
+
+	return 0;
+}
+
+/**
+ * Free the command buffers of a device.
+ */
+void zbc_arena_exit(struct zbc_device *dev)
+{
+	struct zbc_arena *arena = dev->zbd_arena;
+
+	if (!arena)
+		return;
+
+	dev->zbd_arena = NULL;
+	zbc_free(arena->bufs);
+	zbc_free(arena);
+}
+
+/**
+ * Get a page aligned command buffer of at least @size bytes.
+ */
+void *zbc_arena_get(struct zbc_device *dev, size_t size)
+{
+	struct zbc_arena *arena = dev->zbd_arena;
+	unsigned long free;
+	int i;
+
+	if (arena && size <= ZBC_ARENA_BUFSZ) {
+		free = __atomic_load_n(&arena->free, __ATOMIC_RELAXED);
+		while (free) {
+			i = __builtin_ctzl(free);
+			if (__atomic_compare_exchange_n(&arena->free, &free,
+							free & ~(1UL << i),
+							false, __ATOMIC_ACQUIRE,
+							__ATOMIC_RELAXED))
+				return arena->bufs + i * ZBC_ARENA_BUFSZ;
+		}
+	}
+
+	return zbc_memalign(sysconf(_SC_PAGESIZE), size);
+}
+
+/**
+ * Release a command buffer.
+ */
+void zbc_arena_put(struct zbc_device *dev, void *buf)
+{
+	struct zbc_arena *arena = dev->zbd_arena;
+	uint8_t *p = buf;
+
+	if (arena && p >= arena->bufs &&
+	    p < arena->bufs + ZBC_ARENA_NR_BUFS * ZBC_ARENA_BUFSZ) {
+		__atomic_fetch_or(&arena->free,
+				  1UL << ((p - arena->bufs) / ZBC_ARENA_BUFSZ),
+				  __ATOMIC_RELEASE);
+		return;
+	}
+
+	zbc_free(buf);
+}
@@ -44,6 +44,8 @@
 #define ZBC_ATA_REQUEST_SENSE_DATA_EXT		0x0B
 #define ZBC_ATA_READ_DMA_EXT			0x25
 #define ZBC_ATA_WRITE_DMA_EXT			0x35
+#define ZBC_ATA_READ_FPDMA_QUEUED		0x60
+#define ZBC_ATA_WRITE_FPDMA_QUEUED		0x61
 #define ZBC_ATA_FLUSH_CACHE_EXT			0xEA
 #define ZBC_ATA_ZAC_MANAGEMENT_IN		0x4A
 #define ZBC_ATA_ZAC_MANAGEMENT_OUT		0x9F
@@ -72,6 +74,9 @@ enum zbc_ata_drv_flags {
 	/** Use SCSI SBC commands for I/O operations */
 	ZBC_ATA_USE_SBC		= 0x00000001,
 
+	/** FPDMA QUEUED commands are not supported by the SAT layer */
+	ZBC_ATA_NO_NCQ		= 0x00000002,
+
 };
 
 /**
@@ -503,6 +508,57 @@ static int zbc_ata_get_zoned_device_info(struct zbc_device *dev)
 	return 0;
 }
 
+/**
+ * Test if a read or write must use an FPDMA QUEUED (NCQ) command to pass
+ * the priority and FUA hints to the device.
+ */
+static inline bool zbc_ata_use_ncq(struct zbc_device *dev)
+{
+	return !(dev->zbd_drv_flags & ZBC_ATA_NO_NCQ) &&
+		(zbc_hint_prio() == ZBC_IO_PRIO_HIGH || zbc_hint_fua());
+}
+
+/**
+ * Change a READ DMA EXT or WRITE DMA EXT ATA PASSTHROUGH CDB into a
+ * READ FPDMA QUEUED or WRITE FPDMA QUEUED command: the FPDMA protocol
+ * is used, the sector count moves to the features field, the priority
+ * goes in bits 15:14 of the count field (the tag is set by the kernel)
+ * and FUA is bit 7 of the device field.
+ */
+static void zbc_ata_set_ncq(struct zbc_sg_cmd *cmd, uint32_t lba_count,
+			    bool write)
+{
+	/* FPDMA protocol, ext=1 */
+	cmd->cdb[1] = (0xc << 1) | 0x01;
+	/* t_length=01 (features) */
+	cmd->cdb[2] = (cmd->cdb[2] & ~0x03) | 0x01;
+	cmd->cdb[3] = (lba_count >> 8) & 0xff;
+	cmd->cdb[4] = lba_count & 0xff;
+	cmd->cdb[5] = zbc_hint_prio() == ZBC_IO_PRIO_HIGH ? 0x2 << 6 : 0;
+	cmd->cdb[6] = 0;
+	if (zbc_hint_fua())
+		cmd->cdb[13] |= 1 << 7;
+	cmd->cdb[14] = write ?
+		ZBC_ATA_WRITE_FPDMA_QUEUED : ZBC_ATA_READ_FPDMA_QUEUED;
+}
+
+/**
+ * Check if a failed FPDMA QUEUED command was rejected by the SAT layer
+ * or the device. If it was, do not use NCQ commands anymore.
+ */
+static bool zbc_ata_ncq_rejected(struct zbc_device *dev, int ret)
+{
+	if (ret != -EIO || zerrno.sk != ZBC_SK_ILLEGAL_REQUEST ||
+	    zerrno.asc_ascq != ZBC_ASC_INVALID_FIELD_IN_CDB)
+		return false;
+
+	zbc_warning("%s: FPDMA QUEUED commands not supported, ignoring I/O hints\n",
+		    dev->zbd_filename);
+	dev->zbd_drv_flags |= ZBC_ATA_NO_NCQ;
+
+	return true;
+}
+
 /**
  * Read from a ZAC device using READ DMA EXT packed
  * in an ATA PASSTHROUGH command.
@@ -512,6 +568,7 @@ static ssize_t zbc_ata_native_pread(struct zbc_device *dev, void *buf,
 {
 	uint32_t lba_count = zbc_dev_sect2lba(dev, count);
 	uint64_t lba_offset = zbc_dev_sect2lba(dev, offset);
+	bool ncq = zbc_ata_use_ncq(dev);
 	size_t sz = count << 9;
 	struct zbc_sg_cmd cmd;
 	ssize_t ret;
@@ -585,6 +642,8 @@ static ssize_t zbc_ata_native_pread(struct zbc_device *dev, void *buf,
 	cmd.cdb[12] = (lba_offset >> 16) & 0xff;
 	cmd.cdb[13] = 1 << 6;
 	cmd.cdb[14] = ZBC_ATA_READ_DMA_EXT;
+	if (ncq)
+		zbc_ata_set_ncq(&cmd, lba_count, false);
 
 	/* Execute the command */
 	ret = zbc_sg_cmd_exec(dev, &cmd);
@@ -599,6 +658,10 @@ static ssize_t zbc_ata_native_pread(struct zbc_device *dev, void *buf,
 	/* Done */
 	zbc_sg_cmd_destroy(&cmd);
 
+	/* Retry without NCQ if FPDMA QUEUED is not supported */
+	if (ncq && ret < 0 && zbc_ata_ncq_rejected(dev, ret))
+		return zbc_ata_native_pread(dev, buf, count, offset);
+
 	return ret;
 }
 
@@ -624,6 +687,7 @@ static ssize_t zbc_ata_native_pwrite(struct zbc_device *dev, const void *buf,
 	size_t sz = count << 9;
 	uint32_t lba_count = zbc_dev_sect2lba(dev, count);
 	uint64_t lba_offset = zbc_dev_sect2lba(dev, offset);
+	bool ncq = zbc_ata_use_ncq(dev);
 	struct zbc_sg_cmd cmd;
 	int ret;
 
@@ -693,6 +757,8 @@ static ssize_t zbc_ata_native_pwrite(struct zbc_device *dev, const void *buf,
 	cmd.cdb[12] = (lba_offset >> 16) & 0xff;
 	cmd.cdb[13] = 1 << 6;
 	cmd.cdb[14] = ZBC_ATA_WRITE_DMA_EXT;
+	if (ncq)
+		zbc_ata_set_ncq(&cmd, lba_count, true);
 
 	/* Execute the command */
 	ret = zbc_sg_cmd_exec(dev, &cmd);
@@ -707,6 +773,10 @@ static ssize_t zbc_ata_native_pwrite(struct zbc_device *dev, const void *buf,
 	/* Done */
 	zbc_sg_cmd_destroy(&cmd);
 
+	/* Retry without NCQ if FPDMA QUEUED is not supported */
+	if (ncq && ret < 0 && zbc_ata_ncq_rejected(dev, ret))
+		return zbc_ata_native_pwrite(dev, buf, count, offset);
+
 	return ret;
 }
 
@@ -1304,34 +1374,50 @@ static void zbc_ata_test_sbc_sat(struct zbc_device *dev)
  */
 static int zbc_ata_get_dev_info(struct zbc_device *dev)
 {
+	unsigned long long start;
 	int ret;
 
 	/* Make sure the device is ready */
+	start = zbc_time_ns();
 	ret = zbc_sg_test_unit_ready(dev);
+	zbc_open_phase(dev->zbd_filename, "test unit ready", start, ret);
 	if (ret != 0)
 		return ret;
 
 	/* Get device model */
+	start = zbc_time_ns();
 	ret = zbc_ata_classify(dev);
+	zbc_open_phase(dev->zbd_filename, "classify", start, ret);
 	if (ret != 0)
 		return ret;
 
 	/* Get capacity information */
+	start = zbc_time_ns();
 	ret = zbc_ata_get_capacity(dev);
+	zbc_open_phase(dev->zbd_filename, "capacity log", start, ret);
 	if (ret != 0 )
 		return ret;
 
 	/* Get vendor information */
+	start = zbc_time_ns();
 	zbc_ata_vendor_id(dev);
+	zbc_open_phase(dev->zbd_filename, "vendor id", start, 0);
 
 	/* Get zoned device information */
+	start = zbc_time_ns();
 	ret = zbc_ata_get_zoned_device_info(dev);
+	zbc_open_phase(dev->zbd_filename, "zoned device information log",
+		       start, ret);
 	if (ret != 0)
 		return ret;
 
 	/* Check if we have a functional SAT for read/write */
-	if (!zbc_test_mode(dev))
+	if (!zbc_test_mode(dev)) {
+		start = zbc_time_ns();
 		zbc_ata_test_sbc_sat(dev);
+		zbc_open_phase(dev->zbd_filename, "SBC SAT read test",
+			       start, 0);
+	}
 
 	return 0;
 }
@@ -1342,6 +1428,7 @@ static int zbc_ata_get_dev_info(struct zbc_device *dev)
 static int zbc_ata_open(const char *filename,
 			int flags, struct zbc_device **pdev)
 {
+	unsigned long long start;
 	struct zbc_device *dev;
 	struct stat st;
 	int fd, ret;
@@ -1371,13 +1458,14 @@ static int zbc_ata_open(const char *filename,
 	}
 
 	if (!S_ISCHR(st.st_mode) && !S_ISBLK(st.st_mode)) {
+		zbc_open_reject(filename, "not a device file");
 		ret = -ENXIO;
 		goto out;
 	}
 
 	/* Set device decriptor */
 	ret = -ENOMEM;
-	dev = calloc(1, sizeof(struct zbc_device));
+	dev = zbc_calloc(1, sizeof(struct zbc_device));
 	if (!dev)
 		goto out;
 
@@ -1389,7 +1477,7 @@ static int zbc_ata_open(const char *filename,
 	if (flags & O_DIRECT)
 		dev->zbd_o_flags |= ZBC_O_DIRECT;
 
-	dev->zbd_filename = strdup(filename);
+	dev->zbd_filename = zbc_strdup(filename);
 	if (!dev->zbd_filename)
 		goto out_free_dev;
 
@@ -1398,8 +1486,10 @@ static int zbc_ata_open(const char *filename,
 		goto out_free_filename;
 
 	/* Set sense data reporting */
+	start = zbc_time_ns();
 	ret = zbc_ata_set_features(dev,
 			ZBC_ATA_ENABLE_SENSE_DATA_REPORTING, 0x01);
+	zbc_open_phase(filename, "enable sense data reporting", start, ret);
 	if (ret != 0) {
 		zbc_error("%s: Enable sense data reporting failed\n",
 			  filename);
@@ -1414,10 +1504,10 @@ static int zbc_ata_open(const char *filename,
 	return 0;
 
 out_free_filename:
-	free(dev->zbd_filename);
+	zbc_free(dev->zbd_filename);
 
 out_free_dev:
-	free(dev);
+	zbc_free(dev);
 
 out:
 	if (fd >= 0)
@@ -1435,8 +1525,8 @@ static int zbc_ata_close(struct zbc_device *dev)
 	if (close(dev->zbd_fd))
 		return -errno;
 
-	free(dev->zbd_filename);
-	free(dev);
+	zbc_free(dev->zbd_filename);
+	zbc_free(dev);
 
 	return 0;
 }
@@ -154,7 +154,7 @@ static int zbc_block_get_partition_start(struct zbc_device *dev)
 static int zbc_block_open_holder(struct zbc_device *dev)
 {
 	struct zbc_block_device *zbd = zbc_dev_to_block(dev);
-	char *zbd_filename = strdup(dev->zbd_filename);
+	char *zbd_filename = zbc_strdup(dev->zbd_filename);
 	char str[128];
 	int ret = 0;
 
@@ -175,7 +175,7 @@ static int zbc_block_open_holder(struct zbc_device *dev)
 			  errno, strerror(errno));
 	}
 
-	free(zbd_filename);
+	zbc_free(zbd_filename);
 
 	return ret;
 }
@@ -203,7 +203,7 @@ static int zbc_block_handle_partition(struct zbc_device *dev)
 
 	if (!zbd->is_part) {
 not_part:
-		zbd->holder_name = strdup(dev_name);
+		zbd->holder_name = zbc_strdup(dev_name);
 		zbd->part_offset = 0;
 		dev->zbd_sg_fd = dev->zbd_fd;
 		goto out;
@@ -216,7 +216,7 @@ not_part:
 		if (asprintf(&path, "/sys/block/%s/%s", e->d_name, dev_name) < 0)
 			continue;
 		if (stat(path, &statbuf) == 0)
-			zbd->holder_name = strdup(e->d_name);
+			zbd->holder_name = zbc_strdup(e->d_name);
 		free(path);
 	}
 	closedir(d);
@@ -360,17 +360,24 @@ static int zbc_block_get_vendor_id(struct zbc_device *dev)
 static int zbc_block_get_info(struct zbc_device *dev, struct stat *st)
 {
 	struct zbc_block_device *zbd = zbc_dev_to_block(dev);
-	unsigned long long size64;
+	unsigned long long size64, start;
 	int size32;
 	int ret;
 
 	/* Check if we are dealing with a partition */
+	start = zbc_time_ns();
 	ret = zbc_block_handle_partition(dev);
+	zbc_open_phase(dev->zbd_filename, "partition", start, ret);
 	if (ret)
 		return ret;
 
 	/* Is this a zoned device */
+	start = zbc_time_ns();
 	ret = zbc_block_device_classify(dev);
+	zbc_open_phase(dev->zbd_filename, "sysfs zoned model", start, ret);
+	if (ret == -ENXIO)
+		zbc_open_reject(dev->zbd_filename,
+				"not a zoned block device");
 	if (ret != 0)
 		return ret;
 
@@ -464,12 +471,19 @@ static int zbc_block_get_info(struct zbc_device *dev, struct stat *st)
 			dev->zbd_info.zbd_opt_nr_non_seq_write_seq_pref =
 				ZBC_NOT_REPORTED;
 		}
-	} else if (zbc_scsi_get_zbd_characteristics(dev)) {
-		return -ENXIO;
+	} else {
+		start = zbc_time_ns();
+		ret = zbc_scsi_get_zbd_characteristics(dev);
+		zbc_open_phase(dev->zbd_filename, "zoned characteristics",
+			       start, ret);
+		if (ret)
+			return -ENXIO;
 	}
 
 	/* Get maximum command size */
+	start = zbc_time_ns();
 	zbc_sg_get_max_cmd_blocks(dev);
+	zbc_open_phase(dev->zbd_filename, "max command size", start, 0);
 
 	dev->zbd_info.zbd_sectors =
 		(dev->zbd_info.zbd_lblocks *
@@ -493,7 +507,7 @@ static int zbc_block_open(const char *filename, int flags,
 		  filename);
 
 #ifndef HAVE_LINUX_BLKZONED_H
-	zbc_debug("libzbc compiled without zoned block device driver support\n");
+	zbc_open_reject(filename, "no zoned block device support");
 	return -ENXIO;
 #endif
 
@@ -506,8 +520,10 @@ static int zbc_block_open(const char *filename, int flags,
 		return ret;
 	}
 
-	if (!S_ISBLK(st.st_mode))
+	if (!S_ISBLK(st.st_mode)) {
+		zbc_open_reject(filename, "not a block device");
 		return -ENXIO;
+	}
 
 	/* Open block device */
 	fd = open(filename, (flags & ZBC_O_DMODE_MASK) | O_LARGEFILE);
@@ -522,13 +538,13 @@ static int zbc_block_open(const char *filename, int flags,
 
 	/* Allocate a handle */
 	ret = -ENOMEM;
-	zbd = calloc(1, sizeof(struct zbc_block_device));
+	zbd = zbc_calloc(1, sizeof(struct zbc_block_device));
 	if (!zbd)
 		goto out;
 
 	dev = &zbd->dev;
 	dev->zbd_fd = fd;
-	dev->zbd_filename = strdup(filename);
+	dev->zbd_filename = zbc_strdup(filename);
 	if (!dev->zbd_filename)
 		goto out_free_dev;
 
@@ -546,12 +562,12 @@ static int zbc_block_open(const char *filename, int flags,
 
 out_free_filename:
 	if (zbd->holder_name)
-		free(zbd->holder_name);
+		zbc_free(zbd->holder_name);
 
-	free(dev->zbd_filename);
+	zbc_free(dev->zbd_filename);
 
 out_free_dev:
-	free(zbd);
+	zbc_free(zbd);
 
 out:
 	if (fd >= 0)
@@ -578,9 +594,9 @@ static int zbc_block_close(struct zbc_device *dev)
 	if (ret == 0) {
 		if (zbd->is_part)
 			close(dev->zbd_sg_fd);
-		free(zbd->holder_name);
-		free(dev->zbd_filename);
-		free(zbd);
+		zbc_free(zbd->holder_name);
+		zbc_free(dev->zbd_filename);
+		zbc_free(zbd);
 	}
 
 	return ret;
@@ -638,6 +654,7 @@ static int zbc_block_report_zones(struct zbc_device *dev, uint64_t start_sector,
 				  struct zbc_zone *zones,
 				  unsigned int *nr_zones)
 {
+	unsigned int rep_nr_zones = ZBC_BLOCK_ZONE_REPORT_NR_ZONES;
 	size_t rep_size;
 	uint64_t sector = start_sector;
 	struct zbc_zone zone;
@@ -646,9 +663,12 @@ static int zbc_block_report_zones(struct zbc_device *dev, uint64_t start_sector,
 	unsigned int i, n = 0;
 	int ret;
 
+	/* Small reports use a buffer of the device arena */
+	if (*nr_zones && *nr_zones < rep_nr_zones)
+		rep_nr_zones = *nr_zones;
 	rep_size = sizeof(struct blk_zone_report) +
-		sizeof(struct blk_zone) * ZBC_BLOCK_ZONE_REPORT_NR_ZONES;
-	rep = malloc(rep_size);
+		sizeof(struct blk_zone) * rep_nr_zones;
+	rep = zbc_arena_get(dev, rep_size);
 	if (!rep) {
 		zbc_error("%s: No memory for report zones\n",
 			  dev->zbd_filename);
@@ -662,7 +682,7 @@ static int zbc_block_report_zones(struct zbc_device *dev, uint64_t start_sector,
 		/* Get zone info */
 		memset(rep, 0, rep_size);
 		rep->sector = sector;
-		rep->nr_zones = ZBC_BLOCK_ZONE_REPORT_NR_ZONES;
+		rep->nr_zones = rep_nr_zones;
 
 		ret = ioctl(dev->zbd_fd, BLKREPORTZONE, rep);
 		if (ret != 0) {
@@ -712,7 +732,7 @@ static int zbc_block_report_zones(struct zbc_device *dev, uint64_t start_sector,
 	*nr_zones = n;
 
 out:
-	free(rep);
+	zbc_arena_put(dev, rep);
 
 	return ret;
 }
@@ -765,6 +785,7 @@ static int zbc_block_reset_one(struct zbc_device *dev, uint64_t sector)
  */
 static int zbc_block_reset_all(struct zbc_device *dev)
 {
+	unsigned int max_zones = ZBC_ARENA_BUFSZ / sizeof(struct zbc_zone);
 	struct zbc_zone *zones;
 	unsigned int i, nr_zones;
 	struct blk_zone_range range;
@@ -772,8 +793,7 @@ static int zbc_block_reset_all(struct zbc_device *dev)
 	uint64_t nr_seq_sectors;
 	int ret;
 
-	zones = calloc(ZBC_BLOCK_ZONE_REPORT_NR_ZONES,
-		       sizeof(struct zbc_zone));
+	zones = zbc_arena_get(dev, max_zones * sizeof(struct zbc_zone));
 	if (!zones) {
 		zbc_error("%s: No memory for report zones\n",
 			  dev->zbd_filename);
@@ -783,7 +803,7 @@ static int zbc_block_reset_all(struct zbc_device *dev)
 	while (1) {
 
 		/* Get zone info */
-		nr_zones = ZBC_BLOCK_ZONE_REPORT_NR_ZONES;
+		nr_zones = max_zones;
 		ret = zbc_block_report_zones(dev, sector, ZBC_RO_ALL,
 					     zones, &nr_zones);
 		if (ret || !nr_zones)
@@ -835,7 +855,7 @@ static int zbc_block_reset_all(struct zbc_device *dev)
 
 	}
 
-	free(zones);
+	zbc_arena_put(dev, zones);
 
 	return ret;
 }
@@ -882,6 +902,45 @@ static int zbc_block_zone_op(struct zbc_device *dev, uint64_t sector,
 	}
 }
 
+/**
+ * Execute an operation on a range of contiguous zones.
+ */
+static int zbc_block_zone_op_range(struct zbc_device *dev, uint64_t sector,
+				   uint64_t nr_sectors, enum zbc_zone_op op)
+{
+	struct blk_zone_range range;
+	unsigned long cmd;
+	int ret;
+
+	switch (op) {
+	case ZBC_OP_RESET_ZONE:
+		cmd = BLKRESETZONE;
+		break;
+#ifdef BLKFINISHZONE
+	case ZBC_OP_FINISH_ZONE:
+		cmd = BLKFINISHZONE;
+		break;
+#endif
+	default:
+		return -ENOTSUP;
+	}
+
+	range.sector = sector;
+	range.nr_sectors = nr_sectors;
+	ret = ioctl(dev->zbd_fd, cmd, &range);
+	if (ret != 0) {
+		ret = -errno;
+		zbc_error("%s: ioctl %s failed %d (%s)\n",
+			  dev->zbd_filename,
+			  op == ZBC_OP_RESET_ZONE ?
+			  "BLKRESETZONE" : "BLKFINISHZONE",
+			  errno, strerror(errno));
+		return ret;
+	}
+
+	return 0;
+}
+
 /**
  * Read from the block device.
  */
@@ -909,7 +968,7 @@ static ssize_t zbc_block_pwrite(struct zbc_device *dev,
 	ssize_t ret;
 
 	/* Read */
-	ret = pwrite(dev->zbd_fd, buf, count << 9, offset << 9);
+	ret = zbc_file_pwrite(dev->zbd_fd, buf, count << 9, offset << 9);
 	if (ret < 0)
 		return -errno;
 
@@ -940,6 +999,12 @@ static int zbc_block_zone_op(struct zbc_device *dev, uint64_t sector,
 	return -EOPNOTSUPP;
 }
 
+static int zbc_block_zone_op_range(struct zbc_device *dev, uint64_t sector,
+				   uint64_t nr_sectors, enum zbc_zone_op op)
+{
+	return -ENOTSUP;
+}
+
 static ssize_t zbc_block_pread(struct zbc_device *dev, void *buf,
 			       size_t count, uint64_t offset)
 {
@@ -972,4 +1037,5 @@ struct zbc_drv zbc_block_drv =
 	.zbd_flush		= zbc_block_flush,
 	.zbd_report_zones	= zbc_block_report_zones,
 	.zbd_zone_op		= zbc_block_zone_op,
+	.zbd_zone_op_range	= zbc_block_zone_op_range,
 };
@@ -0,0 +1,1639 @@
+/*
+ * This file is part of libzbc.
+ *
+ * Copyright (C) 2009-2014, HGST, Inc. All rights reserved.
+ * Copyright (C) 2016, Western Digital. All rights reserved.
+ *
+ * This software is distributed under the terms of the BSD 2-clause license,
+ * "as is," without technical support, and WITHOUT ANY WARRANTY, without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE. You should have received a copy of the BSD 2-clause license along
+ * with libzbc. If not, see  <http://opensource.org/licenses/BSD-2-Clause>.
+ *
+ * Author: Damien Le Moal (damien.lemoal@wdc.com)
+ */
+
+#include "zbc.h"
+#include "libzbc/zbc_btree.h"
+
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * Defaults.
+ */
+#define ZBC_BT_PAGE_SIZE	4096
+#define ZBC_BT_VAL_SIZE		8
+#define ZBC_BT_CACHE_SIZE	(16 * 1024 * 1024)
+#define ZBC_BT_MIN_FREE_ZONES	2
+
+/**
+ * Size of page batch writes and of zone cleaning reads.
+ */
+#define ZBC_BT_IO_SIZE		(1024 * 1024)
+
+/**
+ * Maximum tree height.
+ */
+#define ZBC_BT_MAX_HEIGHT	16
+
+#define ZBC_BT_NONE		((uint64_t)-1)
+
+/**
+ * Page header. Pages are followed by their keys and their values (leaf
+ * pages) or child page sectors (inner pages), each array at a fixed offset.
+ * @lo is the lower bound key of the page used to reach it from its parent.
+ */
+#define ZBC_BT_PAGE_MAGIC	0x5a425450
+
+struct zbc_bt_hdr {
+	uint32_t		magic;
+	uint32_t		crc;
+	uint16_t		level;
+	uint16_t		nr;
+	uint32_t		reserved;
+	uint64_t		lo;
+	uint64_t		seq;
+};
+
+/**
+ * Root block, followed by the number of live pages of each zone.
+ */
+#define ZBC_BT_ROOT_MAGIC	0x5a425452
+
+struct zbc_bt_root {
+	uint32_t		magic;
+	uint32_t		crc;
+	uint64_t		seq;
+	uint64_t		root;
+	uint64_t		nr_keys;
+	uint32_t		page_size;
+	uint32_t		val_size;
+	uint32_t		nr_zones;
+	uint32_t		cur_zone;
+	uint32_t		live[];
+};
+
+/**
+ * In memory page. Clean pages are in the page cache, with @ref counting
+ * the users preventing their eviction. Dirty pages are not in the cache:
+ * they are referenced from their dirty parent @kids array, or are the
+ * tree root.
+ */
+struct zbc_bt_node {
+	struct zbc_bt_hdr	*hdr;
+	uint64_t		sector;
+	bool			dirty;
+	unsigned int		ref;
+	struct zbc_bt_node	**kids;
+
+	/* Page cache hash chain and LRU list */
+	struct zbc_bt_node	*hnext;
+	struct zbc_bt_node	*prev;
+	struct zbc_bt_node	*next;
+};
+
+/**
+ * B+tree.
+ */
+struct zbc_btree {
+	struct zbc_device	*dev;
+	struct zbc_btree_params	params;
+	pthread_mutex_t		lock;
+	int			error;
+
+	size_t			ps;
+	uint64_t		ps_sectors;
+	unsigned int		max_leaf;
+	unsigned int		max_inner;
+
+	/* Root: dirty root node, or sector of the committed root */
+	struct zbc_bt_node	*root;
+	uint64_t		root_sector;
+	uint64_t		nr_keys;
+	uint64_t		seq;
+	bool			dirty;
+
+	/* Zones and their number of live pages */
+	struct zbc_zpool	zpool;
+	uint32_t		*live;
+
+	/* Zone being written, next page sector and write batch */
+	struct zbc_zone		*zone;
+	uint64_t		wsector;
+	uint64_t		bsector;
+	size_t			blen;
+	size_t			bsize;
+	void			*wbuf;
+
+	/* Root blocks */
+	struct zbc_bt_root	*rblk;
+	size_t			rblk_size;
+
+	/* Page cache: LRU lists of leaf (0) and inner (1) pages */
+	struct zbc_bt_node	**hash;
+	unsigned int		hash_mask;
+	unsigned int		nr_cached;
+	unsigned int		max_cached;
+	struct zbc_bt_node	lru[2];
+
+	struct zbc_btree_stats	stats;
+};
+
+static inline uint64_t *zbc_bt_keys(struct zbc_bt_node *n)
+{
+	return (uint64_t *)(n->hdr + 1);
+}
+
+static inline uint8_t *zbc_bt_vals(struct zbc_btree *tree,
+				   struct zbc_bt_node *n)
+{
+	return (uint8_t *)(zbc_bt_keys(n) + tree->max_leaf);
+}
+
+static inline uint64_t *zbc_bt_ptrs(struct zbc_btree *tree,
+				    struct zbc_bt_node *n)
+{
+	return zbc_bt_keys(n) + tree->max_inner;
+}
+
+/**
+ * Index of the zone of the pool containing @sector.
+ */
+static inline unsigned int zbc_bt_zone_idx(struct zbc_btree *tree,
+					   uint64_t sector)
+{
+	return zbc_zpool_lookup(&tree->zpool, sector) - tree->zpool.zp_zones;
+}
+
+static struct zbc_bt_node *zbc_bt_node_alloc(struct zbc_btree *tree)
+{
+	struct zbc_bt_node *n;
+
+	n = zbc_calloc(1, sizeof(struct zbc_bt_node));
+	if (!n)
+		return NULL;
+
+	n->hdr = zbc_memalign(sysconf(_SC_PAGESIZE), tree->ps);
+	if (!n->hdr) {
+		zbc_free(n);
+		return NULL;
+	}
+	memset(n->hdr, 0, tree->ps);
+
+	return n;
+}
+
+static void zbc_bt_node_free(struct zbc_bt_node *n)
+{
+	zbc_free(n->kids);
+	zbc_free(n->hdr);
+	zbc_free(n);
+}
+
+/**
+ * Allocate a new dirty node.
+ */
+static struct zbc_bt_node *zbc_bt_node_new(struct zbc_btree *tree,
+					   unsigned int level)
+{
+	struct zbc_bt_node *n = zbc_bt_node_alloc(tree);
+
+	if (!n)
+		return NULL;
+
+	n->dirty = true;
+	n->hdr->level = level;
+	if (level) {
+		n->kids = zbc_calloc(tree->max_inner,
+				     sizeof(struct zbc_bt_node *));
+		if (!n->kids) {
+			zbc_bt_node_free(n);
+			return NULL;
+		}
+	}
+
+	return n;
+}
+
+/**
+ * Free a dirty subtree.
+ */
+static void zbc_bt_node_free_dirty(struct zbc_btree *tree,
+				   struct zbc_bt_node *n)
+{
+	unsigned int i;
+
+	if (n->kids) {
+		for (i = 0; i < n->hdr->nr; i++) {
+			if (n->kids[i])
+				zbc_bt_node_free_dirty(tree, n->kids[i]);
+		}
+	}
+
+	zbc_bt_node_free(n);
+}
+
+static inline unsigned int zbc_bt_hash(struct zbc_btree *tree,
+				       uint64_t sector)
+{
+	return (sector * 0x9e3779b97f4a7c15ULL >> 32) & tree->hash_mask;
+}
+
+static void zbc_bt_lru_del(struct zbc_bt_node *n)
+{
+	n->prev->next = n->next;
+	n->next->prev = n->prev;
+}
+
+static void zbc_bt_lru_add(struct zbc_btree *tree, struct zbc_bt_node *n)
+{
+	struct zbc_bt_node *head = &tree->lru[n->hdr->level > 0];
+
+	n->next = head->next;
+	n->prev = head;
+	head->next->prev = n;
+	head->next = n;
+}
+
+static void zbc_bt_cache_remove(struct zbc_btree *tree, struct zbc_bt_node *n)
+{
+	struct zbc_bt_node **p = &tree->hash[zbc_bt_hash(tree, n->sector)];
+
+	while (*p != n)
+		p = &(*p)->hnext;
+	*p = n->hnext;
+
+	zbc_bt_lru_del(n);
+	tree->nr_cached--;
+}
+
+/**
+ * Evict unused pages from the cache, leaf pages first.
+ */
+static void zbc_bt_cache_shrink(struct zbc_btree *tree)
+{
+	struct zbc_bt_node *n;
+	int l;
+
+	for (l = 0; l < 2; l++) {
+		n = tree->lru[l].prev;
+		while (tree->nr_cached > tree->max_cached &&
+		       n != &tree->lru[l]) {
+			if (n->ref) {
+				n = n->prev;
+				continue;
+			}
+			zbc_bt_cache_remove(tree, n);
+			zbc_bt_node_free(n);
+			n = tree->lru[l].prev;
+		}
+	}
+}
+
+static void zbc_bt_cache_insert(struct zbc_btree *tree, struct zbc_bt_node *n)
+{
+	unsigned int h = zbc_bt_hash(tree, n->sector);
+
+	n->hnext = tree->hash[h];
+	tree->hash[h] = n;
+	zbc_bt_lru_add(tree, n);
+	tree->nr_cached++;
+
+	zbc_bt_cache_shrink(tree);
+}
+
+/**
+ * Check a page header.
+ */
+static bool zbc_bt_page_valid(struct zbc_btree *tree, struct zbc_bt_hdr *hdr)
+{
+	uint32_t crc = hdr->crc;
+	bool valid;
+
+	if (hdr->magic != ZBC_BT_PAGE_MAGIC ||
+	    hdr->level >= ZBC_BT_MAX_HEIGHT ||
+	    hdr->nr > (hdr->level ? tree->max_inner : tree->max_leaf))
+		return false;
+
+	hdr->crc = 0;
+	valid = crc == zbc_crc32c(0, hdr, tree->ps);
+	hdr->crc = crc;
+
+	return valid;
+}
+
+/**
+ * Get the page at @sector, from the cache or from the device.
+ */
+static int zbc_bt_node_get(struct zbc_btree *tree, uint64_t sector,
+			   struct zbc_bt_node **pn)
+{
+	struct zbc_bt_node *n;
+	ssize_t ret;
+
+	for (n = tree->hash[zbc_bt_hash(tree, sector)]; n; n = n->hnext) {
+		if (n->sector == sector) {
+			zbc_bt_lru_del(n);
+			zbc_bt_lru_add(tree, n);
+			n->ref++;
+			tree->stats.zts_cache_hits++;
+			*pn = n;
+			return 0;
+		}
+	}
+
+	n = zbc_bt_node_alloc(tree);
+	if (!n)
+		return -ENOMEM;
+
+	ret = zbc_pread(tree->dev, n->hdr, tree->ps_sectors, sector);
+	if (ret >= 0 && (uint64_t)ret != tree->ps_sectors)
+		ret = -EIO;
+	if (ret < 0) {
+		zbc_bt_node_free(n);
+		return ret;
+	}
+	tree->stats.zts_page_reads++;
+
+	if (!zbc_bt_page_valid(tree, n->hdr)) {
+		zbc_error("%s: Invalid B+tree page at sector %llu\n",
+			  tree->dev->zbd_filename,
+			  (unsigned long long)sector);
+		zbc_bt_node_free(n);
+		return -EIO;
+	}
+
+	n->sector = sector;
+	n->ref = 1;
+	zbc_bt_cache_insert(tree, n);
+	*pn = n;
+
+	return 0;
+}
+
+static void zbc_bt_node_put(struct zbc_bt_node *n)
+{
+	if (!n->dirty)
+		n->ref--;
+}
+
+/**
+ * Get the root node (NULL for an empty tree).
+ */
+static int zbc_bt_root_get(struct zbc_btree *tree, struct zbc_bt_node **pn)
+{
+	*pn = tree->root;
+	if (tree->root || tree->root_sector == ZBC_BT_NONE)
+		return 0;
+
+	return zbc_bt_node_get(tree, tree->root_sector, pn);
+}
+
+/**
+ * Get the child @i of an inner node.
+ */
+static int zbc_bt_child(struct zbc_btree *tree, struct zbc_bt_node *n,
+			unsigned int i, struct zbc_bt_node **pc)
+{
+	if (n->dirty && n->kids[i]) {
+		*pc = n->kids[i];
+		return 0;
+	}
+
+	return zbc_bt_node_get(tree, zbc_bt_ptrs(tree, n)[i], pc);
+}
+
+/**
+ * Make a clean node dirty: its page will be written to a new location
+ * at the next commit, so its current location is not live anymore.
+ */
+static int zbc_bt_dirty(struct zbc_btree *tree, struct zbc_bt_node *n)
+{
+	struct zbc_bt_node **kids = NULL;
+
+	if (n->dirty)
+		return 0;
+
+	if (n->hdr->level) {
+		kids = zbc_calloc(tree->max_inner,
+				  sizeof(struct zbc_bt_node *));
+		if (!kids)
+			return -ENOMEM;
+	}
+
+	zbc_bt_cache_remove(tree, n);
+	tree->live[zbc_bt_zone_idx(tree, n->sector)]--;
+	n->kids = kids;
+	n->dirty = true;
+	n->ref = 0;
+
+	return 0;
+}
+
+/**
+ * Get the root node for modification, creating an empty leaf for an
+ * empty tree.
+ */
+static int zbc_bt_dirty_root(struct zbc_btree *tree, struct zbc_bt_node **pn)
+{
+	struct zbc_bt_node *n;
+	int ret;
+
+	tree->dirty = true;
+
+	if (tree->root) {
+		*pn = tree->root;
+		return 0;
+	}
+
+	if (tree->root_sector == ZBC_BT_NONE) {
+		n = zbc_bt_node_new(tree, 0);
+		if (!n)
+			return -ENOMEM;
+	} else {
+		ret = zbc_bt_node_get(tree, tree->root_sector, &n);
+		if (ret)
+			return ret;
+		ret = zbc_bt_dirty(tree, n);
+		if (ret) {
+			zbc_bt_node_put(n);
+			return ret;
+		}
+	}
+
+	tree->root = n;
+	tree->root_sector = ZBC_BT_NONE;
+	*pn = n;
+
+	return 0;
+}
+
+/**
+ * Get the child @i of a dirty inner node for modification.
+ */
+static int zbc_bt_dirty_child(struct zbc_btree *tree, struct zbc_bt_node *n,
+			      unsigned int i, struct zbc_bt_node **pc)
+{
+	struct zbc_bt_node *c;
+	int ret;
+
+	if (n->kids[i]) {
+		*pc = n->kids[i];
+		return 0;
+	}
+
+	ret = zbc_bt_node_get(tree, zbc_bt_ptrs(tree, n)[i], &c);
+	if (ret)
+		return ret;
+
+	ret = zbc_bt_dirty(tree, c);
+	if (ret) {
+		zbc_bt_node_put(c);
+		return ret;
+	}
+
+	n->kids[i] = c;
+	*pc = c;
+
+	return 0;
+}
+
+/**
+ * Index of the first key of a leaf greater than or equal to @key.
+ */
+static unsigned int zbc_bt_leaf_find(struct zbc_bt_node *n, uint64_t key,
+				     bool *found)
+{
+	uint64_t *keys = zbc_bt_keys(n);
+	unsigned int lo = 0, hi = n->hdr->nr, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (keys[mid] < key)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	*found = lo < n->hdr->nr && keys[lo] == key;
+
+	return lo;
+}
+
+/**
+ * Index of the child of an inner node covering @key.
+ */
+static unsigned int zbc_bt_inner_find(struct zbc_bt_node *n, uint64_t key)
+{
+	uint64_t *keys = zbc_bt_keys(n);
+	unsigned int lo = 1, hi = n->hdr->nr, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (keys[mid] <= key)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo - 1;
+}
+
+/**
+ * Lookup the leaf holding @key.
+ */
+static int zbc_bt_lookup(struct zbc_btree *tree, uint64_t key,
+			 struct zbc_bt_node **pn)
+{
+	struct zbc_bt_node *n, *c;
+	int ret;
+
+	ret = zbc_bt_root_get(tree, &n);
+	if (ret)
+		return ret;
+	if (!n)
+		return -ENOENT;
+
+	while (n->hdr->level) {
+		ret = zbc_bt_child(tree, n, zbc_bt_inner_find(n, key), &c);
+		zbc_bt_node_put(n);
+		if (ret)
+			return ret;
+		n = c;
+	}
+
+	*pn = n;
+
+	return 0;
+}
+
+/**
+ * zbc_btree_get - Lookup a key
+ */
+int zbc_btree_get(struct zbc_btree *tree, uint64_t key, void *val)
+{
+	size_t vs = tree->params.ztp_val_size;
+	struct zbc_bt_node *n;
+	unsigned int i;
+	bool found;
+	int ret;
+
+	pthread_mutex_lock(&tree->lock);
+
+	ret = tree->error;
+	if (ret)
+		goto out;
+
+	ret = zbc_bt_lookup(tree, key, &n);
+	if (ret)
+		goto out;
+
+	i = zbc_bt_leaf_find(n, key, &found);
+	if (found)
+		memcpy(val, zbc_bt_vals(tree, n) + i * vs, vs);
+	else
+		ret = -ENOENT;
+	zbc_bt_node_put(n);
+
+out:
+	pthread_mutex_unlock(&tree->lock);
+
+	return ret;
+}
+
+static int zbc_bt_next(struct zbc_btree *tree, struct zbc_bt_node *n,
+		       uint64_t key, uint64_t *next, void *val)
+{
+	size_t vs = tree->params.ztp_val_size;
+	struct zbc_bt_node *c;
+	unsigned int i;
+	bool found;
+	int ret;
+
+	if (!n->hdr->level) {
+		i = zbc_bt_leaf_find(n, key, &found);
+		if (i >= n->hdr->nr)
+			return -ENOENT;
+		*next = zbc_bt_keys(n)[i];
+		memcpy(val, zbc_bt_vals(tree, n) + i * vs, vs);
+		return 0;
+	}
+
+	for (i = zbc_bt_inner_find(n, key); i < n->hdr->nr; i++) {
+		ret = zbc_bt_child(tree, n, i, &c);
+		if (ret)
+			return ret;
+		ret = zbc_bt_next(tree, c, key, next, val);
+		zbc_bt_node_put(c);
+		if (ret != -ENOENT)
+			return ret;
+	}
+
+	return -ENOENT;
+}
+
+/**
+ * zbc_btree_next - Lookup the first key greater than or equal to a key
+ */
+int zbc_btree_next(struct zbc_btree *tree, uint64_t key,
+		   uint64_t *next, void *val)
+{
+	struct zbc_bt_node *n;
+	int ret;
+
+	pthread_mutex_lock(&tree->lock);
+
+	ret = tree->error;
+	if (ret)
+		goto out;
+
+	ret = zbc_bt_root_get(tree, &n);
+	if (ret)
+		goto out;
+
+	if (n) {
+		ret = zbc_bt_next(tree, n, key, next, val);
+		zbc_bt_node_put(n);
+	} else {
+		ret = -ENOENT;
+	}
+
+out:
+	pthread_mutex_unlock(&tree->lock);
+
+	return ret;
+}
+
+/**
+ * Insert an entry at index @i of a node.
+ */
+static void zbc_bt_node_insert(struct zbc_btree *tree, struct zbc_bt_node *n,
+			       unsigned int i, uint64_t key, const void *val,
+			       struct zbc_bt_node *kid)
+{
+	size_t vs = tree->params.ztp_val_size;
+	uint64_t *keys = zbc_bt_keys(n);
+	unsigned int nr = n->hdr->nr;
+	uint64_t *ptrs;
+	uint8_t *vals;
+
+	memmove(&keys[i + 1], &keys[i], (nr - i) * sizeof(uint64_t));
+	keys[i] = key;
+
+	if (n->hdr->level) {
+		ptrs = zbc_bt_ptrs(tree, n);
+		memmove(&ptrs[i + 1], &ptrs[i], (nr - i) * sizeof(uint64_t));
+		memmove(&n->kids[i + 1], &n->kids[i],
+			(nr - i) * sizeof(struct zbc_bt_node *));
+		ptrs[i] = ZBC_BT_NONE;
+		n->kids[i] = kid;
+	} else {
+		vals = zbc_bt_vals(tree, n);
+		memmove(vals + (i + 1) * vs, vals + i * vs, (nr - i) * vs);
+		memcpy(vals + i * vs, val, vs);
+	}
+
+	n->hdr->nr++;
+}
+
+/**
+ * Remove the entry at index @i of a node.
+ */
+static void zbc_bt_node_remove(struct zbc_btree *tree, struct zbc_bt_node *n,
+			       unsigned int i)
+{
+	size_t vs = tree->params.ztp_val_size;
+	uint64_t *keys = zbc_bt_keys(n);
+	unsigned int nr = n->hdr->nr - 1;
+	uint64_t *ptrs;
+	uint8_t *vals;
+
+	memmove(&keys[i], &keys[i + 1], (nr - i) * sizeof(uint64_t));
+
+	if (n->hdr->level) {
+		ptrs = zbc_bt_ptrs(tree, n);
+		memmove(&ptrs[i], &ptrs[i + 1], (nr - i) * sizeof(uint64_t));
+		memmove(&n->kids[i], &n->kids[i + 1],
+			(nr - i) * sizeof(struct zbc_bt_node *));
+		n->kids[nr] = NULL;
+	} else {
+		vals = zbc_bt_vals(tree, n);
+		memmove(vals + i * vs, vals + (i + 1) * vs, (nr - i) * vs);
+	}
+
+	n->hdr->nr = nr;
+}
+
+/**
+ * Split a full dirty node, moving its upper half to a new node @pr.
+ */
+static int zbc_bt_split(struct zbc_btree *tree, struct zbc_bt_node *n,
+			struct zbc_bt_node **pr)
+{
+	size_t vs = tree->params.ztp_val_size;
+	unsigned int nr = n->hdr->nr, h = nr / 2;
+	struct zbc_bt_node *r;
+
+	r = zbc_bt_node_new(tree, n->hdr->level);
+	if (!r)
+		return -ENOMEM;
+
+	memcpy(zbc_bt_keys(r), zbc_bt_keys(n) + h,
+	       (nr - h) * sizeof(uint64_t));
+	if (n->hdr->level) {
+		memcpy(zbc_bt_ptrs(tree, r), zbc_bt_ptrs(tree, n) + h,
+		       (nr - h) * sizeof(uint64_t));
+		memcpy(r->kids, n->kids + h,
+		       (nr - h) * sizeof(struct zbc_bt_node *));
+		memset(n->kids + h, 0,
+		       (nr - h) * sizeof(struct zbc_bt_node *));
+	} else {
+		memcpy(zbc_bt_vals(tree, r), zbc_bt_vals(tree, n) + h * vs,
+		       (nr - h) * vs);
+	}
+
+	r->hdr->nr = nr - h;
+	n->hdr->nr = h;
+	*pr = r;
+
+	return 0;
+}
+
+/**
+ * Insert @key in the dirty subtree @n. If @n is split, its new right
+ * sibling is returned in @pr with the separator key @sep.
+ */
+static int zbc_bt_insert(struct zbc_btree *tree, struct zbc_bt_node *n,
+			 uint64_t key, const void *val,
+			 uint64_t *sep, struct zbc_bt_node **pr)
+{
+	size_t vs = tree->params.ztp_val_size;
+	unsigned int max = n->hdr->level ? tree->max_inner : tree->max_leaf;
+	struct zbc_bt_node *c, *cr = NULL, *r = NULL;
+	uint64_t csep;
+	unsigned int i;
+	bool found;
+	int ret;
+
+	*pr = NULL;
+
+	if (n->hdr->level) {
+		i = zbc_bt_inner_find(n, key);
+		ret = zbc_bt_dirty_child(tree, n, i, &c);
+		if (ret)
+			return ret;
+		ret = zbc_bt_insert(tree, c, key, val, &csep, &cr);
+		if (ret || !cr)
+			return ret;
+		/* Insert the new child after its left sibling */
+		key = csep;
+		i++;
+	} else {
+		i = zbc_bt_leaf_find(n, key, &found);
+		if (found) {
+			memcpy(zbc_bt_vals(tree, n) + i * vs, val, vs);
+			return 0;
+		}
+		tree->nr_keys++;
+	}
+
+	if (n->hdr->nr == max) {
+		ret = zbc_bt_split(tree, n, &r);
+		if (ret) {
+			/* A child may already be split */
+			if (cr)
+				zbc_bt_node_free_dirty(tree, cr);
+			tree->error = ret;
+			return ret;
+		}
+		if (i >= n->hdr->nr) {
+			i -= n->hdr->nr;
+			n = r;
+		}
+	}
+
+	zbc_bt_node_insert(tree, n, i, key, val, cr);
+
+	if (r) {
+		*sep = zbc_bt_keys(r)[0];
+		r->hdr->lo = *sep;
+		*pr = r;
+	}
+
+	return 0;
+}
+
+/**
+ * zbc_btree_put - Insert or update a key
+ */
+int zbc_btree_put(struct zbc_btree *tree, uint64_t key, const void *val)
+{
+	struct zbc_bt_node *n, *r, *root;
+	uint64_t sep;
+	int ret;
+
+	pthread_mutex_lock(&tree->lock);
+
+	ret = tree->error;
+	if (ret)
+		goto out;
+
+	ret = zbc_bt_dirty_root(tree, &n);
+	if (ret)
+		goto out;
+
+	ret = zbc_bt_insert(tree, n, key, val, &sep, &r);
+	if (ret || !r)
+		goto out;
+
+	/* Grow the tree */
+	if (n->hdr->level + 1 >= ZBC_BT_MAX_HEIGHT ||
+	    !(root = zbc_bt_node_new(tree, n->hdr->level + 1))) {
+		/* The tree is left in an inconsistent state */
+		zbc_bt_node_free_dirty(tree, r);
+		tree->error = -ENOMEM;
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	zbc_bt_keys(root)[0] = n->hdr->lo;
+	zbc_bt_keys(root)[1] = sep;
+	zbc_bt_ptrs(tree, root)[0] = ZBC_BT_NONE;
+	zbc_bt_ptrs(tree, root)[1] = ZBC_BT_NONE;
+	root->kids[0] = n;
+	root->kids[1] = r;
+	root->hdr->nr = 2;
+	tree->root = root;
+
+out:
+	pthread_mutex_unlock(&tree->lock);
+
+	return ret;
+}
+
+/**
+ * Remove @key from the dirty subtree @n. Empty nodes are removed from
+ * their parent.
+ */
+static int zbc_bt_remove(struct zbc_btree *tree, struct zbc_bt_node *n,
+			 uint64_t key)
+{
+	struct zbc_bt_node *c;
+	unsigned int i;
+	bool found;
+	int ret;
+
+	if (!n->hdr->level) {
+		i = zbc_bt_leaf_find(n, key, &found);
+		if (!found)
+			return -ENOENT;
+		zbc_bt_node_remove(tree, n, i);
+		tree->nr_keys--;
+		return 0;
+	}
+
+	i = zbc_bt_inner_find(n, key);
+	ret = zbc_bt_dirty_child(tree, n, i, &c);
+	if (ret)
+		return ret;
+
+	ret = zbc_bt_remove(tree, c, key);
+	if (ret)
+		return ret;
+
+	if (!c->hdr->nr) {
+		zbc_bt_node_free(c);
+		n->kids[i] = NULL;
+		zbc_bt_node_remove(tree, n, i);
+	}
+
+	return 0;
+}
+
+/**
+ * zbc_btree_delete - Delete a key
+ */
+int zbc_btree_delete(struct zbc_btree *tree, uint64_t key)
+{
+	struct zbc_bt_node *n;
+	bool found;
+	int ret;
+
+	pthread_mutex_lock(&tree->lock);
+
+	ret = tree->error;
+	if (ret)
+		goto out;
+
+	/* Do not copy pages if the key is not in the tree */
+	ret = zbc_bt_lookup(tree, key, &n);
+	if (ret)
+		goto out;
+	zbc_bt_leaf_find(n, key, &found);
+	zbc_bt_node_put(n);
+	if (!found) {
+		ret = -ENOENT;
+		goto out;
+	}
+
+	ret = zbc_bt_dirty_root(tree, &n);
+	if (ret)
+		goto out;
+
+	ret = zbc_bt_remove(tree, n, key);
+	if (ret)
+		goto out;
+
+	/* Shrink the tree */
+	if (!n->hdr->nr) {
+		zbc_bt_node_free(n);
+		tree->root = NULL;
+		tree->root_sector = ZBC_BT_NONE;
+	}
+
+	while ((n = tree->root) && n->hdr->level && n->hdr->nr == 1) {
+		if (n->kids[0]) {
+			tree->root = n->kids[0];
+		} else {
+			tree->root = NULL;
+			tree->root_sector = zbc_bt_ptrs(tree, n)[0];
+		}
+		zbc_bt_node_free(n);
+	}
+
+out:
+	pthread_mutex_unlock(&tree->lock);
+
+	return ret;
+}
+
+/**
+ * Write the write batch.
+ */
+static int zbc_bt_write_batch(struct zbc_btree *tree)
+{
+	struct zbc_zone *zone = tree->zone;
+	size_t count = tree->blen >> 9;
+	ssize_t ret;
+
+	if (!count)
+		return 0;
+
+	ret = zbc_pwrite(tree->dev, tree->wbuf, count, tree->bsector);
+	if (ret >= 0 && (size_t)ret != count)
+		ret = -EIO;
+	if (ret < 0)
+		return ret;
+
+	tree->bsector += count;
+	tree->blen = 0;
+	tree->stats.zts_page_writes += count / tree->ps_sectors;
+
+	zone->zbz_write_pointer = tree->bsector;
+	if (tree->bsector >= zbc_zone_start(zone) + zbc_zone_length(zone))
+		zone->zbz_condition = ZBC_ZC_FULL;
+	else
+		zone->zbz_condition = ZBC_ZC_IMP_OPEN;
+
+	return 0;
+}
+
+/**
+ * Append a page to the write batch, returning its sector.
+ */
+static int zbc_bt_append(struct zbc_btree *tree, struct zbc_bt_hdr *hdr,
+			 uint64_t *sector)
+{
+	struct zbc_zone *zone = tree->zone;
+	int ret;
+
+	if (!zone || tree->wsector + tree->ps_sectors >
+	    zbc_zone_start(zone) + zbc_zone_length(zone)) {
+		ret = zbc_bt_write_batch(tree);
+		if (ret)
+			return ret;
+		zone = zbc_zpool_get(&tree->zpool);
+		if (!zone) {
+			zbc_error("%s: No empty zone for B+tree pages\n",
+				  tree->dev->zbd_filename);
+			return -ENOSPC;
+		}
+		tree->zone = zone;
+		tree->wsector = zbc_zone_start(zone);
+		tree->bsector = tree->wsector;
+	}
+
+	if (tree->blen == tree->bsize) {
+		ret = zbc_bt_write_batch(tree);
+		if (ret)
+			return ret;
+	}
+
+	memcpy((char *)tree->wbuf + tree->blen, hdr, tree->ps);
+	tree->blen += tree->ps;
+	*sector = tree->wsector;
+	tree->wsector += tree->ps_sectors;
+	tree->live[zone - tree->zpool.zp_zones]++;
+
+	return 0;
+}
+
+/**
+ * Write a dirty subtree, children first. Written pages become clean
+ * and are added to the page cache.
+ */
+static int zbc_bt_write_node(struct zbc_btree *tree, struct zbc_bt_node *n,
+			     uint64_t *sector)
+{
+	uint64_t *ptrs;
+	unsigned int i;
+	int ret;
+
+	if (n->hdr->level) {
+		ptrs = zbc_bt_ptrs(tree, n);
+		for (i = 0; i < n->hdr->nr; i++) {
+			if (!n->kids[i])
+				continue;
+			ret = zbc_bt_write_node(tree, n->kids[i], &ptrs[i]);
+			if (ret)
+				return ret;
+			n->kids[i] = NULL;
+		}
+	}
+
+	n->hdr->magic = ZBC_BT_PAGE_MAGIC;
+	n->hdr->seq = tree->seq + 1;
+	n->hdr->crc = 0;
+	n->hdr->crc = zbc_crc32c(0, n->hdr, tree->ps);
+
+	ret = zbc_bt_append(tree, n->hdr, sector);
+	if (ret)
+		return ret;
+
+	zbc_free(n->kids);
+	n->kids = NULL;
+	n->dirty = false;
+	n->sector = *sector;
+	zbc_bt_cache_insert(tree, n);
+
+	return 0;
+}
+
+/**
+ * Write a root block.
+ */
+static int zbc_bt_write_root(struct zbc_btree *tree)
+{
+	struct zbc_bt_root *rb = tree->rblk;
+	uint64_t sectors = tree->rblk_size >> 9;
+	ssize_t ret;
+
+	rb->magic = ZBC_BT_ROOT_MAGIC;
+	rb->seq = tree->seq + 1;
+	rb->root = tree->root_sector;
+	rb->nr_keys = tree->nr_keys;
+	rb->page_size = tree->ps;
+	rb->val_size = tree->params.ztp_val_size;
+	rb->nr_zones = tree->zpool.zp_nr_zones;
+	rb->cur_zone = tree->zone ?
+		tree->zone - tree->zpool.zp_zones : (uint32_t)-1;
+	memcpy(rb->live, tree->live, rb->nr_zones * sizeof(uint32_t));
+	rb->crc = 0;
+	rb->crc = zbc_crc32c(0, rb, tree->rblk_size);
+
+	ret = zbc_pwrite(tree->dev, rb, sectors,
+			 tree->params.ztp_root_sector +
+			 (rb->seq & 1) * sectors);
+	if (ret >= 0 && (uint64_t)ret != sectors)
+		ret = -EIO;
+	if (ret < 0)
+		return ret;
+
+	return zbc_flush(tree->dev);
+}
+
+/**
+ * Reset the zones without live pages, except the zone being written.
+ */
+static int zbc_bt_reclaim(struct zbc_btree *tree)
+{
+	struct zbc_zone *zone;
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < tree->zpool.zp_nr_zones; i++) {
+		zone = &tree->zpool.zp_zones[i];
+		if (tree->live[i] || zone == tree->zone ||
+		    zbc_zone_empty(zone))
+			continue;
+		ret = zbc_zpool_put(&tree->zpool, zone);
+		if (ret)
+			return ret;
+		tree->stats.zts_nr_reset_zones++;
+	}
+
+	return 0;
+}
+
+static int zbc_bt_commit(struct zbc_btree *tree)
+{
+	int ret;
+
+	if (!tree->dirty)
+		return 0;
+
+	if (tree->root) {
+		ret = zbc_bt_write_node(tree, tree->root, &tree->root_sector);
+		if (ret)
+			goto err;
+		tree->root = NULL;
+	}
+
+	ret = zbc_bt_write_batch(tree);
+	if (ret)
+		goto err;
+
+	/* Pages must be stable before the root block is */
+	ret = zbc_flush(tree->dev);
+	if (ret)
+		goto err;
+
+	ret = zbc_bt_write_root(tree);
+	if (ret)
+		goto err;
+
+	tree->seq++;
+	tree->dirty = false;
+	tree->stats.zts_nr_commits++;
+
+	ret = zbc_bt_reclaim(tree);
+	if (ret)
+		goto err;
+
+	return 0;
+
+err:
+	zbc_error("%s: B+tree commit failed %d\n",
+		  tree->dev->zbd_filename, ret);
+	tree->error = ret;
+
+	return ret;
+}
+
+/**
+ * Test if the page at @sector is in the tree and make it and the pages on
+ * its path dirty if it is.
+ */
+static int zbc_bt_relocate(struct zbc_btree *tree, uint64_t sector,
+			   unsigned int level, uint64_t lo)
+{
+	struct zbc_bt_node *n, *c;
+	unsigned int path[ZBC_BT_MAX_HEIGHT], depth = 0, i;
+	bool live = false;
+	int ret;
+
+	ret = zbc_bt_root_get(tree, &n);
+	if (ret || !n)
+		return ret;
+
+	/* Find the page without modifying the tree */
+	while (n->hdr->level > level) {
+		i = zbc_bt_inner_find(n, lo);
+		path[depth++] = i;
+		if (n->dirty && n->kids[i]) {
+			n = n->kids[i];
+			continue;
+		}
+		if (n->hdr->level == level + 1 &&
+		    zbc_bt_ptrs(tree, n)[i] == sector) {
+			live = true;
+			break;
+		}
+		ret = zbc_bt_child(tree, n, i, &c);
+		zbc_bt_node_put(n);
+		if (ret)
+			return ret;
+		n = c;
+	}
+	if (!live)
+		live = n->hdr->level == level && !n->dirty && n->sector == sector;
+	zbc_bt_node_put(n);
+
+	if (!live)
+		return 0;
+
+	ret = zbc_bt_dirty_root(tree, &n);
+	for (i = 0; !ret && i < depth; i++)
+		ret = zbc_bt_dirty_child(tree, n, path[i], &n);
+	if (ret)
+		return ret;
+
+	tree->stats.zts_nr_relocated++;
+
+	return 0;
+}
+
+/**
+ * Relocate the live pages of a zone.
+ */
+static int zbc_bt_clean_zone(struct zbc_btree *tree, struct zbc_zone *zone)
+{
+	uint64_t sector = zbc_zone_start(zone), end = zbc_zone_wp(zone);
+	struct zbc_bt_hdr *hdr;
+	size_t count, i;
+	void *buf;
+	ssize_t ret;
+
+	buf = zbc_memalign(sysconf(_SC_PAGESIZE), tree->bsize);
+	if (!buf)
+		return -ENOMEM;
+
+	while (sector < end && tree->live[zone - tree->zpool.zp_zones]) {
+
+		count = tree->bsize >> 9;
+		if (count > end - sector)
+			count = end - sector;
+		ret = zbc_pread(tree->dev, buf, count, sector);
+		if (ret >= 0 && (size_t)ret != count)
+			ret = -EIO;
+		if (ret < 0)
+			goto out;
+
+		for (i = 0; i < count; i += tree->ps_sectors) {
+			hdr = (struct zbc_bt_hdr *)((char *)buf + (i << 9));
+			if (!zbc_bt_page_valid(tree, hdr))
+				continue;
+			ret = zbc_bt_relocate(tree, sector + i,
+					      hdr->level, hdr->lo);
+			if (ret)
+				goto out;
+		}
+
+		sector += count;
+
+	}
+
+	ret = 0;
+
+out:
+	zbc_free(buf);
+
+	return ret;
+}
+
+/**
+ * Clean up to @nr_zones zones, fewest live pages first.
+ */
+static int zbc_bt_clean(struct zbc_btree *tree, unsigned int nr_zones,
+			bool gain)
+{
+	uint64_t zone_pages, min;
+	struct zbc_zone *zone, *victim;
+	unsigned int i, n = 0;
+	int ret;
+
+	while (n < nr_zones) {
+
+		victim = NULL;
+		min = (uint64_t)-1;
+		for (i = 0; i < tree->zpool.zp_nr_zones; i++) {
+			zone = &tree->zpool.zp_zones[i];
+			if (zone == tree->zone || zbc_zone_empty(zone) ||
+			    tree->live[i] >= min)
+				continue;
+			victim = zone;
+			min = tree->live[i];
+		}
+		if (!victim)
+			break;
+
+		/* Relocating a zone of live pages does not free space */
+		zone_pages = zbc_zone_length(victim) / tree->ps_sectors;
+		if (gain && min >= zone_pages)
+			break;
+
+		ret = zbc_bt_clean_zone(tree, victim);
+		if (ret)
+			return ret;
+
+		ret = zbc_bt_commit(tree);
+		if (ret)
+			return ret;
+
+		n++;
+		tree->stats.zts_nr_cleaned_zones++;
+
+	}
+
+	return n;
+}
+
+/**
+ * zbc_btree_commit - Commit a B+tree
+ */
+int zbc_btree_commit(struct zbc_btree *tree)
+{
+	int ret;
+
+	pthread_mutex_lock(&tree->lock);
+
+	ret = tree->error;
+	if (ret)
+		goto out;
+
+	ret = zbc_bt_commit(tree);
+	if (!ret && tree->zpool.zp_nr_free < tree->params.ztp_min_free_zones) {
+		ret = zbc_bt_clean(tree, 1, true);
+		if (ret > 0)
+			ret = 0;
+	}
+
+out:
+	pthread_mutex_unlock(&tree->lock);
+
+	return ret;
+}
+
+/**
+ * zbc_btree_clean - Clean zones of a B+tree
+ */
+int zbc_btree_clean(struct zbc_btree *tree, unsigned int nr_zones)
+{
+	int ret;
+
+	pthread_mutex_lock(&tree->lock);
+
+	ret = tree->error;
+	if (ret)
+		goto out;
+
+	ret = zbc_bt_commit(tree);
+	if (!ret)
+		ret = zbc_bt_clean(tree, nr_zones, false);
+
+out:
+	pthread_mutex_unlock(&tree->lock);
+
+	return ret;
+}
+
+/**
+ * zbc_btree_get_stats - Get a B+tree statistics
+ */
+void zbc_btree_get_stats(struct zbc_btree *tree,
+			 struct zbc_btree_stats *stats)
+{
+	struct zbc_bt_node *n = NULL;
+	unsigned int i;
+
+	pthread_mutex_lock(&tree->lock);
+
+	*stats = tree->stats;
+	stats->zts_nr_keys = tree->nr_keys;
+	stats->zts_nr_pages = 0;
+	for (i = 0; i < tree->zpool.zp_nr_zones; i++)
+		stats->zts_nr_pages += tree->live[i];
+
+	stats->zts_height = 0;
+	if (!tree->error && !zbc_bt_root_get(tree, &n) && n) {
+		stats->zts_height = n->hdr->level + 1;
+		zbc_bt_node_put(n);
+	}
+
+	pthread_mutex_unlock(&tree->lock);
+}
+
+/**
+ * Load the last committed root block.
+ */
+static int zbc_bt_load_root(struct zbc_btree *tree)
+{
+	struct zbc_btree_params *params = &tree->params;
+	uint64_t sectors = tree->rblk_size >> 9;
+	struct zbc_bt_root *rb, *best = NULL;
+	unsigned int nz, i;
+	struct zbc_zone zone;
+	uint32_t crc;
+	void *buf;
+	ssize_t ret;
+
+	/* The root blocks must be in conventional zones */
+	for (i = 0; i < 2; i++) {
+		uint64_t sector = params->ztp_root_sector;
+
+		if (i)
+			sector += 2 * sectors - 1;
+		nz = 1;
+		ret = zbc_report_zones(tree->dev, sector, ZBC_RO_ALL,
+				       &zone, &nz);
+		if (ret)
+			return ret;
+		if (!nz || !zbc_zone_conventional(&zone) ||
+		    !zbc_dev_sect_paligned(tree->dev,
+					   params->ztp_root_sector)) {
+			zbc_error("%s: Invalid B+tree root sector %llu\n",
+				  tree->dev->zbd_filename,
+				  (unsigned long long)sector);
+			return -EINVAL;
+		}
+	}
+
+	buf = zbc_memalign(sysconf(_SC_PAGESIZE), 2 * tree->rblk_size);
+	if (!buf)
+		return -ENOMEM;
+
+	ret = zbc_pread(tree->dev, buf, 2 * sectors, params->ztp_root_sector);
+	if (ret >= 0 && (uint64_t)ret != 2 * sectors)
+		ret = -EIO;
+	if (ret < 0)
+		goto out;
+
+	for (i = 0; i < 2; i++) {
+		rb = (struct zbc_bt_root *)((char *)buf + i * tree->rblk_size);
+		crc = rb->crc;
+		rb->crc = 0;
+		if (rb->magic != ZBC_BT_ROOT_MAGIC ||
+		    (rb->seq & 1) != i ||
+		    crc != zbc_crc32c(0, rb, tree->rblk_size))
+			continue;
+		if (!best || rb->seq > best->seq)
+			best = rb;
+	}
+
+	ret = 0;
+	if (!best)
+		goto out;
+
+	if (best->page_size != tree->ps ||
+	    best->val_size != params->ztp_val_size ||
+	    best->nr_zones != tree->zpool.zp_nr_zones ||
+	    (best->cur_zone != (uint32_t)-1 &&
+	     best->cur_zone >= best->nr_zones)) {
+		zbc_error("%s: B+tree parameters do not match the root block\n",
+			  tree->dev->zbd_filename);
+		ret = -EINVAL;
+		goto out;
+	}
+
+	tree->seq = best->seq;
+	tree->root_sector = best->root;
+	tree->nr_keys = best->nr_keys;
+	memcpy(tree->live, best->live, best->nr_zones * sizeof(uint32_t));
+
+	if (best->cur_zone != (uint32_t)-1) {
+		tree->zone = &tree->zpool.zp_zones[best->cur_zone];
+		tree->wsector = zbc_zone_wp(tree->zone);
+		tree->bsector = tree->wsector;
+		if (zbc_zone_empty(tree->zone))
+			tree->zone = NULL;
+	}
+
+	for (i = 0; i < best->nr_zones; i++) {
+		if (tree->live[i] &&
+		    zbc_zone_empty(&tree->zpool.zp_zones[i])) {
+			zbc_error("%s: Live B+tree pages in empty zone %llu\n",
+				  tree->dev->zbd_filename,
+				  zbc_zone_start(&tree->zpool.zp_zones[i]));
+			ret = -EIO;
+			goto out;
+		}
+	}
+
+out:
+	zbc_free(buf);
+
+	return ret;
+}
+
+/**
+ * zbc_btree_open - Open a B+tree
+ */
+int zbc_btree_open(struct zbc_device *dev, struct zbc_btree_params *params,
+		   struct zbc_btree **ptree)
+{
+	size_t pbs = dev->zbd_info.zbd_pblock_size;
+	struct zbc_btree_params *p;
+	struct zbc_btree *tree;
+	unsigned int i;
+	size_t len;
+	int ret;
+
+	if (!params)
+		return -EINVAL;
+
+	tree = zbc_calloc(1, sizeof(struct zbc_btree));
+	if (!tree)
+		return -ENOMEM;
+
+	tree->dev = dev;
+	tree->params = *params;
+	tree->root_sector = ZBC_BT_NONE;
+	pthread_mutex_init(&tree->lock, NULL);
+	for (i = 0; i < 2; i++) {
+		tree->lru[i].next = &tree->lru[i];
+		tree->lru[i].prev = &tree->lru[i];
+	}
+
+	p = &tree->params;
+	if (!p->ztp_page_size)
+		p->ztp_page_size = ZBC_BT_PAGE_SIZE;
+	if (!p->ztp_val_size)
+		p->ztp_val_size = ZBC_BT_VAL_SIZE;
+	if (!p->ztp_cache_size)
+		p->ztp_cache_size = ZBC_BT_CACHE_SIZE;
+	if (!p->ztp_min_free_zones)
+		p->ztp_min_free_zones = ZBC_BT_MIN_FREE_ZONES;
+
+	tree->ps = p->ztp_page_size;
+	tree->ps_sectors = tree->ps >> 9;
+	len = tree->ps - sizeof(struct zbc_bt_hdr);
+	tree->max_leaf = len / (sizeof(uint64_t) + p->ztp_val_size);
+	tree->max_inner = len / (2 * sizeof(uint64_t));
+	if (tree->ps % pbs || tree->ps > ZBC_BT_IO_SIZE ||
+	    tree->max_leaf < 4 || tree->max_inner < 4 ||
+	    tree->max_leaf > UINT16_MAX) {
+		zbc_error("%s: Invalid B+tree parameters\n",
+			  dev->zbd_filename);
+		ret = -EINVAL;
+		goto err;
+	}
+
+	ret = zbc_zpool_init(&tree->zpool, dev, p->ztp_sector,
+			     p->ztp_nr_sectors);
+	if (ret)
+		goto err;
+
+	tree->live = zbc_calloc(tree->zpool.zp_nr_zones, sizeof(uint32_t));
+	tree->rblk_size = sizeof(struct zbc_bt_root) +
+		tree->zpool.zp_nr_zones * sizeof(uint32_t);
+	tree->rblk_size = (tree->rblk_size + pbs - 1) / pbs * pbs;
+	tree->rblk = zbc_memalign(sysconf(_SC_PAGESIZE), tree->rblk_size);
+	tree->bsize = ZBC_BT_IO_SIZE / tree->ps * tree->ps;
+	tree->wbuf = zbc_memalign(sysconf(_SC_PAGESIZE), tree->bsize);
+	tree->max_cached = p->ztp_cache_size / tree->ps;
+	for (i = 1; i < tree->max_cached; i <<= 1)
+		;
+	tree->hash_mask = i - 1;
+	tree->hash = zbc_calloc(i, sizeof(struct zbc_bt_node *));
+	if (!tree->live || !tree->rblk || !tree->wbuf || !tree->hash) {
+		ret = -ENOMEM;
+		goto err;
+	}
+	memset(tree->rblk, 0, tree->rblk_size);
+
+	ret = zbc_bt_load_root(tree);
+	if (ret)
+		goto err;
+
+	/* Reset the zones without live pages */
+	ret = zbc_bt_reclaim(tree);
+	if (ret)
+		goto err;
+
+	*ptree = tree;
+
+	return 0;
+
+err:
+	zbc_btree_close(tree);
+
+	return ret;
+}
+
+/**
+ * zbc_btree_close - Close a B+tree
+ */
+int zbc_btree_close(struct zbc_btree *tree)
+{
+	struct zbc_bt_node *n;
+	int ret = 0;
+	int l;
+
+	if (!tree)
+		return 0;
+
+	if (tree->hash && !tree->error)
+		ret = zbc_bt_commit(tree);
+
+	if (tree->root)
+		zbc_bt_node_free_dirty(tree, tree->root);
+
+	for (l = 0; l < 2; l++) {
+		while (tree->lru[l].next != &tree->lru[l]) {
+			n = tree->lru[l].next;
+			zbc_bt_lru_del(n);
+			zbc_bt_node_free(n);
+		}
+	}
+
+	zbc_zpool_destroy(&tree->zpool);
+	zbc_free(tree->hash);
+	zbc_free(tree->wbuf);
+	zbc_free(tree->rblk);
+	zbc_free(tree->live);
+	pthread_mutex_destroy(&tree->lock);
+	zbc_free(tree);
+
+	return ret;
+}
@@ -0,0 +1,59 @@
+/*
+ * This file is part of libzbc.
+ *
+ * Copyright (C) 2009-2014, HGST, Inc. All rights reserved.
+ * Copyright (C) 2016, Western Digital. All rights reserved.
+ *
+ * This software is distributed under the terms of the BSD 2-clause license,
+ * "as is," without technical support, and WITHOUT ANY WARRANTY, without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE. You should have received a copy of the BSD 2-clause license along
+ * with libzbc. If not, see  <http://opensource.org/licenses/BSD-2-Clause>.
+ *
+ * Author: Damien Le Moal (damien.lemoal@wdc.com)
+ */
+
+#include "zbc.h"
+
+#include <pthread.h>
+
+/*
+ * CRC32C (Castagnoli) reflected polynomial.
+ */
+#define ZBC_CRC32C_POLY		0x82F63B78
+
+static uint32_t zbc_crc32c_table[256];
+static pthread_once_t zbc_crc32c_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Initialize the CRC lookup table.
+ */
+static void zbc_crc32c_init(void)
+{
+	uint32_t crc;
+	int i, j;
+
+	for (i = 0; i < 256; i++) {
+		crc = i;
+		for (j = 0; j < 8; j++)
+			crc = (crc >> 1) ^ ((crc & 1) ? ZBC_CRC32C_POLY : 0);
+		zbc_crc32c_table[i] = crc;
+	}
+}
+
+/**
+ * Compute the CRC32C of a buffer. @crc is the CRC of the previous part
+ * of the data (0 for the first call).
+ */
+uint32_t zbc_crc32c(uint32_t crc, const void *buf, size_t len)
+{
+	const uint8_t *p = buf;
+
+	pthread_once(&zbc_crc32c_once, zbc_crc32c_init);
+
+	crc = ~crc;
+	while (len--)
+		crc = zbc_crc32c_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+
+	return ~crc;
+}
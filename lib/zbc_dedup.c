@@ -0,0 +1,1170 @@
+/*
+ * This file is part of libzbc.
+ *
+ * Copyright (C) 2009-2014, HGST, Inc. All rights reserved.
+ * Copyright (C) 2016, Western Digital. All rights reserved.
+ *
+ * This software is distributed under the terms of the BSD 2-clause license,
+ * "as is," without technical support, and WITHOUT ANY WARRANTY, without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE. You should have received a copy of the BSD 2-clause license along
+ * with libzbc. If not, see  <http://opensource.org/licenses/BSD-2-Clause>.
+ *
+ * Author: Damien Le Moal (damien.lemoal@wdc.com)
+ */
+
+#include "zbc.h"
+#include "libzbc/zbc_dedup.h"
+
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * Default chunk sizes.
+ */
+#define ZBC_DEDUP_MIN_CHUNK	(2 * 1024)
+#define ZBC_DEDUP_AVG_CHUNK	(8 * 1024)
+#define ZBC_DEDUP_MAX_CHUNK	(64 * 1024)
+
+/**
+ * Writer staging buffer and store write buffer sizes.
+ */
+#define ZBC_DEDUP_WRITER_BUFSZ	(4 * 1024 * 1024)
+#define ZBC_DEDUP_WBUF_SIZE	(1024 * 1024)
+#define ZBC_DEDUP_READ_SIZE	(1024 * 1024)
+
+/**
+ * Chunk record header. Records are aligned on 512B sectors and all
+ * records of a zone have the same epoch (to ignore stale data after the
+ * last record of a finished zone).
+ */
+#define ZBC_DEDUP_REC_MAGIC	0x5a44444b
+
+enum {
+	ZBC_DEDUP_REC_CHUNK	= 1,
+	ZBC_DEDUP_REC_PAD	= 2,
+};
+
+struct zbc_dedup_rec {
+	uint32_t		magic;
+	uint32_t		crc;
+	uint32_t		type;
+	uint32_t		len;
+	uint32_t		sectors;
+	uint32_t		reserved;
+	uint64_t		epoch;
+	uint8_t			fp[ZBC_DEDUP_FP_LEN];
+};
+
+#define zbc_dedup_rec_sectors(len)	\
+	((sizeof(struct zbc_dedup_rec) + (len) + 511) >> 9)
+
+/**
+ * Fingerprint index entry.
+ */
+struct zbc_dedup_entry {
+	uint8_t			fp[ZBC_DEDUP_FP_LEN];
+	uint64_t		sector;
+	uint32_t		sectors;
+	uint32_t		len;
+	uint32_t		refcnt;
+};
+
+/**
+ * Chunk of a writer staging buffer.
+ */
+struct zbc_dedup_chunk {
+	size_t			off;
+	uint32_t		len;
+	uint8_t			fp[ZBC_DEDUP_FP_LEN];
+};
+
+/**
+ * Blob writer.
+ */
+struct zbc_dedup_writer {
+	struct zbc_dedup	*dd;
+	uint8_t			*buf;
+	size_t			bufsz;
+	size_t			len;
+	struct zbc_dedup_chunk	*chunks;
+	unsigned int		max_chunks;
+	struct zbc_dedup_hjob	*hjobs;
+	struct zbc_exec_task	*htasks;
+	struct zbc_dedup_recipe	recipe;
+	unsigned int		max_refs;
+	int			error;
+};
+
+/**
+ * Dedup store.
+ */
+struct zbc_dedup {
+	struct zbc_device	*dev;
+	struct zbc_dedup_params	params;
+	struct zbc_zpool	zpool;
+	size_t			blksz;
+	size_t			lblksz;
+	uint64_t		mask_s;
+	uint64_t		mask_l;
+
+	pthread_mutex_t		lock;
+
+	/* Fingerprint index (open addressing, slot = entry + 1) */
+	struct zbc_dedup_entry	*ents;
+	unsigned int		nr_ents;
+	unsigned int		max_ents;
+	uint32_t		*slots;
+	unsigned int		nr_slots;
+
+	/* Bloom filter */
+	uint64_t		*bloom;
+	uint64_t		bloom_bits;
+
+	/* Number of live record sectors of each zone of the pool */
+	uint64_t		*zone_live;
+
+	/* Zone being written and its write buffer */
+	struct zbc_zone		*zone;
+	uint64_t		epoch;
+	uint8_t			*wbuf;
+	size_t			wbuf_len;
+	uint64_t		wbuf_sector;
+
+	struct zbc_dedup_stats	stats;
+};
+
+/*
+ * Gear hash table.
+ */
+static uint64_t zbc_dedup_gear[256];
+static pthread_once_t zbc_dedup_gear_once = PTHREAD_ONCE_INIT;
+
+static void zbc_dedup_gear_init(void)
+{
+	uint64_t x = 0x5a42435a42435a42ULL, z;
+	int i;
+
+	/* splitmix64: the table must be the same for all runs */
+	for (i = 0; i < 256; i++) {
+		x += 0x9e3779b97f4a7c15ULL;
+		z = x;
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		zbc_dedup_gear[i] = z ^ (z >> 31);
+	}
+}
+
+/**
+ * Find the length of the first chunk of @buf (normalized content-defined
+ * chunking: cut points are harder to find before the average chunk size
+ * and easier after it).
+ */
+static size_t zbc_dedup_cut(struct zbc_dedup *dd, const uint8_t *buf,
+			    size_t len)
+{
+	size_t min = dd->params.zdp_min_chunk;
+	size_t avg = dd->params.zdp_avg_chunk;
+	uint64_t h = 0;
+	size_t i;
+
+	if (len <= min)
+		return len;
+	if (len > dd->params.zdp_max_chunk)
+		len = dd->params.zdp_max_chunk;
+	if (avg > len)
+		avg = len;
+
+	for (i = min; i < avg; i++) {
+		h = (h << 1) + zbc_dedup_gear[buf[i]];
+		if (!(h & dd->mask_s))
+			return i + 1;
+	}
+
+	for (; i < len; i++) {
+		h = (h << 1) + zbc_dedup_gear[buf[i]];
+		if (!(h & dd->mask_l))
+			return i + 1;
+	}
+
+	return len;
+}
+
+/**
+ * Number of chunks fingerprinted by a task.
+ */
+#define ZBC_DEDUP_HASH_BATCH	4
+
+struct zbc_dedup_hjob {
+	const uint8_t		*buf;
+	struct zbc_dedup_chunk	*chunks;
+	unsigned int		nr;
+};
+
+/**
+ * Fingerprint a range of chunks.
+ */
+static void zbc_dedup_hash_job(struct zbc_dedup_hjob *job)
+{
+	struct zbc_dedup_chunk *c;
+
+	for (c = job->chunks; c < &job->chunks[job->nr]; c++)
+		zbc_sha256(job->buf + c->off, c->len, c->fp);
+}
+
+static void zbc_dedup_hash_task(struct zbc_exec_task *task, void *arg)
+{
+	zbc_dedup_hash_job(arg);
+}
+
+/**
+ * Fingerprint the chunks of a writer staging buffer, using the library
+ * executor to run up to zdp_nr_threads jobs in parallel.
+ */
+static void zbc_dedup_hash(struct zbc_dedup_writer *w, unsigned int nr)
+{
+	struct zbc_dedup_hjob *jobs = w->hjobs;
+	unsigned int i, nr_jobs, per_job;
+
+	nr_jobs = (nr + ZBC_DEDUP_HASH_BATCH - 1) / ZBC_DEDUP_HASH_BATCH;
+	if (nr_jobs > w->dd->params.zdp_nr_threads)
+		nr_jobs = w->dd->params.zdp_nr_threads;
+
+	per_job = (nr + nr_jobs - 1) / nr_jobs;
+	for (i = 0; i < nr_jobs; i++) {
+		jobs[i].buf = w->buf;
+		jobs[i].chunks = &w->chunks[i * per_job];
+		jobs[i].nr = nr - i * per_job < per_job ?
+			nr - i * per_job : per_job;
+	}
+
+	zbc_exec_run_all(w->dd->dev, ZBC_EXEC_PRIO_NORMAL,
+			 zbc_dedup_hash_task, jobs,
+			 sizeof(struct zbc_dedup_hjob), w->htasks, nr_jobs);
+}
+
+/**
+ * Bloom filter bit positions of a fingerprint.
+ */
+#define ZBC_DEDUP_BLOOM_K	4
+
+static inline uint64_t zbc_dedup_bloom_bit(struct zbc_dedup *dd,
+					   const uint8_t *fp, int k)
+{
+	uint64_t v;
+
+	memcpy(&v, fp + 8 + k * 4, sizeof(v));
+
+	return v & (dd->bloom_bits - 1);
+}
+
+static void zbc_dedup_bloom_add(struct zbc_dedup *dd, const uint8_t *fp)
+{
+	uint64_t b;
+	int k;
+
+	for (k = 0; k < ZBC_DEDUP_BLOOM_K; k++) {
+		b = zbc_dedup_bloom_bit(dd, fp, k);
+		dd->bloom[b >> 6] |= 1ULL << (b & 63);
+	}
+}
+
+static bool zbc_dedup_bloom_test(struct zbc_dedup *dd, const uint8_t *fp)
+{
+	uint64_t b;
+	int k;
+
+	for (k = 0; k < ZBC_DEDUP_BLOOM_K; k++) {
+		b = zbc_dedup_bloom_bit(dd, fp, k);
+		if (!(dd->bloom[b >> 6] & (1ULL << (b & 63))))
+			return false;
+	}
+
+	return true;
+}
+
+/**
+ * Index slot of a fingerprint.
+ */
+static inline unsigned int zbc_dedup_slot(struct zbc_dedup *dd,
+					  const uint8_t *fp)
+{
+	uint32_t h;
+
+	memcpy(&h, fp, sizeof(h));
+
+	return h & (dd->nr_slots - 1);
+}
+
+/**
+ * Look up a fingerprint in the index.
+ */
+static struct zbc_dedup_entry *zbc_dedup_lookup(struct zbc_dedup *dd,
+						const uint8_t *fp)
+{
+	unsigned int s = zbc_dedup_slot(dd, fp);
+	struct zbc_dedup_entry *e;
+
+	while (dd->slots[s]) {
+		e = &dd->ents[dd->slots[s] - 1];
+		if (memcmp(e->fp, fp, ZBC_DEDUP_FP_LEN) == 0)
+			return e;
+		s = (s + 1) & (dd->nr_slots - 1);
+	}
+
+	return NULL;
+}
+
+/**
+ * Rebuild the index slots and the bloom filter from the entry array.
+ */
+static int zbc_dedup_rehash(struct zbc_dedup *dd, unsigned int nr_slots)
+{
+	uint32_t *slots;
+	unsigned int i, s;
+
+	slots = zbc_calloc(nr_slots, sizeof(uint32_t));
+	if (!slots)
+		return -ENOMEM;
+
+	zbc_free(dd->slots);
+	dd->slots = slots;
+	dd->nr_slots = nr_slots;
+	memset(dd->bloom, 0, dd->bloom_bits >> 3);
+
+	for (i = 0; i < dd->nr_ents; i++) {
+		s = zbc_dedup_slot(dd, dd->ents[i].fp);
+		while (slots[s])
+			s = (s + 1) & (nr_slots - 1);
+		slots[s] = i + 1;
+		zbc_dedup_bloom_add(dd, dd->ents[i].fp);
+	}
+
+	return 0;
+}
+
+/**
+ * Add a chunk to the index.
+ */
+static struct zbc_dedup_entry *zbc_dedup_insert(struct zbc_dedup *dd,
+						const uint8_t *fp,
+						uint64_t sector,
+						uint32_t sectors,
+						uint32_t len)
+{
+	struct zbc_dedup_entry *e;
+	unsigned int s;
+
+	if (dd->nr_ents == dd->max_ents) {
+		dd->max_ents = dd->max_ents ? dd->max_ents * 2 : 4096;
+		e = zbc_realloc(dd->ents,
+				dd->nr_ents * sizeof(struct zbc_dedup_entry),
+				dd->max_ents * sizeof(struct zbc_dedup_entry));
+		if (!e)
+			return NULL;
+		dd->ents = e;
+	}
+
+	/* Keep the index load under 70% */
+	if ((dd->nr_ents + 1) * 10 > dd->nr_slots * 7) {
+		if (zbc_dedup_rehash(dd, dd->nr_slots * 2))
+			return NULL;
+	}
+
+	e = &dd->ents[dd->nr_ents];
+	memcpy(e->fp, fp, ZBC_DEDUP_FP_LEN);
+	e->sector = sector;
+	e->sectors = sectors;
+	e->len = len;
+	e->refcnt = 0;
+
+	s = zbc_dedup_slot(dd, fp);
+	while (dd->slots[s])
+		s = (s + 1) & (dd->nr_slots - 1);
+	dd->slots[s] = ++dd->nr_ents;
+
+	zbc_dedup_bloom_add(dd, fp);
+
+	return e;
+}
+
+/**
+ * Get the live sectors counter of the zone containing a chunk.
+ */
+static inline uint64_t *zbc_dedup_zone_live(struct zbc_dedup *dd,
+					    uint64_t sector)
+{
+	struct zbc_zone *zone = zbc_zpool_lookup(&dd->zpool, sector);
+
+	return &dd->zone_live[zone - dd->zpool.zp_zones];
+}
+
+static inline void zbc_dedup_get_entry(struct zbc_dedup *dd,
+				       struct zbc_dedup_entry *e)
+{
+	if (!e->refcnt++)
+		*zbc_dedup_zone_live(dd, e->sector) += e->sectors;
+}
+
+static inline void zbc_dedup_put_entry(struct zbc_dedup *dd,
+				       struct zbc_dedup_entry *e)
+{
+	if (e->refcnt && !--e->refcnt)
+		*zbc_dedup_zone_live(dd, e->sector) -= e->sectors;
+}
+
+/**
+ * Write the content of the write buffer. If @final is true, the buffer
+ * is padded to a physical block and fully written. Otherwise, only the
+ * physical blocks that are complete are written.
+ * Called with the store locked.
+ */
+static int zbc_dedup_wbuf_flush(struct zbc_dedup *dd, bool final)
+{
+	struct zbc_zone *zone = dd->zone;
+	struct zbc_dedup_rec *rec;
+	size_t len;
+	ssize_t ret;
+
+	if (!dd->wbuf_len)
+		return 0;
+
+	if (final) {
+		len = (dd->wbuf_len + dd->blksz - 1) & ~(dd->blksz - 1);
+		if (len > dd->wbuf_len) {
+			rec = (struct zbc_dedup_rec *)(dd->wbuf + dd->wbuf_len);
+			memset(rec, 0, len - dd->wbuf_len);
+			rec->magic = ZBC_DEDUP_REC_MAGIC;
+			rec->type = ZBC_DEDUP_REC_PAD;
+			rec->sectors = (len - dd->wbuf_len) >> 9;
+			rec->epoch = dd->epoch;
+			rec->crc = zbc_crc32c(0, rec, sizeof(*rec));
+			dd->wbuf_len = len;
+		}
+	} else {
+		len = dd->wbuf_len & ~(dd->blksz - 1);
+		if (!len)
+			return 0;
+	}
+
+	ret = zbc_pwrite(dd->dev, dd->wbuf, len >> 9, dd->wbuf_sector);
+	if (ret != (ssize_t)(len >> 9)) {
+		zbc_error("%s: Write dedup chunks at sector %llu failed %zd\n",
+			  dd->dev->zbd_filename,
+			  (unsigned long long)dd->wbuf_sector, ret);
+		return ret < 0 ? ret : -EIO;
+	}
+
+	zone->zbz_write_pointer += len >> 9;
+	if (zbc_zone_wp(zone) == zbc_zone_start(zone) + zbc_zone_length(zone))
+		zone->zbz_condition = ZBC_ZC_FULL;
+	else
+		zone->zbz_condition = ZBC_ZC_IMP_OPEN;
+
+	dd->wbuf_len -= len;
+	memmove(dd->wbuf, dd->wbuf + len, dd->wbuf_len);
+	dd->wbuf_sector += len >> 9;
+
+	return 0;
+}
+
+/**
+ * Reserve space for a record of @sectors sectors in the write buffer.
+ * Called with the store locked.
+ */
+static int zbc_dedup_wbuf_reserve(struct zbc_dedup *dd, uint32_t sectors)
+{
+	struct zbc_zone *zone = dd->zone;
+	int ret;
+
+	if (zone &&
+	    dd->wbuf_sector + (dd->wbuf_len >> 9) + sectors >
+	    zbc_zone_start(zone) + zbc_zone_length(zone)) {
+
+		/* Zone full: write what is left and finish the zone */
+		ret = zbc_dedup_wbuf_flush(dd, true);
+		if (ret)
+			return ret;
+		if (!zbc_zone_full(zone)) {
+			ret = zbc_finish_zone(dd->dev, zbc_zone_start(zone), 0);
+			if (ret)
+				return ret;
+			zone->zbz_write_pointer = zbc_zone_start(zone) +
+				zbc_zone_length(zone);
+			zone->zbz_condition = ZBC_ZC_FULL;
+		}
+		dd->zone = NULL;
+
+	}
+
+	if (!dd->zone) {
+		zone = zbc_zpool_get(&dd->zpool);
+		if (!zone) {
+			zbc_error("%s: No empty zone left for dedup chunks\n",
+				  dd->dev->zbd_filename);
+			return -ENOSPC;
+		}
+		dd->zone = zone;
+		dd->epoch = zbc_time_ns() ^ ((uint64_t)getpid() << 32) ^
+			zbc_zone_start(zone);
+		dd->wbuf_sector = zbc_zone_wp(zone);
+		dd->wbuf_len = 0;
+	}
+
+	if (dd->wbuf_len + ((size_t)sectors << 9) > ZBC_DEDUP_WBUF_SIZE)
+		return zbc_dedup_wbuf_flush(dd, false);
+
+	return 0;
+}
+
+/**
+ * Store a chunk, or reference it if it is already stored.
+ * Called with the store locked.
+ */
+static int zbc_dedup_store(struct zbc_dedup *dd, const uint8_t *data,
+			   struct zbc_dedup_chunk *c,
+			   struct zbc_dedup_ref *ref)
+{
+	uint32_t sectors = zbc_dedup_rec_sectors(c->len);
+	struct zbc_dedup_entry *e;
+	struct zbc_dedup_rec *rec;
+	uint64_t sector;
+	int ret;
+
+	dd->stats.zds_nr_chunks++;
+	dd->stats.zds_logical_bytes += c->len;
+
+	if (zbc_dedup_bloom_test(dd, c->fp)) {
+		e = zbc_dedup_lookup(dd, c->fp);
+		if (e) {
+			dd->stats.zds_nr_dup_chunks++;
+			goto out;
+		}
+		dd->stats.zds_bloom_false_positives++;
+	} else {
+		dd->stats.zds_bloom_negatives++;
+	}
+
+	/* New chunk */
+	ret = zbc_dedup_wbuf_reserve(dd, sectors);
+	if (ret)
+		return ret;
+
+	sector = dd->wbuf_sector + (dd->wbuf_len >> 9);
+	rec = (struct zbc_dedup_rec *)(dd->wbuf + dd->wbuf_len);
+	memset(rec, 0, sizeof(*rec));
+	rec->magic = ZBC_DEDUP_REC_MAGIC;
+	rec->type = ZBC_DEDUP_REC_CHUNK;
+	rec->len = c->len;
+	rec->sectors = sectors;
+	rec->epoch = dd->epoch;
+	memcpy(rec->fp, c->fp, ZBC_DEDUP_FP_LEN);
+	rec->crc = zbc_crc32c(0, rec, sizeof(*rec));
+	memcpy(rec + 1, data + c->off, c->len);
+	memset((uint8_t *)(rec + 1) + c->len, 0,
+	       ((size_t)sectors << 9) - sizeof(*rec) - c->len);
+
+	e = zbc_dedup_insert(dd, c->fp, sector, sectors, c->len);
+	if (!e)
+		return -ENOMEM;
+
+	dd->wbuf_len += (size_t)sectors << 9;
+	dd->stats.zds_stored_bytes += c->len;
+
+out:
+	zbc_dedup_get_entry(dd, e);
+	ref->zdr_sector = e->sector;
+	ref->zdr_sectors = e->sectors;
+	ref->zdr_len = e->len;
+	memcpy(ref->zdr_fp, e->fp, ZBC_DEDUP_FP_LEN);
+
+	return 0;
+}
+
+/**
+ * Check a record header.
+ */
+static bool zbc_dedup_rec_valid(struct zbc_dedup_rec *rec)
+{
+	uint32_t crc = rec->crc;
+	bool valid;
+
+	if (rec->magic != ZBC_DEDUP_REC_MAGIC)
+		return false;
+
+	rec->crc = 0;
+	valid = crc == zbc_crc32c(0, rec, sizeof(*rec));
+	rec->crc = crc;
+
+	return valid && rec->sectors &&
+		(size_t)rec->len + sizeof(*rec) <= (size_t)rec->sectors << 9;
+}
+
+/**
+ * Rebuild the index from the chunk records of a zone.
+ */
+static int zbc_dedup_scan_zone(struct zbc_dedup *dd, struct zbc_zone *zone,
+			       uint8_t *buf)
+{
+	uint64_t lsect = dd->lblksz >> 9;
+	uint64_t sector = zbc_zone_start(zone), end = zbc_zone_wp(zone);
+	uint64_t win = 0, win_sectors = 0, epoch = 0;
+	struct zbc_dedup_rec *rec;
+	ssize_t ret;
+
+	/* The write pointer of full zones is not valid */
+	if (zbc_zone_full(zone))
+		end = zbc_zone_start(zone) + zbc_zone_length(zone);
+
+	while (sector < end) {
+
+		if (sector < win || sector >= win + win_sectors) {
+			win = sector & ~(lsect - 1);
+			win_sectors = end - win;
+			if (win_sectors > ZBC_DEDUP_READ_SIZE >> 9)
+				win_sectors = ZBC_DEDUP_READ_SIZE >> 9;
+			ret = zbc_pread(dd->dev, buf, win_sectors, win);
+			if (ret != (ssize_t)win_sectors)
+				return ret < 0 ? ret : -EIO;
+		}
+
+		rec = (struct zbc_dedup_rec *)(buf + ((sector - win) << 9));
+		if (!zbc_dedup_rec_valid(rec) ||
+		    (epoch && rec->epoch != epoch) ||
+		    sector + rec->sectors > end)
+			break;
+		epoch = rec->epoch;
+
+		if (rec->type == ZBC_DEDUP_REC_CHUNK &&
+		    !zbc_dedup_lookup(dd, rec->fp)) {
+			if (!zbc_dedup_insert(dd, rec->fp, sector,
+					      rec->sectors, rec->len))
+				return -ENOMEM;
+		}
+
+		sector += rec->sectors;
+
+	}
+
+	return 0;
+}
+
+/**
+ * zbc_dedup_open - Open a dedup store
+ */
+int zbc_dedup_open(struct zbc_device *dev, struct zbc_dedup_params *params,
+		   struct zbc_dedup **pdd)
+{
+	struct zbc_dedup_params *p;
+	struct zbc_dedup *dd;
+	uint64_t nr_sectors = 0;
+	unsigned int i, bits;
+	uint8_t *buf = NULL;
+	long nr_cpus;
+	int ret;
+
+	pthread_once(&zbc_dedup_gear_once, zbc_dedup_gear_init);
+
+	dd = zbc_calloc(1, sizeof(struct zbc_dedup));
+	if (!dd)
+		return -ENOMEM;
+
+	dd->dev = dev;
+	dd->params = *params;
+	dd->blksz = dev->zbd_info.zbd_pblock_size;
+	dd->lblksz = dev->zbd_info.zbd_lblock_size;
+	pthread_mutex_init(&dd->lock, NULL);
+
+	p = &dd->params;
+	if (!p->zdp_min_chunk)
+		p->zdp_min_chunk = ZBC_DEDUP_MIN_CHUNK;
+	if (!p->zdp_avg_chunk)
+		p->zdp_avg_chunk = ZBC_DEDUP_AVG_CHUNK;
+	if (!p->zdp_max_chunk)
+		p->zdp_max_chunk = ZBC_DEDUP_MAX_CHUNK;
+	if (p->zdp_avg_chunk & (p->zdp_avg_chunk - 1) ||
+	    p->zdp_avg_chunk < 256 ||
+	    p->zdp_min_chunk > p->zdp_avg_chunk ||
+	    p->zdp_avg_chunk > p->zdp_max_chunk ||
+	    zbc_dedup_rec_sectors(p->zdp_max_chunk) << 9 >
+	    ZBC_DEDUP_WBUF_SIZE) {
+		ret = -EINVAL;
+		goto err;
+	}
+
+	/* Cut point masks use the high bits of the gear hash */
+	bits = __builtin_ctz(p->zdp_avg_chunk);
+	dd->mask_s = ~0ULL << (64 - (bits + 1));
+	dd->mask_l = ~0ULL << (64 - (bits - 1));
+
+	ret = zbc_zpool_init(&dd->zpool, dev, p->zdp_sector,
+			     p->zdp_nr_sectors);
+	if (ret)
+		goto err;
+
+	dd->zone_live = zbc_calloc(dd->zpool.zp_nr_zones, sizeof(uint64_t));
+	if (!dd->zone_live) {
+		ret = -ENOMEM;
+		goto err;
+	}
+
+	/* Bloom filter: about 10 bits per chunk the zones can hold */
+	for (i = 0; i < dd->zpool.zp_nr_zones; i++)
+		nr_sectors += zbc_zone_length(&dd->zpool.zp_zones[i]);
+	dd->bloom_bits = 1ULL << 16;
+	while (dd->bloom_bits < (nr_sectors << 9) / p->zdp_avg_chunk * 10)
+		dd->bloom_bits <<= 1;
+	dd->bloom = zbc_calloc(dd->bloom_bits >> 6, sizeof(uint64_t));
+	if (!dd->bloom) {
+		ret = -ENOMEM;
+		goto err;
+	}
+
+	ret = zbc_dedup_rehash(dd, 8192);
+	if (ret)
+		goto err;
+
+	dd->wbuf = zbc_memalign(dd->blksz, ZBC_DEDUP_WBUF_SIZE);
+	buf = zbc_memalign(dd->blksz, ZBC_DEDUP_READ_SIZE);
+	if (!dd->wbuf || !buf) {
+		ret = -ENOMEM;
+		goto err;
+	}
+
+	/* Rebuild the index */
+	for (i = 0; i < dd->zpool.zp_nr_zones; i++) {
+		if (zbc_zone_empty(&dd->zpool.zp_zones[i]))
+			continue;
+		ret = zbc_dedup_scan_zone(dd, &dd->zpool.zp_zones[i], buf);
+		if (ret)
+			goto err;
+	}
+	zbc_free(buf);
+	buf = NULL;
+
+	/* Fingerprinting jobs run in parallel */
+	if (!p->zdp_nr_threads) {
+		nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		p->zdp_nr_threads = nr_cpus > 0 ? nr_cpus : 1;
+	}
+
+	*pdd = dd;
+
+	return 0;
+
+err:
+	zbc_free(buf);
+	zbc_dedup_close(dd);
+
+	return ret;
+}
+
+/**
+ * zbc_dedup_close - Close a dedup store
+ */
+int zbc_dedup_close(struct zbc_dedup *dd)
+{
+	int ret = 0;
+
+	if (dd->zone)
+		ret = zbc_dedup_wbuf_flush(dd, true);
+
+	zbc_free(dd->wbuf);
+	zbc_free(dd->ents);
+	zbc_free(dd->slots);
+	zbc_free(dd->bloom);
+	zbc_free(dd->zone_live);
+	zbc_zpool_destroy(&dd->zpool);
+	pthread_mutex_destroy(&dd->lock);
+	zbc_free(dd);
+
+	return ret;
+}
+
+/**
+ * zbc_dedup_writer_open - Start writing a blob
+ */
+int zbc_dedup_writer_open(struct zbc_dedup *dd, struct zbc_dedup_writer **pw)
+{
+	struct zbc_dedup_writer *w;
+
+	w = zbc_calloc(1, sizeof(struct zbc_dedup_writer));
+	if (!w)
+		return -ENOMEM;
+
+	w->dd = dd;
+	w->bufsz = ZBC_DEDUP_WRITER_BUFSZ;
+	if (w->bufsz < 16 * (size_t)dd->params.zdp_max_chunk)
+		w->bufsz = 16 * (size_t)dd->params.zdp_max_chunk;
+	w->max_chunks = w->bufsz / dd->params.zdp_min_chunk + 1;
+	w->buf = zbc_malloc(w->bufsz);
+	w->chunks = zbc_calloc(w->max_chunks, sizeof(struct zbc_dedup_chunk));
+	w->hjobs = zbc_calloc(dd->params.zdp_nr_threads,
+			      sizeof(struct zbc_dedup_hjob));
+	w->htasks = zbc_calloc(dd->params.zdp_nr_threads,
+			       sizeof(struct zbc_exec_task));
+	if (!w->buf || !w->chunks || !w->hjobs || !w->htasks) {
+		zbc_free(w->buf);
+		zbc_free(w->chunks);
+		zbc_free(w->hjobs);
+		zbc_free(w->htasks);
+		zbc_free(w);
+		return -ENOMEM;
+	}
+
+	*pw = w;
+
+	return 0;
+}
+
+/**
+ * Chunk, fingerprint and store the data of a writer staging buffer.
+ * If @final is false, data that may be part of a chunk not yet
+ * complete is kept in the buffer.
+ */
+static int zbc_dedup_process(struct zbc_dedup_writer *w, bool final)
+{
+	struct zbc_dedup *dd = w->dd;
+	struct zbc_dedup_recipe *r = &w->recipe;
+	struct zbc_dedup_ref *refs;
+	unsigned int n = 0, i;
+	size_t pos = 0, len;
+	int ret = 0;
+
+	while (pos < w->len) {
+		if (!final && w->len - pos < dd->params.zdp_max_chunk)
+			break;
+		len = zbc_dedup_cut(dd, w->buf + pos, w->len - pos);
+		w->chunks[n].off = pos;
+		w->chunks[n].len = len;
+		n++;
+		pos += len;
+	}
+
+	if (!n)
+		return 0;
+
+	if (r->zdp_nr_chunks + n > w->max_refs) {
+		w->max_refs = (r->zdp_nr_chunks + n) * 2;
+		refs = zbc_realloc(r->zdp_chunks,
+				   r->zdp_nr_chunks * sizeof(struct zbc_dedup_ref),
+				   w->max_refs * sizeof(struct zbc_dedup_ref));
+		if (!refs)
+			return -ENOMEM;
+		r->zdp_chunks = refs;
+	}
+
+	zbc_dedup_hash(w, n);
+
+	pthread_mutex_lock(&dd->lock);
+	for (i = 0; i < n; i++) {
+		ret = zbc_dedup_store(dd, w->buf, &w->chunks[i],
+				      &r->zdp_chunks[r->zdp_nr_chunks]);
+		if (ret)
+			break;
+		r->zdp_nr_chunks++;
+		r->zdp_len += w->chunks[i].len;
+	}
+	pthread_mutex_unlock(&dd->lock);
+
+	w->len -= pos;
+	memmove(w->buf, w->buf + pos, w->len);
+
+	return ret;
+}
+
+/**
+ * zbc_dedup_write - Write data to a blob
+ */
+int zbc_dedup_write(struct zbc_dedup_writer *w, const void *buf, size_t len)
+{
+	const uint8_t *p = buf;
+	size_t sz;
+
+	if (w->error)
+		return w->error;
+
+	while (len) {
+		sz = w->bufsz - w->len;
+		if (sz > len)
+			sz = len;
+		memcpy(w->buf + w->len, p, sz);
+		w->len += sz;
+		p += sz;
+		len -= sz;
+		if (w->len == w->bufsz) {
+			w->error = zbc_dedup_process(w, false);
+			if (w->error)
+				return w->error;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * zbc_dedup_writer_close - Finish writing a blob
+ */
+int zbc_dedup_writer_close(struct zbc_dedup_writer *w,
+			   struct zbc_dedup_recipe *recipe)
+{
+	struct zbc_dedup *dd = w->dd;
+	int ret = w->error;
+
+	if (!ret && recipe)
+		ret = zbc_dedup_process(w, true);
+
+	if (!ret && recipe) {
+		pthread_mutex_lock(&dd->lock);
+		if (dd->zone)
+			ret = zbc_dedup_wbuf_flush(dd, true);
+		pthread_mutex_unlock(&dd->lock);
+		if (!ret)
+			ret = zbc_flush(dd->dev);
+	}
+
+	if (ret || !recipe) {
+		zbc_dedup_unref(dd, &w->recipe);
+		zbc_dedup_recipe_free(&w->recipe);
+	} else {
+		*recipe = w->recipe;
+	}
+
+	zbc_free(w->buf);
+	zbc_free(w->chunks);
+	zbc_free(w->hjobs);
+	zbc_free(w->htasks);
+	zbc_free(w);
+
+	return ret;
+}
+
+/**
+ * zbc_dedup_recipe_free - Free a recipe chunk array
+ */
+void zbc_dedup_recipe_free(struct zbc_dedup_recipe *recipe)
+{
+	zbc_free(recipe->zdp_chunks);
+	recipe->zdp_chunks = NULL;
+	recipe->zdp_nr_chunks = 0;
+	recipe->zdp_len = 0;
+}
+
+/**
+ * zbc_dedup_read - Read data from a blob
+ */
+ssize_t zbc_dedup_read(struct zbc_dedup *dd, struct zbc_dedup_recipe *recipe,
+		       void *buf, size_t len, uint64_t offset)
+{
+	uint64_t lsect = dd->lblksz >> 9, coff = 0, start, end, run_end;
+	uint64_t zone_end;
+	struct zbc_dedup_ref *ref = recipe->zdp_chunks, *r, *last;
+	struct zbc_dedup_ref *end_ref = ref + recipe->zdp_nr_chunks;
+	size_t bufsz, done = 0, sz, skip;
+	struct zbc_dedup_rec *rec;
+	struct zbc_zone *zone;
+	uint8_t *rbuf;
+	ssize_t ret;
+
+	if (offset >= recipe->zdp_len)
+		return 0;
+	if (len > recipe->zdp_len - offset)
+		len = recipe->zdp_len - offset;
+
+	bufsz = ZBC_DEDUP_READ_SIZE;
+	if (bufsz < (zbc_dedup_rec_sectors(dd->params.zdp_max_chunk) << 9) +
+	    2 * dd->lblksz)
+		bufsz = (zbc_dedup_rec_sectors(dd->params.zdp_max_chunk) << 9) +
+			2 * dd->lblksz;
+	rbuf = zbc_memalign(dd->blksz, bufsz);
+	if (!rbuf)
+		return -ENOMEM;
+
+	/* Find the first chunk */
+	while (ref < end_ref && coff + ref->zdr_len <= offset) {
+		coff += ref->zdr_len;
+		ref++;
+	}
+
+	while (done < len && ref < end_ref) {
+
+		/* Gather chunks stored contiguously in the same zone */
+		zone = zbc_zpool_lookup(&dd->zpool, ref->zdr_sector);
+		if (!zone) {
+			ret = -EINVAL;
+			goto out;
+		}
+		zone_end = zbc_zone_start(zone) + zbc_zone_length(zone);
+		start = ref->zdr_sector & ~(lsect - 1);
+		last = ref;
+		run_end = ref->zdr_sector + ref->zdr_sectors;
+		while (last + 1 < end_ref &&
+		       last[1].zdr_sector == run_end &&
+		       run_end + last[1].zdr_sectors <= zone_end &&
+		       ((((run_end + last[1].zdr_sectors + lsect - 1) &
+			  ~(lsect - 1)) - start) << 9) <= bufsz &&
+		       coff + (run_end - ref->zdr_sector) < offset + len) {
+			last++;
+			run_end += last->zdr_sectors;
+		}
+		end = (run_end + lsect - 1) & ~(lsect - 1);
+
+		ret = zbc_pread(dd->dev, rbuf, end - start, start);
+		if (ret != (ssize_t)(end - start)) {
+			ret = ret < 0 ? ret : -EIO;
+			goto out;
+		}
+
+		for (r = ref; r <= last && done < len; r++) {
+			rec = (struct zbc_dedup_rec *)
+				(rbuf + ((r->zdr_sector - start) << 9));
+			if (!zbc_dedup_rec_valid(rec) ||
+			    rec->type != ZBC_DEDUP_REC_CHUNK ||
+			    rec->len != r->zdr_len ||
+			    memcmp(rec->fp, r->zdr_fp, ZBC_DEDUP_FP_LEN) != 0) {
+				zbc_error("%s: Invalid dedup chunk at sector %llu\n",
+					  dd->dev->zbd_filename,
+					  (unsigned long long)r->zdr_sector);
+				ret = -EIO;
+				goto out;
+			}
+			skip = offset + done > coff ? offset + done - coff : 0;
+			sz = r->zdr_len - skip;
+			if (sz > len - done)
+				sz = len - done;
+			memcpy((uint8_t *)buf + done,
+			       (uint8_t *)(rec + 1) + skip, sz);
+			done += sz;
+			coff += r->zdr_len;
+		}
+
+		ref = last + 1;
+
+	}
+
+	ret = done;
+
+out:
+	zbc_free(rbuf);
+
+	return ret;
+}
+
+/**
+ * Change the reference count of the chunks of a recipe.
+ */
+static int zbc_dedup_ref_recipe(struct zbc_dedup *dd,
+				struct zbc_dedup_recipe *recipe, bool get)
+{
+	struct zbc_dedup_entry *e;
+	unsigned int i;
+	int ret = 0;
+
+	pthread_mutex_lock(&dd->lock);
+
+	for (i = 0; i < recipe->zdp_nr_chunks; i++) {
+		if (!zbc_dedup_lookup(dd, recipe->zdp_chunks[i].zdr_fp)) {
+			ret = -ENOENT;
+			goto out;
+		}
+	}
+
+	for (i = 0; i < recipe->zdp_nr_chunks; i++) {
+		e = zbc_dedup_lookup(dd, recipe->zdp_chunks[i].zdr_fp);
+		if (get)
+			zbc_dedup_get_entry(dd, e);
+		else
+			zbc_dedup_put_entry(dd, e);
+	}
+
+out:
+	pthread_mutex_unlock(&dd->lock);
+
+	return ret;
+}
+
+/**
+ * zbc_dedup_ref - Reference the chunks of a recipe
+ */
+int zbc_dedup_ref(struct zbc_dedup *dd, struct zbc_dedup_recipe *recipe)
+{
+	return zbc_dedup_ref_recipe(dd, recipe, true);
+}
+
+/**
+ * zbc_dedup_unref - Release the chunks of a recipe
+ */
+int zbc_dedup_unref(struct zbc_dedup *dd, struct zbc_dedup_recipe *recipe)
+{
+	return zbc_dedup_ref_recipe(dd, recipe, false);
+}
+
+/**
+ * zbc_dedup_gc - Reclaim the zones of unreferenced chunks
+ */
+int zbc_dedup_gc(struct zbc_dedup *dd)
+{
+	struct zbc_zpool *zp = &dd->zpool;
+	struct zbc_zone *zone;
+	unsigned int i, j, nr_zones = 0;
+	bool *dead;
+	int ret = 0;
+
+	dead = zbc_calloc(zp->zp_nr_zones, sizeof(bool));
+	if (!dead)
+		return -ENOMEM;
+
+	pthread_mutex_lock(&dd->lock);
+
+	for (i = 0; i < zp->zp_nr_zones; i++) {
+		zone = &zp->zp_zones[i];
+		if (zone == dd->zone || zbc_zone_empty(zone) ||
+		    dd->zone_live[i])
+			continue;
+		dead[i] = true;
+		nr_zones++;
+	}
+
+	if (!nr_zones)
+		goto out;
+
+	/* Remove the chunks of dead zones from the index */
+	for (i = 0, j = 0; i < dd->nr_ents; i++) {
+		zone = zbc_zpool_lookup(zp, dd->ents[i].sector);
+		if (dead[zone - zp->zp_zones])
+			continue;
+		dd->ents[j++] = dd->ents[i];
+	}
+	dd->nr_ents = j;
+	ret = zbc_dedup_rehash(dd, dd->nr_slots);
+	if (ret)
+		goto out;
+
+	for (i = 0; i < zp->zp_nr_zones; i++) {
+		if (!dead[i])
+			continue;
+		ret = zbc_zpool_put(zp, &zp->zp_zones[i]);
+		if (ret)
+			goto out;
+		dd->stats.zds_nr_gc_zones++;
+	}
+
+	ret = nr_zones;
+
+out:
+	pthread_mutex_unlock(&dd->lock);
+	zbc_free(dead);
+
+	return ret;
+}
+
+/**
+ * zbc_dedup_get_stats - Get a dedup store statistics
+ */
+void zbc_dedup_get_stats(struct zbc_dedup *dd, struct zbc_dedup_stats *stats)
+{
+	pthread_mutex_lock(&dd->lock);
+	*stats = dd->stats;
+	stats->zds_nr_index_chunks = dd->nr_ents;
+	pthread_mutex_unlock(&dd->lock);
+}
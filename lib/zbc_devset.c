@@ -0,0 +1,461 @@
+/*
+ * This file is part of libzbc.
+ *
+ * Copyright (C) 2009-2014, HGST, Inc. All rights reserved.
+ * Copyright (C) 2016, Western Digital. All rights reserved.
+ *
+ * This software is distributed under the terms of the BSD 2-clause license,
+ * "as is," without technical support, and WITHOUT ANY WARRANTY, without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE. You should have received a copy of the BSD 2-clause license along
+ * with libzbc. If not, see  <http://opensource.org/licenses/BSD-2-Clause>.
+ *
+ * Author: Damien Le Moal (damien.lemoal@wdc.com)
+ */
+
+#include "zbc.h"
+#include "libzbc/zbc_devset.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+/**
+ * Default maximum number of requests in flight.
+ */
+#define ZBC_DEVSET_MAX_REQS	1024
+
+/**
+ * Number of buckets of the device hash table.
+ */
+#define ZBC_DEVSET_HASH_SIZE	256
+
+#define zbc_devset_hash(dev)	\
+	(((unsigned long)(dev) >> 6) % ZBC_DEVSET_HASH_SIZE)
+
+/**
+ * Request entry.
+ */
+struct zbc_devset_ent {
+	struct zbc_devset_ent	*next;
+	struct zbc_devset_req	req;
+};
+
+/**
+ * Device of a set.
+ */
+struct zbc_devset_dev {
+	struct zbc_devset_dev	*next;
+	struct zbc_devset	*set;
+	struct zbc_device	*dev;
+
+	pthread_mutex_t		lock;
+	pthread_cond_t		work_cond;
+	pthread_cond_t		idle_cond;
+	struct zbc_devset_ent	*head;
+	struct zbc_devset_ent	*tail;
+	unsigned int		nr_inflight;
+	bool			stop;
+
+	unsigned int		nr_threads;
+	pthread_t		*threads;
+};
+
+/**
+ * The set lock protects the device hash table, the free request entries
+ * and the completion queue. A device lock protects the device request
+ * queue. The set lock is always taken first.
+ */
+struct zbc_devset {
+	pthread_mutex_t		lock;
+	pthread_cond_t		cq_cond;
+	int			efd;
+
+	unsigned int		max_reqs;
+	unsigned int		nr_used;
+	struct zbc_devset_ent	*ents;
+	struct zbc_devset_ent	*free;
+
+	/* Completion queue (ring of max_reqs entries) */
+	struct zbc_devset_cqe	*cq;
+	unsigned int		cq_head;
+	unsigned int		cq_nr;
+	unsigned int		cq_waiters;
+
+	struct zbc_devset_dev	*hash[ZBC_DEVSET_HASH_SIZE];
+};
+
+static struct zbc_devset_dev *zbc_devset_lookup(struct zbc_devset *set,
+						struct zbc_device *dev)
+{
+	struct zbc_devset_dev *d;
+
+	for (d = set->hash[zbc_devset_hash(dev)]; d; d = d->next) {
+		if (d->dev == dev)
+			return d;
+	}
+
+	return NULL;
+}
+
+/**
+ * Execute a request.
+ */
+static ssize_t zbc_devset_exec(struct zbc_devset_req *req)
+{
+	switch (req->zdr_op) {
+	case ZBC_DEVSET_READ:
+		return zbc_pread(req->zdr_dev, req->zdr_buf,
+				 req->zdr_count, req->zdr_sector);
+	case ZBC_DEVSET_WRITE:
+		return zbc_pwrite(req->zdr_dev, req->zdr_buf,
+				  req->zdr_count, req->zdr_sector);
+	case ZBC_DEVSET_FLUSH:
+		return zbc_flush(req->zdr_dev);
+	case ZBC_DEVSET_ZONE_OP:
+		return zbc_zone_operation(req->zdr_dev, req->zdr_sector,
+					  req->zdr_zone_op, req->zdr_flags);
+	default:
+		return -EINVAL;
+	}
+}
+
+/**
+ * Queue the completion of a request and free its entry.
+ */
+static void zbc_devset_complete(struct zbc_devset *set,
+				struct zbc_devset_ent *ent, ssize_t ret)
+{
+	struct zbc_devset_cqe *cqe;
+	uint64_t val = 1;
+
+	pthread_mutex_lock(&set->lock);
+
+	cqe = &set->cq[(set->cq_head + set->cq_nr) % set->max_reqs];
+	cqe->zdc_dev = ent->req.zdr_dev;
+	cqe->zdc_data = ent->req.zdr_data;
+	cqe->zdc_ret = ret;
+
+	/* The file descriptor is readable while the queue is not empty */
+	if (!set->cq_nr++ && write(set->efd, &val, sizeof(val)) < 0)
+		zbc_error("Signal device set completion failed %d (%s)\n",
+			  errno, strerror(errno));
+	if (set->cq_waiters)
+		pthread_cond_broadcast(&set->cq_cond);
+
+	ent->next = set->free;
+	set->free = ent;
+
+	pthread_mutex_unlock(&set->lock);
+}
+
+static void *zbc_devset_thread(void *arg)
+{
+	struct zbc_devset_dev *d = arg;
+	struct zbc_devset_ent *ent;
+	ssize_t ret;
+
+	pthread_mutex_lock(&d->lock);
+
+	while (1) {
+
+		while (!d->head && !d->stop)
+			pthread_cond_wait(&d->work_cond, &d->lock);
+		if (!d->head)
+			break;
+
+		ent = d->head;
+		d->head = ent->next;
+		if (!d->head)
+			d->tail = NULL;
+
+		pthread_mutex_unlock(&d->lock);
+
+		ret = zbc_devset_exec(&ent->req);
+		zbc_devset_complete(d->set, ent, ret);
+
+		pthread_mutex_lock(&d->lock);
+
+		if (!--d->nr_inflight)
+			pthread_cond_broadcast(&d->idle_cond);
+
+	}
+
+	pthread_mutex_unlock(&d->lock);
+
+	return NULL;
+}
+
+/**
+ * Stop the threads of a device and free it.
+ */
+static void zbc_devset_free_dev(struct zbc_devset_dev *d)
+{
+	unsigned int i;
+
+	pthread_mutex_lock(&d->lock);
+	while (d->nr_inflight)
+		pthread_cond_wait(&d->idle_cond, &d->lock);
+	d->stop = true;
+	pthread_cond_broadcast(&d->work_cond);
+	pthread_mutex_unlock(&d->lock);
+
+	for (i = 0; i < d->nr_threads; i++)
+		pthread_join(d->threads[i], NULL);
+
+	pthread_cond_destroy(&d->idle_cond);
+	pthread_cond_destroy(&d->work_cond);
+	pthread_mutex_destroy(&d->lock);
+	zbc_free(d->threads);
+	zbc_free(d);
+}
+
+/**
+ * zbc_devset_create - Create a device set
+ */
+int zbc_devset_create(unsigned int max_reqs, struct zbc_devset **pset)
+{
+	struct zbc_devset *set;
+	unsigned int i;
+	int ret = -ENOMEM;
+
+	if (!max_reqs)
+		max_reqs = ZBC_DEVSET_MAX_REQS;
+
+	set = zbc_calloc(1, sizeof(struct zbc_devset));
+	if (!set)
+		return -ENOMEM;
+
+	set->max_reqs = max_reqs;
+	set->ents = zbc_calloc(max_reqs, sizeof(struct zbc_devset_ent));
+	set->cq = zbc_calloc(max_reqs, sizeof(struct zbc_devset_cqe));
+	if (!set->ents || !set->cq)
+		goto err;
+
+	set->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (set->efd < 0) {
+		ret = -errno;
+		zbc_error("Create device set eventfd failed %d (%s)\n",
+			  errno, strerror(errno));
+		goto err;
+	}
+
+	for (i = 0; i < max_reqs; i++) {
+		set->ents[i].next = set->free;
+		set->free = &set->ents[i];
+	}
+
+	pthread_mutex_init(&set->lock, NULL);
+	pthread_cond_init(&set->cq_cond, NULL);
+
+	*pset = set;
+
+	return 0;
+
+err:
+	zbc_free(set->cq);
+	zbc_free(set->ents);
+	zbc_free(set);
+
+	return ret;
+}
+
+/**
+ * zbc_devset_destroy - Destroy a device set
+ */
+void zbc_devset_destroy(struct zbc_devset *set)
+{
+	struct zbc_devset_dev *d;
+	unsigned int i;
+
+	for (i = 0; i < ZBC_DEVSET_HASH_SIZE; i++) {
+		while ((d = set->hash[i]) != NULL) {
+			set->hash[i] = d->next;
+			zbc_devset_free_dev(d);
+		}
+	}
+
+	close(set->efd);
+	pthread_cond_destroy(&set->cq_cond);
+	pthread_mutex_destroy(&set->lock);
+	zbc_free(set->cq);
+	zbc_free(set->ents);
+	zbc_free(set);
+}
+
+/**
+ * zbc_devset_add - Add a device to a device set
+ */
+int zbc_devset_add(struct zbc_devset *set, struct zbc_device *dev,
+		   unsigned int nr_threads)
+{
+	struct zbc_devset_dev *d;
+	unsigned int h = zbc_devset_hash(dev);
+	int ret;
+
+	if (!nr_threads)
+		nr_threads = 1;
+
+	pthread_mutex_lock(&set->lock);
+	d = zbc_devset_lookup(set, dev);
+	pthread_mutex_unlock(&set->lock);
+	if (d)
+		return -EEXIST;
+
+	d = zbc_calloc(1, sizeof(struct zbc_devset_dev));
+	if (!d)
+		return -ENOMEM;
+	d->threads = zbc_calloc(nr_threads, sizeof(pthread_t));
+	if (!d->threads) {
+		zbc_free(d);
+		return -ENOMEM;
+	}
+
+	d->set = set;
+	d->dev = dev;
+	pthread_mutex_init(&d->lock, NULL);
+	pthread_cond_init(&d->work_cond, NULL);
+	pthread_cond_init(&d->idle_cond, NULL);
+
+	for (; d->nr_threads < nr_threads; d->nr_threads++) {
+		ret = pthread_create(&d->threads[d->nr_threads], NULL,
+				     zbc_devset_thread, d);
+		if (ret) {
+			zbc_error("%s: Create device set thread failed %d (%s)\n",
+				  dev->zbd_filename, ret, strerror(ret));
+			zbc_devset_free_dev(d);
+			return -ret;
+		}
+	}
+
+	pthread_mutex_lock(&set->lock);
+	d->next = set->hash[h];
+	set->hash[h] = d;
+	pthread_mutex_unlock(&set->lock);
+
+	return 0;
+}
+
+/**
+ * zbc_devset_remove - Remove a device from a device set
+ */
+int zbc_devset_remove(struct zbc_devset *set, struct zbc_device *dev)
+{
+	struct zbc_devset_dev **pd, *d;
+
+	pthread_mutex_lock(&set->lock);
+
+	for (pd = &set->hash[zbc_devset_hash(dev)]; *pd; pd = &(*pd)->next) {
+		if ((*pd)->dev == dev)
+			break;
+	}
+	d = *pd;
+	if (d)
+		*pd = d->next;
+
+	pthread_mutex_unlock(&set->lock);
+
+	if (!d)
+		return -ENOENT;
+
+	zbc_devset_free_dev(d);
+
+	return 0;
+}
+
+/**
+ * zbc_devset_submit - Submit requests
+ */
+int zbc_devset_submit(struct zbc_devset *set, struct zbc_devset_req *reqs,
+		      unsigned int nr_reqs)
+{
+	struct zbc_devset_dev *d;
+	struct zbc_devset_ent *ent;
+	unsigned int i;
+	int ret = 0;
+
+	pthread_mutex_lock(&set->lock);
+
+	for (i = 0; i < nr_reqs; i++) {
+
+		if (set->nr_used >= set->max_reqs) {
+			ret = -EAGAIN;
+			break;
+		}
+
+		d = zbc_devset_lookup(set, reqs[i].zdr_dev);
+		if (!d) {
+			ret = -ENOENT;
+			break;
+		}
+
+		ent = set->free;
+		set->free = ent->next;
+		set->nr_used++;
+
+		ent->req = reqs[i];
+		ent->next = NULL;
+
+		pthread_mutex_lock(&d->lock);
+		if (d->tail)
+			d->tail->next = ent;
+		else
+			d->head = ent;
+		d->tail = ent;
+		d->nr_inflight++;
+		pthread_cond_signal(&d->work_cond);
+		pthread_mutex_unlock(&d->lock);
+
+	}
+
+	pthread_mutex_unlock(&set->lock);
+
+	return i ? (int)i : ret;
+}
+
+/**
+ * zbc_devset_reap - Reap completions
+ */
+unsigned int zbc_devset_reap(struct zbc_devset *set,
+			     struct zbc_devset_cqe *cqes,
+			     unsigned int max_cqes, unsigned int min_cqes)
+{
+	unsigned int i, n;
+	uint64_t val;
+
+	if (min_cqes > max_cqes)
+		min_cqes = max_cqes;
+
+	pthread_mutex_lock(&set->lock);
+
+	/* Do not wait for more than what is in flight */
+	set->cq_waiters++;
+	while (set->cq_nr < min_cqes && set->cq_nr < set->nr_used)
+		pthread_cond_wait(&set->cq_cond, &set->lock);
+	set->cq_waiters--;
+
+	n = set->cq_nr < max_cqes ? set->cq_nr : max_cqes;
+	for (i = 0; i < n; i++) {
+		cqes[i] = set->cq[set->cq_head];
+		set->cq_head = (set->cq_head + 1) % set->max_reqs;
+	}
+	set->cq_nr -= n;
+	set->nr_used -= n;
+
+	if (n && !set->cq_nr && read(set->efd, &val, sizeof(val)) < 0 &&
+	    errno != EAGAIN)
+		zbc_error("Clear device set completion failed %d (%s)\n",
+			  errno, strerror(errno));
+
+	pthread_mutex_unlock(&set->lock);
+
+	return n;
+}
+
+/**
+ * zbc_devset_fd - Get the completion file descriptor of a device set
+ */
+int zbc_devset_fd(struct zbc_devset *set)
+{
+	return set->efd;
+}
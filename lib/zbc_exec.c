@@ -0,0 +1,463 @@
+/*
+ * This file is part of libzbc.
+ *
+ * Copyright (C) 2009-2014, HGST, Inc. All rights reserved.
+ * Copyright (C) 2016, Western Digital. All rights reserved.
+ *
+ * This software is distributed under the terms of the BSD 2-clause license,
+ * "as is," without technical support, and WITHOUT ANY WARRANTY, without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE. You should have received a copy of the BSD 2-clause license along
+ * with libzbc. If not, see  <http://opensource.org/licenses/BSD-2-Clause>.
+ *
+ * Author: Damien Le Moal (damien.lemoal@wdc.com)
+ */
+
+#include "zbc.h"
+
+#include <string.h>
+
+/**
+ * Default maximum number of pending tasks.
+ */
+#define ZBC_EXEC_MAX_TASKS	4096
+
+/**
+ * Task states.
+ */
+enum {
+	ZBC_EXEC_QUEUED,
+	ZBC_EXEC_RUNNING,
+	ZBC_EXEC_DONE,
+	ZBC_EXEC_CANCELLED,
+};
+
+/**
+ * Per-thread task queue: one FIFO list per priority lane.
+ */
+struct zbc_exec_queue {
+	pthread_mutex_t		lock;
+	struct zbc_exec_task	*head[ZBC_EXEC_NR_PRIO];
+	struct zbc_exec_task	*tail[ZBC_EXEC_NR_PRIO];
+};
+
+/**
+ * The executor. The global lock protects the executor setup, the sleep
+ * and wake up of idle threads and the completion of waited tasks.
+ */
+static struct zbc_exec {
+	pthread_mutex_t		lock;
+	pthread_cond_t		work_cond;
+	pthread_cond_t		done_cond;
+	struct zbc_exec_params	params;
+	bool			started;
+	struct zbc_exec_queue	*queues;
+	unsigned int		nr_threads;
+	unsigned int		nr_idle;
+	unsigned int		nr_waiters;
+	unsigned int		nr_queued;
+	unsigned int		nr_tasks;
+	unsigned int		rr;
+} zbc_exec = {
+	.lock		= PTHREAD_MUTEX_INITIALIZER,
+	.work_cond	= PTHREAD_COND_INITIALIZER,
+	.done_cond	= PTHREAD_COND_INITIALIZER,
+};
+
+/**
+ * Index of the queue of the calling thread (-1 if not an executor thread).
+ */
+static __thread int zbc_exec_self = -1;
+
+/**
+ * Get the first task of a queue lane.
+ */
+static struct zbc_exec_task *zbc_exec_pop(struct zbc_exec_queue *q, int prio)
+{
+	struct zbc_exec_task *task;
+
+	if (!__atomic_load_n(&q->head[prio], __ATOMIC_RELAXED))
+		return NULL;
+
+	pthread_mutex_lock(&q->lock);
+	task = q->head[prio];
+	if (task) {
+		q->head[prio] = task->next;
+		if (!task->next)
+			q->tail[prio] = NULL;
+	}
+	pthread_mutex_unlock(&q->lock);
+
+	if (task)
+		__atomic_sub_fetch(&zbc_exec.nr_queued, 1, __ATOMIC_SEQ_CST);
+
+	return task;
+}
+
+/**
+ * Get a task to run: the highest priority lanes are served first, from
+ * the queue of the calling thread and then from the other queues.
+ */
+static struct zbc_exec_task *zbc_exec_get(int self)
+{
+	unsigned int n = zbc_exec.nr_threads, first, i;
+	struct zbc_exec_task *task;
+	int prio;
+
+	if (!__atomic_load_n(&zbc_exec.nr_queued, __ATOMIC_SEQ_CST))
+		return NULL;
+
+	first = self >= 0 ? self : 0;
+	for (prio = 0; prio < ZBC_EXEC_NR_PRIO; prio++) {
+		for (i = 0; i < n; i++) {
+			task = zbc_exec_pop(&zbc_exec.queues[(first + i) % n],
+					    prio);
+			if (task)
+				return task;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * Execute a task and signal its completion.
+ */
+static void zbc_exec_run(struct zbc_exec_task *task)
+{
+	int state = ZBC_EXEC_CANCELLED;
+
+	if (!__atomic_load_n(&task->cancel, __ATOMIC_ACQUIRE)) {
+		__atomic_store_n(&task->state, ZBC_EXEC_RUNNING,
+				 __ATOMIC_RELEASE);
+		task->fn(task, task->arg);
+		state = ZBC_EXEC_DONE;
+	}
+
+	if (task->detached) {
+		zbc_free(task);
+		__atomic_sub_fetch(&zbc_exec.nr_tasks, 1, __ATOMIC_SEQ_CST);
+		return;
+	}
+
+	pthread_mutex_lock(&zbc_exec.lock);
+	task->state = state;
+	__atomic_sub_fetch(&zbc_exec.nr_tasks, 1, __ATOMIC_SEQ_CST);
+	pthread_cond_broadcast(&zbc_exec.done_cond);
+	pthread_mutex_unlock(&zbc_exec.lock);
+}
+
+/**
+ * Application scheduler task entry point.
+ */
+static void zbc_exec_run_data(void *data)
+{
+	zbc_exec_run(data);
+}
+
+/**
+ * Executor thread.
+ */
+static void *zbc_exec_thread(void *arg)
+{
+	struct zbc_exec_task *task;
+
+	zbc_exec_self = (int)(long)arg;
+
+	while (1) {
+		task = zbc_exec_get(zbc_exec_self);
+		if (task) {
+			zbc_exec_run(task);
+			continue;
+		}
+
+		pthread_mutex_lock(&zbc_exec.lock);
+		if (!__atomic_load_n(&zbc_exec.nr_queued, __ATOMIC_SEQ_CST)) {
+			zbc_exec.nr_idle++;
+			pthread_cond_wait(&zbc_exec.work_cond, &zbc_exec.lock);
+			zbc_exec.nr_idle--;
+		}
+		pthread_mutex_unlock(&zbc_exec.lock);
+	}
+
+	return NULL;
+}
+
+/**
+ * Start the executor threads. Called with the executor lock held.
+ */
+static int zbc_exec_start(void)
+{
+	struct zbc_exec_params *p = &zbc_exec.params;
+	unsigned int i, n;
+	pthread_t thread;
+	long nr_cpus;
+	int ret = 0;
+
+	if (!p->zep_max_tasks)
+		p->zep_max_tasks = ZBC_EXEC_MAX_TASKS;
+
+	if (p->zep_sched) {
+		__atomic_store_n(&zbc_exec.started, true, __ATOMIC_RELEASE);
+		return 0;
+	}
+
+	n = p->zep_nr_threads;
+	if (!n) {
+		nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		n = nr_cpus > 0 ? nr_cpus : 1;
+	}
+
+	zbc_exec.queues = zbc_calloc(n, sizeof(struct zbc_exec_queue));
+	if (!zbc_exec.queues)
+		return -ENOMEM;
+	for (i = 0; i < n; i++)
+		pthread_mutex_init(&zbc_exec.queues[i].lock, NULL);
+
+	/* Queues must be visible before the threads start */
+	zbc_exec.nr_threads = n;
+	for (i = 0; i < n; i++) {
+		ret = pthread_create(&thread, NULL, zbc_exec_thread,
+				     (void *)(long)i);
+		if (ret) {
+			zbc_error("Start executor thread failed %d (%s)\n",
+				  ret, strerror(ret));
+			break;
+		}
+		pthread_detach(thread);
+	}
+
+	if (!i) {
+		zbc_exec.nr_threads = 0;
+		zbc_free(zbc_exec.queues);
+		zbc_exec.queues = NULL;
+		return -ret;
+	}
+
+	/* Threads that failed to start have an empty queue to steal from */
+	zbc_debug("Executor started with %u threads\n", i);
+
+	__atomic_store_n(&zbc_exec.started, true, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+/**
+ * zbc_exec_setup - Configure the executor
+ */
+int zbc_exec_setup(struct zbc_exec_params *params)
+{
+	int ret = 0;
+
+	pthread_mutex_lock(&zbc_exec.lock);
+	if (zbc_exec.started)
+		ret = -EBUSY;
+	else
+		zbc_exec.params = *params;
+	pthread_mutex_unlock(&zbc_exec.lock);
+
+	return ret;
+}
+
+/**
+ * Queue an initialized task.
+ */
+static int zbc_exec_queue_task(struct zbc_device *dev,
+			       struct zbc_exec_task *task)
+{
+	struct zbc_exec_sched *sched;
+	struct zbc_exec_queue *q;
+	int prio = task->prio;
+	unsigned int i;
+	int ret;
+
+	if (!__atomic_load_n(&zbc_exec.started, __ATOMIC_ACQUIRE)) {
+		pthread_mutex_lock(&zbc_exec.lock);
+		ret = zbc_exec.started ? 0 : zbc_exec_start();
+		pthread_mutex_unlock(&zbc_exec.lock);
+		if (ret)
+			return ret;
+	}
+
+	if (__atomic_add_fetch(&zbc_exec.nr_tasks, 1, __ATOMIC_SEQ_CST) >
+	    zbc_exec.params.zep_max_tasks) {
+		__atomic_sub_fetch(&zbc_exec.nr_tasks, 1, __ATOMIC_SEQ_CST);
+		return -EAGAIN;
+	}
+
+	sched = zbc_exec.params.zep_sched;
+	if (sched) {
+		ret = sched->zes_submit(sched->zes_priv, dev, prio,
+					zbc_exec_run_data, task);
+		if (ret)
+			__atomic_sub_fetch(&zbc_exec.nr_tasks, 1,
+					   __ATOMIC_SEQ_CST);
+		return ret;
+	}
+
+	/*
+	 * Queue the task on the queue of its device, or on the queue of
+	 * the calling executor thread, or round-robin.
+	 */
+	if (dev)
+		i = ((unsigned long)dev >> 6) % zbc_exec.nr_threads;
+	else if (zbc_exec_self >= 0)
+		i = zbc_exec_self;
+	else
+		i = __atomic_fetch_add(&zbc_exec.rr, 1, __ATOMIC_RELAXED) %
+			zbc_exec.nr_threads;
+	q = &zbc_exec.queues[i];
+
+	pthread_mutex_lock(&q->lock);
+	if (q->tail[prio])
+		q->tail[prio]->next = task;
+	else
+		q->head[prio] = task;
+	q->tail[prio] = task;
+	pthread_mutex_unlock(&q->lock);
+	__atomic_add_fetch(&zbc_exec.nr_queued, 1, __ATOMIC_SEQ_CST);
+
+	/* Wake up an idle thread, or the waiters that can help */
+	pthread_mutex_lock(&zbc_exec.lock);
+	if (zbc_exec.nr_idle)
+		pthread_cond_signal(&zbc_exec.work_cond);
+	else if (zbc_exec.nr_waiters)
+		pthread_cond_broadcast(&zbc_exec.done_cond);
+	pthread_mutex_unlock(&zbc_exec.lock);
+
+	return 0;
+}
+
+/**
+ * zbc_exec_submit - Submit a task
+ */
+int zbc_exec_submit(struct zbc_device *dev, enum zbc_exec_prio prio,
+		    zbc_exec_fn fn, void *arg, struct zbc_exec_task **ptask)
+{
+	struct zbc_exec_task *task;
+	int ret;
+
+	if (prio < ZBC_EXEC_PRIO_HIGH || prio > ZBC_EXEC_PRIO_LOW || !fn)
+		return -EINVAL;
+
+	task = zbc_calloc(1, sizeof(struct zbc_exec_task));
+	if (!task)
+		return -ENOMEM;
+	task->fn = fn;
+	task->arg = arg;
+	task->prio = prio;
+	task->detached = (ptask == NULL);
+	task->state = ZBC_EXEC_QUEUED;
+
+	ret = zbc_exec_queue_task(dev, task);
+	if (ret) {
+		zbc_free(task);
+		return ret;
+	}
+
+	if (ptask)
+		*ptask = task;
+
+	return 0;
+}
+
+/**
+ * zbc_exec_cancel - Request the cancellation of a task
+ */
+void zbc_exec_cancel(struct zbc_exec_task *task)
+{
+	__atomic_store_n(&task->cancel, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * zbc_exec_cancelled - Test if the cancellation of a task was requested
+ */
+bool zbc_exec_cancelled(struct zbc_exec_task *task)
+{
+	return __atomic_load_n(&task->cancel, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Wait for a task completion and return its final state.
+ */
+static int zbc_exec_wait_task(struct zbc_exec_task *task)
+{
+	struct zbc_exec_task *t;
+	int state;
+
+	while (1) {
+		pthread_mutex_lock(&zbc_exec.lock);
+		state = task->state;
+		pthread_mutex_unlock(&zbc_exec.lock);
+		if (state >= ZBC_EXEC_DONE)
+			break;
+
+		/* Help while waiting */
+		t = zbc_exec_get(zbc_exec_self);
+		if (t) {
+			zbc_exec_run(t);
+			continue;
+		}
+
+		pthread_mutex_lock(&zbc_exec.lock);
+		if (task->state < ZBC_EXEC_DONE &&
+		    !__atomic_load_n(&zbc_exec.nr_queued, __ATOMIC_SEQ_CST)) {
+			zbc_exec.nr_waiters++;
+			pthread_cond_wait(&zbc_exec.done_cond, &zbc_exec.lock);
+			zbc_exec.nr_waiters--;
+		}
+		pthread_mutex_unlock(&zbc_exec.lock);
+	}
+
+	return state;
+}
+
+/**
+ * zbc_exec_wait - Wait for a task completion
+ */
+int zbc_exec_wait(struct zbc_exec_task *task)
+{
+	int state;
+
+	state = zbc_exec_wait_task(task);
+	if (!task->embedded)
+		zbc_free(task);
+
+	return state == ZBC_EXEC_CANCELLED ? -ECANCELED : 0;
+}
+
+/**
+ * zbc_exec_run_all - Run jobs in parallel: all jobs but the last one are
+ * queued using the caller task slots, the calling thread runs the last job
+ * and the jobs that could not be queued and then waits for the others.
+ */
+void zbc_exec_run_all(struct zbc_device *dev, enum zbc_exec_prio prio,
+		      zbc_exec_fn fn, void *jobs, size_t job_size,
+		      struct zbc_exec_task *tasks, unsigned int nr_jobs)
+{
+	uint8_t *job = jobs;
+	unsigned int i;
+
+	for (i = 0; i < nr_jobs; i++) {
+		memset(&tasks[i], 0, sizeof(struct zbc_exec_task));
+		tasks[i].arg = job + i * job_size;
+		if (i == nr_jobs - 1)
+			break;
+		tasks[i].fn = fn;
+		tasks[i].prio = prio;
+		tasks[i].embedded = true;
+		tasks[i].state = ZBC_EXEC_QUEUED;
+		if (zbc_exec_queue_task(dev, &tasks[i]))
+			tasks[i].fn = NULL;
+	}
+
+	for (i = 0; i < nr_jobs; i++) {
+		if (!tasks[i].fn)
+			fn(&tasks[i], tasks[i].arg);
+	}
+
+	for (i = 0; i < nr_jobs; i++) {
+		if (tasks[i].fn)
+			zbc_exec_wait_task(&tasks[i]);
+	}
+}
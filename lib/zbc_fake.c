@@ -27,6 +27,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <libgen.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -52,6 +53,43 @@
  */
 #define ZBC_FAKE_META_PATH_SIZE	512
 
+/**
+ * Maximum number of stripe members, including the device file.
+ */
+#define ZBC_FAKE_MAX_STRIPES		16
+
+/**
+ * Number of I/O contexts of a striped device and maximum number of
+ * stripe units accessed with one I/O context: larger I/Os are split.
+ */
+#define ZBC_FAKE_NR_IO_CTX		4
+#define ZBC_FAKE_IO_CTX_NR_IOV		1024
+
+/**
+ * Part of a striped I/O on one stripe member: the chunks of the I/O
+ * stored on a member are contiguous in the member.
+ */
+struct zbc_fake_stripe_io {
+	int			fd;
+	bool			write;
+	bool			fua;
+	struct iovec		*iov;
+	int			iovcnt;
+	off_t			offset;
+	ssize_t			ret;
+};
+
+/**
+ * Striped I/O context, allocated when the stripe members are opened so
+ * that reads and writes do not allocate memory.
+ */
+struct zbc_fake_io_ctx {
+	pthread_mutex_t			lock;
+	struct iovec			iov[ZBC_FAKE_IO_CTX_NR_IOV];
+	struct zbc_fake_stripe_io	sio[ZBC_FAKE_MAX_STRIPES];
+	struct zbc_exec_task		tasks[ZBC_FAKE_MAX_STRIPES];
+};
+
 /**
  * Metadata header.
  */
@@ -105,6 +143,17 @@ struct zbc_fake_device {
 	uint32_t		zbd_nr_zones;
 	struct zbc_zone		*zbd_zones;
 
+	/**
+	 * Data striping: stripe unit in bytes and file descriptors of
+	 * the stripe members, the first one being the device file.
+	 * zbd_nr_stripes is 0 if the data is not striped.
+	 */
+	int			zbd_open_flags;
+	size_t			zbd_stripe_size;
+	unsigned int		zbd_nr_stripes;
+	int			zbd_stripe_fd[ZBC_FAKE_MAX_STRIPES];
+	struct zbc_fake_io_ctx	*zbd_io_ctx;
+
 };
 
 /**
@@ -117,6 +166,16 @@ static inline void zbc_fake_dev_meta_path(struct zbc_fake_device *fdev,
 		basename(fdev->dev.zbd_filename));
 }
 
+/**
+ * zbc_fake_dev_stripe_path - Build stripe configuration file path.
+ */
+static inline void zbc_fake_dev_stripe_path(struct zbc_fake_device *fdev,
+					    char *buf)
+{
+	sprintf(buf, "%s/zbc-%s.stripe", ZBC_FAKE_META_DIR,
+		basename(fdev->dev.zbd_filename));
+}
+
 /**
  * zbc_fake_to_file_dev - Convert device address to fake device address.
  */
@@ -134,23 +193,29 @@ static struct zbc_zone *zbc_fake_find_zone(struct zbc_fake_device *fdev,
 					   bool start)
 {
 	struct zbc_zone *zone;
-	unsigned int i;
+	unsigned int lo = 0, hi = fdev->zbd_nr_zones, mid;
 
-	if (!fdev->zbd_zones)
+	if (!fdev->zbd_zones || !fdev->zbd_nr_zones)
 		return NULL;
 
-	for (i = 0; i < fdev->zbd_nr_zones; i++) {
-		zone = &fdev->zbd_zones[i];
-		if (start) {
-			if (zone->zbz_start == sector)
-				return zone;
-		} else {
-			if (sector >= zone->zbz_start &&
-			    sector < zone->zbz_start + zone->zbz_length)
-				return zone;
-		}
+	/* Zones are contiguous and sorted: search the last zone
+	 * starting at or before sector */
+	while (hi - lo > 1) {
+		mid = (lo + hi) / 2;
+		if (fdev->zbd_zones[mid].zbz_start <= sector)
+			lo = mid;
+		else
+			hi = mid;
 	}
 
+	zone = &fdev->zbd_zones[lo];
+	if (start)
+		return zone->zbz_start == sector ? zone : NULL;
+
+	if (sector >= zone->zbz_start &&
+	    sector < zone->zbz_start + zone->zbz_length)
+		return zone;
+
 	return NULL;
 }
 
@@ -413,6 +478,173 @@ static int zbc_fake_set_info(struct zbc_device *dev)
 	return 0;
 }
 
+/**
+ * zbc_fake_get_size - Get the size in bytes of a backing file or device.
+ */
+static int zbc_fake_get_size(int fd, uint64_t *size)
+{
+	unsigned long long size64;
+	struct stat st;
+
+	if (fstat(fd, &st) < 0)
+		return -errno;
+
+	if (S_ISBLK(st.st_mode)) {
+		if (ioctl(fd, BLKGETSIZE64, &size64) != 0)
+			return -errno;
+		*size = size64;
+		return 0;
+	}
+
+	if (S_ISREG(st.st_mode)) {
+		*size = st.st_size;
+		return 0;
+	}
+
+	return -EINVAL;
+}
+
+/**
+ * zbc_fake_close_stripes - Close the stripe members of a device.
+ */
+static void zbc_fake_close_stripes(struct zbc_fake_device *fdev)
+{
+	unsigned int i;
+
+	/* The first member is the device file */
+	for (i = 1; i < fdev->zbd_nr_stripes; i++)
+		close(fdev->zbd_stripe_fd[i]);
+
+	if (fdev->zbd_io_ctx) {
+		for (i = 0; i < ZBC_FAKE_NR_IO_CTX; i++)
+			pthread_mutex_destroy(&fdev->zbd_io_ctx[i].lock);
+		zbc_free(fdev->zbd_io_ctx);
+		fdev->zbd_io_ctx = NULL;
+	}
+
+	fdev->zbd_nr_stripes = 0;
+	fdev->zbd_stripe_size = 0;
+	fdev->dev.zbd_striped = false;
+}
+
+/**
+ * zbc_fake_open_stripes - Open the stripe members of a device listed in
+ * its stripe configuration file and set the device capacity to the
+ * capacity of the smallest member times the number of members.
+ */
+static int zbc_fake_open_stripes(struct zbc_fake_device *fdev)
+{
+	struct zbc_device_info *dev_info = &fdev->dev.zbd_info;
+	char path[ZBC_FAKE_META_PATH_SIZE];
+	uint64_t size, min_size, capacity;
+	unsigned long long stripe_size;
+	unsigned int n = 1, i;
+	size_t len;
+	FILE *f;
+	int fd, ret;
+
+	zbc_fake_dev_stripe_path(fdev, path);
+	f = fopen(path, "r");
+	if (!f)
+		return errno == ENOENT ? 0 : -errno;
+
+	ret = -EINVAL;
+	if (fscanf(f, "%llu\n", &stripe_size) != 1 ||
+	    !stripe_size || stripe_size % dev_info->zbd_pblock_size) {
+		zbc_error("%s: invalid stripe configuration file %s\n",
+			  fdev->dev.zbd_filename, path);
+		goto out;
+	}
+
+	ret = zbc_fake_get_size(fdev->dev.zbd_fd, &min_size);
+	if (ret)
+		goto out;
+
+	fdev->zbd_stripe_fd[0] = fdev->dev.zbd_fd;
+	fdev->zbd_nr_stripes = 1;
+
+	while (fgets(path, sizeof(path), f)) {
+
+		len = strlen(path);
+		if (len && path[len - 1] == '\n')
+			path[--len] = '\0';
+		if (!len)
+			continue;
+
+		if (n >= ZBC_FAKE_MAX_STRIPES) {
+			zbc_error("%s: too many stripe members (max %d)\n",
+				  fdev->dev.zbd_filename,
+				  ZBC_FAKE_MAX_STRIPES);
+			ret = -EINVAL;
+			goto out;
+		}
+
+		fd = open(path, fdev->zbd_open_flags);
+		if (fd < 0) {
+			ret = -errno;
+			zbc_error("%s: open stripe member %s failed %d (%s)\n",
+				  fdev->dev.zbd_filename, path,
+				  errno, strerror(errno));
+			goto out;
+		}
+		fdev->zbd_stripe_fd[n++] = fd;
+		fdev->zbd_nr_stripes = n;
+
+		ret = zbc_fake_get_size(fd, &size);
+		if (ret) {
+			zbc_error("%s: invalid stripe member %s\n",
+				  fdev->dev.zbd_filename, path);
+			goto out;
+		}
+		if (size < min_size)
+			min_size = size;
+
+	}
+
+	if (n < 2) {
+		/* Nothing to stripe */
+		ret = 0;
+		goto out;
+	}
+
+	min_size -= min_size % stripe_size;
+	capacity = min_size * n;
+	if (!capacity) {
+		zbc_error("%s: stripe members too small\n",
+			  fdev->dev.zbd_filename);
+		ret = -EINVAL;
+		goto out;
+	}
+
+	fdev->zbd_io_ctx = zbc_calloc(ZBC_FAKE_NR_IO_CTX,
+				      sizeof(struct zbc_fake_io_ctx));
+	if (!fdev->zbd_io_ctx) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	for (i = 0; i < ZBC_FAKE_NR_IO_CTX; i++)
+		pthread_mutex_init(&fdev->zbd_io_ctx[i].lock, NULL);
+
+	fdev->zbd_stripe_size = stripe_size;
+	fdev->dev.zbd_striped = true;
+
+	dev_info->zbd_pblocks = capacity / dev_info->zbd_pblock_size;
+	dev_info->zbd_lblocks = capacity / dev_info->zbd_lblock_size;
+	dev_info->zbd_sectors = capacity >> 9;
+
+	zbc_debug("%s: data striped across %u members, %llu B stripes\n",
+		  fdev->dev.zbd_filename, n, stripe_size);
+
+	ret = 0;
+
+out:
+	fclose(f);
+	if (ret != 0 || !fdev->zbd_stripe_size)
+		zbc_fake_close_stripes(fdev);
+
+	return ret;
+}
+
 /**
  * zbc_fake_open - Open an emulation device or file.
  */
@@ -420,13 +652,15 @@ static int zbc_fake_open(const char *filename, int flags,
 			 struct zbc_device **pdev)
 {
 	struct zbc_fake_device *fdev;
+	unsigned long long start;
 	int fd, ret;
 
 	zbc_debug("%s: ########## Trying FAKE driver ##########\n",
 		  filename);
 
 	/* Open emulation device/file */
-	fd = open(filename, flags | O_LARGEFILE);
+	flags = (flags & ~ZBC_O_ZONES_MASK) | O_LARGEFILE;
+	fd = open(filename, flags);
 	if (fd < 0) {
 		ret = -errno;
 		zbc_error("%s: open failed %d (%s)\n",
@@ -437,29 +671,41 @@ static int zbc_fake_open(const char *filename, int flags,
 
 	/* Allocate a handle */
 	ret = -ENOMEM;
-	fdev = calloc(1, sizeof(*fdev));
+	fdev = zbc_calloc(1, sizeof(*fdev));
 	if (!fdev)
 		goto out;
 
 	fdev->dev.zbd_fd = fd;
 	fdev->zbd_meta_fd = -1;
+	fdev->zbd_open_flags = flags;
 #ifdef HAVE_DEVTEST
 	fdev->dev.zbd_o_flags = flags & ZBC_O_DEVTEST;
 #endif
 
-	fdev->dev.zbd_filename = strdup(filename);
+	fdev->dev.zbd_filename = zbc_strdup(filename);
 	if (!fdev->dev.zbd_filename)
 		goto out_free_dev;
 
 	/* Set the fake device information */
+	start = zbc_time_ns();
 	ret = zbc_fake_set_info(&fdev->dev);
+	zbc_open_phase(filename, "device information", start, ret);
+	if (ret != 0)
+		goto out_free_filename;
+
+	/* Open stripe members */
+	start = zbc_time_ns();
+	ret = zbc_fake_open_stripes(fdev);
+	zbc_open_phase(filename, "stripes", start, ret);
 	if (ret != 0)
 		goto out_free_filename;
 
 	/* Open metadata */
+	start = zbc_time_ns();
 	ret = zbc_fake_open_metadata(fdev, flags & ZBC_O_SETZONES);
+	zbc_open_phase(filename, "metadata", start, ret);
 	if (ret != 0)
-		goto out_free_filename;
+		goto out_close_stripes;
 
 	*pdev = &fdev->dev;
 
@@ -468,11 +714,14 @@ static int zbc_fake_open(const char *filename, int flags,
 
 	return 0;
 
+out_close_stripes:
+	zbc_fake_close_stripes(fdev);
+
 out_free_filename:
-	free(fdev->dev.zbd_filename);
+	zbc_free(fdev->dev.zbd_filename);
 
 out_free_dev:
-	free(fdev);
+	zbc_free(fdev);
 
 out:
 	close(fd);
@@ -493,11 +742,12 @@ static int zbc_fake_close(struct zbc_device *dev)
 	/* Close metadata */
 	zbc_fake_close_metadata(fdev);
 
-	/* Close device */
+	/* Close stripe members and device */
+	zbc_fake_close_stripes(fdev);
 	close(dev->zbd_fd);
 
-	free(dev->zbd_filename);
-	free(dev);
+	zbc_free(dev->zbd_filename);
+	zbc_free(dev);
 
 	return 0;
 }
@@ -593,9 +843,20 @@ static int zbc_fake_report_zones(struct zbc_device *dev, uint64_t sector,
 	for (in = 0; in < fdev->zbd_nr_zones; in++) {
 		if (zbc_fake_must_report_zone(&fdev->zbd_zones[in],
 					      sector, options)) {
-			if (zones && (out < max_nr_zones))
+			if (zones && (out < max_nr_zones)) {
 				memcpy(&zones[out], &fdev->zbd_zones[in],
 				       sizeof(struct zbc_zone));
+				/*
+				 * Report the write pointer of full zones at
+				 * the end of the zone, whether the zone was
+				 * filled by writes or finished.
+				 */
+				if (zbc_zone_sequential(&zones[out]) &&
+				    zbc_zone_full(&zones[out]))
+					zones[out].zbz_write_pointer =
+						zbc_zone_start(&zones[out]) +
+						zbc_zone_length(&zones[out]);
+			}
 			out++;
 		}
 		if (out >= max_nr_zones && (ro & ZBC_RO_PARTIAL))
@@ -1029,6 +1290,179 @@ zbc_fake_zone_op(struct zbc_device *dev, uint64_t sector,
 	}
 }
 
+static void zbc_fake_stripe_io(struct zbc_fake_stripe_io *sio)
+{
+	struct iovec *iov = sio->iov;
+	int iovcnt = sio->iovcnt, n;
+	off_t offset = sio->offset;
+	size_t len;
+	ssize_t ret;
+
+	sio->ret = 0;
+	while (iovcnt) {
+		n = iovcnt > IOV_MAX ? IOV_MAX : iovcnt;
+		for (len = 0, ret = 0; ret < n; ret++)
+			len += iov[ret].iov_len;
+		if (sio->write)
+			ret = zbc_file_pwritev(sio->fd, iov, n, offset,
+					       sio->fua);
+		else
+			ret = preadv(sio->fd, iov, n, offset);
+		if (ret < 0) {
+			sio->ret = -errno;
+			return;
+		}
+		if ((size_t)ret != len) {
+			sio->ret = -EIO;
+			return;
+		}
+		iov += n;
+		iovcnt -= n;
+		offset += len;
+	}
+}
+
+static void zbc_fake_stripe_task(struct zbc_exec_task *task, void *arg)
+{
+	zbc_fake_stripe_io(arg);
+}
+
+/**
+ * Get a free I/O context of a striped device, waiting for the first one
+ * if all are in use.
+ */
+static struct zbc_fake_io_ctx *zbc_fake_get_io_ctx(struct zbc_fake_device *fdev)
+{
+	unsigned int i;
+
+	for (i = 0; i < ZBC_FAKE_NR_IO_CTX; i++) {
+		if (!pthread_mutex_trylock(&fdev->zbd_io_ctx[i].lock))
+			return &fdev->zbd_io_ctx[i];
+	}
+
+	pthread_mutex_lock(&fdev->zbd_io_ctx[0].lock);
+
+	return &fdev->zbd_io_ctx[0];
+}
+
+/**
+ * Read or write the bytes @pos to @end of a striped device, spanning at
+ * most ZBC_FAKE_IO_CTX_NR_IOV stripe units, with the I/O context @ctx.
+ */
+static int zbc_fake_stripe_data_io(struct zbc_fake_device *fdev,
+				   struct zbc_fake_io_ctx *ctx, uint8_t *buf,
+				   uint64_t pos, uint64_t end, bool write)
+{
+	struct zbc_fake_stripe_io *sio = ctx->sio;
+	unsigned int n = fdev->zbd_nr_stripes, m, first;
+	uint64_t su = fdev->zbd_stripe_size, start = pos;
+	uint64_t c, c_start = pos / su, c_end = (end - 1) / su;
+	size_t len, nr_chunks = c_end - c_start + 1;
+
+	/*
+	 * Chunk c is stored on member c % n at offset (c / n) * su: the
+	 * chunks of a member are consecutive in the iovec array, members
+	 * ordered by their first chunk.
+	 */
+	memset(sio, 0, sizeof(ctx->sio));
+	if (nr_chunks < n)
+		n = nr_chunks;
+	first = c_start % fdev->zbd_nr_stripes;
+	for (m = 0; m < n; m++) {
+		c = c_start + m;
+		sio[m].fd = fdev->zbd_stripe_fd[(first + m) %
+						fdev->zbd_nr_stripes];
+		sio[m].write = write;
+		sio[m].fua = zbc_hint_fua();
+		sio[m].offset = (c / fdev->zbd_nr_stripes) * su;
+		sio[m].iovcnt = (c_end - c) / fdev->zbd_nr_stripes + 1;
+		sio[m].iov = m ? sio[m - 1].iov + sio[m - 1].iovcnt : ctx->iov;
+	}
+	sio[0].offset += pos % su;
+
+	for (c = c_start; c <= c_end; c++) {
+		m = c - c_start;
+		m %= fdev->zbd_nr_stripes;
+		len = su - (pos % su);
+		if (len > end - pos)
+			len = end - pos;
+		sio[m].iov[(c - c_start) / fdev->zbd_nr_stripes].iov_base =
+			buf + (pos - start);
+		sio[m].iov[(c - c_start) / fdev->zbd_nr_stripes].iov_len = len;
+		pos += len;
+	}
+
+	/* Access the members in parallel */
+	zbc_exec_run_all(&fdev->dev, ZBC_EXEC_PRIO_HIGH, zbc_fake_stripe_task,
+			 sio, sizeof(struct zbc_fake_stripe_io), ctx->tasks, n);
+
+	for (m = 0; m < n; m++) {
+		if (sio[m].ret < 0)
+			return sio[m].ret;
+	}
+
+	return 0;
+}
+
+/**
+ * zbc_fake_data_io - Read or write the data of the emulated device. For a
+ * striped device, the I/O is split in stripe units and the units stored
+ * on each member are transferred with a single vectored I/O, the members
+ * being accessed in parallel.
+ */
+static ssize_t zbc_fake_data_io(struct zbc_fake_device *fdev, void *buf,
+				size_t count, uint64_t offset, bool write)
+{
+	uint64_t su = fdev->zbd_stripe_size;
+	uint64_t pos = offset << 9, end = pos + (count << 9);
+	struct zbc_fake_io_ctx *ctx;
+	unsigned int m;
+	uint64_t len;
+	ssize_t ret;
+
+	if (!fdev->zbd_nr_stripes) {
+		if (write)
+			ret = zbc_file_pwrite(fdev->dev.zbd_fd, buf,
+					      count << 9, pos);
+		else
+			ret = pread(fdev->dev.zbd_fd, buf, count << 9, pos);
+		return ret < 0 ? -errno : ret >> 9;
+	}
+
+	/* Single stripe unit: no need to split */
+	if (pos / su == (end - 1) / su) {
+		struct zbc_fake_stripe_io sio;
+		struct iovec v = { .iov_base = buf, .iov_len = count << 9 };
+
+		m = (pos / su) % fdev->zbd_nr_stripes;
+		sio.fd = fdev->zbd_stripe_fd[m];
+		sio.write = write;
+		sio.fua = zbc_hint_fua();
+		sio.iov = &v;
+		sio.iovcnt = 1;
+		sio.offset = (pos / su / fdev->zbd_nr_stripes) * su + pos % su;
+		zbc_fake_stripe_io(&sio);
+		return sio.ret < 0 ? sio.ret : (ssize_t)count;
+	}
+
+	ctx = zbc_fake_get_io_ctx(fdev);
+
+	ret = 0;
+	while (pos < end && !ret) {
+		len = (pos / su + ZBC_FAKE_IO_CTX_NR_IOV) * su - pos;
+		if (len > end - pos)
+			len = end - pos;
+		ret = zbc_fake_stripe_data_io(fdev, ctx, buf, pos, pos + len,
+					      write);
+		buf = (uint8_t *)buf + len;
+		pos += len;
+	}
+
+	pthread_mutex_unlock(&ctx->lock);
+
+	return ret < 0 ? ret : (ssize_t)count;
+}
+
 /**
  * zbc_fake_pread - Read from the emulated device/file.
  */
@@ -1110,13 +1544,10 @@ static ssize_t zbc_fake_pread(struct zbc_device *dev, void *buf,
 	}
 
 	/* Do read */
-	ret = pread(dev->zbd_fd, buf, count << 9, offset << 9);
-	if (ret < 0) {
+	ret = zbc_fake_data_io(fdev, buf, count, offset, false);
+	if (ret < 0)
 		zbc_set_errno(ZBC_SK_MEDIUM_ERROR,
 			      ZBC_ASC_READ_ERROR);
-		ret = -errno;
-	} else
-		ret >>= 9;
 
 out:
 	zbc_fake_unlock(fdev);
@@ -1222,15 +1653,12 @@ static ssize_t zbc_fake_pwrite(struct zbc_device *dev, const void *buf,
 	}
 
 	/* Do write */
-	ret = pwrite(dev->zbd_fd, buf, count << 9, offset << 9);
+	ret = zbc_fake_data_io(fdev, (void *)buf, count, offset, true);
 	if (ret < 0) {
 		zbc_set_errno(ZBC_SK_MEDIUM_ERROR, ZBC_ASC_WRITE_ERROR);
-		ret = -errno;
 		goto out;
 	}
 
-	ret >>= 9;
-
 	if (zbc_zone_sequential_req(zone)) {
 		/* Advance write pointer */
 		zone->zbz_write_pointer += ret;
@@ -1255,6 +1683,7 @@ out:
 static int zbc_fake_flush(struct zbc_device *dev)
 {
 	struct zbc_fake_device *fdev = zbc_fake_to_file_dev(dev);
+	unsigned int i;
 	int ret;
 
 	if (!fdev->zbd_meta) {
@@ -1267,6 +1696,8 @@ static int zbc_fake_flush(struct zbc_device *dev)
 	ret = msync(fdev->zbd_meta, fdev->zbd_meta_size, MS_SYNC);
 	if (ret == 0)
 		ret = fsync(dev->zbd_fd);
+	for (i = 1; ret == 0 && i < fdev->zbd_nr_stripes; i++)
+		ret = fsync(fdev->zbd_stripe_fd[i]);
 
 	zbc_fake_unlock(fdev);
 
@@ -1413,6 +1844,33 @@ out:
 	return ret;
 }
 
+/**
+ * zbc_fake_do_set_write_pointer - Change a zone write pointer and condition.
+ */
+static void zbc_fake_do_set_write_pointer(struct zbc_fake_device *fdev,
+					  struct zbc_zone *zone,
+					  uint64_t wp_sector)
+{
+	/* Do nothing for conventional zones */
+	if (!zbc_zone_sequential_req(zone))
+		return;
+
+	if (zbc_zone_is_open(zone))
+		zbc_zone_do_close(fdev, zone);
+
+	zone->zbz_write_pointer = wp_sector;
+	if (zone->zbz_write_pointer == zone->zbz_start) {
+		zone->zbz_condition = ZBC_ZC_EMPTY;
+	} else if (zone->zbz_write_pointer > zone->zbz_start &&
+		   zone->zbz_write_pointer <
+		   zone->zbz_start + zone->zbz_length) {
+		zone->zbz_condition = ZBC_ZC_CLOSED;
+	} else {
+		zone->zbz_condition = ZBC_ZC_FULL;
+		zone->zbz_write_pointer = (uint64_t)-1;
+	}
+}
+
 /**
  * zbc_fake_set_write_pointer - Change the value of a zone write pointer.
  */
@@ -1434,26 +1892,49 @@ static int zbc_fake_set_write_pointer(struct zbc_device *dev,
 	if (!zone)
 		goto out;
 
-	/* Do nothing for conventional zones */
-	if (zbc_zone_sequential_req(zone)) {
+	zbc_fake_do_set_write_pointer(fdev, zone, wp_sector);
 
-		if (zbc_zone_is_open(zone))
-			zbc_zone_do_close(fdev, zone);
+	ret = 0;
 
-		zone->zbz_write_pointer = wp_sector;
-		if (zone->zbz_write_pointer == zone->zbz_start) {
-			zone->zbz_condition = ZBC_ZC_EMPTY;
-		} else if (zone->zbz_write_pointer > zone->zbz_start &&
-			   zone->zbz_write_pointer <
-			   zone->zbz_start + zone->zbz_length) {
-			zone->zbz_condition = ZBC_ZC_CLOSED;
-		} else {
-			zone->zbz_condition = ZBC_ZC_FULL;
-			zone->zbz_write_pointer = (uint64_t)-1;
-		}
+out:
+	zbc_fake_unlock(fdev);
+
+	return ret;
+}
+
+/**
+ * zbc_fake_set_write_pointers - Change the write pointers of a zone range.
+ */
+static int zbc_fake_set_write_pointers(struct zbc_device *dev,
+				       uint64_t sector, unsigned int nr_zones,
+				       const uint64_t *wp_sectors)
+{
+	struct zbc_fake_device *fdev = zbc_fake_to_file_dev(dev);
+	struct zbc_zone *zone;
+	unsigned int i, z;
+	int ret = -EIO;
 
+	if (!fdev->zbd_meta) {
+		zbc_set_errno(ZBC_SK_NOT_READY, ZBC_ASC_FORMAT_IN_PROGRESS);
+		return -ENXIO;
 	}
 
+	zbc_fake_lock(fdev);
+
+	zone = zbc_fake_find_zone(fdev, sector, true);
+	if (!zone)
+		goto out;
+
+	z = zone - fdev->zbd_zones;
+	if (nr_zones > fdev->zbd_nr_zones - z) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	for (i = 0; i < nr_zones; i++)
+		zbc_fake_do_set_write_pointer(fdev, &fdev->zbd_zones[z + i],
+					      wp_sectors[i]);
+
 	ret = 0;
 
 out:
@@ -1462,6 +1943,82 @@ out:
 	return ret;
 }
 
+/**
+ * zbc_fake_set_stripes - Change the backing files the data is striped
+ * across. The zone configuration is dropped as the capacity changes.
+ */
+static int zbc_fake_set_stripes(struct zbc_device *dev, size_t stripe_size,
+				unsigned int nr_files, const char **files)
+{
+	struct zbc_fake_device *fdev = zbc_fake_to_file_dev(dev);
+	char path[ZBC_FAKE_META_PATH_SIZE];
+	char tmp[ZBC_FAKE_META_PATH_SIZE + 4];
+	unsigned int i;
+	FILE *f;
+	int ret;
+
+	if (nr_files >= ZBC_FAKE_MAX_STRIPES ||
+	    (nr_files &&
+	     (!stripe_size || stripe_size % dev->zbd_info.zbd_pblock_size))) {
+		zbc_error("%s: invalid stripe configuration\n",
+			  dev->zbd_filename);
+		return -EINVAL;
+	}
+
+	zbc_fake_lock(fdev);
+
+	/* Write the new configuration */
+	zbc_fake_dev_stripe_path(fdev, path);
+	if (nr_files) {
+		sprintf(tmp, "%s.tmp", path);
+		f = fopen(tmp, "w");
+		if (!f) {
+			ret = -errno;
+			goto out;
+		}
+		fprintf(f, "%zu\n", stripe_size);
+		for (i = 0; i < nr_files; i++)
+			fprintf(f, "%s\n", files[i]);
+		if (fclose(f) || rename(tmp, path)) {
+			ret = -errno;
+			unlink(tmp);
+			goto out;
+		}
+	} else if (unlink(path) && errno != ENOENT) {
+		ret = -errno;
+		goto out;
+	}
+
+	/* Drop the zone configuration */
+	zbc_fake_close_metadata(fdev);
+	fdev->zbd_zones = NULL;
+	fdev->zbd_nr_zones = 0;
+	zbc_fake_dev_meta_path(fdev, path);
+	unlink(path);
+
+	/* Reload the device capacity and stripe members */
+	zbc_fake_close_stripes(fdev);
+	ret = zbc_fake_set_info(dev);
+	if (ret)
+		goto out;
+
+	ret = zbc_fake_open_stripes(fdev);
+	if (ret) {
+		zbc_fake_dev_stripe_path(fdev, path);
+		unlink(path);
+		zbc_fake_set_info(dev);
+	}
+
+out:
+	zbc_fake_unlock(fdev);
+
+	if (ret)
+		zbc_error("%s: set stripes failed %d (%s)\n",
+			  dev->zbd_filename, -ret, strerror(-ret));
+
+	return ret;
+}
+
 /**
  * Fake backend driver definition.
  */
@@ -1476,4 +2033,6 @@ struct zbc_drv zbc_fake_drv = {
 	.zbd_zone_op		= zbc_fake_zone_op,
 	.zbd_set_zones		= zbc_fake_set_zones,
 	.zbd_set_wp		= zbc_fake_set_write_pointer,
+	.zbd_set_wps		= zbc_fake_set_write_pointers,
+	.zbd_set_stripes	= zbc_fake_set_stripes,
 };
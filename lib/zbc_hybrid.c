@@ -0,0 +1,1231 @@
+/*
+ * This file is part of libzbc.
+ *
+ * Copyright (C) 2009-2014, HGST, Inc. All rights reserved.
+ * Copyright (C) 2016, Western Digital. All rights reserved.
+ *
+ * This software is distributed under the terms of the BSD 2-clause license,
+ * "as is," without technical support, and WITHOUT ANY WARRANTY, without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE. You should have received a copy of the BSD 2-clause license along
+ * with libzbc. If not, see  <http://opensource.org/licenses/BSD-2-Clause>.
+ *
+ * Author: Damien Le Moal (damien.lemoal@wdc.com)
+ */
+
+#include "zbc.h"
+#include "libzbc/zbc_hybrid.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+/**
+ * Defaults.
+ */
+#define ZBC_HY_BLOCK_SIZE	4096
+#define ZBC_HY_FREE_PCT		10
+
+/**
+ * Maximum size of the backing device I/Os.
+ */
+#define ZBC_HY_IO_SIZE		(1024 * 1024)
+
+#define ZBC_HY_NONE		((uint32_t)-1)
+#define ZBC_HY_NO_BLOCK		((uint64_t)-1)
+
+/**
+ * Cache layout: 2 superblocks, the dirty block map, the staging area of
+ * zone rewrites (the size of the largest zone) and the cache blocks.
+ * Superblocks are written alternately and hold the state of the zone
+ * rewrite in progress, if any. Their size does not depend on the block
+ * size, so that a cache is never mistaken for an unused one.
+ */
+#define ZBC_HY_SB_MAGIC		0x5a424859
+#define ZBC_HY_SB_SIZE		4096
+
+struct zbc_hy_sb {
+	uint32_t		magic;
+	uint32_t		crc;
+	uint64_t		seq;
+	uint32_t		block_size;
+	uint32_t		nr_blocks;
+	uint64_t		sector;
+	uint64_t		nr_sectors;
+
+	/* Zone rewritten: zone start, staged image sectors and CRC */
+	uint64_t		stage_zone;
+	uint64_t		stage_sectors;
+	uint32_t		stage_crc;
+	uint32_t		reserved;
+};
+
+/**
+ * Dirty block map block, followed by the backing device sector of the
+ * block held by each cache block of the map block (or ZBC_HY_NO_BLOCK).
+ */
+#define ZBC_HY_MAP_MAGIC	0x5a42484d
+
+struct zbc_hy_mblk {
+	uint32_t		magic;
+	uint32_t		crc;
+	uint32_t		index;
+	uint32_t		reserved;
+};
+
+/**
+ * Cache block: hash chain and dirty block list of its zone.
+ */
+struct zbc_hy_blk {
+	uint64_t		sector;
+	uint32_t		hnext;
+	uint32_t		znext;
+};
+
+/**
+ * Hybrid device.
+ */
+struct zbc_hybrid {
+	struct zbc_device	*dev;
+	struct zbc_hybrid_params params;
+	pthread_mutex_t		lock;
+	int			error;
+	int			fd;
+
+	size_t			bs;
+	uint64_t		bsectors;
+
+	/* Backing zones and the dirty blocks of each zone */
+	struct zbc_zone		*zones;
+	unsigned int		nr_zones;
+	uint32_t		*zhead;
+	uint32_t		*zdirty;
+	uint64_t		max_zone_sectors;
+
+	/* Cache layout (bytes) */
+	off_t			map_ofst;
+	off_t			stage_ofst;
+	off_t			data_ofst;
+
+	/* Cache blocks, block hash table and free blocks */
+	struct zbc_hy_blk	*blks;
+	uint32_t		nr_blks;
+	uint32_t		*hash;
+	uint32_t		hash_mask;
+	uint32_t		*free;
+	uint32_t		nr_free;
+
+	/* Dirty block map blocks and their dirty flags */
+	void			*map;
+	unsigned int		nr_mblks;
+	unsigned int		ents_per_mblk;
+	uint8_t			*mdirty;
+
+	/* Superblock and zone image buffer */
+	struct zbc_hy_sb	*sb;
+	uint64_t		seq;
+	void			*img;
+
+	/* Sorted sectors of the dirty blocks of a conventional zone */
+	uint64_t		*dsect;
+
+	struct zbc_hybrid_stats	stats;
+};
+
+/**
+ * Read or write the cache.
+ */
+static int zbc_hy_cache_io(struct zbc_hybrid *hy, void *buf, size_t len,
+			   off_t ofst, bool write)
+{
+	ssize_t ret;
+
+	while (len) {
+		if (write)
+			ret = pwrite(hy->fd, buf, len, ofst);
+		else
+			ret = pread(hy->fd, buf, len, ofst);
+		if (ret <= 0) {
+			if (ret < 0 && errno == EINTR)
+				continue;
+			ret = ret < 0 ? -errno : -EIO;
+			zbc_error("%s: %s cache at %lld failed %zd\n",
+				  hy->params.zyp_cache_path,
+				  write ? "Write" : "Read",
+				  (long long)ofst, ret);
+			return ret;
+		}
+		buf = (char *)buf + ret;
+		len -= ret;
+		ofst += ret;
+	}
+
+	return 0;
+}
+
+static int zbc_hy_cache_sync(struct zbc_hybrid *hy)
+{
+	int ret;
+
+	if (fdatasync(hy->fd) < 0) {
+		ret = -errno;
+		zbc_error("%s: Sync cache failed %d\n",
+			  hy->params.zyp_cache_path, ret);
+		return ret;
+	}
+
+	return 0;
+}
+
+/**
+ * Read or write the backing device, in I/Os of at most ZBC_HY_IO_SIZE.
+ */
+static int zbc_hy_dev_io(struct zbc_hybrid *hy, void *buf, uint64_t count,
+			 uint64_t sector, bool write)
+{
+	uint64_t n;
+	ssize_t ret;
+
+	while (count) {
+		n = count < (ZBC_HY_IO_SIZE >> 9) ? count : ZBC_HY_IO_SIZE >> 9;
+		if (write)
+			ret = zbc_pwrite(hy->dev, buf, n, sector);
+		else
+			ret = zbc_pread(hy->dev, buf, n, sector);
+		if (ret >= 0 && (uint64_t)ret != n)
+			ret = -EIO;
+		if (ret < 0)
+			return ret;
+		buf = (char *)buf + (n << 9);
+		count -= n;
+		sector += n;
+	}
+
+	return 0;
+}
+
+static inline off_t zbc_hy_blk_ofst(struct zbc_hybrid *hy, uint32_t i)
+{
+	return hy->data_ofst + (off_t)i * hy->bs;
+}
+
+static inline uint64_t *zbc_hy_map_ent(struct zbc_hybrid *hy, uint32_t i)
+{
+	char *mb = (char *)hy->map + (i / hy->ents_per_mblk) * hy->bs;
+
+	return (uint64_t *)(mb + sizeof(struct zbc_hy_mblk)) +
+		i % hy->ents_per_mblk;
+}
+
+static inline void zbc_hy_set_map(struct zbc_hybrid *hy, uint32_t i,
+				  uint64_t sector)
+{
+	*zbc_hy_map_ent(hy, i) = sector;
+	hy->mdirty[i / hy->ents_per_mblk] = 1;
+}
+
+static inline uint32_t zbc_hy_hash(struct zbc_hybrid *hy, uint64_t sector)
+{
+	uint64_t b = sector / hy->bsectors;
+
+	return ((b * 0x9e3779b97f4a7c15ULL) >> 32) & hy->hash_mask;
+}
+
+/**
+ * Get the end of the readable data of a zone.
+ */
+static uint64_t zbc_hy_zone_wp(struct zbc_zone *zone)
+{
+	if (zbc_zone_conventional(zone) || zbc_zone_full(zone))
+		return zbc_zone_start(zone) + zbc_zone_length(zone);
+	if (zbc_zone_empty(zone))
+		return zbc_zone_start(zone);
+
+	return zbc_zone_wp(zone);
+}
+
+/**
+ * Get the index of the zone containing a sector of the range.
+ */
+static unsigned int zbc_hy_zone_idx(struct zbc_hybrid *hy, uint64_t sector)
+{
+	unsigned int lo = 0, hi = hy->nr_zones - 1, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi + 1) / 2;
+		if (zbc_zone_start(&hy->zones[mid]) <= sector)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+
+	return lo;
+}
+
+/**
+ * Find the cache block holding a block.
+ */
+static uint32_t zbc_hy_lookup(struct zbc_hybrid *hy, uint64_t sector)
+{
+	uint32_t i = hy->hash[zbc_hy_hash(hy, sector)];
+
+	while (i != ZBC_HY_NONE && hy->blks[i].sector != sector)
+		i = hy->blks[i].hnext;
+
+	return i;
+}
+
+/**
+ * Add a cache block to the hash table and to the dirty list of its zone.
+ */
+static void zbc_hy_add(struct zbc_hybrid *hy, uint32_t i, uint64_t sector)
+{
+	struct zbc_hy_blk *blk = &hy->blks[i];
+	uint32_t h = zbc_hy_hash(hy, sector);
+	unsigned int zi = zbc_hy_zone_idx(hy, sector);
+
+	blk->sector = sector;
+	blk->hnext = hy->hash[h];
+	hy->hash[h] = i;
+	blk->znext = hy->zhead[zi];
+	hy->zhead[zi] = i;
+	hy->zdirty[zi]++;
+}
+
+static void zbc_hy_hash_del(struct zbc_hybrid *hy, uint32_t i)
+{
+	uint32_t *p = &hy->hash[zbc_hy_hash(hy, hy->blks[i].sector)];
+
+	while (*p != i)
+		p = &hy->blks[*p].hnext;
+	*p = hy->blks[i].hnext;
+}
+
+/**
+ * Write the runs of modified dirty block map blocks.
+ */
+static int zbc_hy_write_map(struct zbc_hybrid *hy)
+{
+	struct zbc_hy_mblk *mb;
+	unsigned int i, j, k;
+	int ret;
+
+	for (i = 0; i < hy->nr_mblks; i = j) {
+		if (!hy->mdirty[i]) {
+			j = i + 1;
+			continue;
+		}
+
+		for (j = i; j < hy->nr_mblks && hy->mdirty[j]; j++) {
+			mb = (struct zbc_hy_mblk *)((char *)hy->map + j * hy->bs);
+			mb->crc = 0;
+			mb->crc = zbc_crc32c(0, mb, hy->bs);
+		}
+
+		ret = zbc_hy_cache_io(hy, (char *)hy->map + i * hy->bs,
+				      (j - i) * hy->bs,
+				      hy->map_ofst + (off_t)i * hy->bs, true);
+		if (ret)
+			return ret;
+
+		for (k = i; k < j; k++)
+			hy->mdirty[k] = 0;
+	}
+
+	return 0;
+}
+
+/**
+ * Write the next superblock and sync the cache.
+ */
+static int zbc_hy_write_sb(struct zbc_hybrid *hy)
+{
+	struct zbc_hy_sb *sb = hy->sb;
+	int ret;
+
+	sb->magic = ZBC_HY_SB_MAGIC;
+	sb->seq = hy->seq + 1;
+	sb->block_size = hy->bs;
+	sb->nr_blocks = hy->nr_blks;
+	sb->sector = hy->params.zyp_sector;
+	sb->nr_sectors = hy->params.zyp_nr_sectors;
+	sb->crc = 0;
+	sb->crc = zbc_crc32c(0, sb, ZBC_HY_SB_SIZE);
+
+	ret = zbc_hy_cache_io(hy, sb, ZBC_HY_SB_SIZE,
+			      (sb->seq & 1) * ZBC_HY_SB_SIZE, true);
+	if (ret)
+		return ret;
+
+	ret = zbc_hy_cache_sync(hy);
+	if (ret)
+		return ret;
+
+	hy->seq++;
+
+	return 0;
+}
+
+/**
+ * Write sectors of a sequential zone from its start or from its write
+ * pointer and update the zone information.
+ */
+static int zbc_hy_write_zone(struct zbc_hybrid *hy, unsigned int zi,
+			     uint64_t sector, uint64_t count, bool reset)
+{
+	struct zbc_zone *zone = &hy->zones[zi];
+	uint64_t start = zbc_zone_start(zone);
+	unsigned int nz = 1;
+	int ret;
+
+	if (reset) {
+		ret = zbc_reset_zone(hy->dev, start, 0);
+		if (ret)
+			return ret;
+	}
+
+	ret = zbc_hy_dev_io(hy, hy->img, count, sector, true);
+	if (ret)
+		return ret;
+
+	ret = zbc_flush(hy->dev);
+	if (ret)
+		return ret;
+
+	/* Do not keep the zone open */
+	if (sector + count < start + zbc_zone_length(zone)) {
+		ret = zbc_close_zone(hy->dev, start, 0);
+		if (ret)
+			return ret;
+	}
+
+	hy->stats.zys_destage_sectors += count;
+
+	return zbc_report_zones(hy->dev, start, ZBC_RO_ALL, zone, &nz);
+}
+
+static int zbc_hy_sector_cmp(const void *a, const void *b)
+{
+	uint64_t sa = *(const uint64_t *)a, sb = *(const uint64_t *)b;
+
+	return sa < sb ? -1 : sa > sb;
+}
+
+/**
+ * Write the dirty blocks of a conventional zone in place, in sector order
+ * and merging contiguous blocks in I/Os of at most ZBC_HY_IO_SIZE.
+ */
+static int zbc_hy_destage_conv(struct zbc_hybrid *hy, unsigned int zi)
+{
+	unsigned int max_len = ZBC_HY_IO_SIZE / hy->bs;
+	unsigned int n = 0, b, len, k, m;
+	uint32_t i;
+	int ret;
+
+	for (i = hy->zhead[zi]; i != ZBC_HY_NONE; i = hy->blks[i].znext)
+		hy->dsect[n++] = hy->blks[i].sector;
+	qsort(hy->dsect, n, sizeof(uint64_t), zbc_hy_sector_cmp);
+
+	for (b = 0; b < n; b += len) {
+		for (len = 1; b + len < n && len < max_len; len++) {
+			if (hy->dsect[b + len] !=
+			    hy->dsect[b] + len * hy->bsectors)
+				break;
+		}
+
+		/* Read runs of contiguous cache blocks */
+		for (k = 0; k < len; k += m) {
+			i = zbc_hy_lookup(hy, hy->dsect[b + k]);
+			for (m = 1; k + m < len; m++) {
+				if (zbc_hy_lookup(hy, hy->dsect[b + k + m]) !=
+				    i + m)
+					break;
+			}
+			ret = zbc_hy_cache_io(hy, (char *)hy->img + k * hy->bs,
+					      m * hy->bs,
+					      zbc_hy_blk_ofst(hy, i), false);
+			if (ret)
+				return ret;
+		}
+
+		ret = zbc_hy_dev_io(hy, hy->img, len * hy->bsectors,
+				    hy->dsect[b], true);
+		if (ret)
+			return ret;
+		hy->stats.zys_destage_sectors += len * hy->bsectors;
+	}
+
+	return zbc_flush(hy->dev);
+}
+
+/**
+ * Destage the dirty blocks of a zone.
+ */
+static int zbc_hy_destage_zone(struct zbc_hybrid *hy, unsigned int zi)
+{
+	struct zbc_zone *zone = &hy->zones[zi];
+	uint64_t start = zbc_zone_start(zone);
+	uint64_t wp = zbc_hy_zone_wp(zone);
+	uint64_t first = ZBC_HY_NO_BLOCK, end = 0, base;
+	struct zbc_hy_blk *blk;
+	bool staged = false;
+	uint32_t i;
+	int ret;
+
+	for (i = hy->zhead[zi]; i != ZBC_HY_NONE; i = hy->blks[i].znext) {
+		blk = &hy->blks[i];
+		if (blk->sector < first)
+			first = blk->sector;
+		if (blk->sector + hy->bsectors > end)
+			end = blk->sector + hy->bsectors;
+	}
+	if (first == ZBC_HY_NO_BLOCK)
+		return 0;
+
+	if (zbc_zone_conventional(zone)) {
+		ret = zbc_hy_destage_conv(hy, zi);
+		if (ret)
+			goto err;
+		goto done;
+	}
+
+	/*
+	 * Append the dirty blocks if they are all after the write pointer,
+	 * or merge them with the zone data and rewrite the zone.
+	 */
+	base = first >= wp ? wp : start;
+	if (end < wp)
+		end = wp;
+	if (base == start && wp > start) {
+		ret = zbc_hy_dev_io(hy, hy->img, wp - start, start, false);
+		if (ret)
+			goto err;
+	}
+	memset((char *)hy->img + ((wp - base) << 9), 0, (end - wp) << 9);
+
+	for (i = hy->zhead[zi]; i != ZBC_HY_NONE; i = hy->blks[i].znext) {
+		blk = &hy->blks[i];
+		ret = zbc_hy_cache_io(hy,
+				      (char *)hy->img +
+				      ((blk->sector - base) << 9),
+				      hy->bs, zbc_hy_blk_ofst(hy, i), false);
+		if (ret)
+			goto err;
+	}
+
+	if (base == wp) {
+		ret = zbc_hy_write_zone(hy, zi, wp, end - wp, false);
+		if (ret)
+			goto err;
+		hy->stats.zys_nr_appends++;
+		goto done;
+	}
+
+	/* Stage the zone image before the zone is reset */
+	ret = zbc_hy_cache_io(hy, hy->img, (end - start) << 9,
+			      hy->stage_ofst, true);
+	if (!ret)
+		ret = zbc_hy_cache_sync(hy);
+	if (ret)
+		goto err;
+
+	hy->sb->stage_zone = start;
+	hy->sb->stage_sectors = end - start;
+	hy->sb->stage_crc = zbc_crc32c(0, hy->img, (end - start) << 9);
+	ret = zbc_hy_write_sb(hy);
+	if (ret)
+		goto err;
+	staged = true;
+
+	ret = zbc_hy_write_zone(hy, zi, start, end - start, true);
+	if (ret)
+		goto err;
+
+done:
+	/* Free the cache blocks once the map is durable */
+	for (i = hy->zhead[zi]; i != ZBC_HY_NONE; i = hy->blks[i].znext)
+		zbc_hy_set_map(hy, i, ZBC_HY_NO_BLOCK);
+	ret = zbc_hy_write_map(hy);
+	if (ret)
+		goto err;
+
+	if (staged) {
+		hy->sb->stage_zone = 0;
+		hy->sb->stage_sectors = 0;
+		hy->sb->stage_crc = 0;
+		ret = zbc_hy_write_sb(hy);
+	} else {
+		ret = zbc_hy_cache_sync(hy);
+	}
+	if (ret)
+		goto err;
+
+	for (i = hy->zhead[zi]; i != ZBC_HY_NONE; i = hy->blks[i].znext) {
+		zbc_hy_hash_del(hy, i);
+		hy->free[hy->nr_free++] = i;
+		hy->stats.zys_destage_blocks++;
+	}
+	hy->zhead[zi] = ZBC_HY_NONE;
+	hy->zdirty[zi] = 0;
+	hy->stats.zys_nr_destages++;
+
+	return 0;
+
+err:
+	zbc_error("%s: Destage zone %llu failed %d\n",
+		  hy->dev->zbd_filename, (unsigned long long)start, ret);
+	hy->error = ret;
+
+	return ret;
+}
+
+/**
+ * Get the zone with the most dirty blocks (-1 if there is none).
+ */
+static int zbc_hy_dirtiest_zone(struct zbc_hybrid *hy)
+{
+	unsigned int i;
+	int zi = -1;
+
+	for (i = 0; i < hy->nr_zones; i++) {
+		if (hy->zdirty[i] &&
+		    (zi < 0 || hy->zdirty[i] > hy->zdirty[zi]))
+			zi = i;
+	}
+
+	return zi;
+}
+
+static int zbc_hy_check_io(struct zbc_hybrid *hy, size_t count,
+			   uint64_t offset)
+{
+	struct zbc_hybrid_params *p = &hy->params;
+
+	if (!count || count % hy->bsectors || offset % hy->bsectors ||
+	    offset < p->zyp_sector ||
+	    offset + count > p->zyp_sector + p->zyp_nr_sectors) {
+		zbc_error("%s: Invalid hybrid device I/O (%zu sectors at %llu)\n",
+			  hy->dev->zbd_filename, count,
+			  (unsigned long long)offset);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/**
+ * zbc_hybrid_pread - Read sectors from a hybrid device
+ */
+ssize_t zbc_hybrid_pread(struct zbc_hybrid *hy, void *buf, size_t count,
+			 uint64_t offset)
+{
+	uint64_t sector = offset, end = offset + count;
+	uint64_t n, lim, wp, rd;
+	struct zbc_zone *zone;
+	char *p = buf;
+	uint32_t i;
+	int ret;
+
+	ret = zbc_hy_check_io(hy, count, offset);
+	if (ret)
+		return ret;
+
+	pthread_mutex_lock(&hy->lock);
+
+	ret = hy->error;
+	while (!ret && sector < end) {
+		i = zbc_hy_lookup(hy, sector);
+		if (i != ZBC_HY_NONE) {
+			/* Run of contiguous cache blocks */
+			for (n = 1; sector + n * hy->bsectors < end &&
+			     zbc_hy_lookup(hy, sector + n * hy->bsectors) ==
+			     i + n; n++)
+				;
+			ret = zbc_hy_cache_io(hy, p, n * hy->bs,
+					      zbc_hy_blk_ofst(hy, i), false);
+			hy->stats.zys_read_hits += n;
+		} else {
+			/* Run of uncached blocks of the same zone */
+			zone = &hy->zones[zbc_hy_zone_idx(hy, sector)];
+			lim = zbc_zone_start(zone) + zbc_zone_length(zone);
+			if (lim > end)
+				lim = end;
+			for (n = 1; sector + n * hy->bsectors < lim &&
+			     zbc_hy_lookup(hy, sector + n * hy->bsectors) ==
+			     ZBC_HY_NONE; n++)
+				;
+			wp = zbc_hy_zone_wp(zone);
+			rd = wp > sector ? wp - sector : 0;
+			if (rd > n * hy->bsectors)
+				rd = n * hy->bsectors;
+			if (rd)
+				ret = zbc_hy_dev_io(hy, p, rd, sector, false);
+			memset(p + (rd << 9), 0, (n * hy->bsectors - rd) << 9);
+			hy->stats.zys_read_misses += n;
+		}
+		sector += n * hy->bsectors;
+		p += n * hy->bs;
+	}
+
+	pthread_mutex_unlock(&hy->lock);
+
+	return ret ? ret : (ssize_t)count;
+}
+
+/**
+ * Get the number of blocks of a write that are not cached.
+ */
+static uint64_t zbc_hy_nr_uncached(struct zbc_hybrid *hy, uint64_t nr,
+				   uint64_t offset)
+{
+	uint64_t b, n = 0;
+
+	for (b = 0; b < nr; b++) {
+		if (zbc_hy_lookup(hy, offset + b * hy->bsectors) == ZBC_HY_NONE)
+			n++;
+	}
+
+	return n;
+}
+
+/**
+ * zbc_hybrid_pwrite - Write sectors to a hybrid device
+ */
+ssize_t zbc_hybrid_pwrite(struct zbc_hybrid *hy, const void *buf,
+			  size_t count, uint64_t offset)
+{
+	uint64_t nr = count / hy->bsectors, needed, reserve, b;
+	uint32_t i = ZBC_HY_NONE, run = ZBC_HY_NONE, run_len = 0;
+	const char *p = buf, *run_buf = NULL;
+	int zi, ret;
+
+	ret = zbc_hy_check_io(hy, count, offset);
+	if (ret)
+		return ret;
+
+	pthread_mutex_lock(&hy->lock);
+
+	ret = hy->error;
+	if (ret)
+		goto out;
+
+	if (nr > hy->nr_blks) {
+		ret = -ENOSPC;
+		goto out;
+	}
+
+	/*
+	 * Destage zones to keep enough free cache blocks. Destaging a zone
+	 * of the write frees cache blocks that the write would have
+	 * overwritten, so count the blocks needed again after each destage.
+	 */
+	reserve = (uint64_t)hy->nr_blks * hy->params.zyp_free_pct / 100;
+	needed = zbc_hy_nr_uncached(hy, nr, offset);
+	while (hy->nr_free < needed + reserve &&
+	       (zi = zbc_hy_dirtiest_zone(hy)) >= 0) {
+		ret = zbc_hy_destage_zone(hy, zi);
+		if (ret)
+			goto out;
+		needed = zbc_hy_nr_uncached(hy, nr, offset);
+	}
+	if (hy->nr_free < needed) {
+		ret = -ENOSPC;
+		goto out;
+	}
+
+	/* Write runs of contiguous cache blocks */
+	for (b = 0; b <= nr; b++, p += hy->bs) {
+		if (b < nr) {
+			uint64_t sector = offset + b * hy->bsectors;
+
+			i = zbc_hy_lookup(hy, sector);
+			if (i == ZBC_HY_NONE) {
+				i = hy->free[--hy->nr_free];
+				zbc_hy_add(hy, i, sector);
+				zbc_hy_set_map(hy, i, sector);
+			} else {
+				hy->stats.zys_write_hits++;
+			}
+			if (run_len && i == run + run_len) {
+				run_len++;
+				continue;
+			}
+		}
+		if (run_len) {
+			ret = zbc_hy_cache_io(hy, (void *)run_buf,
+					      run_len * hy->bs,
+					      zbc_hy_blk_ofst(hy, run), true);
+			if (ret)
+				goto out;
+		}
+		run = i;
+		run_buf = p;
+		run_len = 1;
+	}
+
+	hy->stats.zys_write_blocks += nr;
+
+out:
+	pthread_mutex_unlock(&hy->lock);
+
+	return ret ? ret : (ssize_t)count;
+}
+
+/**
+ * zbc_hybrid_flush - Flush a hybrid device
+ */
+int zbc_hybrid_flush(struct zbc_hybrid *hy)
+{
+	int ret;
+
+	pthread_mutex_lock(&hy->lock);
+
+	ret = hy->error;
+	if (!ret)
+		ret = zbc_hy_write_map(hy);
+	if (!ret)
+		ret = zbc_hy_cache_sync(hy);
+
+	pthread_mutex_unlock(&hy->lock);
+
+	return ret;
+}
+
+/**
+ * zbc_hybrid_destage - Destage zones of a hybrid device
+ */
+int zbc_hybrid_destage(struct zbc_hybrid *hy, unsigned int nr_zones)
+{
+	unsigned int n = 0;
+	int zi, ret;
+
+	pthread_mutex_lock(&hy->lock);
+
+	ret = hy->error;
+	while (!ret && (!nr_zones || n < nr_zones) &&
+	       (zi = zbc_hy_dirtiest_zone(hy)) >= 0) {
+		ret = zbc_hy_destage_zone(hy, zi);
+		if (!ret)
+			n++;
+	}
+
+	pthread_mutex_unlock(&hy->lock);
+
+	return ret ? ret : (int)n;
+}
+
+/**
+ * zbc_hybrid_get_stats - Get a hybrid device statistics
+ */
+void zbc_hybrid_get_stats(struct zbc_hybrid *hy,
+			  struct zbc_hybrid_stats *stats)
+{
+	pthread_mutex_lock(&hy->lock);
+
+	*stats = hy->stats;
+	stats->zys_nr_blocks = hy->nr_blks;
+	stats->zys_nr_dirty = hy->nr_blks - hy->nr_free;
+
+	pthread_mutex_unlock(&hy->lock);
+}
+
+/**
+ * Get the zones of the backing device range.
+ */
+static int zbc_hy_get_zones(struct zbc_hybrid *hy)
+{
+	struct zbc_hybrid_params *p = &hy->params;
+	uint64_t end = p->zyp_sector + p->zyp_nr_sectors;
+	struct zbc_zone *zones;
+	unsigned int nr_zones, i, j;
+	int ret;
+
+	ret = zbc_list_zones(hy->dev, p->zyp_sector, ZBC_RO_ALL,
+			     &zones, &nr_zones);
+	if (ret)
+		return ret;
+
+	/* Keep the zones that are within the range */
+	for (i = 0, j = 0; i < nr_zones; i++) {
+		if (p->zyp_nr_sectors &&
+		    zones[i].zbz_start + zones[i].zbz_length > end)
+			break;
+		if (zones[i].zbz_start % hy->bsectors ||
+		    zones[i].zbz_length % hy->bsectors)
+			break;
+		zones[j++] = zones[i];
+	}
+
+	if (!j || zbc_zone_start(&zones[0]) != p->zyp_sector ||
+	    (p->zyp_nr_sectors &&
+	     zbc_zone_start(&zones[j - 1]) +
+	     zbc_zone_length(&zones[j - 1]) != end)) {
+		zbc_error("%s: Invalid hybrid device range\n",
+			  hy->dev->zbd_filename);
+		zbc_free(zones);
+		return -EINVAL;
+	}
+
+	if (!p->zyp_nr_sectors)
+		p->zyp_nr_sectors = zbc_zone_start(&zones[j - 1]) +
+			zbc_zone_length(&zones[j - 1]) - p->zyp_sector;
+
+	hy->zones = zones;
+	hy->nr_zones = j;
+	for (i = 0; i < j; i++) {
+		if (zbc_zone_length(&zones[i]) > hy->max_zone_sectors)
+			hy->max_zone_sectors = zbc_zone_length(&zones[i]);
+	}
+
+	return 0;
+}
+
+/**
+ * Determine the cache layout.
+ */
+static int zbc_hy_layout(struct zbc_hybrid *hy)
+{
+	uint64_t stage = hy->max_zone_sectors << 9, avail, n;
+	off_t size;
+
+	size = lseek(hy->fd, 0, SEEK_END);
+	if (size < 0)
+		return -errno;
+
+	hy->ents_per_mblk = (hy->bs - sizeof(struct zbc_hy_mblk)) /
+		sizeof(uint64_t);
+
+	/* Keep the cache blocks aligned to the block size */
+	hy->map_ofst = (2 * ZBC_HY_SB_SIZE + hy->bs - 1) / hy->bs * hy->bs;
+
+	n = 0;
+	if ((uint64_t)size > hy->map_ofst + stage) {
+		avail = (size - hy->map_ofst - stage) / hy->bs;
+		n = avail * hy->ents_per_mblk / (hy->ents_per_mblk + 1);
+		while (n && n + (n + hy->ents_per_mblk - 1) /
+		       hy->ents_per_mblk > avail)
+			n--;
+	}
+	if (!n || n >= ZBC_HY_NONE) {
+		zbc_error("%s: Invalid hybrid device cache size %lld\n",
+			  hy->params.zyp_cache_path, (long long)size);
+		return -EINVAL;
+	}
+
+	hy->nr_blks = n;
+	hy->nr_mblks = (n + hy->ents_per_mblk - 1) / hy->ents_per_mblk;
+	hy->stage_ofst = hy->map_ofst + (off_t)hy->nr_mblks * hy->bs;
+	hy->data_ofst = hy->stage_ofst + stage;
+
+	return 0;
+}
+
+/**
+ * Initialize an unused cache.
+ */
+static int zbc_hy_format(struct zbc_hybrid *hy)
+{
+	struct zbc_hy_mblk *mb;
+	unsigned int i;
+	uint32_t b;
+	int ret;
+
+	memset(hy->map, 0, hy->nr_mblks * hy->bs);
+	for (i = 0; i < hy->nr_mblks; i++) {
+		mb = (struct zbc_hy_mblk *)((char *)hy->map + i * hy->bs);
+		mb->magic = ZBC_HY_MAP_MAGIC;
+		mb->index = i;
+	}
+	for (b = 0; b < hy->nr_blks; b++)
+		zbc_hy_set_map(hy, b, ZBC_HY_NO_BLOCK);
+
+	ret = zbc_hy_write_map(hy);
+	if (ret)
+		return ret;
+
+	memset(hy->sb, 0, ZBC_HY_SB_SIZE);
+
+	return zbc_hy_write_sb(hy);
+}
+
+/**
+ * Replay an interrupted zone rewrite.
+ */
+static int zbc_hy_replay(struct zbc_hybrid *hy)
+{
+	struct zbc_hy_sb *sb = hy->sb;
+	unsigned int zi;
+	int ret;
+
+	zi = zbc_hy_zone_idx(hy, sb->stage_zone);
+	if (sb->stage_zone != zbc_zone_start(&hy->zones[zi]) ||
+	    zbc_zone_conventional(&hy->zones[zi]) ||
+	    sb->stage_sectors > zbc_zone_length(&hy->zones[zi]))
+		goto err;
+
+	ret = zbc_hy_cache_io(hy, hy->img, sb->stage_sectors << 9,
+			      hy->stage_ofst, false);
+	if (ret)
+		return ret;
+	if (zbc_crc32c(0, hy->img, sb->stage_sectors << 9) != sb->stage_crc)
+		goto err;
+
+	ret = zbc_hy_write_zone(hy, zi, sb->stage_zone, sb->stage_sectors,
+				true);
+	if (ret)
+		return ret;
+
+	sb->stage_zone = 0;
+	sb->stage_sectors = 0;
+	sb->stage_crc = 0;
+
+	return zbc_hy_write_sb(hy);
+
+err:
+	zbc_error("%s: Invalid staged zone %llu\n",
+		  hy->params.zyp_cache_path,
+		  (unsigned long long)sb->stage_zone);
+
+	return -EIO;
+}
+
+/**
+ * Load the dirty block map of a cache, replaying the zone rewrite
+ * recorded in its last superblock, if any.
+ */
+static int zbc_hy_load_map(struct zbc_hybrid *hy, struct zbc_hy_sb *best)
+{
+	struct zbc_hybrid_params *p = &hy->params;
+	struct zbc_hy_mblk *mb;
+	unsigned int i;
+	uint32_t crc;
+	int ret;
+
+	if (best->block_size != hy->bs ||
+	    best->nr_blocks != hy->nr_blks ||
+	    best->sector != p->zyp_sector ||
+	    best->nr_sectors != p->zyp_nr_sectors) {
+		zbc_error("%s: Hybrid device parameters do not match the cache\n",
+			  p->zyp_cache_path);
+		return -EINVAL;
+	}
+
+	memcpy(hy->sb, best, ZBC_HY_SB_SIZE);
+	hy->seq = best->seq;
+
+	ret = zbc_hy_cache_io(hy, hy->map, hy->nr_mblks * hy->bs,
+			      hy->map_ofst, false);
+	if (ret)
+		return ret;
+
+	for (i = 0; i < hy->nr_mblks; i++) {
+		mb = (struct zbc_hy_mblk *)((char *)hy->map + i * hy->bs);
+		crc = mb->crc;
+		mb->crc = 0;
+		if (mb->magic != ZBC_HY_MAP_MAGIC || mb->index != i ||
+		    crc != zbc_crc32c(0, mb, hy->bs)) {
+			zbc_error("%s: Invalid dirty block map block %u\n",
+				  p->zyp_cache_path, i);
+			return -EIO;
+		}
+		mb->crc = crc;
+	}
+
+	if (hy->sb->stage_sectors)
+		return zbc_hy_replay(hy);
+
+	return 0;
+}
+
+/**
+ * Load the cache superblock and dirty block map.
+ */
+static int zbc_hy_load(struct zbc_hybrid *hy)
+{
+	struct zbc_hybrid_params *p = &hy->params;
+	struct zbc_hy_sb *sb, *best = NULL;
+	uint64_t sector;
+	unsigned int i;
+	uint32_t crc, b;
+	void *buf;
+	int ret;
+
+	buf = zbc_memalign(sysconf(_SC_PAGESIZE), 2 * ZBC_HY_SB_SIZE);
+	if (!buf)
+		return -ENOMEM;
+
+	ret = zbc_hy_cache_io(hy, buf, 2 * ZBC_HY_SB_SIZE, 0, false);
+	if (ret)
+		goto out;
+
+	for (i = 0; i < 2; i++) {
+		sb = (struct zbc_hy_sb *)((char *)buf + i * ZBC_HY_SB_SIZE);
+		crc = sb->crc;
+		sb->crc = 0;
+		if (sb->magic != ZBC_HY_SB_MAGIC ||
+		    (sb->seq & 1) != i ||
+		    crc != zbc_crc32c(0, sb, ZBC_HY_SB_SIZE))
+			continue;
+		if (!best || sb->seq > best->seq)
+			best = sb;
+	}
+
+	if (!best)
+		ret = zbc_hy_format(hy);
+	else
+		ret = zbc_hy_load_map(hy, best);
+	if (ret)
+		goto out;
+
+	/* Free blocks are used in ascending order */
+	for (b = hy->nr_blks; b-- > 0;) {
+		sector = *zbc_hy_map_ent(hy, b);
+		if (sector == ZBC_HY_NO_BLOCK) {
+			hy->free[hy->nr_free++] = b;
+			continue;
+		}
+		if (sector % hy->bsectors || sector < p->zyp_sector ||
+		    sector >= p->zyp_sector + p->zyp_nr_sectors ||
+		    zbc_hy_lookup(hy, sector) != ZBC_HY_NONE) {
+			zbc_error("%s: Invalid cache block %u sector %llu\n",
+				  p->zyp_cache_path, b,
+				  (unsigned long long)sector);
+			ret = -EIO;
+			goto out;
+		}
+		zbc_hy_add(hy, b, sector);
+	}
+
+out:
+	zbc_free(buf);
+
+	return ret;
+}
+
+/**
+ * zbc_hybrid_open - Open a hybrid device
+ */
+int zbc_hybrid_open(struct zbc_device *dev, struct zbc_hybrid_params *params,
+		    struct zbc_hybrid **phy)
+{
+	size_t pbs = dev->zbd_info.zbd_pblock_size;
+	struct zbc_hybrid_params *p;
+	struct zbc_hybrid *hy;
+	unsigned int i;
+	int ret;
+
+	if (!params || !params->zyp_cache_path)
+		return -EINVAL;
+
+	hy = zbc_calloc(1, sizeof(struct zbc_hybrid));
+	if (!hy)
+		return -ENOMEM;
+
+	hy->dev = dev;
+	hy->params = *params;
+	hy->fd = -1;
+	pthread_mutex_init(&hy->lock, NULL);
+
+	p = &hy->params;
+	if (!p->zyp_block_size)
+		p->zyp_block_size = ZBC_HY_BLOCK_SIZE;
+	if (!p->zyp_free_pct)
+		p->zyp_free_pct = ZBC_HY_FREE_PCT;
+
+	hy->bs = p->zyp_block_size;
+	hy->bsectors = hy->bs >> 9;
+	if (hy->bs % pbs ||
+	    hy->bs > ZBC_HY_IO_SIZE || p->zyp_free_pct >= 100) {
+		zbc_error("%s: Invalid hybrid device parameters\n",
+			  dev->zbd_filename);
+		ret = -EINVAL;
+		goto err;
+	}
+
+	ret = zbc_hy_get_zones(hy);
+	if (ret)
+		goto err;
+
+	hy->fd = open(p->zyp_cache_path, O_RDWR);
+	if (hy->fd < 0) {
+		ret = -errno;
+		zbc_error("Open hybrid device cache %s failed %d\n",
+			  p->zyp_cache_path, ret);
+		goto err;
+	}
+
+	ret = zbc_hy_layout(hy);
+	if (ret)
+		goto err;
+
+	hy->zhead = zbc_malloc(hy->nr_zones * sizeof(uint32_t));
+	hy->zdirty = zbc_calloc(hy->nr_zones, sizeof(uint32_t));
+	hy->blks = zbc_malloc(hy->nr_blks * sizeof(struct zbc_hy_blk));
+	for (i = 1; i < hy->nr_blks; i <<= 1)
+		;
+	hy->hash_mask = i - 1;
+	hy->hash = zbc_malloc(i * sizeof(uint32_t));
+	hy->free = zbc_malloc(hy->nr_blks * sizeof(uint32_t));
+	hy->map = zbc_memalign(sysconf(_SC_PAGESIZE), hy->nr_mblks * hy->bs);
+	hy->mdirty = zbc_calloc(hy->nr_mblks, 1);
+	hy->sb = zbc_memalign(sysconf(_SC_PAGESIZE), ZBC_HY_SB_SIZE);
+	hy->img = zbc_memalign(sysconf(_SC_PAGESIZE),
+			       hy->max_zone_sectors << 9);
+	hy->dsect = zbc_malloc((hy->max_zone_sectors / hy->bsectors + 1) *
+			       sizeof(uint64_t));
+	if (!hy->zhead || !hy->zdirty || !hy->blks || !hy->hash ||
+	    !hy->free || !hy->map || !hy->mdirty || !hy->sb || !hy->img ||
+	    !hy->dsect) {
+		ret = -ENOMEM;
+		goto err;
+	}
+	memset(hy->zhead, 0xff, hy->nr_zones * sizeof(uint32_t));
+	memset(hy->hash, 0xff, i * sizeof(uint32_t));
+
+	ret = zbc_hy_load(hy);
+	if (ret)
+		goto err;
+
+	*phy = hy;
+
+	return 0;
+
+err:
+	/* Do not write anything */
+	hy->error = ret;
+	zbc_hybrid_close(hy);
+
+	return ret;
+}
+
+/**
+ * zbc_hybrid_close - Close a hybrid device
+ */
+int zbc_hybrid_close(struct zbc_hybrid *hy)
+{
+	int ret = 0;
+
+	if (!hy)
+		return 0;
+
+	if (!hy->error)
+		ret = zbc_hybrid_flush(hy);
+
+	if (hy->fd >= 0)
+		close(hy->fd);
+	pthread_mutex_destroy(&hy->lock);
+	zbc_free(hy->dsect);
+	zbc_free(hy->img);
+	zbc_free(hy->sb);
+	zbc_free(hy->mdirty);
+	zbc_free(hy->map);
+	zbc_free(hy->free);
+	zbc_free(hy->hash);
+	zbc_free(hy->blks);
+	zbc_free(hy->zdirty);
+	zbc_free(hy->zhead);
+	zbc_free(hy->zones);
+	zbc_free(hy);
+
+	return ret;
+}
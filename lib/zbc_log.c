@@ -0,0 +1,1194 @@
+/*
+ * This file is part of libzbc.
+ *
+ * Copyright (C) 2009-2014, HGST, Inc. All rights reserved.
+ * Copyright (C) 2016, Western Digital. All rights reserved.
+ *
+ * This software is distributed under the terms of the BSD 2-clause license,
+ * "as is," without technical support, and WITHOUT ANY WARRANTY, without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE. You should have received a copy of the BSD 2-clause license along
+ * with libzbc. If not, see  <http://opensource.org/licenses/BSD-2-Clause>.
+ *
+ * Author: Damien Le Moal (damien.lemoal@wdc.com)
+ */
+
+#include "zbc.h"
+#include "libzbc/zbc_log.h"
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/**
+ * Default batch size.
+ */
+#define ZBC_LOG_BATCH_SIZE	(256 * 1024)
+
+/**
+ * Zone header (first block of each zone of a partition chain).
+ */
+#define ZBC_LOG_ZONE_MAGIC	0x5a4c425a
+
+struct zbc_log_zone_hdr {
+	uint32_t		magic;
+	uint32_t		crc;
+	uint32_t		nr_partitions;
+	uint32_t		partition;
+	uint64_t		seq;
+	uint64_t		offset;
+};
+
+/**
+ * Cursor slot header, followed by one offset per partition.
+ */
+#define ZBC_LOG_CURSOR_MAGIC	0x5a4c4355
+
+struct zbc_log_cursor_hdr {
+	uint32_t		magic;
+	uint32_t		crc;
+	uint32_t		cursor;
+	uint32_t		nr_partitions;
+	uint64_t		offsets[];
+};
+
+/**
+ * Sparse offset index entry: one per batch.
+ */
+struct zbc_log_idx {
+	uint64_t		offset;
+	uint64_t		sector;
+};
+
+/**
+ * Zone of a partition chain.
+ */
+struct zbc_log_zone {
+	struct zbc_zone		*zone;
+	uint64_t		seq;
+	uint64_t		base;
+	struct zbc_log_idx	*idx;
+	unsigned int		nr_idx;
+	unsigned int		max_idx;
+	bool			indexed;
+};
+
+/**
+ * Partition.
+ */
+struct zbc_log_part {
+	pthread_mutex_t		lock;
+
+	/* Zone chain, oldest zone first */
+	struct zbc_log_zone	*zones;
+	unsigned int		nr_zones;
+	unsigned int		max_zones;
+	uint64_t		next_seq;
+
+	/* Offset of the next message buffered and written */
+	uint64_t		next_offset;
+	uint64_t		flushed_offset;
+
+	/* Write buffer */
+	uint8_t			*buf;
+	size_t			buf_len;
+	unsigned int		buf_nr;
+};
+
+/**
+ * Log descriptor.
+ */
+struct zbc_log {
+	struct zbc_device	*dev;
+	struct zbc_log_params	params;
+	struct zbc_zpool	zpool;
+	size_t			blksz;
+	struct zbc_log_part	*parts;
+
+	/* Cursors */
+	pthread_mutex_t		cursor_lock;
+	uint8_t			*cursors;
+	size_t			cursor_size;
+};
+
+#define zbc_log_roundup(log, len)	\
+	(((len) + (log)->blksz - 1) & ~((log)->blksz - 1))
+
+/**
+ * Allocate a buffer aligned on the device physical block size.
+ */
+static void *zbc_log_alloc(struct zbc_log *log, size_t size)
+{
+	void *buf;
+
+	buf = zbc_memalign(log->blksz, size);
+	if (!buf)
+		return NULL;
+	memset(buf, 0, size);
+
+	return buf;
+}
+
+/**
+ * Compute a batch CRC.
+ */
+static uint32_t zbc_log_batch_crc(struct zbc_log_batch_hdr *bh)
+{
+	uint32_t crc, saved = bh->zlb_crc;
+
+	bh->zlb_crc = 0;
+	crc = zbc_crc32c(0, bh, bh->zlb_len);
+	bh->zlb_crc = saved;
+
+	return crc;
+}
+
+/**
+ * Check a batch header read from zone @lz at @sector.
+ */
+static bool zbc_log_batch_valid(struct zbc_log *log, struct zbc_log_zone *lz,
+				struct zbc_log_batch_hdr *bh, uint64_t sector)
+{
+	struct zbc_zone *zone = lz->zone;
+
+	return bh->zlb_magic == ZBC_LOG_BATCH_MAGIC &&
+		bh->zlb_len >= sizeof(struct zbc_log_batch_hdr) &&
+		bh->zlb_len <= (size_t)bh->zlb_sectors << 9 &&
+		bh->zlb_sectors &&
+		sector + bh->zlb_sectors <= zbc_zone_wp(zone);
+}
+
+/**
+ * Add an entry to a zone index.
+ */
+static int zbc_log_index_add(struct zbc_log_zone *lz,
+			     uint64_t offset, uint64_t sector)
+{
+	struct zbc_log_idx *idx;
+
+	if (lz->nr_idx == lz->max_idx) {
+		lz->max_idx = lz->max_idx ? lz->max_idx * 2 : 64;
+		idx = zbc_realloc(lz->idx,
+				  lz->nr_idx * sizeof(struct zbc_log_idx),
+				  lz->max_idx * sizeof(struct zbc_log_idx));
+		if (!idx)
+			return -ENOMEM;
+		lz->idx = idx;
+	}
+
+	lz->idx[lz->nr_idx].offset = offset;
+	lz->idx[lz->nr_idx].sector = sector;
+	lz->nr_idx++;
+
+	return 0;
+}
+
+/**
+ * Build a zone index by reading the header of all batches of the zone.
+ * Return the offset following the last message of the zone in @end and
+ * the sector following the last valid batch of the zone in @end_sector.
+ */
+static int zbc_log_index_zone(struct zbc_log *log, struct zbc_log_zone *lz,
+			      uint64_t *end, uint64_t *end_sector)
+{
+	struct zbc_zone *zone = lz->zone;
+	struct zbc_log_batch_hdr *bh;
+	uint64_t sector = zbc_zone_start(zone) + (log->blksz >> 9);
+	uint64_t offset = lz->base;
+	ssize_t ret;
+
+	bh = zbc_log_alloc(log, log->blksz);
+	if (!bh)
+		return -ENOMEM;
+
+	lz->nr_idx = 0;
+	while (sector < zbc_zone_wp(zone)) {
+
+		ret = zbc_pread(log->dev, bh, log->blksz >> 9, sector);
+		if (ret != (ssize_t)(log->blksz >> 9)) {
+			ret = ret < 0 ? ret : -EIO;
+			goto out;
+		}
+
+		if (!zbc_log_batch_valid(log, lz, bh, sector) ||
+		    bh->zlb_offset != offset) {
+			/*
+			 * End of the data of a finished zone (stale data),
+			 * or partially written batch: the zone ends here.
+			 */
+			if (bh->zlb_magic == ZBC_LOG_BATCH_MAGIC &&
+			    bh->zlb_offset == offset)
+				zbc_warning("%s: Invalid batch at sector %llu\n",
+					    log->dev->zbd_filename,
+					    (unsigned long long)sector);
+			break;
+		}
+
+		ret = zbc_log_index_add(lz, offset, sector);
+		if (ret)
+			goto out;
+
+		offset += bh->zlb_nr_msgs;
+		sector += bh->zlb_sectors;
+
+	}
+
+	lz->indexed = true;
+	if (end)
+		*end = offset;
+	if (end_sector)
+		*end_sector = sector;
+	ret = 0;
+
+out:
+	zbc_free(bh);
+
+	return ret;
+}
+
+/**
+ * Add a zone to a partition chain.
+ */
+static struct zbc_log_zone *zbc_log_chain_add(struct zbc_log_part *lp,
+					      struct zbc_zone *zone,
+					      uint64_t seq, uint64_t base)
+{
+	struct zbc_log_zone *lz;
+
+	if (lp->nr_zones == lp->max_zones) {
+		lp->max_zones = lp->max_zones ? lp->max_zones * 2 : 16;
+		lz = zbc_realloc(lp->zones,
+				 lp->nr_zones * sizeof(struct zbc_log_zone),
+				 lp->max_zones * sizeof(struct zbc_log_zone));
+		if (!lz)
+			return NULL;
+		lp->zones = lz;
+	}
+
+	lz = &lp->zones[lp->nr_zones++];
+	memset(lz, 0, sizeof(struct zbc_log_zone));
+	lz->zone = zone;
+	lz->seq = seq;
+	lz->base = base;
+
+	return lz;
+}
+
+/**
+ * Reset the oldest zone of a partition chain.
+ */
+static int zbc_log_chain_drop(struct zbc_log *log, struct zbc_log_part *lp)
+{
+	struct zbc_log_zone *lz = &lp->zones[0];
+	int ret;
+
+	ret = zbc_zpool_put(&log->zpool, lz->zone);
+	if (ret)
+		return ret;
+
+	zbc_free(lz->idx);
+	lp->nr_zones--;
+	memmove(&lp->zones[0], &lp->zones[1],
+		lp->nr_zones * sizeof(struct zbc_log_zone));
+
+	return 0;
+}
+
+/**
+ * Start a new zone for a partition.
+ */
+static struct zbc_log_zone *zbc_log_new_zone(struct zbc_log *log,
+					     unsigned int part)
+{
+	struct zbc_log_part *lp = &log->parts[part];
+	struct zbc_log_zone_hdr *zh;
+	struct zbc_log_zone *lz;
+	struct zbc_zone *zone;
+	ssize_t ret;
+
+	zone = zbc_zpool_get(&log->zpool);
+	if (!zone) {
+		zbc_error("%s: No empty zone left for log partition %u\n",
+			  log->dev->zbd_filename, part);
+		return NULL;
+	}
+
+	zh = zbc_log_alloc(log, log->blksz);
+	if (!zh)
+		goto err;
+
+	zh->magic = ZBC_LOG_ZONE_MAGIC;
+	zh->nr_partitions = log->params.zlp_nr_partitions;
+	zh->partition = part;
+	zh->seq = lp->next_seq;
+	zh->offset = lp->flushed_offset;
+	zh->crc = zbc_crc32c(0, zh, sizeof(struct zbc_log_zone_hdr));
+
+	ret = zbc_pwrite(log->dev, zh, log->blksz >> 9, zbc_zone_start(zone));
+	zbc_free(zh);
+	if (ret != (ssize_t)(log->blksz >> 9)) {
+		zbc_error("%s: Write log zone header at sector %llu failed\n",
+			  log->dev->zbd_filename, zbc_zone_start(zone));
+		goto err;
+	}
+	zone->zbz_write_pointer += log->blksz >> 9;
+	zone->zbz_condition = ZBC_ZC_IMP_OPEN;
+
+	lz = zbc_log_chain_add(lp, zone, lp->next_seq, lp->flushed_offset);
+	if (!lz)
+		goto err;
+	lz->indexed = true;
+	lp->next_seq++;
+
+	/* Apply retention */
+	if (log->params.zlp_max_zones &&
+	    lp->nr_zones > log->params.zlp_max_zones) {
+		if (zbc_log_chain_drop(log, lp) == 0)
+			lz = &lp->zones[lp->nr_zones - 1];
+	}
+
+	return lz;
+
+err:
+	zbc_zpool_put(&log->zpool, zone);
+
+	return NULL;
+}
+
+/**
+ * Write a partition buffered messages. Called with the partition locked.
+ */
+static int zbc_log_flush_part(struct zbc_log *log, unsigned int part)
+{
+	struct zbc_log_part *lp = &log->parts[part];
+	struct zbc_log_batch_hdr *bh = (struct zbc_log_batch_hdr *)lp->buf;
+	struct zbc_log_zone *lz = NULL;
+	struct zbc_zone *zone = NULL;
+	size_t len = zbc_log_roundup(log, lp->buf_len);
+	uint64_t sectors = len >> 9;
+	ssize_t ret;
+
+	if (!lp->buf_nr)
+		return 0;
+
+	memset(lp->buf + lp->buf_len, 0, len - lp->buf_len);
+	bh->zlb_magic = ZBC_LOG_BATCH_MAGIC;
+	bh->zlb_offset = lp->flushed_offset;
+	bh->zlb_nr_msgs = lp->buf_nr;
+	bh->zlb_len = lp->buf_len;
+	bh->zlb_sectors = sectors;
+	bh->zlb_reserved = 0;
+	bh->zlb_crc = zbc_log_batch_crc(bh);
+
+	if (lp->nr_zones) {
+		lz = &lp->zones[lp->nr_zones - 1];
+		zone = lz->zone;
+	}
+
+	if (!zone ||
+	    zbc_zone_wp(zone) + sectors >
+	    zbc_zone_start(zone) + zbc_zone_length(zone)) {
+
+		/* Finish the current zone to release its open resource */
+		if (zone && !zbc_zone_full(zone)) {
+			ret = zbc_finish_zone(log->dev, zbc_zone_start(zone), 0);
+			if (ret)
+				return ret;
+			zone->zbz_write_pointer = zbc_zone_start(zone) +
+				zbc_zone_length(zone);
+			zone->zbz_condition = ZBC_ZC_FULL;
+		}
+
+		lz = zbc_log_new_zone(log, part);
+		if (!lz)
+			return -ENOSPC;
+		zone = lz->zone;
+
+	}
+
+	ret = zbc_pwrite(log->dev, lp->buf, sectors, zbc_zone_wp(zone));
+	if (ret != (ssize_t)sectors) {
+		zbc_error("%s: Write log batch at sector %llu failed %zd\n",
+			  log->dev->zbd_filename, zbc_zone_wp(zone), ret);
+		return ret < 0 ? ret : -EIO;
+	}
+
+	ret = zbc_log_index_add(lz, lp->flushed_offset, zbc_zone_wp(zone));
+	if (ret)
+		return ret;
+
+	zone->zbz_write_pointer += sectors;
+	if (zbc_zone_wp(zone) == zbc_zone_start(zone) + zbc_zone_length(zone))
+		zone->zbz_condition = ZBC_ZC_FULL;
+
+	lp->flushed_offset += lp->buf_nr;
+	lp->buf_len = sizeof(struct zbc_log_batch_hdr);
+	lp->buf_nr = 0;
+
+	return 0;
+}
+
+/**
+ * Recover the partitions zone chains.
+ */
+static int zbc_log_recover(struct zbc_log *log)
+{
+	struct zbc_zpool *zp = &log->zpool;
+	struct zbc_log_zone_hdr *zh;
+	struct zbc_log_part *lp;
+	struct zbc_log_zone *lz, tmp;
+	struct zbc_zone *zone;
+	unsigned int i, j, k;
+	uint64_t end_sector;
+	uint32_t crc;
+	int ret = 0;
+
+	zh = zbc_log_alloc(log, log->blksz);
+	if (!zh)
+		return -ENOMEM;
+
+	for (i = 0; i < zp->zp_nr_zones; i++) {
+
+		zone = &zp->zp_zones[i];
+		if (zbc_zone_empty(zone))
+			continue;
+
+		if (zbc_pread(log->dev, zh, log->blksz >> 9,
+			      zbc_zone_start(zone)) !=
+		    (ssize_t)(log->blksz >> 9)) {
+			ret = -EIO;
+			goto out;
+		}
+
+		crc = zh->crc;
+		zh->crc = 0;
+		if (zh->magic != ZBC_LOG_ZONE_MAGIC ||
+		    crc != zbc_crc32c(0, zh, sizeof(struct zbc_log_zone_hdr)) ||
+		    zh->nr_partitions != log->params.zlp_nr_partitions ||
+		    zh->partition >= log->params.zlp_nr_partitions) {
+			zbc_error("%s: Zone %llu does not belong to the log\n",
+				  log->dev->zbd_filename,
+				  zbc_zone_start(zone));
+			ret = -EINVAL;
+			goto out;
+		}
+
+		lp = &log->parts[zh->partition];
+		if (!zbc_log_chain_add(lp, zone, zh->seq, zh->offset)) {
+			ret = -ENOMEM;
+			goto out;
+		}
+
+	}
+
+	for (i = 0; i < log->params.zlp_nr_partitions; i++) {
+
+		lp = &log->parts[i];
+		if (!lp->nr_zones)
+			continue;
+
+		/* Sort the chain by zone sequence number */
+		for (j = 1; j < lp->nr_zones; j++) {
+			tmp = lp->zones[j];
+			for (k = j; k > 0 && lp->zones[k - 1].seq > tmp.seq; k--)
+				lp->zones[k] = lp->zones[k - 1];
+			lp->zones[k] = tmp;
+		}
+
+		/* Recover the next offset from the last zone batches */
+		lz = &lp->zones[lp->nr_zones - 1];
+		ret = zbc_log_index_zone(log, lz, &lp->flushed_offset,
+					 &end_sector);
+		if (ret)
+			goto out;
+		lp->next_offset = lp->flushed_offset;
+		lp->next_seq = lz->seq + 1;
+
+		/*
+		 * If the last batch of the zone was only partially written
+		 * (e.g. crash during a write), new batches written after it
+		 * could not be found again: finish the zone.
+		 */
+		zone = lz->zone;
+		if (end_sector < zbc_zone_wp(zone) && !zbc_zone_full(zone)) {
+			ret = zbc_finish_zone(log->dev, zbc_zone_start(zone), 0);
+			if (ret)
+				goto out;
+			zone->zbz_write_pointer = zbc_zone_start(zone) +
+				zbc_zone_length(zone);
+			zone->zbz_condition = ZBC_ZC_FULL;
+		}
+
+	}
+
+out:
+	zbc_free(zh);
+
+	return ret;
+}
+
+/**
+ * Read the cursors area.
+ */
+static int zbc_log_load_cursors(struct zbc_log *log)
+{
+	struct zbc_log_params *params = &log->params;
+	struct zbc_log_cursor_hdr *ch;
+	struct zbc_zone zone;
+	size_t len = params->zlp_nr_cursors * log->cursor_size;
+	unsigned int nz, i;
+	uint32_t crc;
+	ssize_t ret;
+
+	/* The cursors area must be in conventional zones */
+	for (i = 0; i < 2; i++) {
+		uint64_t sector = params->zlp_cursor_sector;
+
+		if (i)
+			sector += (len >> 9) - 1;
+		nz = 1;
+		ret = zbc_report_zones(log->dev, sector, ZBC_RO_ALL,
+				       &zone, &nz);
+		if (ret)
+			return ret;
+		if (!nz || !zbc_zone_conventional(&zone) ||
+		    !zbc_dev_sect_paligned(log->dev, params->zlp_cursor_sector)) {
+			zbc_error("%s: Invalid log cursors sector %llu\n",
+				  log->dev->zbd_filename,
+				  (unsigned long long)sector);
+			return -EINVAL;
+		}
+	}
+
+	log->cursors = zbc_log_alloc(log, len);
+	if (!log->cursors)
+		return -ENOMEM;
+
+	ret = zbc_pread(log->dev, log->cursors, len >> 9,
+			params->zlp_cursor_sector);
+	if (ret != (ssize_t)(len >> 9))
+		return ret < 0 ? ret : -EIO;
+
+	for (i = 0; i < params->zlp_nr_cursors; i++) {
+		ch = (struct zbc_log_cursor_hdr *)
+			(log->cursors + i * log->cursor_size);
+		crc = ch->crc;
+		ch->crc = 0;
+		if (ch->magic == ZBC_LOG_CURSOR_MAGIC &&
+		    ch->cursor == i &&
+		    ch->nr_partitions == params->zlp_nr_partitions &&
+		    crc == zbc_crc32c(0, ch, log->cursor_size))
+			continue;
+		/* Uninitialized or corrupted: start from 0 */
+		memset(ch, 0, log->cursor_size);
+		ch->magic = ZBC_LOG_CURSOR_MAGIC;
+		ch->cursor = i;
+		ch->nr_partitions = params->zlp_nr_partitions;
+	}
+
+	return 0;
+}
+
+/**
+ * zbc_log_open - Open a log
+ */
+int zbc_log_open(struct zbc_device *dev, struct zbc_log_params *params,
+		 struct zbc_log **plog)
+{
+	struct zbc_log *log;
+	uint64_t min_len = (uint64_t)-1;
+	unsigned int i;
+	int ret;
+
+	if (!params->zlp_nr_partitions)
+		return -EINVAL;
+
+	log = zbc_calloc(1, sizeof(struct zbc_log));
+	if (!log)
+		return -ENOMEM;
+
+	log->dev = dev;
+	log->params = *params;
+	log->blksz = dev->zbd_info.zbd_pblock_size;
+	if (!log->params.zlp_batch_size)
+		log->params.zlp_batch_size = ZBC_LOG_BATCH_SIZE;
+	log->params.zlp_batch_size =
+		zbc_log_roundup(log, log->params.zlp_batch_size);
+	pthread_mutex_init(&log->cursor_lock, NULL);
+
+	ret = zbc_zpool_init(&log->zpool, dev, params->zlp_sector,
+			     params->zlp_nr_sectors);
+	if (ret)
+		goto err;
+
+	/* A batch and the zone header must fit in the smallest zone */
+	for (i = 0; i < log->zpool.zp_nr_zones; i++)
+		if (zbc_zone_length(&log->zpool.zp_zones[i]) < min_len)
+			min_len = zbc_zone_length(&log->zpool.zp_zones[i]);
+	if ((log->params.zlp_batch_size + log->blksz) >> 9 > min_len) {
+		zbc_error("%s: Log batch size %zu too large\n",
+			  dev->zbd_filename, log->params.zlp_batch_size);
+		ret = -EINVAL;
+		goto err;
+	}
+
+	/* Each partition keeps one zone open */
+	if (dev->zbd_info.zbd_model == ZBC_DM_HOST_MANAGED &&
+	    dev->zbd_info.zbd_max_nr_open_seq_req != ZBC_NO_LIMIT &&
+	    params->zlp_nr_partitions > dev->zbd_info.zbd_max_nr_open_seq_req) {
+		zbc_error("%s: Too many log partitions (%u, max %u)\n",
+			  dev->zbd_filename, params->zlp_nr_partitions,
+			  dev->zbd_info.zbd_max_nr_open_seq_req);
+		ret = -EINVAL;
+		goto err;
+	}
+
+	log->parts = zbc_calloc(params->zlp_nr_partitions,
+			    sizeof(struct zbc_log_part));
+	if (!log->parts) {
+		ret = -ENOMEM;
+		goto err;
+	}
+
+	for (i = 0; i < params->zlp_nr_partitions; i++) {
+		pthread_mutex_init(&log->parts[i].lock, NULL);
+		log->parts[i].buf = zbc_log_alloc(log,
+						  log->params.zlp_batch_size);
+		if (!log->parts[i].buf) {
+			ret = -ENOMEM;
+			goto err;
+		}
+		log->parts[i].buf_len = sizeof(struct zbc_log_batch_hdr);
+	}
+
+	ret = zbc_log_recover(log);
+	if (ret)
+		goto err;
+
+	if (params->zlp_nr_cursors) {
+		log->cursor_size = zbc_log_roundup(log,
+				sizeof(struct zbc_log_cursor_hdr) +
+				params->zlp_nr_partitions * sizeof(uint64_t));
+		ret = zbc_log_load_cursors(log);
+		if (ret)
+			goto err;
+	}
+
+	*plog = log;
+
+	return 0;
+
+err:
+	zbc_log_close(log);
+
+	return ret;
+}
+
+/**
+ * zbc_log_close - Close a log
+ */
+int zbc_log_close(struct zbc_log *log)
+{
+	struct zbc_log_part *lp;
+	unsigned int i, j;
+	int ret = 0, err;
+
+	for (i = 0; log->parts && i < log->params.zlp_nr_partitions; i++) {
+		lp = &log->parts[i];
+		if (lp->buf) {
+			err = zbc_log_flush_part(log, i);
+			if (err && !ret)
+				ret = err;
+			zbc_free(lp->buf);
+		}
+		for (j = 0; j < lp->nr_zones; j++)
+			zbc_free(lp->zones[j].idx);
+		zbc_free(lp->zones);
+		pthread_mutex_destroy(&lp->lock);
+	}
+
+	zbc_free(log->parts);
+	zbc_free(log->cursors);
+	zbc_zpool_destroy(&log->zpool);
+	pthread_mutex_destroy(&log->cursor_lock);
+	zbc_free(log);
+
+	return ret;
+}
+
+/**
+ * zbc_log_append - Append a message to a partition
+ */
+int zbc_log_append(struct zbc_log *log, unsigned int part,
+		   const void *msg, size_t len, uint64_t *offset)
+{
+	struct zbc_log_part *lp;
+	uint32_t mlen = len;
+	int ret = 0;
+
+	if (part >= log->params.zlp_nr_partitions)
+		return -EINVAL;
+
+	if (sizeof(struct zbc_log_batch_hdr) + sizeof(uint32_t) + len >
+	    log->params.zlp_batch_size)
+		return -EMSGSIZE;
+
+	lp = &log->parts[part];
+	pthread_mutex_lock(&lp->lock);
+
+	if (lp->buf_len + sizeof(uint32_t) + len >
+	    log->params.zlp_batch_size) {
+		ret = zbc_log_flush_part(log, part);
+		if (ret)
+			goto out;
+	}
+
+	memcpy(lp->buf + lp->buf_len, &mlen, sizeof(uint32_t));
+	memcpy(lp->buf + lp->buf_len + sizeof(uint32_t), msg, len);
+	lp->buf_len += sizeof(uint32_t) + len;
+	lp->buf_nr++;
+
+	if (offset)
+		*offset = lp->next_offset;
+	lp->next_offset++;
+
+out:
+	pthread_mutex_unlock(&lp->lock);
+
+	return ret;
+}
+
+/**
+ * zbc_log_flush - Write buffered messages of a partition
+ */
+int zbc_log_flush(struct zbc_log *log, unsigned int part)
+{
+	struct zbc_log_part *lp;
+	int ret;
+
+	if (part >= log->params.zlp_nr_partitions)
+		return -EINVAL;
+
+	lp = &log->parts[part];
+	pthread_mutex_lock(&lp->lock);
+	ret = zbc_log_flush_part(log, part);
+	pthread_mutex_unlock(&lp->lock);
+
+	return ret;
+}
+
+/**
+ * zbc_log_offsets - Get a partition offsets range
+ */
+int zbc_log_offsets(struct zbc_log *log, unsigned int part,
+		    uint64_t *first, uint64_t *next)
+{
+	struct zbc_log_part *lp;
+
+	if (part >= log->params.zlp_nr_partitions)
+		return -EINVAL;
+
+	lp = &log->parts[part];
+	pthread_mutex_lock(&lp->lock);
+	if (first)
+		*first = lp->nr_zones ? lp->zones[0].base : lp->flushed_offset;
+	if (next)
+		*next = lp->flushed_offset;
+	pthread_mutex_unlock(&lp->lock);
+
+	return 0;
+}
+
+/**
+ * Locate the range of complete batches to read to get messages starting
+ * at @offset, limited to @max_bytes (at least one batch if @force).
+ * Returns 1 if there is nothing to read and 0 if the range was found.
+ */
+static int zbc_log_locate(struct zbc_log *log, unsigned int part,
+			  uint64_t offset, size_t max_bytes, bool force,
+			  uint64_t *sector, uint64_t *nr_sectors,
+			  uint64_t *next)
+{
+	struct zbc_log_part *lp = &log->parts[part];
+	struct zbc_log_zone *lz;
+	uint64_t start, end, bend;
+	unsigned int lo, hi, mid, i;
+	int ret = 0;
+
+	pthread_mutex_lock(&lp->lock);
+
+	if (offset >= lp->flushed_offset) {
+		ret = 1;
+		goto out;
+	}
+
+	if (!lp->nr_zones || offset < lp->zones[0].base) {
+		ret = -ERANGE;
+		goto out;
+	}
+
+	/* Find the zone containing offset */
+	lo = 0;
+	hi = lp->nr_zones;
+	while (hi - lo > 1) {
+		mid = (lo + hi) / 2;
+		if (lp->zones[mid].base <= offset)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	lz = &lp->zones[lo];
+
+	if (!lz->indexed) {
+		ret = zbc_log_index_zone(log, lz, NULL, NULL);
+		if (ret)
+			goto out;
+	}
+
+	/* Find the batch containing offset */
+	lo = 0;
+	hi = lz->nr_idx;
+	if (!hi) {
+		ret = -EIO;
+		goto out;
+	}
+	while (hi - lo > 1) {
+		mid = (lo + hi) / 2;
+		if (lz->idx[mid].offset <= offset)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	/* Add complete batches up to max_bytes */
+	start = lz->idx[lo].sector;
+	end = start;
+	for (i = lo; i < lz->nr_idx; i++) {
+		if (i + 1 < lz->nr_idx)
+			bend = lz->idx[i + 1].sector;
+		else
+			bend = zbc_zone_wp(lz->zone);
+		if (((bend - start) << 9) > max_bytes && (i > lo || !force))
+			break;
+		end = bend;
+		if (i + 1 < lz->nr_idx)
+			*next = lz->idx[i + 1].offset;
+		else if (lz == &lp->zones[lp->nr_zones - 1])
+			*next = lp->flushed_offset;
+		else
+			*next = lz[1].base;
+	}
+
+	if (end == start) {
+		ret = -ENOBUFS;
+		goto out;
+	}
+
+	*sector = start;
+	*nr_sectors = end - start;
+
+out:
+	pthread_mutex_unlock(&lp->lock);
+
+	return ret;
+}
+
+/**
+ * zbc_log_fetch - Fetch messages from a partition
+ */
+int zbc_log_fetch(struct zbc_log *log, unsigned int part,
+		  uint64_t offset, void *buf, size_t bufsz,
+		  struct zbc_log_msg *msgs, unsigned int *nr_msgs)
+{
+	struct zbc_log_batch_hdr *bh;
+	uint64_t sector, nr_sectors, next, moff;
+	unsigned int n = 0, i;
+	uint8_t *p, *bend;
+	uint32_t mlen;
+	size_t pos = 0;
+	ssize_t ret;
+
+	if (part >= log->params.zlp_nr_partitions)
+		return -EINVAL;
+
+	ret = zbc_log_locate(log, part, offset, bufsz, false,
+			     &sector, &nr_sectors, &next);
+	if (ret) {
+		*nr_msgs = 0;
+		return ret > 0 ? 0 : ret;
+	}
+
+	ret = zbc_pread(log->dev, buf, nr_sectors, sector);
+	if (ret != (ssize_t)nr_sectors)
+		return ret < 0 ? ret : -EIO;
+
+	while (pos < (nr_sectors << 9) && n < *nr_msgs) {
+
+		bh = (struct zbc_log_batch_hdr *)((uint8_t *)buf + pos);
+		if (bh->zlb_magic != ZBC_LOG_BATCH_MAGIC ||
+		    bh->zlb_len > (size_t)bh->zlb_sectors << 9 ||
+		    pos + ((size_t)bh->zlb_sectors << 9) > (nr_sectors << 9) ||
+		    bh->zlb_crc != zbc_log_batch_crc(bh)) {
+			/* The zone may have been reset by retention */
+			zbc_error("%s: Invalid log batch at sector %llu\n",
+				  log->dev->zbd_filename,
+				  (unsigned long long)(sector + (pos >> 9)));
+			return -EIO;
+		}
+
+		p = (uint8_t *)(bh + 1);
+		bend = (uint8_t *)bh + bh->zlb_len;
+		moff = bh->zlb_offset;
+		for (i = 0; i < bh->zlb_nr_msgs && n < *nr_msgs; i++) {
+			if (p + sizeof(uint32_t) > bend)
+				return -EIO;
+			memcpy(&mlen, p, sizeof(uint32_t));
+			p += sizeof(uint32_t);
+			if (p + mlen > bend)
+				return -EIO;
+			if (moff >= offset) {
+				msgs[n].zlm_offset = moff;
+				msgs[n].zlm_data = p;
+				msgs[n].zlm_len = mlen;
+				n++;
+			}
+			p += mlen;
+			moff++;
+		}
+
+		pos += (size_t)bh->zlb_sectors << 9;
+
+	}
+
+	*nr_msgs = n;
+
+	return 0;
+}
+
+/**
+ * Transfer a range of sectors to a file descriptor with splice(2).
+ * Returns -EINVAL if splice is not supported for @fd.
+ */
+static ssize_t zbc_log_splice_range(struct zbc_log *log, int fd,
+				    uint64_t sector, uint64_t nr_sectors)
+{
+	loff_t off = sector << 9;
+	size_t len = nr_sectors << 9, done = 0;
+	ssize_t ret = 0, n;
+	int p[2];
+
+	if (pipe(p) < 0)
+		return -errno;
+	fcntl(p[1], F_SETPIPE_SZ, 1024 * 1024);
+
+	while (done < len) {
+
+		n = splice(log->dev->zbd_fd, &off, p[1], NULL,
+			   len - done, SPLICE_F_MOVE);
+		if (n <= 0) {
+			ret = n < 0 ? -errno : -EIO;
+			break;
+		}
+
+		while (n) {
+			ret = splice(p[0], NULL, fd, NULL, n,
+				     SPLICE_F_MOVE | SPLICE_F_MORE);
+			if (ret <= 0) {
+				ret = ret < 0 ? -errno : -EIO;
+				goto out;
+			}
+			n -= ret;
+			done += ret;
+		}
+		ret = 0;
+
+	}
+
+out:
+	close(p[0]);
+	close(p[1]);
+
+	if (ret < 0 && !done)
+		return ret;
+
+	return done == len ? (ssize_t)done : -EIO;
+}
+
+/**
+ * Transfer a range of sectors to a file descriptor with read and write.
+ */
+static ssize_t zbc_log_copy_range(struct zbc_log *log, int fd,
+				  uint64_t sector, uint64_t nr_sectors)
+{
+	size_t bufsz = log->params.zlp_batch_size, done = 0, len;
+	uint64_t n;
+	ssize_t ret = 0;
+	uint8_t *buf;
+
+	buf = zbc_log_alloc(log, bufsz);
+	if (!buf)
+		return -ENOMEM;
+
+	while (nr_sectors) {
+
+		n = nr_sectors;
+		if (n > bufsz >> 9)
+			n = bufsz >> 9;
+
+		ret = zbc_pread(log->dev, buf, n, sector);
+		if (ret != (ssize_t)n) {
+			ret = ret < 0 ? ret : -EIO;
+			goto out;
+		}
+
+		len = 0;
+		while (len < (n << 9)) {
+			ret = write(fd, buf + len, (n << 9) - len);
+			if (ret < 0) {
+				ret = -errno;
+				goto out;
+			}
+			len += ret;
+		}
+
+		done += len;
+		sector += n;
+		nr_sectors -= n;
+
+	}
+
+	ret = done;
+
+out:
+	zbc_free(buf);
+
+	return ret;
+}
+
+/**
+ * zbc_log_splice - Transfer batches of messages to a file descriptor
+ */
+ssize_t zbc_log_splice(struct zbc_log *log, unsigned int part,
+		       uint64_t offset, int fd, size_t max_bytes,
+		       uint64_t *next)
+{
+	uint64_t sector, nr_sectors, nxt;
+	ssize_t ret;
+
+	if (part >= log->params.zlp_nr_partitions)
+		return -EINVAL;
+
+	ret = zbc_log_locate(log, part, offset, max_bytes, true,
+			     &sector, &nr_sectors, &nxt);
+	if (ret) {
+		if (next)
+			*next = offset;
+		return ret > 0 ? 0 : ret;
+	}
+
+	ret = -EINVAL;
+	if (zbc_dev_has_file_io(log->dev))
+		ret = zbc_log_splice_range(log, fd, sector, nr_sectors);
+	if (ret == -EINVAL)
+		ret = zbc_log_copy_range(log, fd, sector, nr_sectors);
+
+	if (ret >= 0 && next)
+		*next = nxt;
+
+	return ret;
+}
+
+/**
+ * Get a cursor slot.
+ */
+static struct zbc_log_cursor_hdr *zbc_log_cursor(struct zbc_log *log,
+						 unsigned int cursor,
+						 unsigned int part)
+{
+
+	if (cursor >= log->params.zlp_nr_cursors ||
+	    part >= log->params.zlp_nr_partitions)
+		return NULL;
+
+	return (struct zbc_log_cursor_hdr *)
+		(log->cursors + cursor * log->cursor_size);
+}
+
+/**
+ * zbc_log_cursor_get - Get a consumer cursor offset for a partition
+ */
+int zbc_log_cursor_get(struct zbc_log *log, unsigned int cursor,
+		       unsigned int part, uint64_t *offset)
+{
+	struct zbc_log_cursor_hdr *ch = zbc_log_cursor(log, cursor, part);
+
+	if (!ch)
+		return -EINVAL;
+
+	pthread_mutex_lock(&log->cursor_lock);
+	*offset = ch->offsets[part];
+	pthread_mutex_unlock(&log->cursor_lock);
+
+	return 0;
+}
+
+/**
+ * zbc_log_cursor_commit - Commit a consumer cursor offset for a partition
+ */
+int zbc_log_cursor_commit(struct zbc_log *log, unsigned int cursor,
+			  unsigned int part, uint64_t offset)
+{
+	struct zbc_log_cursor_hdr *ch = zbc_log_cursor(log, cursor, part);
+	uint64_t sectors = log->cursor_size >> 9;
+	ssize_t ret;
+
+	if (!ch)
+		return -EINVAL;
+
+	pthread_mutex_lock(&log->cursor_lock);
+
+	ch->offsets[part] = offset;
+	ch->crc = 0;
+	ch->crc = zbc_crc32c(0, ch, log->cursor_size);
+
+	ret = zbc_pwrite(log->dev, ch, sectors,
+			 log->params.zlp_cursor_sector + cursor * sectors);
+	if (ret == (ssize_t)sectors)
+		ret = zbc_flush(log->dev);
+	else if (ret >= 0)
+		ret = -EIO;
+
+	ch->crc = 0;
+
+	pthread_mutex_unlock(&log->cursor_lock);
+
+	return ret;
+}
+
+/**
+ * zbc_log_retain - Discard the oldest messages of a partition
+ */
+int zbc_log_retain(struct zbc_log *log, unsigned int part, uint64_t offset)
+{
+	struct zbc_log_part *lp;
+	int ret, n = 0;
+
+	if (part >= log->params.zlp_nr_partitions)
+		return -EINVAL;
+
+	lp = &log->parts[part];
+	pthread_mutex_lock(&lp->lock);
+
+	while (lp->nr_zones > 1 && lp->zones[1].base <= offset) {
+		ret = zbc_log_chain_drop(log, lp);
+		if (ret) {
+			n = ret;
+			break;
+		}
+		n++;
+	}
+
+	pthread_mutex_unlock(&lp->lock);
+
+	return n;
+}
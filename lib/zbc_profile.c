@@ -0,0 +1,362 @@
+/*
+ * This file is part of libzbc.
+ *
+ * Copyright (C) 2009-2014, HGST, Inc. All rights reserved.
+ * Copyright (C) 2016, Western Digital. All rights reserved.
+ *
+ * This software is distributed under the terms of the BSD 2-clause license,
+ * "as is," without technical support, and WITHOUT ANY WARRANTY, without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE. You should have received a copy of the BSD 2-clause license along
+ * with libzbc. If not, see  <http://opensource.org/licenses/BSD-2-Clause>.
+ *
+ * Author: Damien Le Moal (damien.lemoal@wdc.com)
+ */
+
+#include "zbc.h"
+#include "libzbc/zbc_profile.h"
+
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * Profiling defaults.
+ */
+#define ZBC_PROFILE_NR_SAMPLES		256
+#define ZBC_PROFILE_IO_SIZE		(1024 * 1024)
+#define ZBC_PROFILE_SAMPLE_SIZE		(32 * 1024 * 1024)
+
+/**
+ * Profile file header, followed by the samples. @crc is the CRC32C of
+ * the header, computed with @crc set to 0, and of the samples. All fields
+ * are in host byte order.
+ */
+#define ZBC_PROFILE_MAGIC		0x4650425a
+#define ZBC_PROFILE_VERSION		1
+
+struct zbc_profile_hdr {
+	uint32_t	magic;
+	uint32_t	version;
+	uint64_t	sectors;
+	uint32_t	io_size;
+	uint32_t	nr_samples;
+	uint32_t	crc;
+	uint32_t	reserved;
+};
+
+/**
+ * Execute sequential I/Os of @io_count sectors on @count sectors starting
+ * from @sector and get the throughput and average I/O latency.
+ */
+static int zbc_profile_io(struct zbc_device *dev, bool write, void *buf,
+			  size_t io_count, uint64_t sector, uint64_t count,
+			  uint32_t *kbps, uint32_t *lat_us)
+{
+	unsigned long long start, ns;
+	uint64_t done = 0, nr_ios = 0;
+	double rate;
+	ssize_t ret;
+	size_t n;
+
+	start = zbc_time_ns();
+	while (done < count) {
+		n = count - done < io_count ? count - done : io_count;
+		if (write)
+			ret = zbc_pwrite(dev, buf, n, sector + done);
+		else
+			ret = zbc_pread(dev, buf, n, sector + done);
+		if (ret <= 0)
+			return ret < 0 ? ret : -EIO;
+		done += ret;
+		nr_ios++;
+	}
+	ns = zbc_time_ns() - start;
+	if (!ns)
+		ns = 1;
+
+	rate = (double)(done << 9) / 1024 * 1000000000.0 / (double)ns;
+	*kbps = rate > (double)UINT32_MAX ? UINT32_MAX : (uint32_t)rate;
+	*lat_us = ns / nr_ios / 1000;
+
+	return 0;
+}
+
+/**
+ * Measure the throughput of a zone.
+ */
+static int zbc_profile_zone(struct zbc_device *dev, struct zbc_zone *zone,
+			    unsigned int flags, void *buf, size_t io_count,
+			    uint64_t sample_count,
+			    struct zbc_profile_sample *sample)
+{
+	uint64_t count = zbc_zone_length(zone);
+	bool seq = !zbc_zone_conventional(zone);
+	int ret;
+
+	sample->zps_sector = zbc_zone_start(zone);
+	if (zbc_zone_offline(zone))
+		return 0;
+
+	if (count > sample_count)
+		count = sample_count;
+
+	if ((flags & ZBC_PROFILE_WRITE) && !zbc_zone_rdonly(zone)) {
+
+		if (seq && !zbc_zone_empty(zone)) {
+			ret = zbc_reset_zone(dev, zbc_zone_start(zone), 0);
+			if (ret)
+				return ret;
+		}
+
+		ret = zbc_profile_io(dev, true, buf, io_count,
+				     zbc_zone_start(zone), count,
+				     &sample->zps_write_kbps,
+				     &sample->zps_write_lat_us);
+		if (ret)
+			return ret;
+
+		ret = zbc_profile_io(dev, false, buf, io_count,
+				     zbc_zone_start(zone), count,
+				     &sample->zps_read_kbps,
+				     &sample->zps_read_lat_us);
+		if (ret)
+			return ret;
+
+		if (seq)
+			return zbc_reset_zone(dev, zbc_zone_start(zone), 0);
+
+		return 0;
+	}
+
+	/* Only read the written space of sequential zones */
+	if (seq && !zbc_zone_full(zone)) {
+		if (zbc_zone_wp(zone) <= zbc_zone_start(zone))
+			return 0;
+		if (count > zbc_zone_wp(zone) - zbc_zone_start(zone))
+			count = zbc_zone_wp(zone) - zbc_zone_start(zone);
+	}
+
+	return zbc_profile_io(dev, false, buf, io_count,
+			      zbc_zone_start(zone), count,
+			      &sample->zps_read_kbps,
+			      &sample->zps_read_lat_us);
+}
+
+/**
+ * zbc_profile_run - Profile the throughput of a device
+ */
+int zbc_profile_run(struct zbc_device *dev, struct zbc_profile_params *params,
+		    struct zbc_profile **pprof)
+{
+	struct zbc_profile_params p = { 0 };
+	size_t pbs = dev->zbd_info.zbd_pblock_size;
+	struct zbc_profile *prof;
+	struct zbc_zone *zones;
+	unsigned int i, nr_zones;
+	void *buf;
+	int ret;
+
+	if (params)
+		p = *params;
+	if (!p.zpp_io_size)
+		p.zpp_io_size = ZBC_PROFILE_IO_SIZE;
+	if (!p.zpp_sample_size)
+		p.zpp_sample_size = ZBC_PROFILE_SAMPLE_SIZE;
+
+	/* I/Os must be aligned on physical blocks for sequential zones */
+	p.zpp_io_size -= p.zpp_io_size % pbs;
+	p.zpp_sample_size -= p.zpp_sample_size % pbs;
+	if (!p.zpp_io_size || !p.zpp_sample_size)
+		return -EINVAL;
+
+	ret = zbc_list_zones(dev, 0, ZBC_RO_ALL, &zones, &nr_zones);
+	if (ret)
+		return ret;
+
+	if (!p.zpp_zone_step) {
+		p.zpp_zone_step = nr_zones / ZBC_PROFILE_NR_SAMPLES;
+		if (!p.zpp_zone_step)
+			p.zpp_zone_step = 1;
+	}
+
+	prof = zbc_calloc(1, sizeof(struct zbc_profile));
+	buf = zbc_memalign(sysconf(_SC_PAGESIZE), p.zpp_io_size);
+	if (!prof || !buf) {
+		ret = -ENOMEM;
+		goto err;
+	}
+
+	prof->zp_sectors = dev->zbd_info.zbd_sectors;
+	prof->zp_io_size = p.zpp_io_size;
+	prof->zp_nr_samples =
+		(nr_zones + p.zpp_zone_step - 1) / p.zpp_zone_step;
+	prof->zp_samples = zbc_calloc(prof->zp_nr_samples,
+				      sizeof(struct zbc_profile_sample));
+	if (!prof->zp_samples) {
+		ret = -ENOMEM;
+		goto err;
+	}
+	memset(buf, 0, p.zpp_io_size);
+
+	for (i = 0; i < prof->zp_nr_samples; i++) {
+		ret = zbc_profile_zone(dev, &zones[i * p.zpp_zone_step],
+				       p.zpp_flags, buf, p.zpp_io_size >> 9,
+				       p.zpp_sample_size >> 9,
+				       &prof->zp_samples[i]);
+		if (ret) {
+			zbc_error("%s: Profile zone at sector %llu failed %d\n",
+				  dev->zbd_filename,
+				  zbc_zone_start(&zones[i * p.zpp_zone_step]),
+				  ret);
+			goto err;
+		}
+		if (p.zpp_progress)
+			p.zpp_progress(p.zpp_priv, i + 1, prof->zp_nr_samples);
+	}
+
+	zbc_free(buf);
+	zbc_free(zones);
+	*pprof = prof;
+
+	return 0;
+
+err:
+	zbc_free(buf);
+	zbc_free(zones);
+	zbc_profile_free(prof);
+
+	return ret;
+}
+
+/**
+ * zbc_profile_free - Free a profile
+ */
+void zbc_profile_free(struct zbc_profile *prof)
+{
+	if (!prof)
+		return;
+
+	zbc_free(prof->zp_samples);
+	zbc_free(prof);
+}
+
+/**
+ * zbc_profile_save - Save a profile to a file
+ */
+int zbc_profile_save(struct zbc_profile *prof, const char *path)
+{
+	size_t len = prof->zp_nr_samples * sizeof(struct zbc_profile_sample);
+	struct zbc_profile_hdr hdr;
+	FILE *f;
+	int ret = 0;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = ZBC_PROFILE_MAGIC;
+	hdr.version = ZBC_PROFILE_VERSION;
+	hdr.sectors = prof->zp_sectors;
+	hdr.io_size = prof->zp_io_size;
+	hdr.nr_samples = prof->zp_nr_samples;
+	hdr.crc = zbc_crc32c(0, &hdr, sizeof(hdr));
+	hdr.crc = zbc_crc32c(hdr.crc, prof->zp_samples, len);
+
+	f = fopen(path, "w");
+	if (!f)
+		return -errno;
+
+	if (fwrite(&hdr, sizeof(hdr), 1, f) != 1 ||
+	    (len && fwrite(prof->zp_samples, len, 1, f) != 1))
+		ret = -EIO;
+
+	if (fclose(f) && !ret)
+		ret = -errno;
+
+	return ret;
+}
+
+/**
+ * zbc_profile_load - Load a profile from a file
+ */
+int zbc_profile_load(const char *path, struct zbc_profile **pprof)
+{
+	struct zbc_profile_hdr hdr;
+	struct zbc_profile *prof = NULL;
+	uint32_t crc;
+	size_t len;
+	FILE *f;
+	int ret;
+
+	f = fopen(path, "r");
+	if (!f)
+		return -errno;
+
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1 ||
+	    hdr.magic != ZBC_PROFILE_MAGIC ||
+	    hdr.version != ZBC_PROFILE_VERSION) {
+		ret = -EINVAL;
+		goto err;
+	}
+
+	prof = zbc_calloc(1, sizeof(struct zbc_profile));
+	if (!prof) {
+		ret = -ENOMEM;
+		goto err;
+	}
+	prof->zp_sectors = hdr.sectors;
+	prof->zp_io_size = hdr.io_size;
+	prof->zp_nr_samples = hdr.nr_samples;
+
+	len = hdr.nr_samples * sizeof(struct zbc_profile_sample);
+	if (len) {
+		prof->zp_samples = zbc_malloc(len);
+		if (!prof->zp_samples) {
+			ret = -ENOMEM;
+			goto err;
+		}
+		if (fread(prof->zp_samples, len, 1, f) != 1) {
+			ret = -EINVAL;
+			goto err;
+		}
+	}
+
+	crc = hdr.crc;
+	hdr.crc = 0;
+	hdr.crc = zbc_crc32c(0, &hdr, sizeof(hdr));
+	if (zbc_crc32c(hdr.crc, prof->zp_samples, len) != crc) {
+		ret = -EINVAL;
+		goto err;
+	}
+
+	fclose(f);
+	*pprof = prof;
+
+	return 0;
+
+err:
+	fclose(f);
+	zbc_profile_free(prof);
+
+	return ret;
+}
+
+/**
+ * zbc_profile_lookup - Get the profile sample of a sector
+ */
+const struct zbc_profile_sample *
+zbc_profile_lookup(struct zbc_profile *prof, uint64_t sector)
+{
+	unsigned int lo = 0, hi = prof->zp_nr_samples, mid;
+
+	if (!hi)
+		return NULL;
+
+	/* Find the last sample starting at or before sector */
+	while (hi - lo > 1) {
+		mid = (lo + hi) / 2;
+		if (prof->zp_samples[mid].zps_sector <= sector)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	return &prof->zp_samples[lo];
+}
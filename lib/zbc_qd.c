@@ -0,0 +1,266 @@
+/*
+ * This file is part of libzbc.
+ *
+ * Copyright (C) 2009-2014, HGST, Inc. All rights reserved.
+ * Copyright (C) 2016, Western Digital. All rights reserved.
+ *
+ * This software is distributed under the terms of the BSD 2-clause license,
+ * "as is," without technical support, and WITHOUT ANY WARRANTY, without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE. You should have received a copy of the BSD 2-clause license along
+ * with libzbc. If not, see  <http://opensource.org/licenses/BSD-2-Clause>.
+ *
+ * Author: Damien Le Moal (damien.lemoal@wdc.com)
+ */
+
+#include "zbc.h"
+
+#include <string.h>
+
+/**
+ * Default parameters.
+ */
+#define ZBC_QD_MIN		1
+#define ZBC_QD_MAX		64
+#define ZBC_QD_TOLERANCE	50
+
+/**
+ * Sampling interval: the limit is updated after at least
+ * ZBC_QD_WIN_CMDS commands or ZBC_QD_WIN_NS nanoseconds.
+ */
+#define ZBC_QD_WIN_CMDS		16
+#define ZBC_QD_WIN_NS		100000000ULL
+
+/**
+ * Latencies are normalized to commands of this size (128 KiB).
+ */
+#define ZBC_QD_NORM_SECTORS	256
+
+/**
+ * Controller state.
+ */
+struct zbc_qd {
+	pthread_mutex_t		lock;
+	pthread_cond_t		cond;
+	struct zbc_qd_params	params;
+
+	/* Current limit (fixed point, 8 fractional bits) */
+	unsigned int		limit;
+	unsigned int		inflight;
+
+	/* Baseline normalized latency */
+	unsigned long long	lat_min;
+
+	/* Slow start: double the limit until the latency first increases */
+	bool			slow_start;
+
+	/* Current sampling interval */
+	unsigned long long	win_start;
+	unsigned int		win_cmds;
+	unsigned int		win_max_inflight;
+	unsigned long long	win_lat;
+	unsigned long long	win_sectors;
+};
+
+#define zbc_qd_limit(qd)	((qd)->limit >> 8)
+
+/**
+ * Publish the controller state in the device statistics.
+ */
+static void zbc_qd_export(struct zbc_device *dev, struct zbc_qd *qd)
+{
+	struct zbc_device_stats *stats = dev->zbd_stats;
+
+	__atomic_store_n(&stats->zbs_qd_limit, zbc_qd_limit(qd),
+			 __ATOMIC_RELAXED);
+	__atomic_store_n(&stats->zbs_qd_inflight, qd->inflight,
+			 __ATOMIC_RELAXED);
+	__atomic_store_n(&stats->zbs_qd_lat_min_ns, qd->lat_min,
+			 __ATOMIC_RELAXED);
+}
+
+/**
+ * End a sampling interval and update the limit. Called with the
+ * controller lock held.
+ */
+static void zbc_qd_update(struct zbc_device *dev, struct zbc_qd *qd,
+			  unsigned long long now)
+{
+	struct zbc_device_stats *stats = dev->zbd_stats;
+	unsigned long long elapsed = now - qd->win_start ? : 1;
+	unsigned long long lat, target;
+	unsigned int limit = qd->limit;
+
+	lat = qd->win_lat / qd->win_cmds;
+
+	/*
+	 * The baseline is the lowest latency seen, slowly drifting up so
+	 * that it follows permanent changes of the device performance.
+	 */
+	if (!qd->lat_min || lat < qd->lat_min)
+		qd->lat_min = lat ? lat : 1;
+	else
+		qd->lat_min += (lat - qd->lat_min) >> 8;
+
+	target = qd->lat_min * (100 + qd->params.zqp_tolerance) / 100;
+	if (lat > target) {
+		/* Decrease proportionally (at most halve) */
+		qd->slow_start = false;
+		if (lat > target * 2)
+			limit /= 2;
+		else
+			limit = (unsigned long long)limit * target / lat;
+	} else if (qd->win_max_inflight >= zbc_qd_limit(qd)) {
+		/* Saturated and latency is fine: probe for more */
+		if (qd->slow_start)
+			limit *= 2;
+		else
+			limit += 1 << 8;
+	}
+
+	if (limit < qd->params.zqp_min_qd << 8)
+		limit = qd->params.zqp_min_qd << 8;
+	if (limit > qd->params.zqp_max_qd << 8)
+		limit = qd->params.zqp_max_qd << 8;
+	if (limit > qd->limit)
+		pthread_cond_broadcast(&qd->cond);
+	qd->limit = limit;
+
+	__atomic_store_n(&stats->zbs_qd_lat_ns, lat, __ATOMIC_RELAXED);
+	__atomic_store_n(&stats->zbs_qd_iops,
+			 (unsigned long long)qd->win_cmds * 1000000000ULL /
+			 elapsed, __ATOMIC_RELAXED);
+	__atomic_store_n(&stats->zbs_qd_bw,
+			 qd->win_sectors * 1000000000ULL / elapsed,
+			 __ATOMIC_RELAXED);
+
+	qd->win_start = now;
+	qd->win_cmds = 0;
+	qd->win_max_inflight = qd->inflight;
+	qd->win_lat = 0;
+	qd->win_sectors = 0;
+}
+
+/**
+ * Wait for a command slot and return the command start time.
+ */
+unsigned long long zbc_qd_get(struct zbc_device *dev)
+{
+	struct zbc_qd *qd = dev->zbd_qd;
+	unsigned long long start;
+
+	pthread_mutex_lock(&qd->lock);
+
+	if (qd->inflight >= zbc_qd_limit(qd)) {
+		start = zbc_time_ns();
+		while (qd->inflight >= zbc_qd_limit(qd))
+			pthread_cond_wait(&qd->cond, &qd->lock);
+		__atomic_fetch_add(&dev->zbd_stats->zbs_qd_nr_waits, 1,
+				   __ATOMIC_RELAXED);
+		__atomic_fetch_add(&dev->zbd_stats->zbs_qd_wait_ns,
+				   zbc_time_ns() - start, __ATOMIC_RELAXED);
+	}
+
+	qd->inflight++;
+	if (qd->inflight > qd->win_max_inflight)
+		qd->win_max_inflight = qd->inflight;
+	zbc_qd_export(dev, qd);
+
+	pthread_mutex_unlock(&qd->lock);
+
+	return zbc_time_ns();
+}
+
+/**
+ * Release a command slot.
+ */
+void zbc_qd_put(struct zbc_device *dev, unsigned long long start,
+		size_t sectors)
+{
+	struct zbc_qd *qd = dev->zbd_qd;
+	unsigned long long now = zbc_time_ns();
+	unsigned long long lat = now - start;
+
+	/* Normalize the latency of large commands */
+	if (sectors > ZBC_QD_NORM_SECTORS)
+		lat = lat * ZBC_QD_NORM_SECTORS / sectors;
+
+	pthread_mutex_lock(&qd->lock);
+
+	qd->inflight--;
+	qd->win_cmds++;
+	qd->win_lat += lat;
+	qd->win_sectors += sectors;
+
+	if (qd->win_cmds >= ZBC_QD_WIN_CMDS + 2 * zbc_qd_limit(qd) ||
+	    now - qd->win_start >= ZBC_QD_WIN_NS)
+		zbc_qd_update(dev, qd, now);
+
+	if (qd->inflight < zbc_qd_limit(qd))
+		pthread_cond_signal(&qd->cond);
+	zbc_qd_export(dev, qd);
+
+	pthread_mutex_unlock(&qd->lock);
+}
+
+/**
+ * Free the controller of a device.
+ */
+void zbc_qd_exit(struct zbc_device *dev)
+{
+	struct zbc_qd *qd = dev->zbd_qd;
+
+	if (!qd)
+		return;
+
+	dev->zbd_qd = NULL;
+	pthread_cond_destroy(&qd->cond);
+	pthread_mutex_destroy(&qd->lock);
+	zbc_free(qd);
+
+	__atomic_store_n(&dev->zbd_stats->zbs_qd_limit, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&dev->zbd_stats->zbs_qd_inflight, 0,
+			 __ATOMIC_RELAXED);
+}
+
+/**
+ * zbc_set_qd_control - Enable or disable the adaptive queue depth controller
+ */
+int zbc_set_qd_control(struct zbc_device *dev, struct zbc_qd_params *params)
+{
+	struct zbc_qd *qd;
+
+	zbc_qd_exit(dev);
+	if (!params)
+		return 0;
+
+	qd = zbc_calloc(1, sizeof(struct zbc_qd));
+	if (!qd)
+		return -ENOMEM;
+
+	qd->params = *params;
+	if (!qd->params.zqp_min_qd)
+		qd->params.zqp_min_qd = ZBC_QD_MIN;
+	if (!qd->params.zqp_max_qd)
+		qd->params.zqp_max_qd = ZBC_QD_MAX;
+	if (!qd->params.zqp_tolerance)
+		qd->params.zqp_tolerance = ZBC_QD_TOLERANCE;
+	if (qd->params.zqp_min_qd > qd->params.zqp_max_qd ||
+	    qd->params.zqp_max_qd > 65536) {
+		zbc_free(qd);
+		return -EINVAL;
+	}
+
+	pthread_mutex_init(&qd->lock, NULL);
+	pthread_cond_init(&qd->cond, NULL);
+
+	/* Start low and let the controller probe upward */
+	qd->limit = qd->params.zqp_min_qd << 8;
+	qd->slow_start = true;
+	qd->win_start = zbc_time_ns();
+
+	dev->zbd_qd = qd;
+	zbc_qd_export(dev, qd);
+
+	return 0;
+}
@@ -0,0 +1,400 @@
+/*
+ * This file is part of libzbc.
+ *
+ * Copyright (C) 2009-2014, HGST, Inc. All rights reserved.
+ * Copyright (C) 2016, Western Digital. All rights reserved.
+ *
+ * This software is distributed under the terms of the BSD 2-clause license,
+ * "as is," without technical support, and WITHOUT ANY WARRANTY, without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE. You should have received a copy of the BSD 2-clause license along
+ * with libzbc. If not, see  <http://opensource.org/licenses/BSD-2-Clause>.
+ *
+ * Author: Damien Le Moal (damien.lemoal@wdc.com)
+ */
+
+#include "zbc.h"
+#include "libzbc/zbc_sb.h"
+
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * Default number of slots.
+ */
+#define ZBC_SB_NR_SLOTS		2
+
+/**
+ * Slot header, followed by the superblock data. The slot written for
+ * generation @gen is slot @gen % @nr_slots.
+ */
+#define ZBC_SB_MAGIC		0x5a425342
+
+struct zbc_sb_hdr {
+	uint32_t		magic;
+	uint32_t		crc;
+	uint64_t		gen;
+	uint64_t		version;
+	uint32_t		nr_slots;
+	uint32_t		slot_size;
+	uint32_t		len;
+	uint32_t		reserved;
+};
+
+/**
+ * Superblock. @cond is signaled when a slot write completes.
+ */
+struct zbc_sb {
+	struct zbc_device	*dev;
+	struct zbc_sb_params	params;
+	pthread_mutex_t		lock;
+	pthread_cond_t		cond;
+
+	size_t			slot_size;
+	uint64_t		slot_sectors;
+
+	/* Last update data and its version */
+	void			*data;
+	size_t			len;
+	uint64_t		version;
+
+	/* Last slot written and committed version */
+	uint64_t		gen;
+	uint64_t		committed;
+	bool			writing;
+
+	/* Slot write buffer */
+	struct zbc_sb_hdr	*wbuf;
+
+	struct zbc_sb_stats	stats;
+};
+
+/**
+ * Check that the slots are within conventional zones.
+ */
+static int zbc_sb_check_zones(struct zbc_sb *sb)
+{
+	uint64_t sector = sb->params.zkp_sector;
+	uint64_t end = sector + sb->params.zkp_nr_slots * sb->slot_sectors;
+	struct zbc_zone zone;
+	unsigned int nz;
+	int ret;
+
+	if (!zbc_dev_sect_paligned(sb->dev, sector))
+		goto err;
+
+	while (sector < end) {
+		nz = 1;
+		ret = zbc_report_zones(sb->dev, sector, ZBC_RO_ALL,
+				       &zone, &nz);
+		if (ret)
+			return ret;
+		if (!nz || !zbc_zone_conventional(&zone))
+			goto err;
+		sector = zbc_zone_start(&zone) + zbc_zone_length(&zone);
+	}
+
+	return 0;
+
+err:
+	zbc_error("%s: Invalid superblock sector %llu\n",
+		  sb->dev->zbd_filename,
+		  (unsigned long long)sb->params.zkp_sector);
+
+	return -EINVAL;
+}
+
+/**
+ * Load the valid slot with the highest generation.
+ */
+static int zbc_sb_load(struct zbc_sb *sb)
+{
+	unsigned int nr_slots = sb->params.zkp_nr_slots;
+	struct zbc_sb_hdr *hdr, *best = NULL;
+	uint64_t sectors = nr_slots * sb->slot_sectors;
+	unsigned int i;
+	uint32_t crc;
+	void *buf;
+	ssize_t ret;
+
+	buf = zbc_memalign(sysconf(_SC_PAGESIZE), nr_slots * sb->slot_size);
+	if (!buf)
+		return -ENOMEM;
+
+	ret = zbc_pread(sb->dev, buf, sectors, sb->params.zkp_sector);
+	if (ret >= 0 && (uint64_t)ret != sectors)
+		ret = -EIO;
+	if (ret < 0)
+		goto out;
+
+	for (i = 0; i < nr_slots; i++) {
+		hdr = (struct zbc_sb_hdr *)((char *)buf + i * sb->slot_size);
+		if (hdr->magic != ZBC_SB_MAGIC)
+			continue;
+		if (hdr->nr_slots != nr_slots ||
+		    hdr->slot_size != sb->slot_size) {
+			zbc_error("%s: Superblock parameters do not match slot %u\n",
+				  sb->dev->zbd_filename, i);
+			ret = -EINVAL;
+			goto out;
+		}
+		crc = hdr->crc;
+		hdr->crc = 0;
+		if (hdr->gen % nr_slots != i ||
+		    hdr->len > sb->params.zkp_data_size ||
+		    crc != zbc_crc32c(0, hdr, sb->slot_size))
+			continue;
+		if (!best || hdr->gen > best->gen)
+			best = hdr;
+	}
+
+	ret = 0;
+	if (!best)
+		goto out;
+
+	sb->gen = best->gen;
+	sb->version = best->version;
+	sb->committed = best->version;
+	sb->len = best->len;
+	memcpy(sb->data, best + 1, best->len);
+
+out:
+	zbc_free(buf);
+
+	return ret;
+}
+
+/**
+ * zbc_sb_open - Open a superblock
+ */
+int zbc_sb_open(struct zbc_device *dev, struct zbc_sb_params *params,
+		struct zbc_sb **psb)
+{
+	size_t pbs = dev->zbd_info.zbd_pblock_size;
+	struct zbc_sb_params *p;
+	struct zbc_sb *sb;
+	int ret;
+
+	if (!params)
+		return -EINVAL;
+
+	sb = zbc_calloc(1, sizeof(struct zbc_sb));
+	if (!sb)
+		return -ENOMEM;
+
+	sb->dev = dev;
+	sb->params = *params;
+	pthread_mutex_init(&sb->lock, NULL);
+	pthread_cond_init(&sb->cond, NULL);
+
+	p = &sb->params;
+	if (!p->zkp_nr_slots)
+		p->zkp_nr_slots = ZBC_SB_NR_SLOTS;
+	if (!p->zkp_data_size)
+		p->zkp_data_size = pbs - sizeof(struct zbc_sb_hdr);
+
+	sb->slot_size = sizeof(struct zbc_sb_hdr) + p->zkp_data_size;
+	sb->slot_size = (sb->slot_size + pbs - 1) / pbs * pbs;
+	sb->slot_sectors = sb->slot_size >> 9;
+	if (p->zkp_nr_slots < 2 || p->zkp_data_size > UINT32_MAX ||
+	    sb->slot_size > UINT32_MAX || p->zkp_flags & ~ZBC_SB_FUA) {
+		zbc_error("%s: Invalid superblock parameters\n",
+			  dev->zbd_filename);
+		ret = -EINVAL;
+		goto err;
+	}
+
+	ret = zbc_sb_check_zones(sb);
+	if (ret)
+		goto err;
+
+	sb->data = zbc_malloc(p->zkp_data_size);
+	sb->wbuf = zbc_memalign(sysconf(_SC_PAGESIZE), sb->slot_size);
+	if (!sb->data || !sb->wbuf) {
+		ret = -ENOMEM;
+		goto err;
+	}
+
+	ret = zbc_sb_load(sb);
+	if (ret)
+		goto err;
+
+	*psb = sb;
+
+	return 0;
+
+err:
+	zbc_sb_close(sb);
+
+	return ret;
+}
+
+/**
+ * Write the slot of the next generation. Called with the superblock
+ * lock held, which is released during the write.
+ */
+static int zbc_sb_write(struct zbc_sb *sb)
+{
+	struct zbc_sb_hdr *hdr = sb->wbuf;
+	struct zbc_io_hints hints = {
+		.zih_prio = ZBC_IO_PRIO_NORMAL,
+		.zih_flags = ZBC_IO_FUA,
+	};
+	bool fua = sb->params.zkp_flags & ZBC_SB_FUA;
+	uint64_t sector;
+	ssize_t ret;
+
+	memset(hdr, 0, sb->slot_size);
+	hdr->magic = ZBC_SB_MAGIC;
+	hdr->gen = sb->gen + 1;
+	hdr->version = sb->version;
+	hdr->nr_slots = sb->params.zkp_nr_slots;
+	hdr->slot_size = sb->slot_size;
+	hdr->len = sb->len;
+	memcpy(hdr + 1, sb->data, sb->len);
+	hdr->crc = zbc_crc32c(0, hdr, sb->slot_size);
+
+	sector = sb->params.zkp_sector +
+		(hdr->gen % sb->params.zkp_nr_slots) * sb->slot_sectors;
+
+	sb->writing = true;
+	pthread_mutex_unlock(&sb->lock);
+
+	ret = zbc_pwrite_hints(sb->dev, hdr, sb->slot_sectors, sector,
+			       fua ? &hints : NULL);
+	if (ret >= 0 && (uint64_t)ret != sb->slot_sectors)
+		ret = -EIO;
+	if (ret >= 0 && !fua)
+		ret = zbc_flush(sb->dev);
+
+	pthread_mutex_lock(&sb->lock);
+	sb->writing = false;
+	pthread_cond_broadcast(&sb->cond);
+
+	if (ret < 0) {
+		zbc_error("%s: Write superblock slot at %llu failed %zd\n",
+			  sb->dev->zbd_filename,
+			  (unsigned long long)sector, ret);
+		return ret;
+	}
+
+	/*
+	 * A failed write is retried in the same slot, so that the slot of
+	 * the last generation written is never overwritten.
+	 */
+	sb->gen = hdr->gen;
+	sb->committed = hdr->version;
+	sb->stats.zks_nr_writes++;
+	if (!fua)
+		sb->stats.zks_nr_flushes++;
+
+	return 0;
+}
+
+/**
+ * zbc_sb_commit - Commit the superblock
+ */
+int zbc_sb_commit(struct zbc_sb *sb, uint64_t version)
+{
+	int ret = 0;
+
+	pthread_mutex_lock(&sb->lock);
+
+	sb->stats.zks_nr_commits++;
+	if (!version || version > sb->version)
+		version = sb->version;
+
+	while (sb->committed < version) {
+		if (sb->writing) {
+			/* The next write will include this version */
+			pthread_cond_wait(&sb->cond, &sb->lock);
+			continue;
+		}
+		ret = zbc_sb_write(sb);
+		if (ret)
+			break;
+	}
+
+	pthread_mutex_unlock(&sb->lock);
+
+	return ret;
+}
+
+/**
+ * zbc_sb_update - Update the superblock data
+ */
+int zbc_sb_update(struct zbc_sb *sb, const void *buf, size_t len,
+		  uint64_t *version)
+{
+	if (len > sb->params.zkp_data_size)
+		return -ENOSPC;
+
+	pthread_mutex_lock(&sb->lock);
+
+	memcpy(sb->data, buf, len);
+	sb->len = len;
+	sb->version++;
+	sb->stats.zks_nr_updates++;
+	if (version)
+		*version = sb->version;
+
+	pthread_mutex_unlock(&sb->lock);
+
+	return 0;
+}
+
+/**
+ * zbc_sb_get - Get the superblock data
+ */
+size_t zbc_sb_get(struct zbc_sb *sb, void *buf, size_t len,
+		  uint64_t *version)
+{
+	size_t ret;
+
+	pthread_mutex_lock(&sb->lock);
+
+	ret = sb->len;
+	memcpy(buf, sb->data, len < ret ? len : ret);
+	if (version)
+		*version = sb->version;
+
+	pthread_mutex_unlock(&sb->lock);
+
+	return ret;
+}
+
+/**
+ * zbc_sb_get_stats - Get a superblock statistics
+ */
+void zbc_sb_get_stats(struct zbc_sb *sb, struct zbc_sb_stats *stats)
+{
+	pthread_mutex_lock(&sb->lock);
+
+	*stats = sb->stats;
+	stats->zks_version = sb->version;
+	stats->zks_committed = sb->committed;
+
+	pthread_mutex_unlock(&sb->lock);
+}
+
+/**
+ * zbc_sb_close - Close a superblock
+ */
+int zbc_sb_close(struct zbc_sb *sb)
+{
+	int ret = 0;
+
+	if (!sb)
+		return 0;
+
+	if (sb->wbuf && sb->data)
+		ret = zbc_sb_commit(sb, 0);
+
+	pthread_cond_destroy(&sb->cond);
+	pthread_mutex_destroy(&sb->lock);
+	zbc_free(sb->wbuf);
+	zbc_free(sb->data);
+	zbc_free(sb);
+
+	return ret;
+}
@@ -182,12 +182,15 @@ static int zbc_scsi_classify(struct zbc_device *dev)
 	char vid[ZBC_SCSI_VID_LEN + 1];
 	char pid[ZBC_SCSI_PID_LEN + 1];
 	char rev[ZBC_SCSI_REV_LEN + 1];
+	unsigned long long start;
 	uint8_t zoned;
 	int dev_type;
 	int ret;
 
 	/* Get device info */
+	start = zbc_time_ns();
 	ret = zbc_scsi_inquiry(dev, 0, buf, ZBC_SCSI_INQUIRY_BUF_LEN);
+	zbc_open_phase(dev->zbd_filename, "inquiry", start, ret);
 	if (ret != 0) {
 		zbc_error("%s: zbc_scsi_inquiry failed\n",
 			  dev->zbd_filename);
@@ -199,9 +202,15 @@ static int zbc_scsi_classify(struct zbc_device *dev)
 	 * If SAT is working, treat the disk as SCSI.
 	 */
 	if (strncmp((char *)&buf[8], "ATA", 3) == 0) {
+		start = zbc_time_ns();
 		ret = zbc_scsi_test_sat(dev);
-		if (ret != 0)
+		zbc_open_phase(dev->zbd_filename, "SAT report zones",
+			       start, ret);
+		if (ret != 0) {
+			zbc_open_reject(dev->zbd_filename,
+					"ATA device without ZBC SAT");
 			return -ENXIO;
+		}
 	}
 
 	/* This is a SCSI device */
@@ -240,6 +249,7 @@ static int zbc_scsi_classify(struct zbc_device *dev)
 		/* Unsupported device */
 		zbc_error("%s: Unsupported device type 0x%02X\n",
 			  dev->zbd_filename, dev_type);
+		zbc_open_reject(dev->zbd_filename, "unsupported device type");
 		return -ENXIO;
 	}
 
@@ -250,7 +260,9 @@ static int zbc_scsi_classify(struct zbc_device *dev)
 	 * reported by the zoned field for host-managed devices.
 	 */
 	memset(buf, 0, sizeof(buf));
+	start = zbc_time_ns();
 	ret = zbc_scsi_inquiry(dev, 0xB1, buf, ZBC_SCSI_VPD_PAGE_B1_LEN);
+	zbc_open_phase(dev->zbd_filename, "inquiry VPD page B1", start, ret);
 	if (ret != 0) {
 		zbc_error("%s: zbc_scsi_inquiry VPD page 0xB1 failed\n",
 			  dev->zbd_filename);
@@ -774,10 +786,13 @@ int zbc_scsi_get_zbd_characteristics(struct zbc_device *dev)
  */
 static int zbc_scsi_get_dev_info(struct zbc_device *dev)
 {
+	unsigned long long start;
 	int ret;
 
 	/* Make sure the device is ready */
+	start = zbc_time_ns();
 	ret = zbc_sg_test_unit_ready(dev);
+	zbc_open_phase(dev->zbd_filename, "test unit ready", start, ret);
 	if (ret != 0)
 		return ret;
 
@@ -787,12 +802,17 @@ static int zbc_scsi_get_dev_info(struct zbc_device *dev)
 		return ret;
 
 	/* Get capacity information */
+	start = zbc_time_ns();
 	ret = zbc_scsi_get_capacity(dev);
+	zbc_open_phase(dev->zbd_filename, "read capacity", start, ret);
 	if (ret != 0)
 		return ret;
 
 	/* Get zoned block device characteristics */
+	start = zbc_time_ns();
 	ret = zbc_scsi_get_zbd_characteristics(dev);
+	zbc_open_phase(dev->zbd_filename, "zoned characteristics",
+		       start, ret);
 	if (ret != 0)
 		return ret;
 
@@ -833,13 +853,14 @@ static int zbc_scsi_open(const char *filename,
 
 	if (!S_ISCHR(st.st_mode) &&
 	    !S_ISBLK(st.st_mode)) {
+		zbc_open_reject(filename, "not a device file");
 		ret = -ENXIO;
 		goto out;
 	}
 
 	/* Set device decriptor */
 	ret = -ENOMEM;
-	dev = calloc(1, sizeof(struct zbc_device));
+	dev = zbc_calloc(1, sizeof(struct zbc_device));
 	if (!dev)
 		goto out;
 
@@ -851,7 +872,7 @@ static int zbc_scsi_open(const char *filename,
 	if (flags & O_DIRECT)
 		dev->zbd_o_flags |= ZBC_O_DIRECT;
 
-	dev->zbd_filename = strdup(filename);
+	dev->zbd_filename = zbc_strdup(filename);
 	if (!dev->zbd_filename)
 		goto out_free_dev;
 
@@ -867,10 +888,10 @@ static int zbc_scsi_open(const char *filename,
 	return 0;
 
 out_free_filename:
-	free(dev->zbd_filename);
+	zbc_free(dev->zbd_filename);
 
 out_free_dev:
-	free(dev);
+	zbc_free(dev);
 
 out:
 	if (fd >= 0)
@@ -892,12 +913,34 @@ static int zbc_scsi_close(struct zbc_device *dev)
 	if (close(dev->zbd_fd))
 		return -errno;
 
-	free(dev->zbd_filename);
-	free(dev);
+	zbc_free(dev->zbd_filename);
+	zbc_free(dev);
 
 	return 0;
 }
 
+/**
+ * DPO (bit 4) and FUA (bit 3) bits of READ 16 and WRITE 16 CDBs.
+ */
+#define ZBC_SCSI_RW_DPO		0x10
+#define ZBC_SCSI_RW_FUA		0x08
+
+/**
+ * zbc_scsi_rw_cdb_flags - Get the DPO and FUA bits of READ 16 and WRITE 16
+ * CDBs: DPO is always set and the hints add FUA.
+ */
+uint8_t zbc_scsi_rw_cdb_flags(const struct zbc_io_hints *hints)
+{
+	uint8_t flags = ZBC_SCSI_RW_DPO;
+
+	if (hints->zih_flags & ZBC_IO_DPO)
+		flags |= ZBC_SCSI_RW_DPO;
+	if (hints->zih_flags & ZBC_IO_FUA)
+		flags |= ZBC_SCSI_RW_FUA;
+
+	return flags;
+}
+
 /**
  * Read from a ZBC device
  */
@@ -915,7 +958,7 @@ ssize_t zbc_scsi_pread(struct zbc_device *dev, void *buf,
 
 	/* Fill command CDB */
 	cmd.cdb[0] = ZBC_SG_READ_CDB_OPCODE;
-	cmd.cdb[1] = 0x10;
+	cmd.cdb[1] = zbc_scsi_rw_cdb_flags(&zhints);
 	zbc_sg_set_int64(&cmd.cdb[2], zbc_dev_sect2lba(dev, offset));
 	zbc_sg_set_int32(&cmd.cdb[10], zbc_dev_sect2lba(dev, count));
 
@@ -946,7 +989,7 @@ ssize_t zbc_scsi_pwrite(struct zbc_device *dev, const void *buf,
 
 	/* Fill command CDB */
 	cmd.cdb[0] = ZBC_SG_WRITE_CDB_OPCODE;
-	cmd.cdb[1] = 0x10;
+	cmd.cdb[1] = zbc_scsi_rw_cdb_flags(&zhints);
 	zbc_sg_set_int64(&cmd.cdb[2], zbc_dev_sect2lba(dev, offset));
 	zbc_sg_set_int32(&cmd.cdb[10], zbc_dev_sect2lba(dev, count));
 
@@ -242,6 +242,7 @@ static void zbc_sg_set_sense(struct zbc_device *dev, struct zbc_sg_cmd *cmd)
 #define ZBC_SG_FLAG_DIRECT_IO	0x01
 #endif
 #define ZBC_SG_FLAG_Q_AT_TAIL	0x10
+#define ZBC_SG_FLAG_Q_AT_HEAD	0x20
 
 /**
  * Initialize a command.
@@ -260,11 +261,13 @@ int zbc_sg_cmd_init(struct zbc_device *dev,
 	cmd->cdb_opcode = zbc_sg_cmd_list[cmd_code].cdb_opcode;
 	cmd->cdb_sa = zbc_sg_cmd_list[cmd_code].cdb_sa;
 
+	cmd->dev = dev;
+
 	if (!out_buf && out_bufsz > 0) {
 
-		/* Allocate a buffer */
-		if (posix_memalign((void **) &cmd->out_buf,
-				   sysconf_pagesize(), out_bufsz) != 0) {
+		/* Get a buffer from the device arena */
+		cmd->out_buf = zbc_arena_get(dev, out_bufsz);
+		if (!cmd->out_buf) {
 			zbc_error("No memory for command output buffer (%zu B)\n",
 				  out_bufsz);
 			return -ENOMEM;
@@ -286,7 +289,11 @@ int zbc_sg_cmd_init(struct zbc_device *dev,
 	cmd->io_hdr.interface_id = 'S';
 	cmd->io_hdr.timeout = 20000;
 
-	cmd->io_hdr.flags = ZBC_SG_FLAG_Q_AT_TAIL;
+	/* High priority I/Os are queued ahead of other commands */
+	if (zbc_hint_prio() == ZBC_IO_PRIO_HIGH)
+		cmd->io_hdr.flags = ZBC_SG_FLAG_Q_AT_HEAD;
+	else
+		cmd->io_hdr.flags = ZBC_SG_FLAG_Q_AT_TAIL;
 	if (dev->zbd_o_flags & ZBC_O_DIRECT && cmd->out_bufsz)
 		cmd->io_hdr.flags |= ZBC_SG_FLAG_DIRECT_IO;
 
@@ -311,7 +318,7 @@ void zbc_sg_cmd_destroy(struct zbc_sg_cmd *cmd)
 {
 	/* Free the command buffer */
         if (cmd->out_buf && cmd->out_buf_needfree) {
-		free(cmd->out_buf);
+		zbc_arena_put(cmd->dev, cmd->out_buf);
 		cmd->out_buf = NULL;
 		cmd->out_bufsz = 0;
         }
@@ -206,6 +206,8 @@ struct zbc_sg_cmd {
 
 	uint8_t		sense_buf[ZBC_SG_SENSE_MAX_LENGTH];
 
+	struct zbc_device *dev;
+
 	int		out_buf_needfree;
 	size_t		out_bufsz;
 	uint8_t		*out_buf;
@@ -0,0 +1,653 @@
+/*
+ * This file is part of libzbc.
+ *
+ * Copyright (C) 2009-2014, HGST, Inc. All rights reserved.
+ * Copyright (C) 2016, Western Digital. All rights reserved.
+ *
+ * This software is distributed under the terms of the BSD 2-clause license,
+ * "as is," without technical support, and WITHOUT ANY WARRANTY, without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE. You should have received a copy of the BSD 2-clause license along
+ * with libzbc. If not, see  <http://opensource.org/licenses/BSD-2-Clause>.
+ *
+ * Author: Damien Le Moal (damien.lemoal@wdc.com)
+ */
+
+#include "zbc.h"
+#include "libzbc/zbc_exec.h"
+#include "libzbc/zbc_shuffle.h"
+
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * Defaults.
+ */
+#define ZBC_SHUF_MEM_SIZE	(64 * 1024 * 1024)
+#define ZBC_SHUF_IO_SIZE	(1024 * 1024)
+#define ZBC_SHUF_NR_STREAMS	8
+
+/**
+ * Asynchronous stream buffer write.
+ */
+struct zbc_shuf_io {
+	struct zbc_exec_task	*task;
+	struct zbc_device	*dev;
+	void			*buf;
+	uint64_t		sector;
+	size_t			count;
+	ssize_t			ret;
+};
+
+/**
+ * A stream appends partition data to its write buffer and writes the
+ * buffer sequentially to its current zone. A buffer never crosses a zone
+ * boundary: its capacity @limit is set when it is started, from the space
+ * left in the zone.
+ */
+struct zbc_shuf_stream {
+	struct zbc_zone		*zone;
+	uint64_t		sector;
+	size_t			limit;
+	size_t			len;
+
+	/* Buffer being filled is buf[w], buf[w ^ 1] may be in flight */
+	void			*buf[2];
+	struct zbc_shuf_io	io[2];
+	unsigned int		w;
+};
+
+/**
+ * Partition buffer and extent index. @placed is the amount of data
+ * appended to the stream buffers and @flushed the amount of data on
+ * the device at the last flush.
+ */
+struct zbc_shuf_part {
+	char			*buf;
+	size_t			len;
+	uint64_t		placed;
+	uint64_t		flushed;
+
+	struct zbc_shuffle_extent *ext;
+	unsigned int		nr_ext;
+	unsigned int		max_ext;
+};
+
+/**
+ * Shuffle writer.
+ */
+struct zbc_shuffle {
+	struct zbc_device	*dev;
+	struct zbc_shuffle_params params;
+	struct zbc_zpool	zpool;
+	size_t			buf_size;
+
+	struct zbc_shuf_part	*parts;
+	char			*part_bufs;
+
+	struct zbc_shuf_stream	*streams;
+	unsigned int		nr_streams;
+
+	/* Read bounce buffer */
+	void			*rbuf;
+
+	struct zbc_shuffle_stats stats;
+};
+
+static void zbc_shuf_io_run(struct zbc_shuf_io *io)
+{
+	io->ret = zbc_pwrite(io->dev, io->buf, io->count, io->sector);
+	if (io->ret >= 0 && (size_t)io->ret != io->count)
+		io->ret = -EIO;
+}
+
+static void zbc_shuf_io_task(struct zbc_exec_task *task, void *arg)
+{
+	zbc_shuf_io_run(arg);
+}
+
+static ssize_t zbc_shuf_io_wait(struct zbc_shuf_io *io)
+{
+	if (io->task) {
+		zbc_exec_wait(io->task);
+		io->task = NULL;
+	}
+
+	return io->ret;
+}
+
+/**
+ * Write the buffer of a stream, padded to the device physical block
+ * size. The write of the previous buffer must complete first to keep
+ * writes sequential. The next append starts a new buffer.
+ */
+static int zbc_shuf_stream_write(struct zbc_shuffle *shuf,
+				 struct zbc_shuf_stream *st)
+{
+	size_t pbs = shuf->dev->zbd_info.zbd_pblock_size;
+	struct zbc_shuf_io *io = &st->io[st->w];
+	size_t len = (st->len + pbs - 1) / pbs * pbs;
+	ssize_t ret;
+
+	ret = zbc_shuf_io_wait(&st->io[st->w ^ 1]);
+	if (ret < 0)
+		return ret;
+
+	st->limit = 0;
+	if (!st->len)
+		return 0;
+
+	if (len > st->len)
+		memset((char *)st->buf[st->w] + st->len, 0, len - st->len);
+
+	io->dev = shuf->dev;
+	io->buf = st->buf[st->w];
+	io->sector = st->sector;
+	io->count = len >> 9;
+	if (zbc_exec_submit(shuf->dev, ZBC_EXEC_PRIO_HIGH, zbc_shuf_io_task,
+			    io, &io->task)) {
+		io->task = NULL;
+		zbc_shuf_io_run(io);
+	}
+
+	st->sector += len >> 9;
+	st->zone->zbz_write_pointer = st->sector;
+	if (st->sector >= zbc_zone_start(st->zone) + zbc_zone_length(st->zone))
+		st->zone->zbz_condition = ZBC_ZC_FULL;
+	else
+		st->zone->zbz_condition = ZBC_ZC_IMP_OPEN;
+
+	st->len = 0;
+	st->w ^= 1;
+	shuf->stats.zhs_nr_writes++;
+	shuf->stats.zhs_dev_bytes += len;
+
+	return 0;
+}
+
+/**
+ * Start a new buffer for a stream, switching to a new zone if the
+ * current zone is full.
+ */
+static int zbc_shuf_stream_start(struct zbc_shuffle *shuf,
+				 struct zbc_shuf_stream *st)
+{
+	struct zbc_zone *zone = st->zone;
+	uint64_t room;
+
+	if (!zone ||
+	    st->sector >= zbc_zone_start(zone) + zbc_zone_length(zone)) {
+		zone = zbc_zpool_get(&shuf->zpool);
+		if (!zone) {
+			zbc_error("%s: No empty zone for shuffle stream\n",
+				  shuf->dev->zbd_filename);
+			return -ENOSPC;
+		}
+		st->zone = zone;
+		st->sector = zbc_zone_start(zone);
+		shuf->stats.zhs_nr_zones++;
+	}
+
+	room = (zbc_zone_start(zone) + zbc_zone_length(zone) - st->sector) << 9;
+	st->limit = shuf->params.zhp_io_size;
+	if (st->limit > room)
+		st->limit = room;
+	st->len = 0;
+
+	return 0;
+}
+
+/**
+ * Add an extent to a partition index, merging it with the last extent
+ * if the data is contiguous on the device.
+ */
+static int zbc_shuf_part_map(struct zbc_shuffle *shuf,
+			     struct zbc_shuf_part *p,
+			     uint64_t sector, size_t offset, size_t len)
+{
+	struct zbc_shuffle_extent *e;
+	unsigned int max_ext;
+
+	sector += offset >> 9;
+	offset &= 511;
+
+	if (p->nr_ext) {
+		e = &p->ext[p->nr_ext - 1];
+		if ((e->zhe_sector << 9) + e->zhe_sector_offset +
+		    e->zhe_length == (sector << 9) + offset &&
+		    (uint64_t)e->zhe_length + len <= UINT32_MAX) {
+			e->zhe_length += len;
+			return 0;
+		}
+	}
+
+	if (p->nr_ext == p->max_ext) {
+		max_ext = p->max_ext ? p->max_ext * 2 : 16;
+		e = zbc_malloc(max_ext * sizeof(struct zbc_shuffle_extent));
+		if (!e)
+			return -ENOMEM;
+		if (p->nr_ext)
+			memcpy(e, p->ext,
+			       p->nr_ext * sizeof(struct zbc_shuffle_extent));
+		zbc_free(p->ext);
+		p->ext = e;
+		p->max_ext = max_ext;
+	}
+
+	e = &p->ext[p->nr_ext++];
+	e->zhe_offset = p->placed;
+	e->zhe_sector = sector;
+	e->zhe_sector_offset = offset;
+	e->zhe_length = len;
+	shuf->stats.zhs_nr_extents++;
+
+	return 0;
+}
+
+/**
+ * Append data of a partition to the buffer of its stream, writing the
+ * stream buffer each time it is full.
+ */
+static int zbc_shuf_append(struct zbc_shuffle *shuf, unsigned int part,
+			   const char *data, size_t len)
+{
+	struct zbc_shuf_stream *st = &shuf->streams[part % shuf->nr_streams];
+	struct zbc_shuf_part *p = &shuf->parts[part];
+	size_t n;
+	int ret;
+
+	while (len) {
+
+		if (st->len == st->limit) {
+			ret = zbc_shuf_stream_write(shuf, st);
+			if (ret)
+				return ret;
+			ret = zbc_shuf_stream_start(shuf, st);
+			if (ret)
+				return ret;
+		}
+
+		n = st->limit - st->len;
+		if (n > len)
+			n = len;
+
+		ret = zbc_shuf_part_map(shuf, p, st->sector, st->len, n);
+		if (ret)
+			return ret;
+
+		memcpy((char *)st->buf[st->w] + st->len, data, n);
+		st->len += n;
+		p->placed += n;
+		data += n;
+		len -= n;
+
+	}
+
+	return 0;
+}
+
+/**
+ * zbc_shuffle_open - Create a shuffle writer
+ */
+int zbc_shuffle_open(struct zbc_device *dev,
+		     struct zbc_shuffle_params *params,
+		     struct zbc_shuffle **pshuf)
+{
+	struct zbc_device_info *info = &dev->zbd_info;
+	size_t pbs = info->zbd_pblock_size;
+	size_t pgsz = sysconf(_SC_PAGESIZE);
+	struct zbc_shuffle_params *p;
+	struct zbc_shuffle *shuf;
+	unsigned int i, max_open;
+	int ret;
+
+	if (!params || !params->zhp_nr_partitions)
+		return -EINVAL;
+
+	shuf = zbc_calloc(1, sizeof(struct zbc_shuffle));
+	if (!shuf)
+		return -ENOMEM;
+
+	shuf->dev = dev;
+	shuf->params = *params;
+	p = &shuf->params;
+
+	if (!p->zhp_mem_size)
+		p->zhp_mem_size = ZBC_SHUF_MEM_SIZE;
+	if (!p->zhp_io_size)
+		p->zhp_io_size = ZBC_SHUF_IO_SIZE;
+	p->zhp_io_size -= p->zhp_io_size % pbs;
+
+	shuf->buf_size = p->zhp_mem_size / p->zhp_nr_partitions;
+	if (shuf->buf_size > p->zhp_io_size)
+		shuf->buf_size = p->zhp_io_size;
+	shuf->buf_size -= shuf->buf_size % pbs;
+	if (!p->zhp_io_size || !shuf->buf_size) {
+		zbc_error("%s: Invalid shuffle parameters\n",
+			  dev->zbd_filename);
+		ret = -EINVAL;
+		goto err;
+	}
+
+	ret = zbc_zpool_init(&shuf->zpool, dev, p->zhp_sector,
+			     p->zhp_nr_sectors);
+	if (ret)
+		goto err;
+
+	/* Reclaim all zones */
+	for (i = 0; i < shuf->zpool.zp_nr_zones; i++) {
+		if (zbc_zone_empty(&shuf->zpool.zp_zones[i]))
+			continue;
+		ret = zbc_zpool_put(&shuf->zpool, &shuf->zpool.zp_zones[i]);
+		if (ret)
+			goto err;
+	}
+
+	/* One zone is written per stream */
+	max_open = p->zhp_max_open;
+	if (!max_open) {
+		if (info->zbd_model == ZBC_DM_HOST_AWARE &&
+		    info->zbd_opt_nr_open_seq_pref != ZBC_NOT_REPORTED)
+			max_open = info->zbd_opt_nr_open_seq_pref;
+		else if (info->zbd_model == ZBC_DM_HOST_MANAGED &&
+			 info->zbd_max_nr_open_seq_req != ZBC_NO_LIMIT)
+			max_open = info->zbd_max_nr_open_seq_req;
+		if (!max_open)
+			max_open = ZBC_SHUF_NR_STREAMS;
+	}
+	if (max_open > p->zhp_nr_partitions)
+		max_open = p->zhp_nr_partitions;
+	if (max_open > shuf->zpool.zp_nr_zones)
+		max_open = shuf->zpool.zp_nr_zones;
+	shuf->nr_streams = max_open;
+	shuf->stats.zhs_nr_streams = max_open;
+
+	shuf->parts = zbc_calloc(p->zhp_nr_partitions,
+				 sizeof(struct zbc_shuf_part));
+	shuf->part_bufs = zbc_malloc(p->zhp_nr_partitions * shuf->buf_size);
+	shuf->streams = zbc_calloc(shuf->nr_streams,
+				   sizeof(struct zbc_shuf_stream));
+	shuf->rbuf = zbc_memalign(pgsz, p->zhp_io_size);
+	if (!shuf->parts || !shuf->part_bufs || !shuf->streams ||
+	    !shuf->rbuf) {
+		ret = -ENOMEM;
+		goto err;
+	}
+
+	for (i = 0; i < p->zhp_nr_partitions; i++)
+		shuf->parts[i].buf = shuf->part_bufs + i * shuf->buf_size;
+
+	for (i = 0; i < shuf->nr_streams; i++) {
+		shuf->streams[i].buf[0] = zbc_memalign(pgsz, p->zhp_io_size);
+		shuf->streams[i].buf[1] = zbc_memalign(pgsz, p->zhp_io_size);
+		if (!shuf->streams[i].buf[0] || !shuf->streams[i].buf[1]) {
+			ret = -ENOMEM;
+			goto err;
+		}
+	}
+
+	*pshuf = shuf;
+
+	return 0;
+
+err:
+	zbc_shuffle_close(shuf);
+
+	return ret;
+}
+
+/**
+ * zbc_shuffle_write - Write data to a partition
+ */
+int zbc_shuffle_write(struct zbc_shuffle *shuf, unsigned int part,
+		      const void *buf, size_t count)
+{
+	struct zbc_shuf_part *p;
+	const char *data = buf;
+	size_t n;
+	int ret;
+
+	if (part >= shuf->params.zhp_nr_partitions)
+		return -EINVAL;
+
+	p = &shuf->parts[part];
+	shuf->stats.zhs_bytes += count;
+
+	while (count) {
+
+		/* Full buffers worth of data bypass the partition buffer */
+		if (!p->len && count >= shuf->buf_size) {
+			n = count - count % shuf->buf_size;
+			ret = zbc_shuf_append(shuf, part, data, n);
+			if (ret)
+				return ret;
+			data += n;
+			count -= n;
+			continue;
+		}
+
+		n = shuf->buf_size - p->len;
+		if (n > count)
+			n = count;
+		memcpy(p->buf + p->len, data, n);
+		p->len += n;
+		data += n;
+		count -= n;
+
+		if (p->len == shuf->buf_size) {
+			ret = zbc_shuf_append(shuf, part, p->buf, p->len);
+			if (ret)
+				return ret;
+			p->len = 0;
+		}
+
+	}
+
+	return 0;
+}
+
+/**
+ * zbc_shuffle_flush - Flush a shuffle writer
+ */
+int zbc_shuffle_flush(struct zbc_shuffle *shuf)
+{
+	struct zbc_shuf_stream *st;
+	struct zbc_shuf_part *p;
+	unsigned int i, j;
+	int ret;
+
+	/* Small partitions tails are packed together in the streams */
+	for (i = 0; i < shuf->params.zhp_nr_partitions; i++) {
+		p = &shuf->parts[i];
+		if (!p->len)
+			continue;
+		ret = zbc_shuf_append(shuf, i, p->buf, p->len);
+		if (ret)
+			return ret;
+		p->len = 0;
+	}
+
+	for (i = 0; i < shuf->nr_streams; i++) {
+		ret = zbc_shuf_stream_write(shuf, &shuf->streams[i]);
+		if (ret)
+			return ret;
+	}
+
+	for (i = 0; i < shuf->nr_streams; i++) {
+		st = &shuf->streams[i];
+		for (j = 0; j < 2; j++) {
+			ret = zbc_shuf_io_wait(&st->io[j]);
+			if (ret < 0)
+				return ret;
+		}
+	}
+
+	for (i = 0; i < shuf->params.zhp_nr_partitions; i++)
+		shuf->parts[i].flushed = shuf->parts[i].placed;
+
+	return 0;
+}
+
+/**
+ * zbc_shuffle_get_extents - Get the extents of a partition
+ */
+int zbc_shuffle_get_extents(struct zbc_shuffle *shuf, unsigned int part,
+			    struct zbc_shuffle_extent *extents,
+			    unsigned int *nr_extents)
+{
+	struct zbc_shuf_part *p;
+	unsigned int i;
+
+	if (part >= shuf->params.zhp_nr_partitions)
+		return -EINVAL;
+
+	p = &shuf->parts[part];
+	for (i = 0; i < p->nr_ext; i++) {
+		if (p->ext[i].zhe_offset >= p->flushed)
+			break;
+		if (!extents)
+			continue;
+		if (i >= *nr_extents)
+			break;
+		extents[i] = p->ext[i];
+		if (p->ext[i].zhe_offset + p->ext[i].zhe_length > p->flushed)
+			extents[i].zhe_length =
+				p->flushed - p->ext[i].zhe_offset;
+	}
+
+	*nr_extents = i;
+
+	return 0;
+}
+
+/**
+ * Get the index of the extent of a partition containing @offset.
+ */
+static unsigned int zbc_shuf_part_lookup(struct zbc_shuf_part *p,
+					 uint64_t offset)
+{
+	unsigned int lo = 0, hi = p->nr_ext, mid;
+
+	while (hi - lo > 1) {
+		mid = (lo + hi) / 2;
+		if (offset < p->ext[mid].zhe_offset)
+			hi = mid;
+		else
+			lo = mid;
+	}
+
+	return lo;
+}
+
+/**
+ * zbc_shuffle_read - Read data from a partition
+ */
+ssize_t zbc_shuffle_read(struct zbc_shuffle *shuf, unsigned int part,
+			 void *buf, size_t count, uint64_t offset)
+{
+	size_t pbs = shuf->dev->zbd_info.zbd_pblock_size;
+	struct zbc_shuffle_extent *e;
+	struct zbc_shuf_part *p;
+	uint64_t pos, start, end;
+	char *data = buf;
+	size_t done = 0, n;
+	unsigned int i;
+	ssize_t ret;
+
+	if (part >= shuf->params.zhp_nr_partitions)
+		return -EINVAL;
+
+	p = &shuf->parts[part];
+	if (offset >= p->flushed)
+		return 0;
+	if (count > p->flushed - offset)
+		count = p->flushed - offset;
+
+	i = zbc_shuf_part_lookup(p, offset);
+	while (done < count) {
+
+		e = &p->ext[i];
+		if (offset >= e->zhe_offset + e->zhe_length) {
+			i++;
+			continue;
+		}
+
+		/* Read the physical blocks holding the data */
+		pos = (e->zhe_sector << 9) + e->zhe_sector_offset +
+			offset - e->zhe_offset;
+		n = e->zhe_offset + e->zhe_length - offset;
+		if (n > count - done)
+			n = count - done;
+		start = pos / pbs * pbs;
+		end = (pos + n + pbs - 1) / pbs * pbs;
+		if (end - start > shuf->params.zhp_io_size) {
+			end = start + shuf->params.zhp_io_size;
+			n = end - pos;
+		}
+
+		ret = zbc_pread(shuf->dev, shuf->rbuf, (end - start) >> 9,
+				start >> 9);
+		if (ret < 0)
+			return ret;
+		if ((uint64_t)ret != (end - start) >> 9)
+			return -EIO;
+
+		memcpy(data + done, (char *)shuf->rbuf + (pos - start), n);
+		done += n;
+		offset += n;
+
+	}
+
+	return done;
+}
+
+/**
+ * zbc_shuffle_get_stats - Get a shuffle writer statistics
+ */
+void zbc_shuffle_get_stats(struct zbc_shuffle *shuf,
+			   struct zbc_shuffle_stats *stats)
+{
+	*stats = shuf->stats;
+}
+
+/**
+ * zbc_shuffle_close - Free a shuffle writer
+ */
+void zbc_shuffle_close(struct zbc_shuffle *shuf)
+{
+	struct zbc_shuf_stream *st;
+	unsigned int i;
+
+	if (!shuf)
+		return;
+
+	if (shuf->streams) {
+		for (i = 0; i < shuf->nr_streams; i++) {
+			st = &shuf->streams[i];
+			zbc_shuf_io_wait(&st->io[0]);
+			zbc_shuf_io_wait(&st->io[1]);
+			zbc_free(st->buf[0]);
+			zbc_free(st->buf[1]);
+		}
+	}
+
+	if (shuf->zpool.zp_zones) {
+		for (i = 0; i < shuf->zpool.zp_nr_zones; i++) {
+			if (!zbc_zone_empty(&shuf->zpool.zp_zones[i]))
+				zbc_zpool_put(&shuf->zpool,
+					      &shuf->zpool.zp_zones[i]);
+		}
+	}
+
+	if (shuf->parts) {
+		for (i = 0; i < shuf->params.zhp_nr_partitions; i++)
+			zbc_free(shuf->parts[i].ext);
+	}
+
+	zbc_zpool_destroy(&shuf->zpool);
+	zbc_free(shuf->rbuf);
+	zbc_free(shuf->streams);
+	zbc_free(shuf->part_bufs);
+	zbc_free(shuf->parts);
+	zbc_free(shuf);
+}
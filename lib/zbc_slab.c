@@ -0,0 +1,882 @@
+/*
+ * This file is part of libzbc.
+ *
+ * Copyright (C) 2009-2014, HGST, Inc. All rights reserved.
+ * Copyright (C) 2016, Western Digital. All rights reserved.
+ *
+ * This software is distributed under the terms of the BSD 2-clause license,
+ * "as is," without technical support, and WITHOUT ANY WARRANTY, without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE. You should have received a copy of the BSD 2-clause license along
+ * with libzbc. If not, see  <http://opensource.org/licenses/BSD-2-Clause>.
+ *
+ * Author: Damien Le Moal (damien.lemoal@wdc.com)
+ */
+
+#include "zbc.h"
+#include "libzbc/zbc_slab.h"
+
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * Defaults.
+ */
+#define ZBC_SLAB_SIZE		(1024 * 1024)
+#define ZBC_SLAB_MAX_SIZE	(64 * 1024)
+
+#define ZBC_SLAB_NONE		((uint32_t)-1)
+#define ZBC_SLAB_FREE		0xff
+
+/**
+ * The metadata is written alternately to two copies at the beginning of
+ * the range of sectors, each copy starting with a header block. A sync
+ * writes the copy not holding the last synced metadata with the next
+ * generation number, so copy 0 holds even generations and copy 1 odd
+ * ones. The header has the CRC of the header block and a CRC of the CRCs
+ * of the other metadata blocks of the copy, so that a copy partially
+ * written is detected.
+ */
+#define ZBC_SLAB_NR_COPIES	2
+
+#define ZBC_SLAB_HDR_MAGIC	0x5a42534c
+
+struct zbc_slab_hdr {
+	uint32_t		magic;
+	uint32_t		crc;
+	uint64_t		gen;
+	uint32_t		block_size;
+	uint32_t		max_size;
+	uint64_t		slab_sectors;
+	uint32_t		nr_slabs;
+	uint32_t		nr_meta;
+	uint32_t		meta_crc;
+	uint32_t		reserved;
+};
+
+/**
+ * Metadata block, following the header block and holding the records of
+ * consecutive slabs. A record holds the size class of a slab and the
+ * bitmap of its allocated blocks.
+ */
+#define ZBC_SLAB_META_MAGIC	0x5a42534d
+
+struct zbc_slab_mblk {
+	uint32_t		magic;
+	uint32_t		crc;
+	uint32_t		index;
+	uint32_t		reserved;
+};
+
+struct zbc_slab_rec {
+	uint8_t			class;
+	uint8_t			reserved[7];
+	uint64_t		map[];
+};
+
+/**
+ * In memory slab. Free slabs are in the free slab list and slabs with
+ * free blocks are in the list of their size class.
+ */
+struct zbc_slab_ent {
+	uint32_t		prev;
+	uint32_t		next;
+	uint32_t		nr_used;
+};
+
+/**
+ * Slab allocator.
+ */
+struct zbc_slab {
+	struct zbc_device	*dev;
+	struct zbc_slab_params	params;
+	pthread_mutex_t		lock;
+
+	size_t			pbs;
+	uint64_t		slab_sectors;
+	unsigned int		slab_blocks;
+	unsigned int		nr_classes;
+	uint32_t		nr_slabs;
+	uint64_t		data_start;
+
+	/*
+	 * Metadata blocks of a copy (header included), generation of the
+	 * last synced copy and, for each block, the mask of the copies in
+	 * which the block is stale.
+	 */
+	void			*meta;
+	unsigned int		nr_meta;
+	size_t			rec_size;
+	unsigned int		recs_per_blk;
+	uint64_t		gen;
+	uint8_t			*dirty;
+	bool			modified;
+
+	/* Slabs, list of free slabs and lists of slabs of each size class */
+	struct zbc_slab_ent	*ents;
+	uint32_t		free_slabs;
+	uint32_t		*partial;
+
+	uint64_t		free_sectors;
+	uint32_t		nr_free_slabs;
+	struct zbc_slab_stats	stats;
+};
+
+static inline unsigned int zbc_slab_meta_idx(struct zbc_slab *slab,
+					     uint32_t i)
+{
+	return 1 + i / slab->recs_per_blk;
+}
+
+static inline struct zbc_slab_rec *zbc_slab_rec(struct zbc_slab *slab,
+						uint32_t i)
+{
+	return (struct zbc_slab_rec *)((char *)slab->meta +
+		zbc_slab_meta_idx(slab, i) * slab->pbs +
+		sizeof(struct zbc_slab_mblk) +
+		(i % slab->recs_per_blk) * slab->rec_size);
+}
+
+static inline void zbc_slab_set_dirty(struct zbc_slab *slab, uint32_t i)
+{
+	slab->dirty[zbc_slab_meta_idx(slab, i)] = (1 << ZBC_SLAB_NR_COPIES) - 1;
+	slab->modified = true;
+}
+
+static inline struct zbc_slab_mblk *zbc_slab_mblk(struct zbc_slab *slab,
+						  void *meta, unsigned int i)
+{
+	return (struct zbc_slab_mblk *)((char *)meta + i * slab->pbs);
+}
+
+static inline unsigned int zbc_slab_nr_objs(struct zbc_slab *slab,
+					    unsigned int class)
+{
+	return slab->slab_blocks >> class;
+}
+
+static inline uint64_t zbc_slab_obj_sectors(struct zbc_slab *slab,
+					    unsigned int class)
+{
+	return (uint64_t)(slab->pbs >> 9) << class;
+}
+
+static void zbc_slab_list_add(struct zbc_slab *slab, uint32_t *head,
+			      uint32_t i)
+{
+	struct zbc_slab_ent *e = &slab->ents[i];
+
+	e->prev = ZBC_SLAB_NONE;
+	e->next = *head;
+	if (*head != ZBC_SLAB_NONE)
+		slab->ents[*head].prev = i;
+	*head = i;
+}
+
+static void zbc_slab_list_del(struct zbc_slab *slab, uint32_t *head,
+			      uint32_t i)
+{
+	struct zbc_slab_ent *e = &slab->ents[i];
+
+	if (e->prev != ZBC_SLAB_NONE)
+		slab->ents[e->prev].next = e->next;
+	else
+		*head = e->next;
+	if (e->next != ZBC_SLAB_NONE)
+		slab->ents[e->next].prev = e->prev;
+	e->prev = ZBC_SLAB_NONE;
+	e->next = ZBC_SLAB_NONE;
+}
+
+/**
+ * Check that the range of sectors is within conventional zones,
+ * determining its end if its size is 0.
+ */
+static int zbc_slab_check_zones(struct zbc_slab *slab)
+{
+	struct zbc_slab_params *p = &slab->params;
+	uint64_t sector = p->zcp_sector;
+	uint64_t end = sector + p->zcp_nr_sectors;
+	struct zbc_zone zone;
+	unsigned int nz;
+	int ret;
+
+	if (!zbc_dev_sect_paligned(slab->dev, sector))
+		goto err;
+
+	if (!p->zcp_nr_sectors)
+		end = slab->dev->zbd_info.zbd_sectors;
+
+	while (sector < end) {
+		nz = 1;
+		ret = zbc_report_zones(slab->dev, sector, ZBC_RO_ALL,
+				       &zone, &nz);
+		if (ret)
+			return ret;
+		if (!nz || !zbc_zone_conventional(&zone)) {
+			if (!p->zcp_nr_sectors)
+				break;
+			goto err;
+		}
+		sector = zbc_zone_start(&zone) + zbc_zone_length(&zone);
+	}
+
+	if (!p->zcp_nr_sectors)
+		p->zcp_nr_sectors = sector - p->zcp_sector;
+	if (!p->zcp_nr_sectors)
+		goto err;
+
+	return 0;
+
+err:
+	zbc_error("%s: Invalid slab allocator sector %llu\n",
+		  slab->dev->zbd_filename,
+		  (unsigned long long)p->zcp_sector);
+
+	return -EINVAL;
+}
+
+/**
+ * Write the metadata blocks stale in the copy of the next generation,
+ * contiguous blocks being written together. The header is always written.
+ */
+static int zbc_slab_write_meta(struct zbc_slab *slab)
+{
+	struct zbc_slab_hdr *hdr = slab->meta;
+	uint64_t bsectors = slab->pbs >> 9;
+	uint64_t gen = slab->gen + 1;
+	uint8_t bit = 1 << (gen % ZBC_SLAB_NR_COPIES);
+	uint64_t sector = slab->params.zcp_sector +
+		(gen % ZBC_SLAB_NR_COPIES) * slab->nr_meta * bsectors;
+	struct zbc_slab_mblk *mb;
+	unsigned int i, j, k;
+	ssize_t ret;
+
+	slab->dirty[0] |= bit;
+	hdr->meta_crc = 0;
+	for (i = 1; i < slab->nr_meta; i++) {
+		mb = zbc_slab_mblk(slab, slab->meta, i);
+		if (slab->dirty[i] & bit) {
+			mb->crc = 0;
+			mb->crc = zbc_crc32c(0, mb, slab->pbs);
+		}
+		hdr->meta_crc = zbc_crc32c(hdr->meta_crc, &mb->crc,
+					   sizeof(mb->crc));
+	}
+	hdr->gen = gen;
+	hdr->crc = 0;
+	hdr->crc = zbc_crc32c(0, hdr, slab->pbs);
+
+	for (i = 0; i < slab->nr_meta; i = j) {
+		if (!(slab->dirty[i] & bit)) {
+			j = i + 1;
+			continue;
+		}
+
+		for (j = i; j < slab->nr_meta && (slab->dirty[j] & bit); j++)
+			;
+
+		ret = zbc_pwrite(slab->dev, (char *)slab->meta + i * slab->pbs,
+				 (j - i) * bsectors, sector + i * bsectors);
+		if (ret >= 0 && (uint64_t)ret != (j - i) * bsectors)
+			ret = -EIO;
+		if (ret < 0) {
+			zbc_error("%s: Write slab metadata at %llu failed %zd\n",
+				  slab->dev->zbd_filename,
+				  (unsigned long long)(sector + i * bsectors),
+				  ret);
+			return ret;
+		}
+
+		for (k = i; k < j; k++)
+			slab->dirty[k] &= ~bit;
+		slab->stats.zcs_meta_writes += j - i;
+	}
+
+	slab->gen = gen;
+	slab->modified = false;
+
+	return 0;
+}
+
+/**
+ * Initialize the metadata and write both copies.
+ */
+static int zbc_slab_format(struct zbc_slab *slab)
+{
+	struct zbc_slab_hdr *hdr = slab->meta;
+	struct zbc_slab_mblk *mb;
+	unsigned int i;
+	int ret;
+
+	memset(slab->meta, 0, slab->nr_meta * slab->pbs);
+
+	hdr->magic = ZBC_SLAB_HDR_MAGIC;
+	hdr->block_size = slab->pbs;
+	hdr->max_size = slab->params.zcp_max_size;
+	hdr->slab_sectors = slab->slab_sectors;
+	hdr->nr_slabs = slab->nr_slabs;
+	hdr->nr_meta = slab->nr_meta;
+
+	for (i = 1; i < slab->nr_meta; i++) {
+		mb = zbc_slab_mblk(slab, slab->meta, i);
+		mb->magic = ZBC_SLAB_META_MAGIC;
+		mb->index = i;
+	}
+
+	for (i = 0; i < slab->nr_slabs; i++)
+		zbc_slab_rec(slab, i)->class = ZBC_SLAB_FREE;
+
+	/* Overwrite both copies, which may hold a previous format */
+	slab->gen = 0;
+	memset(slab->dirty, (1 << ZBC_SLAB_NR_COPIES) - 1, slab->nr_meta);
+	for (i = 0; i < ZBC_SLAB_NR_COPIES; i++) {
+		ret = zbc_slab_write_meta(slab);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+/**
+ * Check a copy of the metadata: return 0 if the copy is valid, -ENOENT if
+ * it has no header, -EINVAL if its parameters do not match the allocator
+ * parameters and -EIO if it is corrupted.
+ */
+static int zbc_slab_check_meta(struct zbc_slab *slab, void *meta,
+			       unsigned int copy)
+{
+	struct zbc_slab_hdr *hdr = meta;
+	struct zbc_slab_mblk *mb;
+	uint32_t crc, meta_crc = 0;
+	unsigned int i;
+	int ret = 0;
+
+	if (hdr->magic != ZBC_SLAB_HDR_MAGIC)
+		return -ENOENT;
+
+	crc = hdr->crc;
+	hdr->crc = 0;
+	if (crc != zbc_crc32c(0, hdr, slab->pbs) ||
+	    hdr->gen % ZBC_SLAB_NR_COPIES != copy)
+		ret = -EIO;
+	hdr->crc = crc;
+	if (ret)
+		return ret;
+
+	if (hdr->block_size != slab->pbs ||
+	    hdr->max_size != slab->params.zcp_max_size ||
+	    hdr->slab_sectors != slab->slab_sectors ||
+	    hdr->nr_slabs != slab->nr_slabs ||
+	    hdr->nr_meta != slab->nr_meta)
+		return -EINVAL;
+
+	for (i = 1; i < slab->nr_meta; i++) {
+		mb = zbc_slab_mblk(slab, meta, i);
+		crc = mb->crc;
+		mb->crc = 0;
+		if (mb->magic != ZBC_SLAB_META_MAGIC || mb->index != i ||
+		    crc != zbc_crc32c(0, mb, slab->pbs))
+			ret = -EIO;
+		mb->crc = crc;
+		if (ret)
+			return ret;
+		meta_crc = zbc_crc32c(meta_crc, &crc, sizeof(crc));
+	}
+
+	if (meta_crc != hdr->meta_crc)
+		return -EIO;
+
+	return 0;
+}
+
+/**
+ * Read the metadata copies and keep the valid copy of the newest
+ * generation. The metadata buffer holds all copies.
+ */
+static int zbc_slab_read_meta(struct zbc_slab *slab)
+{
+	uint64_t sectors = slab->nr_meta * (slab->pbs >> 9);
+	size_t size = slab->nr_meta * slab->pbs;
+	struct zbc_slab_hdr *hdr;
+	int cret[ZBC_SLAB_NR_COPIES];
+	unsigned int c, best = ZBC_SLAB_NR_COPIES;
+	void *meta;
+	ssize_t ret;
+
+	ret = zbc_pread(slab->dev, slab->meta, sectors * ZBC_SLAB_NR_COPIES,
+			slab->params.zcp_sector);
+	if (ret >= 0 && (uint64_t)ret != sectors * ZBC_SLAB_NR_COPIES)
+		ret = -EIO;
+	if (ret < 0)
+		return ret;
+
+	for (c = 0; c < ZBC_SLAB_NR_COPIES; c++) {
+		meta = (char *)slab->meta + c * size;
+		cret[c] = zbc_slab_check_meta(slab, meta, c);
+		if (cret[c])
+			continue;
+		hdr = meta;
+		if (best == ZBC_SLAB_NR_COPIES || hdr->gen > slab->gen) {
+			best = c;
+			slab->gen = hdr->gen;
+		}
+	}
+
+	if (best == ZBC_SLAB_NR_COPIES) {
+		for (c = 0; c < ZBC_SLAB_NR_COPIES; c++) {
+			if (cret[c] == -EINVAL) {
+				zbc_error("%s: Slab allocator parameters do not match the metadata\n",
+					  slab->dev->zbd_filename);
+				return -EINVAL;
+			}
+		}
+		for (c = 0; c < ZBC_SLAB_NR_COPIES; c++) {
+			if (cret[c] == -EIO) {
+				zbc_error("%s: Invalid slab metadata\n",
+					  slab->dev->zbd_filename);
+				return -EIO;
+			}
+		}
+		zbc_error("%s: No slab allocator metadata at sector %llu\n",
+			  slab->dev->zbd_filename,
+			  (unsigned long long)slab->params.zcp_sector);
+		return -EINVAL;
+	}
+
+	if (best)
+		memcpy(slab->meta, (char *)slab->meta + best * size, size);
+
+	/* The other copies are older */
+	memset(slab->dirty,
+	       ((1 << ZBC_SLAB_NR_COPIES) - 1) & ~(1 << best), slab->nr_meta);
+
+	zbc_debug("%s: Slab metadata copy %u, generation %llu\n",
+		  slab->dev->zbd_filename, best,
+		  (unsigned long long)slab->gen);
+
+	return 0;
+}
+
+/**
+ * Load or format the metadata and build the slab lists.
+ */
+static int zbc_slab_load(struct zbc_slab *slab)
+{
+	struct zbc_slab_rec *rec;
+	unsigned int nr_objs = 0, w;
+	uint32_t i;
+	int ret;
+
+	if (slab->params.zcp_flags & ZBC_SLAB_FORMAT)
+		ret = zbc_slab_format(slab);
+	else
+		ret = zbc_slab_read_meta(slab);
+	if (ret)
+		return ret;
+
+	for (i = slab->nr_slabs; i-- > 0;) {
+		struct zbc_slab_ent *e = &slab->ents[i];
+
+		rec = zbc_slab_rec(slab, i);
+		if (rec->class != ZBC_SLAB_FREE) {
+			if (rec->class >= slab->nr_classes) {
+				zbc_error("%s: Invalid slab %u size class %u\n",
+					  slab->dev->zbd_filename,
+					  i, rec->class);
+				return -EIO;
+			}
+			nr_objs = zbc_slab_nr_objs(slab, rec->class);
+			for (w = 0; w < (nr_objs + 63) / 64; w++)
+				e->nr_used += __builtin_popcountll(rec->map[w]);
+		}
+
+		if (!e->nr_used) {
+			if (rec->class != ZBC_SLAB_FREE) {
+				rec->class = ZBC_SLAB_FREE;
+				zbc_slab_set_dirty(slab, i);
+			}
+			memset(rec->map, 0, slab->rec_size - sizeof(*rec));
+			zbc_slab_list_add(slab, &slab->free_slabs, i);
+			slab->nr_free_slabs++;
+			slab->free_sectors += slab->slab_sectors;
+			continue;
+		}
+
+		slab->free_sectors += (nr_objs - e->nr_used) *
+			zbc_slab_obj_sectors(slab, rec->class);
+		if (e->nr_used < nr_objs)
+			zbc_slab_list_add(slab, &slab->partial[rec->class], i);
+	}
+
+	/* Persist the formatted or repaired metadata */
+	if (slab->modified) {
+		ret = zbc_slab_write_meta(slab);
+		if (ret)
+			return ret;
+	}
+
+	return zbc_flush(slab->dev);
+}
+
+/**
+ * zbc_slab_open - Open a slab allocator
+ */
+int zbc_slab_open(struct zbc_device *dev, struct zbc_slab_params *params,
+		  struct zbc_slab **pslab)
+{
+	size_t pbs = dev->zbd_info.zbd_pblock_size;
+	struct zbc_slab_params *p;
+	struct zbc_slab *slab;
+	uint64_t bsectors = pbs >> 9, end, n;
+	unsigned int words, i;
+	int ret;
+
+	if (!params || params->zcp_flags & ~ZBC_SLAB_FORMAT)
+		return -EINVAL;
+
+	slab = zbc_calloc(1, sizeof(struct zbc_slab));
+	if (!slab)
+		return -ENOMEM;
+
+	slab->dev = dev;
+	slab->params = *params;
+	slab->pbs = pbs;
+	pthread_mutex_init(&slab->lock, NULL);
+
+	p = &slab->params;
+	if (!p->zcp_slab_size)
+		p->zcp_slab_size = ZBC_SLAB_SIZE;
+	if (!p->zcp_max_size)
+		p->zcp_max_size = ZBC_SLAB_MAX_SIZE;
+
+	slab->slab_blocks = p->zcp_slab_size / pbs;
+	slab->slab_sectors = p->zcp_slab_size >> 9;
+	for (i = 0; (pbs << i) < p->zcp_max_size; i++)
+		;
+	slab->nr_classes = i + 1;
+	words = (slab->slab_blocks + 63) / 64;
+	slab->rec_size = sizeof(struct zbc_slab_rec) + words * sizeof(uint64_t);
+	slab->recs_per_blk = (pbs - sizeof(struct zbc_slab_mblk)) /
+		slab->rec_size;
+	if (p->zcp_slab_size % pbs ||
+	    (slab->slab_blocks & (slab->slab_blocks - 1)) ||
+	    (pbs << i) != p->zcp_max_size ||
+	    p->zcp_max_size > p->zcp_slab_size ||
+	    p->zcp_max_size > UINT32_MAX ||
+	    !slab->recs_per_blk) {
+		zbc_error("%s: Invalid slab allocator parameters\n",
+			  dev->zbd_filename);
+		ret = -EINVAL;
+		goto err;
+	}
+
+	ret = zbc_slab_check_zones(slab);
+	if (ret)
+		goto err;
+
+	/*
+	 * Largest number of slabs fitting with the copies of their metadata
+	 * blocks. Slabs
+	 * are aligned to the slab size so that blocks do not cross zone
+	 * boundaries.
+	 */
+	end = p->zcp_sector + p->zcp_nr_sectors;
+	n = p->zcp_nr_sectors / slab->slab_sectors;
+	for (; n; n--) {
+		slab->nr_meta = 1 + (n + slab->recs_per_blk - 1) /
+			slab->recs_per_blk;
+		slab->data_start = p->zcp_sector +
+			ZBC_SLAB_NR_COPIES * slab->nr_meta * bsectors;
+		slab->data_start = (slab->data_start + slab->slab_sectors - 1) /
+			slab->slab_sectors * slab->slab_sectors;
+		if (slab->data_start + n * slab->slab_sectors <= end)
+			break;
+	}
+	if (!n || n > UINT32_MAX) {
+		zbc_error("%s: Invalid slab allocator range size %llu\n",
+			  dev->zbd_filename,
+			  (unsigned long long)p->zcp_nr_sectors);
+		ret = -EINVAL;
+		goto err;
+	}
+	slab->nr_slabs = n;
+
+	slab->meta = zbc_memalign(sysconf(_SC_PAGESIZE),
+				  ZBC_SLAB_NR_COPIES * slab->nr_meta * pbs);
+	slab->dirty = zbc_calloc(slab->nr_meta, 1);
+	slab->ents = zbc_calloc(n, sizeof(struct zbc_slab_ent));
+	slab->partial = zbc_malloc(slab->nr_classes * sizeof(uint32_t));
+	if (!slab->meta || !slab->dirty || !slab->ents || !slab->partial) {
+		ret = -ENOMEM;
+		goto err;
+	}
+	slab->free_slabs = ZBC_SLAB_NONE;
+	for (i = 0; i < slab->nr_classes; i++)
+		slab->partial[i] = ZBC_SLAB_NONE;
+
+	ret = zbc_slab_load(slab);
+	if (ret)
+		goto err;
+
+	*pslab = slab;
+
+	return 0;
+
+err:
+	/* Do not write anything */
+	slab->modified = false;
+	zbc_slab_close(slab);
+
+	return ret;
+}
+
+/**
+ * zbc_slab_alloc - Allocate a block
+ */
+ssize_t zbc_slab_alloc(struct zbc_slab *slab, size_t size, uint64_t *sector)
+{
+	struct zbc_slab_rec *rec;
+	struct zbc_slab_ent *e;
+	unsigned int class = 0, idx, w;
+	uint32_t i;
+	uint64_t m;
+
+	if (!size || size > slab->params.zcp_max_size)
+		return -EINVAL;
+
+	while ((slab->pbs << class) < size)
+		class++;
+
+	pthread_mutex_lock(&slab->lock);
+
+	i = slab->partial[class];
+	if (i == ZBC_SLAB_NONE) {
+		i = slab->free_slabs;
+		if (i == ZBC_SLAB_NONE) {
+			pthread_mutex_unlock(&slab->lock);
+			return -ENOSPC;
+		}
+		zbc_slab_list_del(slab, &slab->free_slabs, i);
+		slab->nr_free_slabs--;
+		zbc_slab_rec(slab, i)->class = class;
+		zbc_slab_list_add(slab, &slab->partial[class], i);
+	}
+
+	/* The slab has a free block, so the first clear bit is valid */
+	e = &slab->ents[i];
+	rec = zbc_slab_rec(slab, i);
+	for (w = 0; !~rec->map[w]; w++)
+		;
+	m = rec->map[w];
+	idx = w * 64 + __builtin_ctzll(~m);
+	rec->map[w] = m | (1ULL << (idx % 64));
+	zbc_slab_set_dirty(slab, i);
+
+	e->nr_used++;
+	if (e->nr_used == zbc_slab_nr_objs(slab, class))
+		zbc_slab_list_del(slab, &slab->partial[class], i);
+
+	slab->free_sectors -= zbc_slab_obj_sectors(slab, class);
+	slab->stats.zcs_nr_allocs++;
+
+	*sector = slab->data_start + i * slab->slab_sectors +
+		idx * zbc_slab_obj_sectors(slab, class);
+
+	pthread_mutex_unlock(&slab->lock);
+
+	return slab->pbs << class;
+}
+
+/**
+ * Get the slab, block index and size class of an allocated block.
+ * Called with the allocator lock held.
+ */
+static int zbc_slab_lookup(struct zbc_slab *slab, uint64_t sector,
+			   uint32_t *pi, unsigned int *pidx,
+			   unsigned int *pclass)
+{
+	struct zbc_slab_rec *rec;
+	uint64_t ofst, osectors;
+	unsigned int idx;
+	uint32_t i;
+
+	if (sector < slab->data_start)
+		goto err;
+	ofst = sector - slab->data_start;
+	i = ofst / slab->slab_sectors;
+	if (ofst / slab->slab_sectors >= slab->nr_slabs)
+		goto err;
+
+	rec = zbc_slab_rec(slab, i);
+	if (rec->class == ZBC_SLAB_FREE)
+		goto err;
+
+	ofst -= i * slab->slab_sectors;
+	osectors = zbc_slab_obj_sectors(slab, rec->class);
+	idx = ofst / osectors;
+	if (ofst % osectors ||
+	    !(rec->map[idx / 64] & (1ULL << (idx % 64))))
+		goto err;
+
+	*pi = i;
+	*pidx = idx;
+	*pclass = rec->class;
+
+	return 0;
+
+err:
+	zbc_error("%s: Sector %llu is not an allocated slab block\n",
+		  slab->dev->zbd_filename, (unsigned long long)sector);
+
+	return -EINVAL;
+}
+
+/**
+ * zbc_slab_free - Free a block
+ */
+int zbc_slab_free(struct zbc_slab *slab, uint64_t sector)
+{
+	unsigned int idx, class, nr_objs;
+	struct zbc_slab_rec *rec;
+	struct zbc_slab_ent *e;
+	uint32_t i;
+	int ret;
+
+	pthread_mutex_lock(&slab->lock);
+
+	ret = zbc_slab_lookup(slab, sector, &i, &idx, &class);
+	if (ret)
+		goto out;
+
+	e = &slab->ents[i];
+	rec = zbc_slab_rec(slab, i);
+	rec->map[idx / 64] &= ~(1ULL << (idx % 64));
+	zbc_slab_set_dirty(slab, i);
+
+	nr_objs = zbc_slab_nr_objs(slab, class);
+	if (e->nr_used == nr_objs)
+		zbc_slab_list_add(slab, &slab->partial[class], i);
+	e->nr_used--;
+	if (!e->nr_used) {
+		zbc_slab_list_del(slab, &slab->partial[class], i);
+		rec->class = ZBC_SLAB_FREE;
+		zbc_slab_list_add(slab, &slab->free_slabs, i);
+		slab->nr_free_slabs++;
+	}
+
+	slab->free_sectors += zbc_slab_obj_sectors(slab, class);
+	slab->stats.zcs_nr_frees++;
+
+out:
+	pthread_mutex_unlock(&slab->lock);
+
+	return ret;
+}
+
+/**
+ * Read or write a block.
+ */
+static int zbc_slab_rw(struct zbc_slab *slab, uint64_t sector, void *buf,
+		       bool write)
+{
+	unsigned int idx, class;
+	uint64_t count;
+	ssize_t ret;
+	uint32_t i;
+
+	pthread_mutex_lock(&slab->lock);
+	ret = zbc_slab_lookup(slab, sector, &i, &idx, &class);
+	pthread_mutex_unlock(&slab->lock);
+	if (ret)
+		return ret;
+
+	count = zbc_slab_obj_sectors(slab, class);
+	if (write)
+		ret = zbc_pwrite(slab->dev, buf, count, sector);
+	else
+		ret = zbc_pread(slab->dev, buf, count, sector);
+	if (ret >= 0 && (uint64_t)ret != count)
+		ret = -EIO;
+	if (ret < 0)
+		return ret;
+
+	return 0;
+}
+
+/**
+ * zbc_slab_read - Read a block
+ */
+int zbc_slab_read(struct zbc_slab *slab, uint64_t sector, void *buf)
+{
+	return zbc_slab_rw(slab, sector, buf, false);
+}
+
+/**
+ * zbc_slab_write - Write a block
+ */
+int zbc_slab_write(struct zbc_slab *slab, uint64_t sector, const void *buf)
+{
+	return zbc_slab_rw(slab, sector, (void *)buf, true);
+}
+
+/**
+ * zbc_slab_sync - Sync a slab allocator
+ */
+int zbc_slab_sync(struct zbc_slab *slab)
+{
+	int ret = 0;
+
+	pthread_mutex_lock(&slab->lock);
+
+	if (slab->modified)
+		ret = zbc_slab_write_meta(slab);
+	if (!ret)
+		ret = zbc_flush(slab->dev);
+	if (!ret)
+		slab->stats.zcs_nr_syncs++;
+
+	pthread_mutex_unlock(&slab->lock);
+
+	return ret;
+}
+
+/**
+ * zbc_slab_get_stats - Get a slab allocator statistics
+ */
+void zbc_slab_get_stats(struct zbc_slab *slab, struct zbc_slab_stats *stats)
+{
+	pthread_mutex_lock(&slab->lock);
+
+	*stats = slab->stats;
+	stats->zcs_nr_slabs = slab->nr_slabs;
+	stats->zcs_nr_free_slabs = slab->nr_free_slabs;
+	stats->zcs_nr_sectors = (uint64_t)slab->nr_slabs * slab->slab_sectors;
+	stats->zcs_nr_free_sectors = slab->free_sectors;
+
+	pthread_mutex_unlock(&slab->lock);
+}
+
+/**
+ * zbc_slab_close - Close a slab allocator
+ */
+int zbc_slab_close(struct zbc_slab *slab)
+{
+	int ret = 0;
+
+	if (!slab)
+		return 0;
+
+	if (slab->meta && slab->dirty)
+		ret = zbc_slab_sync(slab);
+
+	pthread_mutex_destroy(&slab->lock);
+	zbc_free(slab->partial);
+	zbc_free(slab->ents);
+	zbc_free(slab->dirty);
+	zbc_free(slab->meta);
+	zbc_free(slab);
+
+	return ret;
+}
@@ -0,0 +1,284 @@
+/*
+ * This file is part of libzbc.
+ *
+ * Copyright (C) 2009-2014, HGST, Inc. All rights reserved.
+ * Copyright (C) 2016, Western Digital. All rights reserved.
+ *
+ * This software is distributed under the terms of the BSD 2-clause license,
+ * "as is," without technical support, and WITHOUT ANY WARRANTY, without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE. You should have received a copy of the BSD 2-clause license along
+ * with libzbc. If not, see  <http://opensource.org/licenses/BSD-2-Clause>.
+ *
+ * Author: Damien Le Moal (damien.lemoal@wdc.com)
+ */
+
+#include "zbc.h"
+
+#include <string.h>
+
+/**
+ * Default parameters.
+ */
+#define ZBC_SLOW_MIN_CMDS	64
+#define ZBC_SLOW_SIGMA		3
+#define ZBC_SLOW_MIN_INCREASE	50
+
+/**
+ * Latencies are normalized to commands of this size (128 KiB).
+ */
+#define ZBC_SLOW_NORM_SECTORS	256
+
+/**
+ * Running latency mean and sum of squared deviations (Welford).
+ */
+struct zbc_slow_stat {
+	uint64_t		n;
+	double			mean;
+	double			m2;
+};
+
+/**
+ * Read and write statistics of a region. @slow is the class found slow
+ * plus one, or 0.
+ */
+struct zbc_slow_rgn {
+	struct zbc_slow_stat	stat[2];
+	uint8_t			slow;
+	uint64_t		dev_lat;
+};
+
+/**
+ * Detector state.
+ */
+struct zbc_slow {
+	pthread_mutex_t		lock;
+	struct zbc_slow_params	params;
+	uint64_t		rgn_sectors;
+	unsigned int		nr_rgns;
+	struct zbc_slow_rgn	*rgns;
+	struct zbc_slow_stat	dev_stat[2];
+};
+
+static inline void zbc_slow_stat_add(struct zbc_slow_stat *s, double lat)
+{
+	double delta = lat - s->mean;
+
+	s->n++;
+	s->mean += delta / s->n;
+	s->m2 += delta * (lat - s->mean);
+}
+
+/**
+ * Test if a region statistics are above the device statistics: the
+ * difference of the means must exceed sigma standard errors, that is,
+ * (mean - dev_mean)^2 * n > sigma^2 * dev_variance.
+ */
+static bool zbc_slow_test(struct zbc_slow *slow, struct zbc_slow_stat *s,
+			  struct zbc_slow_stat *d)
+{
+	double sigma = slow->params.zsp_sigma;
+	double diff = s->mean - d->mean;
+	double var;
+
+	if (s->n < slow->params.zsp_min_cmds ||
+	    d->n < 2 * (uint64_t)slow->params.zsp_min_cmds ||
+	    diff <= 0)
+		return false;
+
+	if (s->mean * 100 <
+	    d->mean * (100 + slow->params.zsp_min_increase))
+		return false;
+
+	var = d->m2 / (d->n - 1);
+
+	return diff * diff * s->n > sigma * sigma * var;
+}
+
+static void zbc_slow_region_info(struct zbc_slow *slow, unsigned int r,
+				 struct zbc_slow_region *region)
+{
+	struct zbc_slow_rgn *rgn = &slow->rgns[r];
+	int c = rgn->slow - 1;
+
+	region->zsr_sector = (uint64_t)r * slow->rgn_sectors;
+	region->zsr_nr_sectors = slow->rgn_sectors;
+	region->zsr_class = c ? ZBC_STAT_WRITE : ZBC_STAT_READ;
+	region->zsr_nr_cmds = rgn->stat[c].n;
+	region->zsr_lat_ns = rgn->stat[c].mean;
+	region->zsr_dev_lat_ns = rgn->dev_lat;
+}
+
+/**
+ * Account a completed read or write command.
+ */
+void zbc_slow_account(struct zbc_device *dev, enum zbc_stat_class cls,
+		      uint64_t sector, size_t sectors,
+		      unsigned long long start)
+{
+	struct zbc_slow *slow = dev->zbd_slow;
+	unsigned long long lat = zbc_time_ns() - start;
+	struct zbc_slow_region region;
+	struct zbc_slow_rgn *rgn;
+	unsigned int r;
+	int c = cls == ZBC_STAT_WRITE;
+	bool found = false;
+
+	r = sector / slow->rgn_sectors;
+	if (r >= slow->nr_rgns)
+		return;
+
+	if (sectors > ZBC_SLOW_NORM_SECTORS)
+		lat = lat * ZBC_SLOW_NORM_SECTORS / sectors;
+
+	pthread_mutex_lock(&slow->lock);
+
+	rgn = &slow->rgns[r];
+	zbc_slow_stat_add(&slow->dev_stat[c], lat);
+	zbc_slow_stat_add(&rgn->stat[c], lat);
+
+	if (!rgn->slow &&
+	    zbc_slow_test(slow, &rgn->stat[c], &slow->dev_stat[c])) {
+		rgn->slow = c + 1;
+		rgn->dev_lat = slow->dev_stat[c].mean;
+		zbc_slow_region_info(slow, r, &region);
+		found = true;
+	}
+
+	pthread_mutex_unlock(&slow->lock);
+
+	if (found) {
+		zbc_warning("%s: Slow region at sector %llu, %s latency %llu ns (device %llu ns)\n",
+			    dev->zbd_filename,
+			    (unsigned long long)region.zsr_sector,
+			    zbc_stat_class_str(region.zsr_class),
+			    (unsigned long long)region.zsr_lat_ns,
+			    (unsigned long long)region.zsr_dev_lat_ns);
+		if (slow->params.zsp_callback)
+			slow->params.zsp_callback(dev, &region,
+						  slow->params.zsp_priv);
+	}
+}
+
+/**
+ * Free the detector of a device.
+ */
+void zbc_slow_exit(struct zbc_device *dev)
+{
+	struct zbc_slow *slow = dev->zbd_slow;
+
+	if (!slow)
+		return;
+
+	dev->zbd_slow = NULL;
+	pthread_mutex_destroy(&slow->lock);
+	zbc_free(slow->rgns);
+	zbc_free(slow);
+}
+
+/**
+ * zbc_set_slow_detection - Enable or disable slow region detection
+ */
+int zbc_set_slow_detection(struct zbc_device *dev,
+			   struct zbc_slow_params *params)
+{
+	struct zbc_slow *slow;
+	struct zbc_zone zone;
+	unsigned int n = 1;
+	int ret;
+
+	zbc_slow_exit(dev);
+	if (!params)
+		return 0;
+
+	/* Regions are sized after the first zone */
+	ret = zbc_report_zones(dev, 0, ZBC_RO_ALL, &zone, &n);
+	if (ret)
+		return ret;
+	if (!n || !zbc_zone_length(&zone))
+		return -EIO;
+
+	slow = zbc_calloc(1, sizeof(struct zbc_slow));
+	if (!slow)
+		return -ENOMEM;
+
+	slow->params = *params;
+	if (!slow->params.zsp_region_zones)
+		slow->params.zsp_region_zones = 1;
+	if (!slow->params.zsp_min_cmds)
+		slow->params.zsp_min_cmds = ZBC_SLOW_MIN_CMDS;
+	if (!slow->params.zsp_sigma)
+		slow->params.zsp_sigma = ZBC_SLOW_SIGMA;
+	if (!slow->params.zsp_min_increase)
+		slow->params.zsp_min_increase = ZBC_SLOW_MIN_INCREASE;
+
+	slow->rgn_sectors = zbc_zone_length(&zone) *
+		slow->params.zsp_region_zones;
+	slow->nr_rgns = (dev->zbd_info.zbd_sectors + slow->rgn_sectors - 1) /
+		slow->rgn_sectors;
+	slow->rgns = zbc_calloc(slow->nr_rgns, sizeof(struct zbc_slow_rgn));
+	if (!slow->rgns) {
+		zbc_free(slow);
+		return -ENOMEM;
+	}
+
+	pthread_mutex_init(&slow->lock, NULL);
+	dev->zbd_slow = slow;
+
+	return 0;
+}
+
+/**
+ * zbc_get_slow_regions - Get the slow regions of a device
+ */
+int zbc_get_slow_regions(struct zbc_device *dev,
+			 struct zbc_slow_region *regions,
+			 unsigned int *nr_regions)
+{
+	struct zbc_slow *slow = dev->zbd_slow;
+	unsigned int r, n = 0;
+
+	if (!slow)
+		return -ENXIO;
+
+	pthread_mutex_lock(&slow->lock);
+
+	for (r = 0; r < slow->nr_rgns; r++) {
+		if (!slow->rgns[r].slow)
+			continue;
+		if (regions) {
+			if (n >= *nr_regions)
+				break;
+			zbc_slow_region_info(slow, r, &regions[n]);
+		}
+		n++;
+	}
+
+	pthread_mutex_unlock(&slow->lock);
+
+	*nr_regions = n;
+
+	return 0;
+}
+
+/**
+ * zbc_clear_slow_region - Clear the statistics of a region
+ */
+int zbc_clear_slow_region(struct zbc_device *dev, uint64_t sector)
+{
+	struct zbc_slow *slow = dev->zbd_slow;
+	unsigned int r;
+
+	if (!slow)
+		return -ENXIO;
+
+	r = sector / slow->rgn_sectors;
+	if (sector >= dev->zbd_info.zbd_sectors || r >= slow->nr_rgns)
+		return -EINVAL;
+
+	pthread_mutex_lock(&slow->lock);
+	memset(&slow->rgns[r], 0, sizeof(struct zbc_slow_rgn));
+	pthread_mutex_unlock(&slow->lock);
+
+	return 0;
+}
@@ -0,0 +1,729 @@
+/*
+ * This file is part of libzbc.
+ *
+ * Copyright (C) 2009-2014, HGST, Inc. All rights reserved.
+ * Copyright (C) 2016, Western Digital. All rights reserved.
+ *
+ * This software is distributed under the terms of the BSD 2-clause license,
+ * "as is," without technical support, and WITHOUT ANY WARRANTY, without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE. You should have received a copy of the BSD 2-clause license along
+ * with libzbc. If not, see  <http://opensource.org/licenses/BSD-2-Clause>.
+ *
+ * Author: Damien Le Moal (damien.lemoal@wdc.com)
+ */
+
+#include "zbc.h"
+#include "libzbc/zbc_exec.h"
+#include "libzbc/zbc_sort.h"
+
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * Defaults.
+ */
+#define ZBC_SORT_MEM_SIZE	(256 * 1024 * 1024)
+#define ZBC_SORT_IO_SIZE	(1024 * 1024)
+
+/**
+ * Maximum number of memory buffer partitions.
+ */
+#define ZBC_SORT_MAX_PARTS	64
+
+/**
+ * Asynchronous run chunk read or write.
+ */
+struct zbc_sort_io {
+	struct zbc_exec_task	*task;
+	struct zbc_device	*dev;
+	void			*buf;
+	uint64_t		sector;
+	size_t			count;
+	bool			write;
+	ssize_t			ret;
+
+	/* Zone index and number of records of the chunk */
+	unsigned int		zi;
+	size_t			nr_recs;
+};
+
+/**
+ * A run is a sequence of chunks of zsp_io_size bytes, each holding up to
+ * recs_per_chunk records, written from the start of the run zones. Chunks
+ * never cross zones and the last chunk is truncated to the physical
+ * blocks holding its records.
+ */
+struct zbc_sort_run {
+	struct zbc_zone		**zones;
+	unsigned int		nr_zones;
+	uint64_t		nr_recs;
+
+	/* Read cursor: next chunk to read */
+	unsigned int		zi;
+	uint64_t		sector;
+	uint64_t		recs_left;
+
+	/* First zone not reset yet */
+	unsigned int		reset_zi;
+
+	/* Buffer being merged and read ahead buffer */
+	void			*buf[2];
+	struct zbc_sort_io	io;
+	bool			io_pending;
+};
+
+/**
+ * Merge source: a run or a sorted partition of the memory buffer.
+ */
+struct zbc_sort_src {
+	char			*rec;
+	char			*end;
+	struct zbc_sort_run	*run;
+};
+
+/**
+ * Sorter.
+ */
+struct zbc_sort {
+	struct zbc_device	*dev;
+	struct zbc_sort_params	params;
+	struct zbc_zpool	zpool;
+	size_t			recs_per_chunk;
+
+	/* Memory buffer */
+	char			*mem;
+	size_t			mem_recs;
+	size_t			nr_mem_recs;
+
+	/* Runs and their zones */
+	struct zbc_sort_run	*runs;
+	unsigned int		nr_runs;
+	struct zbc_zone		**run_zones;
+	unsigned int		nr_run_zones;
+
+	/* Run write buffers */
+	void			*wbuf[2];
+
+	/* Merge heap of sources */
+	struct zbc_sort_src	*srcs;
+	unsigned int		nr_srcs;
+	unsigned int		*heap;
+	unsigned int		nr_heap;
+
+	bool			finished;
+	struct zbc_sort_stats	stats;
+};
+
+static void zbc_sort_io_run(struct zbc_sort_io *io)
+{
+	if (io->write)
+		io->ret = zbc_pwrite(io->dev, io->buf, io->count, io->sector);
+	else
+		io->ret = zbc_pread(io->dev, io->buf, io->count, io->sector);
+	if (io->ret >= 0 && (size_t)io->ret != io->count)
+		io->ret = -EIO;
+}
+
+static void zbc_sort_io_task(struct zbc_exec_task *task, void *arg)
+{
+	zbc_sort_io_run(arg);
+}
+
+/**
+ * Start an asynchronous chunk I/O, executed synchronously if it cannot
+ * be queued.
+ */
+static void zbc_sort_io_submit(struct zbc_sort_io *io)
+{
+	if (zbc_exec_submit(io->dev, ZBC_EXEC_PRIO_HIGH, zbc_sort_io_task,
+			    io, &io->task)) {
+		io->task = NULL;
+		zbc_sort_io_run(io);
+	}
+}
+
+static ssize_t zbc_sort_io_wait(struct zbc_sort_io *io)
+{
+	if (io->task) {
+		zbc_exec_wait(io->task);
+		io->task = NULL;
+	}
+
+	return io->ret;
+}
+
+/**
+ * Number of 512B sectors of a chunk of @nr_recs records.
+ */
+static size_t zbc_sort_chunk_sectors(struct zbc_sort *sort, size_t nr_recs)
+{
+	size_t pbs = sort->dev->zbd_info.zbd_pblock_size;
+	size_t len = nr_recs * sort->params.zsp_rec_size;
+
+	return ((len + pbs - 1) / pbs * pbs) >> 9;
+}
+
+/**
+ * Merge heap of sources, ordered by their current record. Ties are
+ * broken with the source index.
+ */
+static inline bool zbc_sort_src_lt(struct zbc_sort *sort,
+				   unsigned int a, unsigned int b)
+{
+	int c = sort->params.zsp_cmp(sort->srcs[a].rec, sort->srcs[b].rec,
+				     sort->params.zsp_priv);
+
+	return c < 0 || (c == 0 && a < b);
+}
+
+static void zbc_sort_heap_down(struct zbc_sort *sort, unsigned int i)
+{
+	unsigned int *h = sort->heap, n = sort->nr_heap, c, tmp;
+
+	while ((c = 2 * i + 1) < n) {
+		if (c + 1 < n && zbc_sort_src_lt(sort, h[c + 1], h[c]))
+			c++;
+		if (!zbc_sort_src_lt(sort, h[c], h[i]))
+			break;
+		tmp = h[i];
+		h[i] = h[c];
+		h[c] = tmp;
+		i = c;
+	}
+}
+
+static void zbc_sort_heap_init(struct zbc_sort *sort)
+{
+	unsigned int i;
+
+	sort->nr_heap = 0;
+	for (i = 0; i < sort->nr_srcs; i++) {
+		if (sort->srcs[i].rec < sort->srcs[i].end)
+			sort->heap[sort->nr_heap++] = i;
+	}
+
+	for (i = sort->nr_heap / 2; i > 0; i--)
+		zbc_sort_heap_down(sort, i - 1);
+}
+
+/**
+ * Memory buffer partition sort job.
+ */
+struct zbc_sort_part {
+	struct zbc_sort		*sort;
+	char			*recs;
+	size_t			nr_recs;
+};
+
+static void zbc_sort_part_run(struct zbc_sort_part *part)
+{
+	struct zbc_sort_params *p = &part->sort->params;
+
+	qsort_r(part->recs, part->nr_recs, p->zsp_rec_size,
+		p->zsp_cmp, p->zsp_priv);
+}
+
+static void zbc_sort_part_task(struct zbc_exec_task *task, void *arg)
+{
+	zbc_sort_part_run(arg);
+}
+
+/**
+ * Sort the partitions of the memory buffer in parallel and setup the
+ * merge sources of the partitions, starting at @first.
+ */
+static unsigned int zbc_sort_mem(struct zbc_sort *sort, unsigned int first)
+{
+	struct zbc_sort_part parts[ZBC_SORT_MAX_PARTS];
+	struct zbc_exec_task tasks[ZBC_SORT_MAX_PARTS];
+	size_t rs = sort->params.zsp_rec_size, n = sort->nr_mem_recs, start;
+	unsigned int i, nr_parts = sort->params.zsp_nr_threads;
+	unsigned long long t = zbc_time_ns();
+
+	if (!n)
+		return 0;
+	if (nr_parts > n)
+		nr_parts = n;
+
+	for (i = 0; i < nr_parts; i++) {
+		start = n * i / nr_parts;
+		parts[i].sort = sort;
+		parts[i].recs = sort->mem + start * rs;
+		parts[i].nr_recs = n * (i + 1) / nr_parts - start;
+	}
+
+	zbc_exec_run_all(sort->dev, ZBC_EXEC_PRIO_NORMAL, zbc_sort_part_task,
+			 parts, sizeof(struct zbc_sort_part), tasks, nr_parts);
+
+	for (i = 0; i < nr_parts; i++) {
+		sort->srcs[first + i].rec = parts[i].recs;
+		sort->srcs[first + i].end = parts[i].recs + parts[i].nr_recs * rs;
+		sort->srcs[first + i].run = NULL;
+	}
+
+	sort->stats.zss_sort_ns += zbc_time_ns() - t;
+
+	return nr_parts;
+}
+
+/**
+ * Write a chunk of a run being written, allocating a new zone if the
+ * chunk does not fit in the current zone. The write of the previous
+ * chunk @prev must complete first to keep writes sequential.
+ */
+static int zbc_sort_run_write(struct zbc_sort *sort, struct zbc_sort_run *run,
+			      struct zbc_sort_io *io, struct zbc_sort_io *prev,
+			      void *buf, size_t nr_recs)
+{
+	size_t count = zbc_sort_chunk_sectors(sort, nr_recs);
+	size_t len = nr_recs * sort->params.zsp_rec_size;
+	struct zbc_zone *zone;
+	int ret;
+
+	ret = zbc_sort_io_wait(prev);
+	if (ret < 0)
+		return ret;
+
+	zone = run->nr_zones ? run->zones[run->nr_zones - 1] : NULL;
+	if (!zone || run->sector + count >
+	    zbc_zone_start(zone) + zbc_zone_length(zone)) {
+		zone = zbc_zpool_get(&sort->zpool);
+		if (!zone) {
+			zbc_error("%s: No empty zone for sort run\n",
+				  sort->dev->zbd_filename);
+			return -ENOSPC;
+		}
+		run->zones[run->nr_zones++] = zone;
+		sort->nr_run_zones++;
+		sort->stats.zss_nr_zones++;
+		run->sector = zbc_zone_start(zone);
+	}
+
+	/* Clear the padding of the last chunk */
+	if ((count << 9) > len)
+		memset((char *)buf + len, 0, (count << 9) - len);
+
+	io->dev = sort->dev;
+	io->buf = buf;
+	io->sector = run->sector;
+	io->count = count;
+	io->write = true;
+	zbc_sort_io_submit(io);
+
+	run->sector += count;
+	zone->zbz_write_pointer = run->sector;
+	zone->zbz_condition = ZBC_ZC_IMP_OPEN;
+	sort->stats.zss_spill_bytes += count << 9;
+
+	return 0;
+}
+
+/**
+ * Sort the memory buffer and write it as a run, merging the sorted
+ * partitions while filling the run chunks. Chunks are written
+ * asynchronously while the next chunk is filled.
+ */
+static int zbc_sort_spill(struct zbc_sort *sort)
+{
+	struct zbc_sort_run *run = &sort->runs[sort->nr_runs];
+	size_t rs = sort->params.zsp_rec_size, n = 0;
+	struct zbc_sort_io io[2];
+	struct zbc_sort_src *src;
+	unsigned long long t;
+	unsigned int w = 0, i;
+	char *p;
+	int ret = 0;
+
+	/* Each run uses at least one zone */
+	if (sort->nr_runs >= sort->zpool.zp_nr_zones)
+		return -ENOSPC;
+
+	sort->nr_srcs = zbc_sort_mem(sort, 0);
+	zbc_sort_heap_init(sort);
+
+	t = zbc_time_ns();
+
+	memset(run, 0, sizeof(struct zbc_sort_run));
+	memset(io, 0, sizeof(io));
+	run->zones = &sort->run_zones[sort->nr_run_zones];
+
+	p = sort->wbuf[w];
+	while (sort->nr_heap) {
+
+		src = &sort->srcs[sort->heap[0]];
+		memcpy(p + n * rs, src->rec, rs);
+		n++;
+
+		src->rec += rs;
+		if (src->rec >= src->end)
+			sort->heap[0] = sort->heap[--sort->nr_heap];
+		zbc_sort_heap_down(sort, 0);
+
+		if (n == sort->recs_per_chunk || !sort->nr_heap) {
+			ret = zbc_sort_run_write(sort, run, &io[w],
+						 &io[w ^ 1], p, n);
+			if (ret)
+				break;
+			run->nr_recs += n;
+			n = 0;
+			w ^= 1;
+			p = sort->wbuf[w];
+		}
+
+	}
+
+	for (i = 0; i < 2; i++) {
+		if (zbc_sort_io_wait(&io[i]) < 0 && !ret)
+			ret = io[i].ret;
+	}
+
+	if (ret) {
+		/* Drop the run */
+		for (i = 0; i < run->nr_zones; i++)
+			zbc_zpool_put(&sort->zpool, run->zones[i]);
+		sort->nr_run_zones -= run->nr_zones;
+		return ret;
+	}
+
+	sort->nr_runs++;
+	sort->nr_mem_recs = 0;
+	sort->stats.zss_nr_runs++;
+	sort->stats.zss_spill_ns += zbc_time_ns() - t;
+
+	return 0;
+}
+
+/**
+ * zbc_sort_open - Create a sorter
+ */
+int zbc_sort_open(struct zbc_device *dev, struct zbc_sort_params *params,
+		  struct zbc_sort **psort)
+{
+	size_t pbs = dev->zbd_info.zbd_pblock_size;
+	struct zbc_sort_params *p;
+	struct zbc_sort *sort;
+	unsigned int i, max_runs;
+	long nr_cpus;
+	int ret;
+
+	if (!params || !params->zsp_rec_size || !params->zsp_cmp)
+		return -EINVAL;
+
+	sort = zbc_calloc(1, sizeof(struct zbc_sort));
+	if (!sort)
+		return -ENOMEM;
+
+	sort->dev = dev;
+	sort->params = *params;
+	p = &sort->params;
+
+	if (!p->zsp_mem_size)
+		p->zsp_mem_size = ZBC_SORT_MEM_SIZE;
+	if (!p->zsp_io_size)
+		p->zsp_io_size = ZBC_SORT_IO_SIZE;
+	p->zsp_io_size -= p->zsp_io_size % pbs;
+	if (!p->zsp_nr_threads) {
+		nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		p->zsp_nr_threads = nr_cpus > 0 ? nr_cpus : 1;
+	}
+	if (p->zsp_nr_threads > ZBC_SORT_MAX_PARTS)
+		p->zsp_nr_threads = ZBC_SORT_MAX_PARTS;
+
+	sort->mem_recs = p->zsp_mem_size / p->zsp_rec_size;
+	if (!p->zsp_io_size || p->zsp_rec_size > p->zsp_io_size ||
+	    !sort->mem_recs) {
+		zbc_error("%s: Invalid sort parameters\n",
+			  dev->zbd_filename);
+		ret = -EINVAL;
+		goto err;
+	}
+	sort->recs_per_chunk = p->zsp_io_size / p->zsp_rec_size;
+
+	ret = zbc_zpool_init(&sort->zpool, dev, p->zsp_sector,
+			     p->zsp_nr_sectors);
+	if (ret)
+		goto err;
+
+	/* Runs are temporary: reclaim all zones */
+	for (i = 0; i < sort->zpool.zp_nr_zones; i++) {
+		if (zbc_zone_empty(&sort->zpool.zp_zones[i]))
+			continue;
+		ret = zbc_zpool_put(&sort->zpool, &sort->zpool.zp_zones[i]);
+		if (ret)
+			goto err;
+	}
+
+	/* Each run uses at least one zone */
+	max_runs = sort->zpool.zp_nr_zones;
+	sort->runs = zbc_calloc(max_runs, sizeof(struct zbc_sort_run));
+	sort->run_zones = zbc_calloc(max_runs, sizeof(struct zbc_zone *));
+	sort->srcs = zbc_calloc(max_runs + ZBC_SORT_MAX_PARTS,
+				sizeof(struct zbc_sort_src));
+	sort->heap = zbc_calloc(max_runs + ZBC_SORT_MAX_PARTS,
+				sizeof(unsigned int));
+	sort->mem = zbc_malloc(sort->mem_recs * p->zsp_rec_size);
+	sort->wbuf[0] = zbc_memalign(sysconf(_SC_PAGESIZE), p->zsp_io_size);
+	sort->wbuf[1] = zbc_memalign(sysconf(_SC_PAGESIZE), p->zsp_io_size);
+	if (!sort->runs || !sort->run_zones || !sort->srcs || !sort->heap ||
+	    !sort->mem || !sort->wbuf[0] || !sort->wbuf[1]) {
+		ret = -ENOMEM;
+		goto err;
+	}
+
+	*psort = sort;
+
+	return 0;
+
+err:
+	zbc_sort_close(sort);
+
+	return ret;
+}
+
+/**
+ * Start reading the next chunk of a run in its read ahead buffer.
+ */
+static void zbc_sort_run_read_ahead(struct zbc_sort *sort,
+				    struct zbc_sort_run *run)
+{
+	struct zbc_sort_io *io = &run->io;
+	struct zbc_zone *zone = run->zones[run->zi];
+	size_t nr_recs = run->recs_left;
+	size_t count;
+
+	if (!nr_recs) {
+		run->io_pending = false;
+		return;
+	}
+
+	if (nr_recs > sort->recs_per_chunk)
+		nr_recs = sort->recs_per_chunk;
+	count = zbc_sort_chunk_sectors(sort, nr_recs);
+
+	/* Same zone switch rule as when writing */
+	if (run->sector + count > zbc_zone_start(zone) + zbc_zone_length(zone)) {
+		run->zi++;
+		run->sector = zbc_zone_start(run->zones[run->zi]);
+	}
+
+	memset(io, 0, sizeof(struct zbc_sort_io));
+	io->dev = sort->dev;
+	io->buf = run->buf[1];
+	io->sector = run->sector;
+	io->count = count;
+	io->zi = run->zi;
+	io->nr_recs = nr_recs;
+	zbc_sort_io_submit(io);
+
+	run->io_pending = true;
+	run->sector += count;
+	run->recs_left -= nr_recs;
+	sort->stats.zss_merge_bytes += count << 9;
+}
+
+/**
+ * Reset the zones of a run before zone @zi.
+ */
+static int zbc_sort_run_reset(struct zbc_sort *sort, struct zbc_sort_run *run,
+			      unsigned int zi)
+{
+	int ret;
+
+	while (run->reset_zi < zi) {
+		ret = zbc_zpool_put(&sort->zpool, run->zones[run->reset_zi]);
+		if (ret)
+			return ret;
+		run->reset_zi++;
+		sort->stats.zss_nr_reset_zones++;
+	}
+
+	return 0;
+}
+
+/**
+ * Refill the merge buffer of a run source with the read ahead chunk.
+ * The source is left empty if all the run records were merged.
+ */
+static int zbc_sort_run_next(struct zbc_sort *sort, struct zbc_sort_src *src)
+{
+	struct zbc_sort_run *run = src->run;
+	void *buf;
+	ssize_t ret;
+
+	src->rec = src->end = NULL;
+
+	if (!run->io_pending)
+		return zbc_sort_run_reset(sort, run, run->nr_zones);
+
+	ret = zbc_sort_io_wait(&run->io);
+	run->io_pending = false;
+	if (ret < 0)
+		return ret;
+
+	/* All chunks of the zones before the chunk read were merged */
+	ret = zbc_sort_run_reset(sort, run, run->io.zi);
+	if (ret)
+		return ret;
+
+	buf = run->buf[0];
+	run->buf[0] = run->buf[1];
+	run->buf[1] = buf;
+
+	src->rec = run->buf[0];
+	src->end = src->rec + run->io.nr_recs * sort->params.zsp_rec_size;
+
+	zbc_sort_run_read_ahead(sort, run);
+
+	return 0;
+}
+
+/**
+ * zbc_sort_add - Add records to a sorter
+ */
+int zbc_sort_add(struct zbc_sort *sort, const void *recs, size_t nr_recs)
+{
+	size_t rs = sort->params.zsp_rec_size, n;
+	int ret;
+
+	if (sort->finished)
+		return -EINVAL;
+
+	while (nr_recs) {
+
+		if (sort->nr_mem_recs == sort->mem_recs) {
+			ret = zbc_sort_spill(sort);
+			if (ret)
+				return ret;
+		}
+
+		n = sort->mem_recs - sort->nr_mem_recs;
+		if (n > nr_recs)
+			n = nr_recs;
+		memcpy(sort->mem + sort->nr_mem_recs * rs, recs, n * rs);
+		sort->nr_mem_recs += n;
+		sort->stats.zss_nr_recs += n;
+		recs = (const char *)recs + n * rs;
+		nr_recs -= n;
+
+	}
+
+	return 0;
+}
+
+/**
+ * zbc_sort_finish - Finish adding records to a sorter
+ */
+int zbc_sort_finish(struct zbc_sort *sort)
+{
+	size_t pgsz = sysconf(_SC_PAGESIZE);
+	struct zbc_sort_run *run;
+	unsigned int i;
+	int ret;
+
+	if (sort->finished)
+		return -EINVAL;
+	sort->finished = true;
+
+	/* Start reading all runs */
+	for (i = 0; i < sort->nr_runs; i++) {
+		run = &sort->runs[i];
+		run->buf[0] = zbc_memalign(pgsz, sort->params.zsp_io_size);
+		run->buf[1] = zbc_memalign(pgsz, sort->params.zsp_io_size);
+		if (!run->buf[0] || !run->buf[1])
+			return -ENOMEM;
+		run->zi = 0;
+		run->sector = zbc_zone_start(run->zones[0]);
+		run->recs_left = run->nr_recs;
+		zbc_sort_run_read_ahead(sort, run);
+	}
+
+	for (i = 0; i < sort->nr_runs; i++) {
+		sort->srcs[i].run = &sort->runs[i];
+		ret = zbc_sort_run_next(sort, &sort->srcs[i]);
+		if (ret)
+			return ret;
+	}
+
+	/* The records in memory are merged without being written */
+	sort->nr_srcs = sort->nr_runs + zbc_sort_mem(sort, sort->nr_runs);
+	zbc_sort_heap_init(sort);
+
+	return 0;
+}
+
+/**
+ * zbc_sort_read - Read sorted records
+ */
+ssize_t zbc_sort_read(struct zbc_sort *sort, void *recs, size_t nr_recs)
+{
+	size_t rs = sort->params.zsp_rec_size, n = 0;
+	struct zbc_sort_src *src;
+	char *p = recs;
+	int ret;
+
+	if (!sort->finished)
+		return -EINVAL;
+
+	while (n < nr_recs && sort->nr_heap) {
+
+		src = &sort->srcs[sort->heap[0]];
+		memcpy(p, src->rec, rs);
+		p += rs;
+		n++;
+
+		src->rec += rs;
+		if (src->rec >= src->end && src->run) {
+			ret = zbc_sort_run_next(sort, src);
+			if (ret)
+				return ret;
+		}
+		if (src->rec >= src->end)
+			sort->heap[0] = sort->heap[--sort->nr_heap];
+		zbc_sort_heap_down(sort, 0);
+
+	}
+
+	sort->stats.zss_nr_read_recs += n;
+
+	return n;
+}
+
+/**
+ * zbc_sort_get_stats - Get a sorter statistics
+ */
+void zbc_sort_get_stats(struct zbc_sort *sort, struct zbc_sort_stats *stats)
+{
+	*stats = sort->stats;
+}
+
+/**
+ * zbc_sort_close - Free a sorter
+ */
+void zbc_sort_close(struct zbc_sort *sort)
+{
+	struct zbc_sort_run *run;
+	unsigned int i;
+
+	if (!sort)
+		return;
+
+	for (i = 0; i < sort->nr_runs; i++) {
+		run = &sort->runs[i];
+		if (run->io_pending)
+			zbc_sort_io_wait(&run->io);
+		zbc_sort_run_reset(sort, run, run->nr_zones);
+		zbc_free(run->buf[0]);
+		zbc_free(run->buf[1]);
+	}
+
+	zbc_zpool_destroy(&sort->zpool);
+	zbc_free(sort->wbuf[0]);
+	zbc_free(sort->wbuf[1]);
+	zbc_free(sort->mem);
+	zbc_free(sort->heap);
+	zbc_free(sort->srcs);
+	zbc_free(sort->run_zones);
+	zbc_free(sort->runs);
+	zbc_free(sort);
+}
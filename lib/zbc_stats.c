@@ -0,0 +1,237 @@
+/*
+ * This file is part of libzbc.
+ *
+ * Copyright (C) 2009-2014, HGST, Inc. All rights reserved.
+ * Copyright (C) 2016, Western Digital. All rights reserved.
+ *
+ * This software is distributed under the terms of the BSD 2-clause license,
+ * "as is," without technical support, and WITHOUT ANY WARRANTY, without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE. You should have received a copy of the BSD 2-clause license along
+ * with libzbc. If not, see  <http://opensource.org/licenses/BSD-2-Clause>.
+ *
+ * Author: Damien Le Moal (damien.lemoal@wdc.com)
+ */
+
+#include "zbc.h"
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * Statistics segment sequence number (to name segments).
+ */
+static unsigned int zbc_stats_seq;
+
+/**
+ * Command class names.
+ */
+static const char *zbc_stat_class_name[ZBC_STAT_NR_CLASSES] = {
+	[ZBC_STAT_READ]		= "read",
+	[ZBC_STAT_WRITE]	= "write",
+	[ZBC_STAT_FLUSH]	= "flush",
+	[ZBC_STAT_REPORT_ZONES]	= "report",
+	[ZBC_STAT_RESET_ZONE]	= "reset",
+	[ZBC_STAT_OPEN_ZONE]	= "open",
+	[ZBC_STAT_CLOSE_ZONE]	= "close",
+	[ZBC_STAT_FINISH_ZONE]	= "finish",
+};
+
+/**
+ * zbc_stat_class_str - returns a command class name
+ */
+const char *zbc_stat_class_str(enum zbc_stat_class cls)
+{
+	if ((unsigned int)cls >= ZBC_STAT_NR_CLASSES)
+		return "unknown";
+	return zbc_stat_class_name[cls];
+}
+
+/**
+ * Map a statistics segment file. Returns NULL on failure.
+ */
+static struct zbc_device_stats *zbc_stats_map(struct zbc_device *dev)
+{
+	struct zbc_device_stats *stats;
+	char path[128];
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/%s%d-%u",
+		 ZBC_STATS_DIR, ZBC_STATS_PREFIX, (int)getpid(),
+		 __atomic_fetch_add(&zbc_stats_seq, 1, __ATOMIC_RELAXED));
+
+	fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd < 0) {
+		zbc_debug("%s: Create statistics file %s failed %d (%s)\n",
+			  dev->zbd_filename, path, errno, strerror(errno));
+		return NULL;
+	}
+
+	if (ftruncate(fd, sizeof(struct zbc_device_stats)) < 0) {
+		zbc_debug("%s: Truncate statistics file %s failed %d (%s)\n",
+			  dev->zbd_filename, path, errno, strerror(errno));
+		goto err;
+	}
+
+	stats = mmap(NULL, sizeof(struct zbc_device_stats),
+		     PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (stats == MAP_FAILED) {
+		zbc_debug("%s: Map statistics file %s failed %d (%s)\n",
+			  dev->zbd_filename, path, errno, strerror(errno));
+		goto err;
+	}
+
+	dev->zbd_stats_path = zbc_strdup(path);
+	if (!dev->zbd_stats_path) {
+		munmap(stats, sizeof(struct zbc_device_stats));
+		goto err;
+	}
+
+	close(fd);
+
+	return stats;
+
+err:
+	close(fd);
+	unlink(path);
+
+	return NULL;
+}
+
+/**
+ * Test if the statistics export was requested with ZBC_STATS_ENV.
+ */
+static bool zbc_stats_export(void)
+{
+	const char *env = getenv(ZBC_STATS_ENV);
+
+	return env && *env && strcmp(env, "0") != 0;
+}
+
+/**
+ * Initialize a device statistics. If requested, the statistics are
+ * exported in a shared memory file if possible. They are kept in private
+ * memory otherwise.
+ */
+int zbc_stats_init(struct zbc_device *dev)
+{
+	struct zbc_device_stats *stats = NULL;
+
+	if (zbc_stats_export())
+		stats = zbc_stats_map(dev);
+	if (!stats) {
+		stats = zbc_calloc(1, sizeof(struct zbc_device_stats));
+		if (!stats)
+			return -ENOMEM;
+	}
+
+	stats->zbs_pid = getpid();
+	strncpy(stats->zbs_filename, dev->zbd_filename,
+		ZBC_STATS_PATH_LEN - 1);
+	stats->zbs_type = dev->zbd_info.zbd_type;
+	stats->zbs_model = dev->zbd_info.zbd_model;
+	stats->zbs_sectors = dev->zbd_info.zbd_sectors;
+	stats->zbs_max_nr_open = dev->zbd_info.zbd_max_nr_open_seq_req;
+	stats->zbs_open_time = time(NULL);
+	stats->zbs_version = ZBC_STATS_VERSION;
+
+	/* Publish the segment only once it is initialized */
+	__atomic_store_n(&stats->zbs_magic, ZBC_STATS_MAGIC, __ATOMIC_RELEASE);
+
+	dev->zbd_stats = stats;
+
+	return 0;
+}
+
+/**
+ * Release a device statistics.
+ */
+void zbc_stats_exit(struct zbc_device *dev)
+{
+
+	if (!dev->zbd_stats)
+		return;
+
+	if (dev->zbd_stats_path) {
+		unlink(dev->zbd_stats_path);
+		munmap(dev->zbd_stats, sizeof(struct zbc_device_stats));
+		zbc_free(dev->zbd_stats_path);
+		dev->zbd_stats_path = NULL;
+	} else {
+		zbc_free(dev->zbd_stats);
+	}
+
+	dev->zbd_stats = NULL;
+}
+
+/**
+ * Get the latency histogram bucket of a command.
+ */
+static inline unsigned int zbc_stats_lat_bucket(unsigned long long lat_ns)
+{
+	unsigned long long lat_us = lat_ns / 1000;
+	unsigned int b;
+
+	if (!lat_us)
+		return 0;
+
+	b = 64 - __builtin_clzll(lat_us);
+	if (b >= ZBC_STAT_LAT_BUCKETS)
+		b = ZBC_STAT_LAT_BUCKETS - 1;
+
+	return b;
+}
+
+/**
+ * Account for a command executed by the device driver. @start is the
+ * command start time obtained with zbc_time_ns().
+ */
+void zbc_stats_account(struct zbc_device *dev, enum zbc_stat_class cls,
+		       unsigned long long start, size_t sectors, bool error)
+{
+	struct zbc_cmd_stats *cs = &dev->zbd_stats->zbs_cmd[cls];
+	unsigned long long lat = zbc_time_ns() - start;
+
+	__atomic_fetch_add(&cs->zbs_nr_cmds, 1, __ATOMIC_RELAXED);
+	if (error)
+		__atomic_fetch_add(&cs->zbs_nr_errors, 1, __ATOMIC_RELAXED);
+	if (sectors)
+		__atomic_fetch_add(&cs->zbs_sectors, sectors, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&cs->zbs_lat_ns, lat, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&cs->zbs_lat_hist[zbc_stats_lat_bucket(lat)], 1,
+			   __ATOMIC_RELAXED);
+}
+
+/**
+ * Update the zone condition snapshot using a report of all zones.
+ */
+void zbc_stats_zones(struct zbc_device *dev,
+		     struct zbc_zone *zones, unsigned int nr_zones)
+{
+	struct zbc_device_stats *stats = dev->zbd_stats;
+	uint32_t cond[16];
+	unsigned int i;
+
+	memset(cond, 0, sizeof(cond));
+	for (i = 0; i < nr_zones; i++)
+		cond[zones[i].zbz_condition & 0x0f]++;
+
+	for (i = 0; i < 16; i++)
+		__atomic_store_n(&stats->zbs_zone_cond[i], cond[i],
+				 __ATOMIC_RELAXED);
+	__atomic_store_n(&stats->zbs_nr_zones, nr_zones, __ATOMIC_RELAXED);
+	__atomic_store_n(&stats->zbs_zones_time, time(NULL), __ATOMIC_RELAXED);
+}
+
+/**
+ * zbc_get_stats - Get a device statistics
+ */
+void zbc_get_stats(struct zbc_device *dev, struct zbc_device_stats *stats)
+{
+	memcpy(stats, dev->zbd_stats, sizeof(struct zbc_device_stats));
+}
@@ -0,0 +1,466 @@
+/*
+ * This file is part of libzbc.
+ *
+ * Copyright (C) 2009-2014, HGST, Inc. All rights reserved.
+ * Copyright (C) 2016, Western Digital. All rights reserved.
+ *
+ * This software is distributed under the terms of the BSD 2-clause license,
+ * "as is," without technical support, and WITHOUT ANY WARRANTY, without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE. You should have received a copy of the BSD 2-clause license along
+ * with libzbc. If not, see  <http://opensource.org/licenses/BSD-2-Clause>.
+ *
+ * Author: Damien Le Moal (damien.lemoal@wdc.com)
+ */
+
+#include "zbc.h"
+#include "libzbc/zbc_zgroup.h"
+
+#include <string.h>
+
+/**
+ * Zone groups: the member zones of all groups are stored contiguously,
+ * group g using zones[g * nr_group_zones] and the following zones.
+ * The zone array caches the condition and write pointer of the member
+ * zones. The write pointer of full members is kept at the zone end.
+ */
+struct zbc_zgroups {
+	struct zbc_device	*dev;
+	unsigned int		nr_group_zones;
+	unsigned int		nr_groups;
+	struct zbc_zone		*zones;
+	pthread_mutex_t		lock;
+};
+
+static inline struct zbc_zone *zbc_zgroup_zones(struct zbc_zgroups *zg,
+						unsigned int g)
+{
+	return &zg->zones[g * zg->nr_group_zones];
+}
+
+static inline uint64_t zbc_zgroup_start(struct zbc_zgroups *zg,
+					unsigned int g)
+{
+	return zbc_zone_start(zbc_zgroup_zones(zg, g));
+}
+
+static inline uint64_t zbc_zgroup_length(struct zbc_zgroups *zg,
+					 unsigned int g)
+{
+	return zbc_zone_length(zbc_zgroup_zones(zg, g)) * zg->nr_group_zones;
+}
+
+/**
+ * Normalize the write pointer of a full zone.
+ */
+static void zbc_zgroup_fix_wp(struct zbc_zone *z)
+{
+	if (zbc_zone_full(z))
+		z->zbz_write_pointer = z->zbz_start + z->zbz_length;
+}
+
+/**
+ * Find the group containing or after @sector. Return zg->nr_groups
+ * if there is none.
+ */
+static unsigned int zbc_zgroup_find(struct zbc_zgroups *zg, uint64_t sector)
+{
+	unsigned int lo = 0, hi = zg->nr_groups, mid;
+
+	/* First group ending after sector */
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (zbc_zgroup_start(zg, mid) + zbc_zgroup_length(zg, mid) <=
+		    sector)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/**
+ * Get the group containing @sector for an I/O or a zone operation.
+ */
+static int zbc_zgroup_get(struct zbc_zgroups *zg, uint64_t sector,
+			  unsigned int *pg)
+{
+	unsigned int g = zbc_zgroup_find(zg, sector);
+
+	if (g >= zg->nr_groups || sector < zbc_zgroup_start(zg, g)) {
+		zbc_error("%s: Sector %llu is not in a zone group\n",
+			  zg->dev->zbd_filename,
+			  (unsigned long long)sector);
+		return -EINVAL;
+	}
+
+	*pg = g;
+
+	return 0;
+}
+
+/**
+ * Get the first member zone of a group that is not full.
+ * Return nr_group_zones if all members are full.
+ */
+static unsigned int zbc_zgroup_cur(struct zbc_zgroups *zg, unsigned int g)
+{
+	struct zbc_zone *z = zbc_zgroup_zones(zg, g);
+	unsigned int i;
+
+	for (i = 0; i < zg->nr_group_zones; i++) {
+		if (!zbc_zone_full(&z[i]))
+			break;
+	}
+
+	return i;
+}
+
+/**
+ * Build the zone descriptor of a group.
+ */
+static void zbc_zgroup_desc(struct zbc_zgroups *zg, unsigned int g,
+			    struct zbc_zone *gz)
+{
+	struct zbc_zone *z = zbc_zgroup_zones(zg, g);
+	unsigned int i, cur;
+
+	memset(gz, 0, sizeof(struct zbc_zone));
+	gz->zbz_type = z[0].zbz_type;
+	gz->zbz_start = z[0].zbz_start;
+	gz->zbz_length = zbc_zgroup_length(zg, g);
+
+	for (i = 0; i < zg->nr_group_zones; i++) {
+		gz->zbz_attributes |= z[i].zbz_attributes;
+		if (zbc_zone_offline(&z[i]) || zbc_zone_rdonly(&z[i])) {
+			gz->zbz_condition = z[i].zbz_condition;
+			gz->zbz_write_pointer = (uint64_t)-1;
+			return;
+		}
+	}
+
+	cur = zbc_zgroup_cur(zg, g);
+	if (cur >= zg->nr_group_zones) {
+		gz->zbz_condition = ZBC_ZC_FULL;
+		gz->zbz_write_pointer = gz->zbz_start + gz->zbz_length;
+		return;
+	}
+
+	gz->zbz_write_pointer = z[cur].zbz_write_pointer;
+	if (zbc_zone_empty(&z[cur]) && cur)
+		gz->zbz_condition = ZBC_ZC_CLOSED;
+	else
+		gz->zbz_condition = z[cur].zbz_condition;
+}
+
+/**
+ * Reload the member zones of a group from the device, e.g. after an
+ * error left the cached write pointers unknown.
+ */
+static int zbc_zgroup_refresh(struct zbc_zgroups *zg, unsigned int g)
+{
+	struct zbc_zone *z = zbc_zgroup_zones(zg, g);
+	unsigned int i, nr_zones = zg->nr_group_zones;
+	int ret;
+
+	ret = zbc_report_zones(zg->dev, zbc_zone_start(z), ZBC_RO_ALL,
+			       z, &nr_zones);
+	if (ret)
+		return ret;
+	if (nr_zones != zg->nr_group_zones)
+		return -EIO;
+
+	for (i = 0; i < nr_zones; i++)
+		zbc_zgroup_fix_wp(&z[i]);
+
+	return 0;
+}
+
+/**
+ * zbc_zgroup_open - Set up the zone groups of a device
+ */
+int zbc_zgroup_open(struct zbc_device *dev, unsigned int nr_group_zones,
+		    struct zbc_zgroups **pzg)
+{
+	struct zbc_zgroups *zg;
+	struct zbc_zone *zones, *z, *first = NULL;
+	unsigned int nr_zones, i, run = 0, nr = 0;
+	int ret;
+
+	if (!nr_group_zones)
+		return -EINVAL;
+
+	ret = zbc_list_zones(dev, 0, ZBC_RO_ALL, &zones, &nr_zones);
+	if (ret)
+		return ret;
+
+	/*
+	 * Form groups from runs of adjacent sequential zones of the same
+	 * type and size, compacting the member zones at the beginning of
+	 * the array.
+	 */
+	for (i = 0; i < nr_zones; i++) {
+		z = &zones[i];
+		if (!zbc_zone_sequential(z)) {
+			run = 0;
+			continue;
+		}
+		if (run &&
+		    (z->zbz_type != first->zbz_type ||
+		     z->zbz_length != first->zbz_length ||
+		     z->zbz_start != zones[nr + run - 1].zbz_start +
+				     zones[nr + run - 1].zbz_length))
+			run = 0;
+		zones[nr + run] = *z;
+		zbc_zgroup_fix_wp(&zones[nr + run]);
+		first = &zones[nr];
+		if (++run == nr_group_zones) {
+			nr += run;
+			run = 0;
+		}
+	}
+
+	if (!nr) {
+		zbc_error("%s: No group of %u adjacent sequential zones\n",
+			  dev->zbd_filename, nr_group_zones);
+		zbc_free(zones);
+		return -EINVAL;
+	}
+
+	zg = zbc_calloc(1, sizeof(struct zbc_zgroups));
+	if (!zg) {
+		zbc_free(zones);
+		return -ENOMEM;
+	}
+
+	zg->dev = dev;
+	zg->nr_group_zones = nr_group_zones;
+	zg->nr_groups = nr / nr_group_zones;
+	zg->zones = zones;
+	pthread_mutex_init(&zg->lock, NULL);
+
+	zbc_debug("%s: %u zone groups of %u zones\n",
+		  dev->zbd_filename, zg->nr_groups, nr_group_zones);
+
+	*pzg = zg;
+
+	return 0;
+}
+
+/**
+ * zbc_zgroup_close - Free the zone groups of a device
+ */
+void zbc_zgroup_close(struct zbc_zgroups *zg)
+{
+	if (!zg)
+		return;
+
+	pthread_mutex_destroy(&zg->lock);
+	zbc_free(zg->zones);
+	zbc_free(zg);
+}
+
+/**
+ * zbc_zgroup_nr_groups - Get the number of zone groups
+ */
+unsigned int zbc_zgroup_nr_groups(struct zbc_zgroups *zg)
+{
+	return zg->nr_groups;
+}
+
+/**
+ * zbc_zgroup_report - Get zone group information
+ */
+int zbc_zgroup_report(struct zbc_zgroups *zg, uint64_t sector,
+		      struct zbc_zone *groups, unsigned int *nr_groups)
+{
+	unsigned int g, n = 0;
+
+	pthread_mutex_lock(&zg->lock);
+
+	g = zbc_zgroup_find(zg, sector);
+	if (!groups) {
+		n = zg->nr_groups - g;
+	} else {
+		for (; g < zg->nr_groups && n < *nr_groups; g++, n++)
+			zbc_zgroup_desc(zg, g, &groups[n]);
+	}
+
+	pthread_mutex_unlock(&zg->lock);
+
+	*nr_groups = n;
+
+	return 0;
+}
+
+/**
+ * zbc_zgroup_pread - Read from a zone group
+ */
+ssize_t zbc_zgroup_pread(struct zbc_zgroups *zg, void *buf,
+			 size_t count, uint64_t offset)
+{
+	struct zbc_device *dev = zg->dev;
+	uint64_t zlen, end, sz;
+	size_t done = 0;
+	unsigned int g;
+	ssize_t ret;
+	int err;
+
+	err = zbc_zgroup_get(zg, offset, &g);
+	if (err)
+		return err;
+
+	end = zbc_zgroup_start(zg, g) + zbc_zgroup_length(zg, g);
+	if (offset + count > end) {
+		zbc_error("%s: Read at %llu + %zu crosses the group end\n",
+			  dev->zbd_filename,
+			  (unsigned long long)offset, count);
+		return -EINVAL;
+	}
+
+	/* Split the read at member zone boundaries */
+	zlen = zbc_zone_length(zbc_zgroup_zones(zg, g));
+	while (done < count) {
+		sz = zlen - (offset - zbc_zgroup_start(zg, g)) % zlen;
+		if (sz > count - done)
+			sz = count - done;
+		ret = zbc_pread(dev, (char *)buf + (done << 9), sz, offset);
+		if (ret <= 0)
+			return done ? (ssize_t)done : ret;
+		done += ret;
+		offset += ret;
+	}
+
+	return done;
+}
+
+/**
+ * zbc_zgroup_pwrite - Write to a zone group
+ */
+ssize_t zbc_zgroup_pwrite(struct zbc_zgroups *zg, const void *buf,
+			  size_t count, uint64_t offset)
+{
+	struct zbc_device *dev = zg->dev;
+	struct zbc_zone *z;
+	uint64_t end, zend, sz;
+	unsigned int g, cur;
+	size_t done = 0;
+	ssize_t ret;
+	int err;
+
+	err = zbc_zgroup_get(zg, offset, &g);
+	if (err)
+		return err;
+
+	pthread_mutex_lock(&zg->lock);
+	z = zbc_zgroup_zones(zg, g);
+	cur = zbc_zgroup_cur(zg, g);
+	if (cur >= zg->nr_group_zones ||
+	    offset != zbc_zone_wp(&z[cur])) {
+		pthread_mutex_unlock(&zg->lock);
+		zbc_error("%s: Write at %llu is not at the group write pointer\n",
+			  dev->zbd_filename, (unsigned long long)offset);
+		zbc_set_errno(ZBC_SK_ILLEGAL_REQUEST,
+			      ZBC_ASC_UNALIGNED_WRITE_COMMAND);
+		return -EIO;
+	}
+	pthread_mutex_unlock(&zg->lock);
+
+	end = zbc_zgroup_start(zg, g) + zbc_zgroup_length(zg, g);
+	if (count > end - offset)
+		count = end - offset;
+
+	/* Split the write at member zone boundaries */
+	while (done < count) {
+		zend = zbc_zone_start(&z[cur]) + zbc_zone_length(&z[cur]);
+		sz = zend - offset;
+		if (sz > count - done)
+			sz = count - done;
+
+		ret = zbc_pwrite(dev, (const char *)buf + (done << 9),
+				 sz, offset);
+		if (ret <= 0) {
+			pthread_mutex_lock(&zg->lock);
+			zbc_zgroup_refresh(zg, g);
+			pthread_mutex_unlock(&zg->lock);
+			return done ? (ssize_t)done : ret;
+		}
+
+		pthread_mutex_lock(&zg->lock);
+		offset += ret;
+		done += ret;
+		z[cur].zbz_write_pointer = offset;
+		if (offset >= zend) {
+			z[cur].zbz_condition = ZBC_ZC_FULL;
+			cur++;
+		} else {
+			z[cur].zbz_condition = ZBC_ZC_IMP_OPEN;
+		}
+		pthread_mutex_unlock(&zg->lock);
+	}
+
+	return done;
+}
+
+/**
+ * Execute a zone operation on all the member zones of a group.
+ */
+static int zbc_zgroup_op(struct zbc_zgroups *zg, uint64_t sector,
+			 enum zbc_zone_op op)
+{
+	struct zbc_zone *z;
+	unsigned int g, i;
+	int ret;
+
+	ret = zbc_zgroup_get(zg, sector, &g);
+	if (ret)
+		return ret;
+
+	if (sector != zbc_zgroup_start(zg, g)) {
+		zbc_error("%s: Sector %llu is not the start of a zone group\n",
+			  zg->dev->zbd_filename,
+			  (unsigned long long)sector);
+		return -EINVAL;
+	}
+
+	pthread_mutex_lock(&zg->lock);
+
+	z = zbc_zgroup_zones(zg, g);
+	ret = zbc_zone_op_range(zg->dev, z, zg->nr_group_zones, op);
+	if (ret) {
+		zbc_zgroup_refresh(zg, g);
+		goto out;
+	}
+
+	for (i = 0; i < zg->nr_group_zones; i++) {
+		if (op == ZBC_OP_RESET_ZONE) {
+			z[i].zbz_condition = ZBC_ZC_EMPTY;
+			z[i].zbz_write_pointer = z[i].zbz_start;
+		} else {
+			z[i].zbz_condition = ZBC_ZC_FULL;
+			zbc_zgroup_fix_wp(&z[i]);
+		}
+	}
+
+out:
+	pthread_mutex_unlock(&zg->lock);
+
+	return ret;
+}
+
+/**
+ * zbc_zgroup_reset - Reset the write pointer of a zone group
+ */
+int zbc_zgroup_reset(struct zbc_zgroups *zg, uint64_t sector)
+{
+	return zbc_zgroup_op(zg, sector, ZBC_OP_RESET_ZONE);
+}
+
+/**
+ * zbc_zgroup_finish - Transition a zone group to the full condition
+ */
+int zbc_zgroup_finish(struct zbc_zgroups *zg, uint64_t sector)
+{
+	return zbc_zgroup_op(zg, sector, ZBC_OP_FINISH_ZONE);
+}
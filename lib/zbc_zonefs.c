@@ -0,0 +1,769 @@
+/*
+ * This file is part of libzbc.
+ *
+ * Copyright (C) 2009-2014, HGST, Inc. All rights reserved.
+ * Copyright (C) 2016, Western Digital. All rights reserved.
+ *
+ * This software is distributed under the terms of the BSD 2-clause license,
+ * "as is," without technical support, and WITHOUT ANY WARRANTY, without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE. You should have received a copy of the BSD 2-clause license along
+ * with libzbc. If not, see  <http://opensource.org/licenses/BSD-2-Clause>.
+ *
+ * Author: Damien Le Moal (damien.lemoal@wdc.com)
+ */
+
+#include "zbc.h"
+#include "zbc_sg.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+
+/**
+ * zonefs file system magic number.
+ */
+#define ZBC_ZONEFS_MAGIC	0x5a4f4653
+
+/**
+ * zonefs file groups (sub-directories of the mount point).
+ */
+enum zbc_zonefs_group {
+	ZBC_ZONEFS_CNV = 0,
+	ZBC_ZONEFS_SEQ,
+	ZBC_ZONEFS_NR_GROUPS,
+};
+
+static const char *zbc_zonefs_group_name[ZBC_ZONEFS_NR_GROUPS] = {
+	"cnv",
+	"seq",
+};
+
+/**
+ * Zone file. The file descriptor is opened on first use.
+ */
+struct zbc_zonefs_file {
+	int			fd;
+	unsigned int		group;
+	unsigned int		fno;
+
+	/*
+	 * Sector offset of the zone in the file: conventional zones may
+	 * be aggregated into a single file.
+	 */
+	uint64_t		ofst;
+};
+
+/**
+ * zonefs device descriptor data.
+ */
+struct zbc_zonefs_device {
+
+	struct zbc_device	dev;
+
+	/* Group directories file descriptors */
+	int			dir_fd[ZBC_ZONEFS_NR_GROUPS];
+
+	/* Zone files open flags */
+	int			oflags;
+
+	unsigned int		nr_zones;
+	struct zbc_zone		*zones;
+	struct zbc_zonefs_file	*files;
+
+};
+
+/**
+ * zbc_dev_to_zonefs - Convert device address to zonefs device address.
+ */
+static inline struct zbc_zonefs_device *
+zbc_dev_to_zonefs(struct zbc_device *dev)
+{
+	return container_of(dev, struct zbc_zonefs_device, dev);
+}
+
+/**
+ * Get the index of the zone containing a sector.
+ */
+static int zbc_zonefs_zone_idx(struct zbc_zonefs_device *zfd, uint64_t sector)
+{
+	unsigned int lo = 0, hi = zfd->nr_zones, mid;
+	struct zbc_zone *zone;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		zone = &zfd->zones[mid];
+		if (sector < zone->zbz_start)
+			hi = mid;
+		else if (sector >= zone->zbz_start + zone->zbz_length)
+			lo = mid + 1;
+		else
+			return mid;
+	}
+
+	return -1;
+}
+
+/**
+ * Get the file descriptor of a zone file, opening the file if needed.
+ */
+static int zbc_zonefs_zone_fd(struct zbc_zonefs_device *zfd, unsigned int zno)
+{
+	struct zbc_zonefs_file *zf = &zfd->files[zno];
+	int fd, cur = -1;
+	char name[16];
+
+	fd = __atomic_load_n(&zf->fd, __ATOMIC_ACQUIRE);
+	if (fd >= 0)
+		return fd;
+
+	snprintf(name, sizeof(name), "%u", zf->fno);
+	fd = openat(zfd->dir_fd[zf->group], name, zfd->oflags);
+	if (fd < 0) {
+		fd = -errno;
+		zbc_error("%s: open %s/%s failed %d (%s)\n",
+			  zfd->dev.zbd_filename,
+			  zbc_zonefs_group_name[zf->group], name,
+			  errno, strerror(errno));
+		return fd;
+	}
+
+	/* Another thread may have opened the file already */
+	if (!__atomic_compare_exchange_n(&zf->fd, &cur, fd, false,
+					 __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		close(fd);
+		fd = cur;
+	}
+
+	return fd;
+}
+
+/**
+ * Open a group directory and count its zone files.
+ */
+static int zbc_zonefs_scan_group(struct zbc_zonefs_device *zfd,
+				 unsigned int group, unsigned int *nr_files)
+{
+	struct dirent *e;
+	unsigned int n = 0;
+	char *end;
+	DIR *d;
+	int fd;
+
+	fd = openat(zfd->dev.zbd_fd, zbc_zonefs_group_name[group],
+		    O_RDONLY | O_DIRECTORY);
+	if (fd < 0) {
+		/* A device may not have any conventional zone */
+		if (errno == ENOENT) {
+			*nr_files = 0;
+			return 0;
+		}
+		return -errno;
+	}
+	zfd->dir_fd[group] = fd;
+
+	fd = dup(fd);
+	if (fd < 0)
+		return -errno;
+	d = fdopendir(fd);
+	if (!d) {
+		close(fd);
+		return -errno;
+	}
+
+	while ((e = readdir(d)) != NULL) {
+		if (e->d_name[0] < '0' || e->d_name[0] > '9')
+			continue;
+		strtoul(e->d_name, &end, 10);
+		if (!*end)
+			n++;
+	}
+	closedir(d);
+
+	*nr_files = n;
+
+	return 0;
+}
+
+/**
+ * Get the size and capacity in sectors of a zone file.
+ */
+static int zbc_zonefs_stat(struct zbc_zonefs_device *zfd, unsigned int group,
+			   unsigned int fno, struct stat *st)
+{
+	char name[16];
+	int ret;
+
+	snprintf(name, sizeof(name), "%u", fno);
+	if (fstatat(zfd->dir_fd[group], name, st, 0) < 0) {
+		ret = -errno;
+		zbc_error("%s: stat %s/%s failed %d (%s)\n",
+			  zfd->dev.zbd_filename,
+			  zbc_zonefs_group_name[group], name,
+			  errno, strerror(errno));
+		return ret;
+	}
+
+	return 0;
+}
+
+/**
+ * Build the zone list: conventional zones first, then sequential zones.
+ * Zone sectors are relative to this list, not to the underlying device.
+ */
+static int zbc_zonefs_get_zones(struct zbc_zonefs_device *zfd)
+{
+	unsigned int nr_files[ZBC_ZONEFS_NR_GROUPS];
+	uint64_t zone_sectors = 0, sector = 0, fsectors, ofst;
+	unsigned int g, i, z = 0, nr_zones = 0;
+	struct stat st;
+	int ret;
+
+	for (g = 0; g < ZBC_ZONEFS_NR_GROUPS; g++) {
+		ret = zbc_zonefs_scan_group(zfd, g, &nr_files[g]);
+		if (ret)
+			return ret;
+	}
+
+	if (!nr_files[ZBC_ZONEFS_SEQ] && !nr_files[ZBC_ZONEFS_CNV])
+		return -ENXIO;
+
+	/* The blocks of sequential zone files is the zone capacity */
+	if (nr_files[ZBC_ZONEFS_SEQ]) {
+		ret = zbc_zonefs_stat(zfd, ZBC_ZONEFS_SEQ, 0, &st);
+		if (ret)
+			return ret;
+		zone_sectors = st.st_blocks;
+	}
+
+	/* Aggregated conventional zones are split using the zone size */
+	for (i = 0; i < nr_files[ZBC_ZONEFS_CNV]; i++) {
+		ret = zbc_zonefs_stat(zfd, ZBC_ZONEFS_CNV, i, &st);
+		if (ret)
+			return ret;
+		fsectors = st.st_size >> 9;
+		if (!fsectors)
+			continue;
+		if (!zone_sectors)
+			zone_sectors = fsectors;
+		nr_zones += (fsectors + zone_sectors - 1) / zone_sectors;
+	}
+	nr_zones += nr_files[ZBC_ZONEFS_SEQ];
+
+	zfd->zones = zbc_calloc(nr_zones, sizeof(struct zbc_zone));
+	zfd->files = zbc_calloc(nr_zones, sizeof(struct zbc_zonefs_file));
+	if (!zfd->zones || !zfd->files)
+		return -ENOMEM;
+
+	for (i = 0; i < nr_files[ZBC_ZONEFS_CNV]; i++) {
+		ret = zbc_zonefs_stat(zfd, ZBC_ZONEFS_CNV, i, &st);
+		if (ret)
+			return ret;
+		fsectors = st.st_size >> 9;
+		for (ofst = 0; ofst < fsectors && z < nr_zones; z++) {
+			zfd->zones[z].zbz_type = ZBC_ZT_CONVENTIONAL;
+			zfd->zones[z].zbz_condition = ZBC_ZC_NOT_WP;
+			zfd->zones[z].zbz_start = sector;
+			zfd->zones[z].zbz_length = zone_sectors;
+			if (ofst + zone_sectors > fsectors)
+				zfd->zones[z].zbz_length = fsectors - ofst;
+			zfd->zones[z].zbz_write_pointer = (uint64_t)-1;
+			zfd->files[z].group = ZBC_ZONEFS_CNV;
+			zfd->files[z].fno = i;
+			zfd->files[z].ofst = ofst;
+			ofst += zfd->zones[z].zbz_length;
+			sector += zfd->zones[z].zbz_length;
+		}
+	}
+
+	for (i = 0; i < nr_files[ZBC_ZONEFS_SEQ] && z < nr_zones; i++, z++) {
+		ret = zbc_zonefs_stat(zfd, ZBC_ZONEFS_SEQ, i, &st);
+		if (ret)
+			return ret;
+		zfd->zones[z].zbz_type = ZBC_ZT_SEQUENTIAL_REQ;
+		zfd->zones[z].zbz_start = sector;
+		zfd->zones[z].zbz_length = st.st_blocks;
+		zfd->files[z].group = ZBC_ZONEFS_SEQ;
+		zfd->files[z].fno = i;
+		sector += st.st_blocks;
+	}
+
+	for (i = 0; i < z; i++)
+		zfd->files[i].fd = -1;
+	zfd->nr_zones = z;
+	zfd->dev.zbd_info.zbd_sectors = sector;
+
+	return 0;
+}
+
+/**
+ * Set the device information.
+ */
+static int zbc_zonefs_set_info(struct zbc_zonefs_device *zfd)
+{
+	struct zbc_device_info *info = &zfd->dev.zbd_info;
+	struct statfs sfs;
+	int ret;
+
+	if (fstatfs(zfd->dev.zbd_fd, &sfs) < 0)
+		return -errno;
+
+	/* zonefs uses the device logical block size as block size */
+	info->zbd_lblock_size = sfs.f_bsize;
+	info->zbd_pblock_size = sfs.f_bsize;
+	if (!info->zbd_lblock_size || info->zbd_lblock_size & 511) {
+		zbc_error("%s: invalid block size %ld\n",
+			  zfd->dev.zbd_filename, (long)sfs.f_bsize);
+		return -EINVAL;
+	}
+
+	ret = zbc_zonefs_get_zones(zfd);
+	if (ret)
+		return ret;
+
+	info->zbd_lblocks = (info->zbd_sectors << 9) / info->zbd_lblock_size;
+	info->zbd_pblocks = info->zbd_lblocks;
+	if (!info->zbd_lblocks) {
+		zbc_error("%s: invalid capacity (logical blocks)\n",
+			  zfd->dev.zbd_filename);
+		return -EINVAL;
+	}
+
+	info->zbd_type = ZBC_DT_ZONEFS;
+	info->zbd_model = ZBC_DM_HOST_MANAGED;
+	strncpy(info->zbd_vendor_id, "Linux zonefs",
+		ZBC_DEVICE_INFO_LENGTH - 1);
+	info->zbd_opt_nr_open_seq_pref = 0;
+	info->zbd_opt_nr_non_seq_write_seq_pref = 0;
+	info->zbd_max_nr_open_seq_req = ZBC_NO_LIMIT;
+
+	/* Get maximum command size */
+	zbc_sg_get_max_cmd_blocks(&zfd->dev);
+
+	return 0;
+}
+
+/**
+ * Close a device.
+ */
+static int zbc_zonefs_close(struct zbc_device *dev)
+{
+	struct zbc_zonefs_device *zfd = zbc_dev_to_zonefs(dev);
+	unsigned int i;
+
+	for (i = 0; i < zfd->nr_zones; i++) {
+		if (zfd->files[i].fd >= 0)
+			close(zfd->files[i].fd);
+	}
+	for (i = 0; i < ZBC_ZONEFS_NR_GROUPS; i++) {
+		if (zfd->dir_fd[i] >= 0)
+			close(zfd->dir_fd[i]);
+	}
+	close(dev->zbd_fd);
+
+	zbc_free(zfd->zones);
+	zbc_free(zfd->files);
+	zbc_free(dev->zbd_filename);
+	zbc_free(zfd);
+
+	return 0;
+}
+
+/**
+ * Open a zonefs mount point.
+ */
+static int zbc_zonefs_open(const char *filename, int flags,
+			   struct zbc_device **pdev)
+{
+	struct zbc_zonefs_device *zfd;
+	unsigned long long start;
+	struct statfs sfs;
+	struct stat st;
+	int fd, ret;
+
+	zbc_debug("%s: ########## Trying ZONEFS driver ##########\n",
+		  filename);
+
+	if (stat(filename, &st) != 0) {
+		ret = -errno;
+		zbc_error("%s: Stat device file failed %d (%s)\n",
+			  filename,
+			  errno, strerror(errno));
+		return ret;
+	}
+
+	if (!S_ISDIR(st.st_mode) ||
+	    statfs(filename, &sfs) != 0 ||
+	    sfs.f_type != ZBC_ZONEFS_MAGIC) {
+		zbc_open_reject(filename, "not a zonefs mount point");
+		return -ENXIO;
+	}
+
+	fd = open(filename, O_RDONLY | O_DIRECTORY);
+	if (fd < 0) {
+		ret = -errno;
+		zbc_error("%s: open failed %d (%s)\n",
+			  filename,
+			  errno, strerror(errno));
+		return ret;
+	}
+
+	/* Allocate a handle */
+	zfd = zbc_calloc(1, sizeof(struct zbc_zonefs_device));
+	if (!zfd) {
+		close(fd);
+		return -ENOMEM;
+	}
+
+	zfd->dev.zbd_fd = fd;
+	zfd->dev.zbd_sg_fd = fd;
+	zfd->dir_fd[ZBC_ZONEFS_CNV] = -1;
+	zfd->dir_fd[ZBC_ZONEFS_SEQ] = -1;
+
+	/* Sequential zone files can only be written with direct I/Os */
+	zfd->oflags = (flags & ZBC_O_MODE_MASK) | O_DIRECT | O_LARGEFILE;
+
+	zfd->dev.zbd_filename = zbc_strdup(filename);
+	if (!zfd->dev.zbd_filename) {
+		ret = -ENOMEM;
+		goto err;
+	}
+
+	start = zbc_time_ns();
+	ret = zbc_zonefs_set_info(zfd);
+	zbc_open_phase(filename, "zone files", start, ret);
+	if (ret)
+		goto err;
+
+	*pdev = &zfd->dev;
+
+	zbc_debug("%s: ########## ZONEFS driver succeeded ##########\n",
+		  filename);
+
+	return 0;
+
+err:
+	zbc_zonefs_close(&zfd->dev);
+
+	zbc_debug("%s: ########## ZONEFS driver failed %d ##########\n",
+		  filename, ret);
+
+	return ret;
+}
+
+/**
+ * Test if a zone must be reported.
+ */
+static bool zbc_zonefs_must_report(struct zbc_zone *zone,
+				   enum zbc_reporting_options ro)
+{
+	switch (zbc_ro_mask(ro)) {
+	case ZBC_RO_ALL:
+		return true;
+	case ZBC_RO_EMPTY:
+		return zbc_zone_empty(zone);
+	case ZBC_RO_IMP_OPEN:
+		return zbc_zone_imp_open(zone);
+	case ZBC_RO_EXP_OPEN:
+		return zbc_zone_exp_open(zone);
+	case ZBC_RO_CLOSED:
+		return zbc_zone_closed(zone);
+	case ZBC_RO_FULL:
+		return zbc_zone_full(zone);
+	case ZBC_RO_RDONLY:
+		return zbc_zone_rdonly(zone);
+	case ZBC_RO_OFFLINE:
+		return zbc_zone_offline(zone);
+	case ZBC_RO_RWP_RECOMMENDED:
+		return zbc_zone_rwp_recommended(zone);
+	case ZBC_RO_NON_SEQ:
+		return zbc_zone_non_seq(zone);
+	case ZBC_RO_NOT_WP:
+		return zbc_zone_not_wp(zone);
+	default:
+		return false;
+	}
+}
+
+/**
+ * Get a zone information. The write pointer of sequential zones is given
+ * by the zone file size and the zone condition by the file permissions.
+ */
+static int zbc_zonefs_get_zone(struct zbc_zonefs_device *zfd,
+			       unsigned int zno, struct zbc_zone *zone)
+{
+	struct zbc_zonefs_file *zf = &zfd->files[zno];
+	struct stat st;
+	int ret;
+
+	*zone = zfd->zones[zno];
+	if (zbc_zone_conventional(zone))
+		return 0;
+
+	ret = zbc_zonefs_stat(zfd, zf->group, zf->fno, &st);
+	if (ret)
+		return ret;
+
+	if (!(st.st_mode & 0777)) {
+		zone->zbz_condition = ZBC_ZC_OFFLINE;
+		zone->zbz_write_pointer = (uint64_t)-1;
+	} else if ((uint64_t)st.st_size >= zbc_zone_length(zone) << 9) {
+		zone->zbz_condition = ZBC_ZC_FULL;
+		zone->zbz_write_pointer = (uint64_t)-1;
+	} else {
+		zone->zbz_write_pointer = zone->zbz_start + (st.st_size >> 9);
+		if (!(st.st_mode & 0222))
+			zone->zbz_condition = ZBC_ZC_RDONLY;
+		else if (!st.st_size)
+			zone->zbz_condition = ZBC_ZC_EMPTY;
+		else if (__atomic_load_n(&zf->fd, __ATOMIC_RELAXED) >= 0 &&
+			 (zfd->oflags & ZBC_O_MODE_MASK) != O_RDONLY)
+			zone->zbz_condition = ZBC_ZC_IMP_OPEN;
+		else
+			zone->zbz_condition = ZBC_ZC_CLOSED;
+	}
+
+	return 0;
+}
+
+/**
+ * Get zone information.
+ */
+static int zbc_zonefs_report_zones(struct zbc_device *dev, uint64_t sector,
+				   enum zbc_reporting_options ro,
+				   struct zbc_zone *zones,
+				   unsigned int *nr_zones)
+{
+	struct zbc_zonefs_device *zfd = zbc_dev_to_zonefs(dev);
+	unsigned int max_nr_zones = zones ? *nr_zones : zfd->nr_zones;
+	unsigned int n = 0;
+	struct zbc_zone zone;
+	int i, ret;
+
+	if (sector >= dev->zbd_info.zbd_sectors) {
+		zbc_set_errno(ZBC_SK_ILLEGAL_REQUEST,
+			      ZBC_ASC_LOGICAL_BLOCK_ADDRESS_OUT_OF_RANGE);
+		return -EIO;
+	}
+
+	for (i = zbc_zonefs_zone_idx(zfd, sector);
+	     i < (int)zfd->nr_zones && n < max_nr_zones; i++) {
+		ret = zbc_zonefs_get_zone(zfd, i, &zone);
+		if (ret)
+			return ret;
+		if (!zbc_zonefs_must_report(&zone, ro))
+			continue;
+		if (zones)
+			zones[n] = zone;
+		n++;
+	}
+
+	*nr_zones = n;
+
+	return 0;
+}
+
+/**
+ * Reset or finish a sequential zone by truncating its file.
+ */
+static int zbc_zonefs_truncate(struct zbc_zonefs_device *zfd,
+			       unsigned int zno, enum zbc_zone_op op)
+{
+	struct zbc_zone *zone = &zfd->zones[zno];
+	off_t size = 0;
+	int fd, ret;
+
+	if (zbc_zone_conventional(zone)) {
+		zbc_set_errno(ZBC_SK_ILLEGAL_REQUEST,
+			      ZBC_ASC_INVALID_FIELD_IN_CDB);
+		return -EIO;
+	}
+
+	fd = zbc_zonefs_zone_fd(zfd, zno);
+	if (fd < 0)
+		return fd;
+
+	if (op == ZBC_OP_FINISH_ZONE)
+		size = zbc_zone_length(zone) << 9;
+
+	if (ftruncate(fd, size) < 0) {
+		ret = -errno;
+		zbc_error("%s: truncate zone %llu file failed %d (%s)\n",
+			  zfd->dev.zbd_filename,
+			  zbc_zone_start(zone),
+			  errno, strerror(errno));
+		return ret;
+	}
+
+	return 0;
+}
+
+/**
+ * Execute an operation on a zone.
+ */
+static int zbc_zonefs_zone_op(struct zbc_device *dev, uint64_t sector,
+			      enum zbc_zone_op op, unsigned int flags)
+{
+	struct zbc_zonefs_device *zfd = zbc_dev_to_zonefs(dev);
+	struct zbc_zone zone;
+	unsigned int i;
+	int zno, ret;
+
+	switch (op) {
+	case ZBC_OP_RESET_ZONE:
+	case ZBC_OP_FINISH_ZONE:
+		break;
+	case ZBC_OP_OPEN_ZONE:
+	case ZBC_OP_CLOSE_ZONE:
+		/* zonefs manages zone resources when files are open */
+		zbc_error("%s: Operation not supported by zonefs\n",
+			  dev->zbd_filename);
+		return -ENOTSUP;
+	default:
+		zbc_error("%s: Invalid operation code 0x%x\n",
+			  dev->zbd_filename, op);
+		return -EINVAL;
+	}
+
+	if (flags & ZBC_OP_ALL_ZONES) {
+		for (i = 0; i < zfd->nr_zones; i++) {
+			ret = zbc_zonefs_get_zone(zfd, i, &zone);
+			if (ret)
+				return ret;
+			if (zbc_zone_conventional(&zone) ||
+			    zbc_zone_offline(&zone) ||
+			    zbc_zone_rdonly(&zone))
+				continue;
+			if (op == ZBC_OP_RESET_ZONE && zbc_zone_empty(&zone))
+				continue;
+			if (op == ZBC_OP_FINISH_ZONE &&
+			    (zbc_zone_empty(&zone) || zbc_zone_full(&zone)))
+				continue;
+			ret = zbc_zonefs_truncate(zfd, i, op);
+			if (ret)
+				return ret;
+		}
+		return 0;
+	}
+
+	zno = zbc_zonefs_zone_idx(zfd, sector);
+	if (zno < 0 || zfd->zones[zno].zbz_start != sector) {
+		zbc_set_errno(ZBC_SK_ILLEGAL_REQUEST,
+			      ZBC_ASC_INVALID_FIELD_IN_CDB);
+		return -EIO;
+	}
+
+	return zbc_zonefs_truncate(zfd, zno, op);
+}
+
+/**
+ * Get the file descriptor and file offset of a request. The request
+ * is truncated to the end of the zone containing its first sector.
+ */
+static int zbc_zonefs_rw_prep(struct zbc_zonefs_device *zfd, size_t *count,
+			      uint64_t sector, off_t *ofst)
+{
+	struct zbc_zone *zone;
+	uint64_t end;
+	int zno;
+
+	zno = zbc_zonefs_zone_idx(zfd, sector);
+	if (zno < 0) {
+		zbc_set_errno(ZBC_SK_ILLEGAL_REQUEST,
+			      ZBC_ASC_LOGICAL_BLOCK_ADDRESS_OUT_OF_RANGE);
+		return -EIO;
+	}
+
+	zone = &zfd->zones[zno];
+	end = zbc_zone_start(zone) + zbc_zone_length(zone);
+	if (sector + *count > end)
+		*count = end - sector;
+	*ofst = (sector - zbc_zone_start(zone) + zfd->files[zno].ofst) << 9;
+
+	return zbc_zonefs_zone_fd(zfd, zno);
+}
+
+/**
+ * Read from a zone file.
+ */
+static ssize_t zbc_zonefs_pread(struct zbc_device *dev, void *buf,
+				size_t count, uint64_t offset)
+{
+	struct zbc_zonefs_device *zfd = zbc_dev_to_zonefs(dev);
+	ssize_t ret;
+	off_t ofst;
+	int fd;
+
+	fd = zbc_zonefs_rw_prep(zfd, &count, offset, &ofst);
+	if (fd < 0)
+		return fd;
+
+	ret = pread(fd, buf, count << 9, ofst);
+	if (ret < 0)
+		return -errno;
+	if (!ret) {
+		/* Read beyond the zone write pointer */
+		zbc_set_errno(ZBC_SK_ILLEGAL_REQUEST,
+			      ZBC_ASC_ATTEMPT_TO_READ_INVALID_DATA);
+		return -EIO;
+	}
+
+	return ret >> 9;
+}
+
+/**
+ * Write to a zone file.
+ */
+static ssize_t zbc_zonefs_pwrite(struct zbc_device *dev, const void *buf,
+				 size_t count, uint64_t offset)
+{
+	struct zbc_zonefs_device *zfd = zbc_dev_to_zonefs(dev);
+	ssize_t ret;
+	off_t ofst;
+	int fd;
+
+	fd = zbc_zonefs_rw_prep(zfd, &count, offset, &ofst);
+	if (fd < 0)
+		return fd;
+
+	ret = zbc_file_pwrite(fd, buf, count << 9, ofst);
+	if (ret < 0) {
+		ret = -errno;
+		if (ret == -EINVAL)
+			zbc_set_errno(ZBC_SK_ILLEGAL_REQUEST,
+				      ZBC_ASC_UNALIGNED_WRITE_COMMAND);
+		return ret;
+	}
+
+	return ret >> 9;
+}
+
+/**
+ * Flush the device write cache.
+ */
+static int zbc_zonefs_flush(struct zbc_device *dev)
+{
+	if (syncfs(dev->zbd_fd) < 0)
+		return -errno;
+
+	return 0;
+}
+
+/**
+ * zonefs backend driver definition.
+ */
+struct zbc_drv zbc_zonefs_drv = {
+	.flag			= ZBC_O_DRV_ZONEFS,
+	.zbd_open		= zbc_zonefs_open,
+	.zbd_close		= zbc_zonefs_close,
+	.zbd_pread		= zbc_zonefs_pread,
+	.zbd_pwrite		= zbc_zonefs_pwrite,
+	.zbd_flush		= zbc_zonefs_flush,
+	.zbd_report_zones	= zbc_zonefs_report_zones,
+	.zbd_zone_op		= zbc_zonefs_zone_op,
+};
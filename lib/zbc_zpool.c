@@ -0,0 +1,163 @@
+/*
+ * This file is part of libzbc.
+ *
+ * Copyright (C) 2009-2014, HGST, Inc. All rights reserved.
+ * Copyright (C) 2016, Western Digital. All rights reserved.
+ *
+ * This software is distributed under the terms of the BSD 2-clause license,
+ * "as is," without technical support, and WITHOUT ANY WARRANTY, without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE. You should have received a copy of the BSD 2-clause license along
+ * with libzbc. If not, see  <http://opensource.org/licenses/BSD-2-Clause>.
+ *
+ * Author: Damien Le Moal (damien.lemoal@wdc.com)
+ */
+
+#include "zbc.h"
+
+#include <string.h>
+
+/**
+ * Initialize a pool with the sequential zones of the range of sectors
+ * [@sector, @sector + @nr_sectors[ of a device. Zones that are empty
+ * are available for allocation.
+ */
+int zbc_zpool_init(struct zbc_zpool *zp, struct zbc_device *dev,
+		   uint64_t sector, uint64_t nr_sectors)
+{
+	struct zbc_zone *zones = NULL;
+	unsigned int nr_zones, i, j;
+	uint64_t end = sector + nr_sectors;
+	int ret;
+
+	memset(zp, 0, sizeof(struct zbc_zpool));
+	zp->zp_dev = dev;
+
+	if (!nr_sectors || end > dev->zbd_info.zbd_sectors)
+		return -EINVAL;
+
+	ret = zbc_list_zones(dev, sector, ZBC_RO_ALL, &zones, &nr_zones);
+	if (ret)
+		return ret;
+
+	/* Keep the sequential zones that are within the range */
+	for (i = 0, j = 0; i < nr_zones; i++) {
+		if (zones[i].zbz_start + zones[i].zbz_length > end)
+			break;
+		if (zbc_zone_sequential(&zones[i]))
+			zones[j++] = zones[i];
+	}
+
+	if (!j) {
+		zbc_error("%s: No sequential zone in sectors %llu..%llu\n",
+			  dev->zbd_filename,
+			  (unsigned long long)sector,
+			  (unsigned long long)end - 1);
+		zbc_free(zones);
+		return -EINVAL;
+	}
+
+	zp->zp_zones = zones;
+	zp->zp_nr_zones = j;
+	zp->zp_free = zbc_calloc(j, sizeof(unsigned int));
+	if (!zp->zp_free) {
+		zbc_free(zones);
+		return -ENOMEM;
+	}
+
+	/* Free list is sorted in decreasing order: lowest zone on top */
+	for (i = j; i > 0; i--) {
+		if (zbc_zone_empty(&zones[i - 1]))
+			zp->zp_free[zp->zp_nr_free++] = i - 1;
+	}
+
+	pthread_mutex_init(&zp->zp_lock, NULL);
+
+	return 0;
+}
+
+/**
+ * Release a pool resources.
+ */
+void zbc_zpool_destroy(struct zbc_zpool *zp)
+{
+
+	if (!zp->zp_zones)
+		return;
+
+	pthread_mutex_destroy(&zp->zp_lock);
+	zbc_free(zp->zp_free);
+	zbc_free(zp->zp_zones);
+	zp->zp_zones = NULL;
+	zp->zp_free = NULL;
+}
+
+/**
+ * Allocate an empty zone (lowest address first).
+ * Returns NULL if there is no empty zone left.
+ */
+struct zbc_zone *zbc_zpool_get(struct zbc_zpool *zp)
+{
+	struct zbc_zone *zone = NULL;
+
+	pthread_mutex_lock(&zp->zp_lock);
+	if (zp->zp_nr_free) {
+		zp->zp_nr_free--;
+		zone = &zp->zp_zones[zp->zp_free[zp->zp_nr_free]];
+	}
+	pthread_mutex_unlock(&zp->zp_lock);
+
+	return zone;
+}
+
+/**
+ * Reset a zone and return it to the free list.
+ */
+int zbc_zpool_put(struct zbc_zpool *zp, struct zbc_zone *zone)
+{
+	unsigned int idx = zone - zp->zp_zones, i;
+	int ret;
+
+	if (!zbc_zone_empty(zone)) {
+		ret = zbc_reset_zone(zp->zp_dev, zone->zbz_start, 0);
+		if (ret) {
+			zbc_error("%s: Reset zone %llu failed %d\n",
+				  zp->zp_dev->zbd_filename,
+				  zbc_zone_start(zone), ret);
+			return ret;
+		}
+		zone->zbz_write_pointer = zone->zbz_start;
+		zone->zbz_condition = ZBC_ZC_EMPTY;
+	}
+
+	pthread_mutex_lock(&zp->zp_lock);
+	for (i = zp->zp_nr_free; i > 0 && zp->zp_free[i - 1] < idx; i--)
+		zp->zp_free[i] = zp->zp_free[i - 1];
+	zp->zp_free[i] = idx;
+	zp->zp_nr_free++;
+	pthread_mutex_unlock(&zp->zp_lock);
+
+	return 0;
+}
+
+/**
+ * Get the zone of the pool containing @sector (NULL if none).
+ */
+struct zbc_zone *zbc_zpool_lookup(struct zbc_zpool *zp, uint64_t sector)
+{
+	unsigned int lo = 0, hi = zp->zp_nr_zones, mid;
+	struct zbc_zone *zone;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		zone = &zp->zp_zones[mid];
+		if (sector < zone->zbz_start)
+			hi = mid;
+		else if (sector >= zone->zbz_start + zone->zbz_length)
+			lo = mid + 1;
+		else
+			return zone;
+	}
+
+	return NULL;
+}
@@ -0,0 +1,771 @@
+/*
+ * This file is part of libzbc.
+ *
+ * Copyright (C) 2009-2014, HGST, Inc. All rights reserved.
+ * Copyright (C) 2016, Western Digital. All rights reserved.
+ *
+ * This software is distributed under the terms of the BSD 2-clause license,
+ * "as is," without technical support, and WITHOUT ANY WARRANTY, without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE. You should have received a copy of the BSD 2-clause license along
+ * with libzbc. If not, see  <http://opensource.org/licenses/BSD-2-Clause>.
+ *
+ * Author: Damien Le Moal (damien.lemoal@wdc.com)
+ */
+
+#include "zbc.h"
+#include "libzbc/zbc_zsum.h"
+
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * Defaults.
+ */
+#define ZBC_ZSUM_SUMMARY_SIZE	(64 * 1024)
+#define ZBC_ZSUM_NR_SLOTS	64
+
+/**
+ * Size of the padding writes.
+ */
+#define ZBC_ZSUM_PAD_SIZE	(1024 * 1024)
+
+/**
+ * Zone header (first physical block of a zone).
+ */
+#define ZBC_ZSUM_HDR_MAGIC	0x5a53484d
+
+struct zbc_zsum_hdr {
+	uint32_t		magic;
+	uint32_t		crc;
+	uint64_t		nonce;
+	uint64_t		zone;
+	uint64_t		slot_sectors;
+	uint32_t		footer_sectors;
+	uint32_t		reserved;
+};
+
+/**
+ * Zone footer, followed by the zone summary. The CRC covers the footer
+ * and the summary.
+ */
+#define ZBC_ZSUM_FTR_MAGIC	0x5a53464d
+
+struct zbc_zsum_ftr {
+	uint32_t		magic;
+	uint32_t		crc;
+	uint64_t		nonce;
+	uint64_t		zone;
+	uint64_t		data_end;
+	uint32_t		summary_len;
+	uint32_t		footer_sectors;
+};
+
+/**
+ * Zone state. The state of a zone that is not empty is determined from
+ * its header and footer when the zone is first used.
+ */
+struct zbc_zsum_zstate {
+	struct zbc_zone		zone;
+	enum zbc_zsum_state	state;
+	bool			loaded;
+	uint64_t		nonce;
+	uint64_t		data_start;
+	uint64_t		data_end;
+	uint64_t		ftr_sector;
+
+	/* Summary of an open zone */
+	uint8_t			*sum;
+	size_t			sum_len;
+};
+
+/**
+ * Zone summary handle.
+ */
+struct zbc_zsum {
+	struct zbc_device	*dev;
+	struct zbc_zsum_params	params;
+	pthread_mutex_t		lock;
+
+	size_t			pbs;
+	uint64_t		ftr_sectors;
+	size_t			ftr_size;
+
+	struct zbc_zsum_zstate	*zones;
+	unsigned int		nr_zones;
+
+	/* Footer and header buffer, and zeroed padding buffer */
+	void			*fbuf;
+	void			*zbuf;
+	uint64_t		nonce;
+};
+
+static inline uint64_t zbc_zs_end(struct zbc_zsum_zstate *z)
+{
+	return zbc_zone_start(&z->zone) + zbc_zone_length(&z->zone);
+}
+
+/**
+ * Data area limit: the footer of a zone filled up ends the zone.
+ */
+static inline uint64_t zbc_zs_limit(struct zbc_zsum *zs,
+				    struct zbc_zsum_zstate *z)
+{
+	return zbc_zs_end(z) - zs->ftr_sectors;
+}
+
+static uint64_t zbc_zs_slot(struct zbc_zsum *zs, struct zbc_zsum_zstate *z)
+{
+	uint64_t pbs_sectors = zs->pbs >> 9;
+	uint64_t slot = zs->params.zmp_slot_sectors;
+
+	if (!slot)
+		slot = zbc_zone_length(&z->zone) / ZBC_ZSUM_NR_SLOTS;
+	slot -= slot % pbs_sectors;
+	if (slot < zs->ftr_sectors)
+		slot = zs->ftr_sectors;
+
+	return slot;
+}
+
+static struct zbc_zsum_zstate *zbc_zs_lookup(struct zbc_zsum *zs,
+					     uint64_t sector)
+{
+	unsigned int lo = 0, hi = zs->nr_zones, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (sector < zbc_zone_start(&zs->zones[mid].zone))
+			hi = mid;
+		else if (sector > zbc_zone_start(&zs->zones[mid].zone))
+			lo = mid + 1;
+		else
+			return &zs->zones[mid];
+	}
+
+	return NULL;
+}
+
+static int zbc_zs_read(struct zbc_zsum *zs, void *buf, size_t count,
+		       uint64_t sector)
+{
+	ssize_t ret;
+
+	ret = zbc_pread(zs->dev, buf, count, sector);
+	if (ret >= 0 && (size_t)ret != count)
+		ret = -EIO;
+
+	return ret < 0 ? ret : 0;
+}
+
+static int zbc_zs_write(struct zbc_zsum *zs, struct zbc_zsum_zstate *z,
+			const void *buf, size_t count, uint64_t sector)
+{
+	ssize_t ret;
+
+	ret = zbc_pwrite(zs->dev, buf, count, sector);
+	if (ret >= 0 && (size_t)ret != count)
+		ret = -EIO;
+	if (ret < 0) {
+		zbc_error("%s: Write zone %llu failed %zd\n",
+			  zs->dev->zbd_filename,
+			  zbc_zone_start(&z->zone), ret);
+		return ret;
+	}
+
+	z->zone.zbz_write_pointer = sector + count;
+	if (zbc_zone_wp(&z->zone) >= zbc_zs_end(z))
+		z->zone.zbz_condition = ZBC_ZC_FULL;
+	else
+		z->zone.zbz_condition = ZBC_ZC_IMP_OPEN;
+
+	return 0;
+}
+
+/**
+ * Read and check the footer of a zone at @sector into @buf.
+ */
+static bool zbc_zs_read_footer(struct zbc_zsum *zs, struct zbc_zsum_zstate *z,
+			       uint64_t sector, void *buf)
+{
+	struct zbc_zsum_ftr *ftr = buf;
+	size_t len;
+	uint32_t crc;
+
+	if (zbc_zs_read(zs, buf, zs->pbs >> 9, sector))
+		return false;
+
+	if (ftr->magic != ZBC_ZSUM_FTR_MAGIC ||
+	    ftr->nonce != z->nonce ||
+	    ftr->zone != zbc_zone_start(&z->zone) ||
+	    ftr->footer_sectors != zs->ftr_sectors ||
+	    ftr->summary_len > zs->params.zmp_summary_size ||
+	    ftr->data_end < z->data_start || ftr->data_end > sector)
+		return false;
+
+	len = sizeof(struct zbc_zsum_ftr) + ftr->summary_len;
+	if (len > zs->pbs &&
+	    zbc_zs_read(zs, (char *)buf + zs->pbs,
+			(zs->ftr_size - zs->pbs) >> 9,
+			sector + (zs->pbs >> 9)))
+		return false;
+
+	crc = ftr->crc;
+	ftr->crc = 0;
+	if (crc != zbc_crc32c(0, ftr, len))
+		return false;
+	ftr->crc = crc;
+
+	return true;
+}
+
+/**
+ * Determine the state of a zone. If the zone is sealed, its footer is
+ * left in @buf.
+ */
+static int zbc_zs_load(struct zbc_zsum *zs, struct zbc_zsum_zstate *z,
+		       void *buf, bool *ftr_read)
+{
+	struct zbc_zsum_hdr *hdr = buf;
+	struct zbc_zsum_ftr *ftr = buf;
+	uint64_t start = zbc_zone_start(&z->zone);
+	uint64_t end = zbc_zs_end(z), slot = zbc_zs_slot(zs, z);
+	uint64_t k, nr_slots;
+	uint32_t crc;
+	int ret;
+
+	*ftr_read = false;
+	if (z->loaded)
+		return 0;
+
+	z->data_start = start + (zs->pbs >> 9);
+	z->data_end = z->data_start;
+	if (zbc_zone_empty(&z->zone)) {
+		z->state = ZBC_ZSUM_EMPTY;
+		z->loaded = true;
+		return 0;
+	}
+
+	z->state = ZBC_ZSUM_UNSEALED;
+	z->data_end = zbc_zone_wp(&z->zone);
+
+	ret = zbc_zs_read(zs, buf, zs->pbs >> 9, start);
+	if (ret)
+		return ret;
+
+	crc = hdr->crc;
+	hdr->crc = 0;
+	if (hdr->magic != ZBC_ZSUM_HDR_MAGIC ||
+	    hdr->zone != start ||
+	    hdr->slot_sectors != slot ||
+	    hdr->footer_sectors != zs->ftr_sectors ||
+	    crc != zbc_crc32c(0, hdr, sizeof(struct zbc_zsum_hdr))) {
+		/* Not written with a zone summary */
+		z->data_start = start;
+		z->loaded = true;
+		return 0;
+	}
+	z->nonce = hdr->nonce;
+
+	if (!zbc_zone_full(&z->zone)) {
+		if (z->data_end <= zbc_zs_limit(zs, z))
+			z->state = ZBC_ZSUM_OPEN;
+		z->loaded = true;
+		return 0;
+	}
+
+	/*
+	 * Look for the footer at the end of the zone first, and then at
+	 * the end of each slot. Only the footer of the current use of the
+	 * zone can match the zone header.
+	 */
+	nr_slots = (end - z->data_start - zs->ftr_sectors) / slot;
+	for (k = 0; k <= nr_slots; k++) {
+		z->ftr_sector = end - (k ? nr_slots + 1 - k : 0) * slot -
+			zs->ftr_sectors;
+		if (zbc_zs_read_footer(zs, z, z->ftr_sector, buf)) {
+			z->state = ZBC_ZSUM_SEALED;
+			z->data_end = ftr->data_end;
+			*ftr_read = true;
+			break;
+		}
+	}
+
+	z->loaded = true;
+
+	return 0;
+}
+
+/**
+ * Write a zone footer ending at @end, padding the data area up to the
+ * footer, and finish the zone if the footer does not end the zone.
+ */
+static int zbc_zs_seal(struct zbc_zsum *zs, struct zbc_zsum_zstate *z,
+		       uint64_t end)
+{
+	struct zbc_zsum_ftr *ftr = zs->fbuf;
+	uint64_t sector = z->data_end, ftr_sector = end - zs->ftr_sectors;
+	size_t count;
+	int ret;
+
+	while (sector < ftr_sector) {
+		count = ZBC_ZSUM_PAD_SIZE >> 9;
+		if (count > ftr_sector - sector)
+			count = ftr_sector - sector;
+		ret = zbc_zs_write(zs, z, zs->zbuf, count, sector);
+		if (ret)
+			return ret;
+		sector += count;
+	}
+
+	memset(ftr, 0, zs->ftr_size);
+	ftr->magic = ZBC_ZSUM_FTR_MAGIC;
+	ftr->nonce = z->nonce;
+	ftr->zone = zbc_zone_start(&z->zone);
+	ftr->data_end = z->data_end;
+	ftr->summary_len = z->sum_len;
+	ftr->footer_sectors = zs->ftr_sectors;
+	if (z->sum_len)
+		memcpy(ftr + 1, z->sum, z->sum_len);
+	ftr->crc = zbc_crc32c(0, ftr,
+			      sizeof(struct zbc_zsum_ftr) + z->sum_len);
+
+	ret = zbc_zs_write(zs, z, ftr, zs->ftr_sectors, ftr_sector);
+	if (ret)
+		return ret;
+
+	if (end < zbc_zs_end(z)) {
+		ret = zbc_finish_zone(zs->dev, zbc_zone_start(&z->zone), 0);
+		if (ret)
+			return ret;
+		z->zone.zbz_write_pointer = zbc_zs_end(z);
+		z->zone.zbz_condition = ZBC_ZC_FULL;
+	}
+
+	z->state = ZBC_ZSUM_SEALED;
+	z->ftr_sector = ftr_sector;
+	zbc_free(z->sum);
+	z->sum = NULL;
+
+	return 0;
+}
+
+/**
+ * Write the header of an empty zone.
+ */
+static int zbc_zs_start(struct zbc_zsum *zs, struct zbc_zsum_zstate *z)
+{
+	struct zbc_zsum_hdr *hdr = zs->fbuf;
+	uint64_t start = zbc_zone_start(&z->zone);
+	int ret;
+
+	z->sum = zbc_malloc(zs->params.zmp_summary_size);
+	if (!z->sum)
+		return -ENOMEM;
+	z->sum_len = 0;
+
+	/* Identify this use of the zone */
+	zs->nonce += 0x9e3779b97f4a7c15ULL;
+	z->nonce = zs->nonce ^ zbc_time_ns() ^ (start << 20);
+
+	memset(hdr, 0, zs->pbs);
+	hdr->magic = ZBC_ZSUM_HDR_MAGIC;
+	hdr->nonce = z->nonce;
+	hdr->zone = start;
+	hdr->slot_sectors = zbc_zs_slot(zs, z);
+	hdr->footer_sectors = zs->ftr_sectors;
+	hdr->crc = zbc_crc32c(0, hdr, sizeof(struct zbc_zsum_hdr));
+
+	ret = zbc_zs_write(zs, z, hdr, zs->pbs >> 9, start);
+	if (ret) {
+		zbc_free(z->sum);
+		z->sum = NULL;
+		return ret;
+	}
+
+	z->state = ZBC_ZSUM_OPEN;
+	z->data_end = z->data_start;
+
+	return 0;
+}
+
+/**
+ * Get a zone for modification, allocating the summary buffer of an open
+ * zone not used yet.
+ */
+static int zbc_zs_get(struct zbc_zsum *zs, uint64_t sector,
+		      struct zbc_zsum_zstate **pz)
+{
+	struct zbc_zsum_zstate *z = zbc_zs_lookup(zs, sector);
+	bool ftr_read;
+	int ret;
+
+	if (!z)
+		return -EINVAL;
+
+	ret = zbc_zs_load(zs, z, zs->fbuf, &ftr_read);
+	if (ret)
+		return ret;
+
+	if (z->state == ZBC_ZSUM_OPEN && !z->sum) {
+		z->sum = zbc_malloc(zs->params.zmp_summary_size);
+		if (!z->sum)
+			return -ENOMEM;
+		z->sum_len = 0;
+	}
+
+	*pz = z;
+
+	return 0;
+}
+
+/**
+ * zbc_zsum_append - Append data to a zone
+ */
+int zbc_zsum_append(struct zbc_zsum *zs, uint64_t zone,
+		    const void *buf, size_t count,
+		    const void *summary, size_t summary_len,
+		    uint64_t *sector)
+{
+	struct zbc_zsum_zstate *z;
+	uint64_t wsector;
+	int ret;
+
+	if (!count || !zbc_dev_sect_paligned(zs->dev, count))
+		return -EINVAL;
+
+	pthread_mutex_lock(&zs->lock);
+
+	ret = zbc_zs_get(zs, zone, &z);
+	if (ret)
+		goto out;
+
+	if (z->state != ZBC_ZSUM_EMPTY && z->state != ZBC_ZSUM_OPEN) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	if (z->data_end + count > zbc_zs_limit(zs, z) ||
+	    z->sum_len + summary_len > zs->params.zmp_summary_size) {
+		ret = -ENOSPC;
+		goto out;
+	}
+
+	if (z->state == ZBC_ZSUM_EMPTY) {
+		ret = zbc_zs_start(zs, z);
+		if (ret)
+			goto out;
+	}
+
+	wsector = z->data_end;
+	ret = zbc_zs_write(zs, z, buf, count, wsector);
+	if (ret)
+		goto out;
+
+	z->data_end += count;
+	if (summary_len) {
+		memcpy(z->sum + z->sum_len, summary, summary_len);
+		z->sum_len += summary_len;
+	}
+	if (sector)
+		*sector = wsector;
+
+	/* The zone is full: seal it */
+	if (z->data_end == zbc_zs_limit(zs, z))
+		ret = zbc_zs_seal(zs, z, zbc_zs_end(z));
+
+out:
+	pthread_mutex_unlock(&zs->lock);
+
+	return ret;
+}
+
+/**
+ * zbc_zsum_set_summary - Set the summary of an open zone
+ */
+int zbc_zsum_set_summary(struct zbc_zsum *zs, uint64_t zone,
+			 const void *summary, size_t summary_len)
+{
+	struct zbc_zsum_zstate *z;
+	int ret;
+
+	if (summary_len > zs->params.zmp_summary_size)
+		return -ENOSPC;
+
+	pthread_mutex_lock(&zs->lock);
+
+	ret = zbc_zs_get(zs, zone, &z);
+	if (ret)
+		goto out;
+
+	if (z->state != ZBC_ZSUM_OPEN) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	memcpy(z->sum, summary, summary_len);
+	z->sum_len = summary_len;
+
+out:
+	pthread_mutex_unlock(&zs->lock);
+
+	return ret;
+}
+
+/**
+ * zbc_zsum_finish - Seal a zone
+ */
+int zbc_zsum_finish(struct zbc_zsum *zs, uint64_t zone)
+{
+	struct zbc_zsum_zstate *z;
+	uint64_t slot, k;
+	int ret;
+
+	pthread_mutex_lock(&zs->lock);
+
+	ret = zbc_zs_get(zs, zone, &z);
+	if (ret)
+		goto out;
+
+	if (z->state == ZBC_ZSUM_SEALED)
+		goto out;
+	if (z->state != ZBC_ZSUM_OPEN) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	/* End the footer at the first slot end after the data */
+	slot = zbc_zs_slot(zs, z);
+	k = (zbc_zs_limit(zs, z) - z->data_end) / slot;
+	ret = zbc_zs_seal(zs, z, zbc_zs_end(z) - k * slot);
+
+out:
+	pthread_mutex_unlock(&zs->lock);
+
+	return ret;
+}
+
+static void zbc_zs_info(struct zbc_zsum *zs, struct zbc_zsum_zstate *z,
+			struct zbc_zsum_zone *info, size_t sum_len)
+{
+	info->zsz_start = zbc_zone_start(&z->zone);
+	info->zsz_state = z->state;
+	info->zsz_data_start = z->data_start;
+	info->zsz_data_end = z->data_end;
+	info->zsz_data_limit = zbc_zs_limit(zs, z);
+	info->zsz_summary_len = sum_len;
+}
+
+/**
+ * zbc_zsum_get_zone - Get the zone summary information of a zone
+ */
+int zbc_zsum_get_zone(struct zbc_zsum *zs, uint64_t zone,
+		      struct zbc_zsum_zone *info)
+{
+	struct zbc_zsum_zstate *z;
+	struct zbc_zsum_ftr *ftr = zs->fbuf;
+	bool ftr_read;
+	size_t sum_len;
+	int ret;
+
+	pthread_mutex_lock(&zs->lock);
+
+	z = zbc_zs_lookup(zs, zone);
+	if (!z) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	ret = zbc_zs_load(zs, z, zs->fbuf, &ftr_read);
+	if (ret)
+		goto out;
+
+	sum_len = z->sum_len;
+	if (z->state == ZBC_ZSUM_SEALED) {
+		if (!ftr_read &&
+		    !zbc_zs_read_footer(zs, z, z->ftr_sector, zs->fbuf)) {
+			ret = -EIO;
+			goto out;
+		}
+		sum_len = ftr->summary_len;
+	}
+
+	zbc_zs_info(zs, z, info, sum_len);
+
+out:
+	pthread_mutex_unlock(&zs->lock);
+
+	return ret;
+}
+
+/**
+ * zbc_zsum_recover - Recover zone summaries
+ */
+int zbc_zsum_recover(struct zbc_zsum *zs, zbc_zsum_recover_fn cb, void *priv)
+{
+	struct zbc_zsum_zone info;
+	struct zbc_zsum_zstate *z;
+	struct zbc_zsum_ftr *ftr;
+	const void *summary;
+	unsigned int i;
+	bool ftr_read;
+	int ret = 0;
+
+	ftr = zbc_memalign(sysconf(_SC_PAGESIZE), zs->ftr_size);
+	if (!ftr)
+		return -ENOMEM;
+
+	for (i = 0; i < zs->nr_zones; i++) {
+
+		z = &zs->zones[i];
+
+		pthread_mutex_lock(&zs->lock);
+		ret = zbc_zs_load(zs, z, ftr, &ftr_read);
+		if (!ret && z->state == ZBC_ZSUM_SEALED && !ftr_read &&
+		    !zbc_zs_read_footer(zs, z, z->ftr_sector, ftr))
+			ret = -EIO;
+		summary = NULL;
+		if (!ret) {
+			if (z->state == ZBC_ZSUM_SEALED) {
+				summary = ftr + 1;
+				zbc_zs_info(zs, z, &info, ftr->summary_len);
+			} else {
+				zbc_zs_info(zs, z, &info, z->sum_len);
+			}
+		}
+		pthread_mutex_unlock(&zs->lock);
+
+		if (ret)
+			break;
+		if (info.zsz_state == ZBC_ZSUM_EMPTY)
+			continue;
+
+		ret = cb(zs, &info, summary, priv);
+		if (ret)
+			break;
+
+	}
+
+	zbc_free(ftr);
+
+	return ret;
+}
+
+/**
+ * zbc_zsum_open - Open zone summaries
+ */
+int zbc_zsum_open(struct zbc_device *dev, struct zbc_zsum_params *params,
+		  struct zbc_zsum **pzs)
+{
+	struct zbc_zone *zones = NULL;
+	struct zbc_zsum_params *p;
+	uint64_t end;
+	unsigned int nr_zones, i;
+	struct zbc_zsum *zs;
+	int ret;
+
+	if (!params)
+		return -EINVAL;
+
+	zs = zbc_calloc(1, sizeof(struct zbc_zsum));
+	if (!zs)
+		return -ENOMEM;
+
+	zs->dev = dev;
+	zs->params = *params;
+	p = &zs->params;
+	pthread_mutex_init(&zs->lock, NULL);
+
+	if (!p->zmp_summary_size)
+		p->zmp_summary_size = ZBC_ZSUM_SUMMARY_SIZE;
+	zs->pbs = dev->zbd_info.zbd_pblock_size;
+	zs->ftr_size = sizeof(struct zbc_zsum_ftr) + p->zmp_summary_size;
+	zs->ftr_size = (zs->ftr_size + zs->pbs - 1) / zs->pbs * zs->pbs;
+	zs->ftr_sectors = zs->ftr_size >> 9;
+
+	end = p->zmp_sector + p->zmp_nr_sectors;
+	if (!p->zmp_nr_sectors || end > dev->zbd_info.zbd_sectors ||
+	    (p->zmp_slot_sectors &&
+	     !zbc_dev_sect_paligned(dev, p->zmp_slot_sectors))) {
+		ret = -EINVAL;
+		goto err;
+	}
+
+	ret = zbc_list_zones(dev, p->zmp_sector, ZBC_RO_ALL,
+			     &zones, &nr_zones);
+	if (ret)
+		goto err;
+
+	zs->zones = zbc_calloc(nr_zones ? nr_zones : 1,
+			       sizeof(struct zbc_zsum_zstate));
+	if (!zs->zones) {
+		ret = -ENOMEM;
+		goto err;
+	}
+
+	for (i = 0; i < nr_zones; i++) {
+		if (zbc_zone_start(&zones[i]) + zbc_zone_length(&zones[i]) > end)
+			break;
+		if (!zbc_zone_sequential(&zones[i]))
+			continue;
+		/* The zone must hold a header, a footer and some data */
+		if (zbc_zone_length(&zones[i]) <
+		    2 * ((zs->pbs >> 9) + zs->ftr_sectors)) {
+			zbc_error("%s: Zone %llu too small for zone summaries\n",
+				  dev->zbd_filename,
+				  zbc_zone_start(&zones[i]));
+			ret = -EINVAL;
+			goto err;
+		}
+		zs->zones[zs->nr_zones++].zone = zones[i];
+	}
+
+	if (!zs->nr_zones) {
+		zbc_error("%s: No sequential zone in sectors %llu..%llu\n",
+			  dev->zbd_filename,
+			  (unsigned long long)p->zmp_sector,
+			  (unsigned long long)end - 1);
+		ret = -EINVAL;
+		goto err;
+	}
+
+	zs->fbuf = zbc_memalign(sysconf(_SC_PAGESIZE), zs->ftr_size);
+	zs->zbuf = zbc_memalign(sysconf(_SC_PAGESIZE), ZBC_ZSUM_PAD_SIZE);
+	if (!zs->fbuf || !zs->zbuf) {
+		ret = -ENOMEM;
+		goto err;
+	}
+	memset(zs->zbuf, 0, ZBC_ZSUM_PAD_SIZE);
+	zs->nonce = (uint64_t)getpid() << 32;
+
+	zbc_free(zones);
+	*pzs = zs;
+
+	return 0;
+
+err:
+	zbc_free(zones);
+	zbc_zsum_close(zs);
+
+	return ret;
+}
+
+/**
+ * zbc_zsum_close - Close zone summaries
+ */
+void zbc_zsum_close(struct zbc_zsum *zs)
+{
+	unsigned int i;
+
+	if (!zs)
+		return;
+
+	for (i = 0; i < zs->nr_zones; i++)
+		zbc_free(zs->zones[i].sum);
+
+	pthread_mutex_destroy(&zs->lock);
+	zbc_free(zs->zbuf);
+	zbc_free(zs->fbuf);
+	zbc_free(zs->zones);
+	zbc_free(zs);
+}
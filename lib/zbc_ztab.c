@@ -0,0 +1,522 @@
+/*
+ * This file is part of libzbc.
+ *
+ * Copyright (C) 2009-2014, HGST, Inc. All rights reserved.
+ * Copyright (C) 2016, Western Digital. All rights reserved.
+ *
+ * This software is distributed under the terms of the BSD 2-clause license,
+ * "as is," without technical support, and WITHOUT ANY WARRANTY, without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE. You should have received a copy of the BSD 2-clause license along
+ * with libzbc. If not, see  <http://opensource.org/licenses/BSD-2-Clause>.
+ *
+ * Author: Damien Le Moal (damien.lemoal@wdc.com)
+ */
+
+#include "zbc.h"
+#include "libzbc/zbc_exec.h"
+
+#include <string.h>
+
+/**
+ * Zone table of a device opened with ZBC_O_LAZY_ZONES.
+ *
+ * The table is divided into chunks covering a fixed range of sectors of
+ * ZBC_REPORT_NOALLOC_NR_ZONES times the size of the first zone, so that a
+ * chunk is normally filled with a single report command. A chunk holds
+ * the zones starting in its range of sectors. Chunks are filled the first
+ * time they are accessed and dropped when the state of their zones cannot
+ * be tracked (e.g. a failed write or a zone operation other than a reset),
+ * to be filled again on the next access.
+ */
+struct zbc_ztab_chunk {
+	bool			loaded;
+	unsigned int		nr_zones;
+	struct zbc_zone		*zones;
+};
+
+struct zbc_ztab {
+	pthread_mutex_t		lock;
+	uint64_t		chunk_sectors;
+	unsigned int		nr_chunks;
+	struct zbc_ztab_chunk	*chunks;
+
+	/* Report buffer */
+	struct zbc_zone		*buf;
+
+	/* Background fill task */
+	struct zbc_exec_task	*task;
+};
+
+#define ZBC_ZTAB_NR_ZONES	ZBC_REPORT_NOALLOC_NR_ZONES
+
+/**
+ * Report zones starting from @sector into the table report buffer.
+ */
+static int zbc_ztab_report(struct zbc_device *dev, struct zbc_ztab *tab,
+			   uint64_t sector, unsigned int *nr_zones)
+{
+	unsigned long long start;
+	int ret;
+
+	*nr_zones = ZBC_ZTAB_NR_ZONES;
+	start = zbc_time_ns();
+	ret = (dev->zbd_drv->zbd_report_zones)(dev, sector,
+					       ZBC_RO_ALL | ZBC_RO_PARTIAL,
+					       tab->buf, nr_zones);
+	zbc_stats_account(dev, ZBC_STAT_REPORT_ZONES, start, 0, ret);
+	if (ret)
+		zbc_error("%s: Get zones from sector %llu failed %d (%s)\n",
+			  dev->zbd_filename, (unsigned long long)sector,
+			  ret, strerror(-ret));
+
+	return ret;
+}
+
+static void zbc_ztab_drop(struct zbc_ztab_chunk *chunk)
+{
+	zbc_free(chunk->zones);
+	chunk->zones = NULL;
+	chunk->nr_zones = 0;
+	chunk->loaded = false;
+}
+
+/**
+ * Fill a chunk of the table. Called with the table lock held.
+ */
+static int zbc_ztab_fill(struct zbc_device *dev, struct zbc_ztab *tab,
+			 unsigned int c)
+{
+	struct zbc_ztab_chunk *chunk = &tab->chunks[c];
+	uint64_t start = (uint64_t)c * tab->chunk_sectors;
+	uint64_t end = start + tab->chunk_sectors;
+	unsigned int i, n, nz = 0, max_nz = 0;
+	struct zbc_zone *zones = NULL, *z;
+	uint64_t sector = start;
+	int ret;
+
+	if (chunk->loaded)
+		return 0;
+
+	if (end > dev->zbd_info.zbd_sectors)
+		end = dev->zbd_info.zbd_sectors;
+
+	while (sector < end) {
+
+		ret = zbc_ztab_report(dev, tab, sector, &n);
+		if (ret)
+			goto err;
+		if (!n)
+			break;
+
+		if (nz + n > max_nz) {
+			max_nz = nz + n;
+			z = zbc_malloc(max_nz * sizeof(struct zbc_zone));
+			if (!z) {
+				ret = -ENOMEM;
+				goto err;
+			}
+			if (nz)
+				memcpy(z, zones, nz * sizeof(struct zbc_zone));
+			zbc_free(zones);
+			zones = z;
+		}
+
+		/* The first zone may belong to the previous chunk */
+		for (i = 0; i < n; i++) {
+			z = &tab->buf[i];
+			if (zbc_zone_start(z) >= end)
+				break;
+			if (zbc_zone_start(z) >= start)
+				zones[nz++] = *z;
+		}
+		if (i < n)
+			break;
+
+		sector = zbc_zone_start(&tab->buf[n - 1]) +
+			zbc_zone_length(&tab->buf[n - 1]);
+	}
+
+	chunk->zones = zones;
+	chunk->nr_zones = nz;
+	chunk->loaded = true;
+
+	return 0;
+
+err:
+	zbc_free(zones);
+	return ret;
+}
+
+/**
+ * Find the zone containing @sector. If @load is false, chunks that are not
+ * loaded are skipped. Called with the table lock held.
+ */
+static struct zbc_zone *zbc_ztab_find(struct zbc_device *dev,
+				      struct zbc_ztab *tab, uint64_t sector,
+				      bool load, unsigned int *pc,
+				      unsigned int *pi, int *err)
+{
+	struct zbc_ztab_chunk *chunk;
+	unsigned int lo, hi, mid;
+	int c, ret;
+
+	*err = 0;
+	if (sector >= dev->zbd_info.zbd_sectors)
+		return NULL;
+
+	for (c = sector / tab->chunk_sectors; c >= 0; c--) {
+
+		chunk = &tab->chunks[c];
+		if (!chunk->loaded) {
+			if (!load)
+				continue;
+			ret = zbc_ztab_fill(dev, tab, c);
+			if (ret) {
+				*err = ret;
+				return NULL;
+			}
+		}
+
+		if (!chunk->nr_zones ||
+		    zbc_zone_start(&chunk->zones[0]) > sector)
+			continue;
+
+		/* Last zone starting at or before sector */
+		lo = 0;
+		hi = chunk->nr_zones;
+		while (hi - lo > 1) {
+			mid = (lo + hi) / 2;
+			if (zbc_zone_start(&chunk->zones[mid]) <= sector)
+				lo = mid;
+			else
+				hi = mid;
+		}
+
+		if (sector >= zbc_zone_start(&chunk->zones[lo]) +
+		    zbc_zone_length(&chunk->zones[lo]))
+			return NULL;
+
+		if (pc)
+			*pc = c;
+		if (pi)
+			*pi = lo;
+
+		return &chunk->zones[lo];
+	}
+
+	return NULL;
+}
+
+static void zbc_ztab_fill_task(struct zbc_exec_task *task, void *arg)
+{
+	struct zbc_device *dev = arg;
+	struct zbc_ztab *tab = dev->zbd_ztab;
+	unsigned int c;
+	int ret;
+
+	for (c = 0; c < tab->nr_chunks; c++) {
+		if (zbc_exec_cancelled(task))
+			break;
+		pthread_mutex_lock(&tab->lock);
+		ret = zbc_ztab_fill(dev, tab, c);
+		pthread_mutex_unlock(&tab->lock);
+		if (ret)
+			break;
+	}
+}
+
+/**
+ * Set up the zone table of a device opened with ZBC_O_LAZY_ZONES: only the
+ * first zone is reported to size the table chunks.
+ */
+int zbc_ztab_init(struct zbc_device *dev, int flags)
+{
+	uint64_t sectors = dev->zbd_info.zbd_sectors;
+	struct zbc_zone zone;
+	struct zbc_ztab *tab;
+	unsigned int n = 1;
+	int ret;
+
+	ret = (dev->zbd_drv->zbd_report_zones)(dev, 0,
+					       ZBC_RO_ALL | ZBC_RO_PARTIAL,
+					       &zone, &n);
+	if (ret)
+		return ret;
+	if (!n || !zbc_zone_length(&zone))
+		return -EIO;
+
+	tab = zbc_calloc(1, sizeof(struct zbc_ztab));
+	if (!tab)
+		return -ENOMEM;
+
+	tab->chunk_sectors = zbc_zone_length(&zone) * ZBC_ZTAB_NR_ZONES;
+	tab->nr_chunks = (sectors + tab->chunk_sectors - 1) /
+		tab->chunk_sectors;
+	tab->chunks = zbc_calloc(tab->nr_chunks,
+				 sizeof(struct zbc_ztab_chunk));
+	tab->buf = zbc_calloc(ZBC_ZTAB_NR_ZONES, sizeof(struct zbc_zone));
+	if (!tab->chunks || !tab->buf) {
+		zbc_free(tab->chunks);
+		zbc_free(tab->buf);
+		zbc_free(tab);
+		return -ENOMEM;
+	}
+	pthread_mutex_init(&tab->lock, NULL);
+
+	dev->zbd_ztab = tab;
+
+	if ((flags & ZBC_O_ZONE_BGFILL) &&
+	    zbc_exec_submit(dev, ZBC_EXEC_PRIO_LOW, zbc_ztab_fill_task,
+			    dev, &tab->task))
+		tab->task = NULL;
+
+	return 0;
+}
+
+/**
+ * Free the zone table of a device.
+ */
+void zbc_ztab_exit(struct zbc_device *dev)
+{
+	struct zbc_ztab *tab = dev->zbd_ztab;
+	unsigned int c;
+
+	if (!tab)
+		return;
+
+	if (tab->task) {
+		zbc_exec_cancel(tab->task);
+		zbc_exec_wait(tab->task);
+	}
+
+	dev->zbd_ztab = NULL;
+	for (c = 0; c < tab->nr_chunks; c++)
+		zbc_free(tab->chunks[c].zones);
+	pthread_mutex_destroy(&tab->lock);
+	zbc_free(tab->chunks);
+	zbc_free(tab->buf);
+	zbc_free(tab);
+}
+
+/**
+ * Get the zone containing @sector from the table.
+ */
+int zbc_ztab_get_zone(struct zbc_device *dev, uint64_t sector,
+		      struct zbc_zone *zone)
+{
+	struct zbc_ztab *tab = dev->zbd_ztab;
+	struct zbc_zone *z;
+	int ret;
+
+	pthread_mutex_lock(&tab->lock);
+	z = zbc_ztab_find(dev, tab, sector, true, NULL, NULL, &ret);
+	if (z)
+		*zone = *z;
+	else if (!ret)
+		ret = -EINVAL;
+	pthread_mutex_unlock(&tab->lock);
+
+	return ret;
+}
+
+/**
+ * Report zones from the table (ZBC_RO_ALL reports only).
+ */
+int zbc_ztab_report_zones(struct zbc_device *dev, uint64_t sector,
+			  struct zbc_zone *zones, unsigned int *nr_zones)
+{
+	struct zbc_ztab *tab = dev->zbd_ztab;
+	struct zbc_ztab_chunk *chunk;
+	unsigned int c, i, n, nz = 0;
+	int ret = 0;
+
+	pthread_mutex_lock(&tab->lock);
+
+	if (!zbc_ztab_find(dev, tab, sector, true, &c, &i, &ret))
+		goto out;
+
+	while (nz < *nr_zones && c < tab->nr_chunks) {
+		ret = zbc_ztab_fill(dev, tab, c);
+		if (ret)
+			goto out;
+		chunk = &tab->chunks[c];
+		n = chunk->nr_zones - i;
+		if (n > *nr_zones - nz)
+			n = *nr_zones - nz;
+		memcpy(&zones[nz], &chunk->zones[i],
+		       n * sizeof(struct zbc_zone));
+		nz += n;
+		c++;
+		i = 0;
+	}
+
+out:
+	pthread_mutex_unlock(&tab->lock);
+	*nr_zones = nz;
+
+	return ret;
+}
+
+/**
+ * Drop the chunks of the zones of a range of sectors.
+ */
+static void zbc_ztab_drop_range(struct zbc_device *dev, struct zbc_ztab *tab,
+				uint64_t sector, uint64_t count)
+{
+	unsigned int c, i, last;
+	struct zbc_zone *z;
+	int ret;
+
+	if (sector >= dev->zbd_info.zbd_sectors)
+		return;
+	if (count > dev->zbd_info.zbd_sectors - sector)
+		count = dev->zbd_info.zbd_sectors - sector;
+
+	/* The chunk of the first zone may precede the chunk of sector */
+	z = zbc_ztab_find(dev, tab, sector, false, &c, &i, &ret);
+	if (!z)
+		c = sector / tab->chunk_sectors;
+	last = (sector + (count ? count - 1 : 0)) / tab->chunk_sectors;
+
+	for (; c <= last; c++)
+		zbc_ztab_drop(&tab->chunks[c]);
+}
+
+/**
+ * Account for the implicit open of a sequential write required zone: if
+ * the number of open zones reaches the device limit, the device may
+ * implicitly close any implicitly open zone, so drop the chunks holding
+ * implicitly open zones. Called with the table lock held.
+ */
+static void zbc_ztab_implicit_open(struct zbc_device *dev,
+				   struct zbc_ztab *tab)
+{
+	uint32_t max_open = dev->zbd_info.zbd_max_nr_open_seq_req;
+	struct zbc_ztab_chunk *chunk;
+	unsigned int c, i, nr_open = 0;
+
+	if (max_open == ZBC_NO_LIMIT || max_open == ZBC_NOT_REPORTED)
+		return;
+
+	for (c = 0; c < tab->nr_chunks; c++) {
+		chunk = &tab->chunks[c];
+		for (i = 0; i < chunk->nr_zones; i++) {
+			if (zbc_zone_sequential_req(&chunk->zones[i]) &&
+			    zbc_zone_is_open(&chunk->zones[i]))
+				nr_open++;
+		}
+	}
+
+	if (nr_open <= max_open)
+		return;
+
+	for (c = 0; c < tab->nr_chunks; c++) {
+		chunk = &tab->chunks[c];
+		for (i = 0; i < chunk->nr_zones; i++) {
+			if (zbc_zone_imp_open(&chunk->zones[i])) {
+				zbc_ztab_drop(chunk);
+				break;
+			}
+		}
+	}
+}
+
+/**
+ * Update the table after a write of @count sectors at @sector. A write at
+ * the write pointer of a sequential zone moves the write pointer and
+ * opens the zone implicitly, or makes the zone full if the write ends at
+ * the end of the zone. Other changes (failed writes, writes not at the
+ * write pointer or crossing the zone end) drop the chunk of the zone.
+ */
+void zbc_ztab_write(struct zbc_device *dev, uint64_t sector, size_t count,
+		    bool error)
+{
+	struct zbc_ztab *tab = dev->zbd_ztab;
+	struct zbc_zone *z;
+	uint64_t end;
+	bool opened;
+	int ret;
+
+	pthread_mutex_lock(&tab->lock);
+
+	z = zbc_ztab_find(dev, tab, sector, false, NULL, NULL, &ret);
+	if (!z)
+		goto out;
+
+	end = zbc_zone_start(z) + zbc_zone_length(z);
+	if (zbc_zone_conventional(z) && sector + count <= end)
+		goto out;
+
+	if (error || !zbc_zone_sequential(z) || zbc_zone_wp(z) != sector ||
+	    sector + count > end ||
+	    !(zbc_zone_empty(z) || zbc_zone_closed(z) ||
+	      zbc_zone_is_open(z))) {
+		zbc_ztab_drop_range(dev, tab, sector, count);
+		goto out;
+	}
+
+	opened = !zbc_zone_is_open(z);
+	if (sector + count == end) {
+		/* Same write pointer as reported by the device driver */
+		z->zbz_condition = ZBC_ZC_FULL;
+		z->zbz_write_pointer = end;
+		goto out;
+	}
+
+	z->zbz_write_pointer = sector + count;
+	if (opened) {
+		z->zbz_condition = ZBC_ZC_IMP_OPEN;
+		if (zbc_zone_sequential_req(z))
+			zbc_ztab_implicit_open(dev, tab);
+	}
+
+out:
+	pthread_mutex_unlock(&tab->lock);
+}
+
+/**
+ * Update the table after a zone operation.
+ */
+void zbc_ztab_zone_op(struct zbc_device *dev, uint64_t sector,
+		      uint64_t count, enum zbc_zone_op op, unsigned int flags,
+		      bool error)
+{
+	struct zbc_ztab *tab = dev->zbd_ztab;
+	struct zbc_zone *z;
+	unsigned int c;
+	int ret;
+
+	pthread_mutex_lock(&tab->lock);
+
+	if (flags & ZBC_OP_ALL_ZONES) {
+		for (c = 0; c < tab->nr_chunks; c++)
+			zbc_ztab_drop(&tab->chunks[c]);
+		goto out;
+	}
+
+	z = zbc_ztab_find(dev, tab, sector, false, NULL, NULL, &ret);
+	if (z && !error && op == ZBC_OP_RESET_ZONE &&
+	    count <= zbc_zone_length(z)) {
+		if (!zbc_zone_conventional(z)) {
+			z->zbz_condition = ZBC_ZC_EMPTY;
+			z->zbz_write_pointer = zbc_zone_start(z);
+			z->zbz_attributes &= ~ZBC_ZA_RWP_RECOMMENDED;
+		}
+		goto out;
+	}
+
+	zbc_ztab_drop_range(dev, tab, sector, count ? count : 1);
+
+out:
+	pthread_mutex_unlock(&tab->lock);
+}
+
+/**
+ * Drop all the chunks of the table (emulated device reconfiguration).
+ */
+void zbc_ztab_invalidate(struct zbc_device *dev)
+{
+	zbc_ztab_zone_op(dev, 0, 0, ZBC_OP_RESET_ZONE, ZBC_OP_ALL_ZONES,
+			 true);
+}
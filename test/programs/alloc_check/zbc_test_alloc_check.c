@@ -0,0 +1,288 @@
+/*
+ * This file is part of libzbc.
+ *
+ * Copyright (C) 2009-2014, HGST, Inc. All rights reserved.
+ * Copyright (C) 2016, Western Digital. All rights reserved.
+ *
+ * This software is distributed under the terms of the BSD 2-clause license,
+ * "as is," without technical support, and WITHOUT ANY WARRANTY, without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE. You should have received a copy of the BSD 2-clause license along
+ * with libzbc. If not, see  <http://opensource.org/licenses/BSD-2-Clause>.
+ *
+ * Author: Damien Le Moal (damien.lemoal@wdc.com)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include "libzbc/zbc.h"
+#include "zbc_private.h"
+
+/**
+ * Allocations counted while the check is armed: calls to the library
+ * allocator and, with the GNU C library, all calls to malloc & co.
+ */
+static int armed;
+static unsigned int nr_alloc_calls;
+
+/**
+ * Maximum size of the I/Os, large enough to span several stripe units of
+ * a striped emulated device.
+ */
+#define ZBC_TEST_IO_SIZE	(256 * 1024)
+
+#define zbc_test_count_alloc()						\
+	do {								\
+		if (__atomic_load_n(&armed, __ATOMIC_RELAXED))		\
+			__atomic_fetch_add(&nr_alloc_calls, 1,		\
+					   __ATOMIC_RELAXED);		\
+	} while (0)
+
+#ifdef __GLIBC__
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t align, size_t size);
+
+void *malloc(size_t size)
+{
+	zbc_test_count_alloc();
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	zbc_test_count_alloc();
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	zbc_test_count_alloc();
+	return __libc_realloc(ptr, size);
+}
+
+int posix_memalign(void **ptr, size_t align, size_t size)
+{
+	zbc_test_count_alloc();
+	*ptr = __libc_memalign(align, size);
+	return *ptr ? 0 : ENOMEM;
+}
+
+#endif
+
+static void *zbc_test_malloc(void *priv, size_t size)
+{
+	zbc_test_count_alloc();
+	return malloc(size);
+}
+
+static void *zbc_test_memalign(void *priv, size_t align, size_t size)
+{
+	void *ptr;
+
+	zbc_test_count_alloc();
+	if (posix_memalign(&ptr, align, size))
+		return NULL;
+
+	return ptr;
+}
+
+static void zbc_test_free(void *priv, void *ptr)
+{
+	free(ptr);
+}
+
+static struct zbc_allocator zbc_test_allocator = {
+	.za_malloc	= zbc_test_malloc,
+	.za_memalign	= zbc_test_memalign,
+	.za_free	= zbc_test_free,
+};
+
+/**
+ * Execute the operations that must not allocate memory on a zone.
+ */
+static int zbc_test_ops(struct zbc_device *dev, uint64_t sector,
+			void *iobuf, size_t count, struct zbc_zone *zones,
+			const char **op)
+{
+	unsigned int nr_zones;
+	ssize_t ret;
+
+	*op = "reset zone";
+	ret = zbc_reset_zone(dev, sector, 0);
+	if (ret)
+		return ret;
+
+	*op = "write";
+	ret = zbc_pwrite(dev, iobuf, count, sector);
+	if (ret < 0)
+		return ret;
+
+	*op = "read";
+	ret = zbc_pread(dev, iobuf, count, sector);
+	if (ret < 0)
+		return ret;
+
+	*op = "flush";
+	ret = zbc_flush(dev);
+	if (ret)
+		return ret;
+
+	*op = "report zones";
+	nr_zones = 1;
+	ret = zbc_report_zones(dev, sector, ZBC_RO_ALL, zones, &nr_zones);
+	if (ret)
+		return ret;
+	nr_zones = ZBC_REPORT_NOALLOC_NR_ZONES;
+	ret = zbc_report_zones(dev, 0, ZBC_RO_ALL, zones, &nr_zones);
+	if (ret)
+		return ret;
+
+	*op = "close zone";
+	ret = zbc_close_zone(dev, sector, 0);
+	if (ret)
+		return ret;
+
+	*op = "open zone";
+	ret = zbc_open_zone(dev, sector, 0);
+	if (ret)
+		return ret;
+
+	*op = "finish zone";
+	ret = zbc_finish_zone(dev, sector, 0);
+	if (ret)
+		return ret;
+
+	*op = "reset zone";
+	return zbc_reset_zone(dev, sector, 0);
+}
+
+int main(int argc, char **argv)
+{
+	struct zbc_device_info info;
+	struct zbc_device *dev;
+	struct zbc_zone *zones = NULL;
+	void *iobuf = NULL;
+	unsigned int oflags, nr_zones = 1;
+	size_t iosize = ZBC_TEST_IO_SIZE;
+	long long lba;
+	const char *op;
+	char *path;
+	int i, ret;
+
+	/* Check command line */
+	if (argc < 3 || argc > 4) {
+		printf("Usage: %s [-v] <dev> <lba>\n"
+		       "  Check that I/O, flush, zone operations and bounded\n"
+		       "  zone reports on the zone starting at <lba> do not\n"
+		       "  allocate memory\n"
+		       "Options:\n"
+		       "  -v : Verbose mode\n",
+		       argv[0]);
+		return 1;
+	}
+
+	if (argc == 4) {
+		if (strcmp(argv[1], "-v") == 0) {
+			zbc_set_log_level("debug");
+		} else {
+			printf("Unknown option \"%s\"\n", argv[1]);
+			return 1;
+		}
+		path = argv[2];
+		lba = atoll(argv[3]);
+	} else {
+		path = argv[1];
+		lba = atoll(argv[2]);
+	}
+
+	ret = zbc_set_allocator(&zbc_test_allocator);
+	if (ret != 0) {
+		fprintf(stderr, "[TEST][ERROR],set allocator failed %d\n",
+			ret);
+		return 1;
+	}
+
+	/* Open device */
+	oflags = ZBC_O_DEVTEST;
+	oflags |= ZBC_O_DRV_ATA | ZBC_O_DRV_FAKE;
+	if (!getenv("ZBC_TEST_FORCE_ATA"))
+		oflags |= ZBC_O_DRV_SCSI;
+
+	ret = zbc_open(path, oflags | O_RDWR, &dev);
+	if (ret != 0) {
+		fprintf(stderr, "[TEST][ERROR],open device failed %d\n",
+			ret);
+		printf("[TEST][ERROR][SENSE_KEY],open-device-failed\n");
+		printf("[TEST][ERROR][ASC_ASCQ],open-device-failed\n");
+		return 1;
+	}
+
+	zbc_get_device_info(dev, &info);
+
+	zones = calloc(ZBC_REPORT_NOALLOC_NR_ZONES, sizeof(struct zbc_zone));
+	ret = posix_memalign(&iobuf, info.zbd_pblock_size, iosize);
+	if (!zones || ret != 0) {
+		fprintf(stderr, "[TEST][ERROR],No memory\n");
+		ret = 1;
+		goto out;
+	}
+	memset(iobuf, 0, iosize);
+
+	/* Do not write past the end of the zone */
+	ret = zbc_report_zones(dev, zbc_lba2sect(&info, lba), ZBC_RO_ALL,
+			       zones, &nr_zones);
+	if (ret || !nr_zones) {
+		fprintf(stderr, "[TEST][ERROR],report zones failed %d\n",
+			ret);
+		ret = 1;
+		goto out;
+	}
+	if (iosize > zbc_zone_length(&zones[0]) << 9)
+		iosize = zbc_zone_length(&zones[0]) << 9;
+
+	/*
+	 * The first pass initializes the C library state (stdio buffers...),
+	 * the second pass must not allocate anything.
+	 */
+	for (i = 0; i < 2; i++) {
+		__atomic_store_n(&armed, i, __ATOMIC_RELAXED);
+		ret = zbc_test_ops(dev, zbc_lba2sect(&info, lba),
+				   iobuf, iosize >> 9, zones, &op);
+		__atomic_store_n(&armed, 0, __ATOMIC_RELAXED);
+		if (ret) {
+			struct zbc_errno zbc_err;
+			const char *sk_name;
+			const char *ascq_name;
+
+			fprintf(stderr,
+				"[TEST][ERROR],%s failed %d\n",
+				op, ret);
+
+			zbc_errno(dev, &zbc_err);
+			sk_name = zbc_sk_str(zbc_err.sk);
+			ascq_name = zbc_asc_ascq_str(zbc_err.asc_ascq);
+
+			printf("[TEST][ERROR][SENSE_KEY],%s\n", sk_name);
+			printf("[TEST][ERROR][ASC_ASCQ],%s\n", ascq_name);
+			ret = 1;
+			goto out;
+		}
+	}
+
+	printf("[TEST][ALLOC_CALLS],%u\n", nr_alloc_calls);
+	ret = 0;
+
+out:
+	free(iobuf);
+	free(zones);
+	zbc_close(dev);
+
+	return ret;
+}
@@ -0,0 +1,82 @@
+/*
+ * This file is part of libzbc.
+ *
+ * Copyright (C) 2009-2014, HGST, Inc. All rights reserved.
+ * Copyright (C) 2016, Western Digital. All rights reserved.
+ *
+ * This software is distributed under the terms of the BSD 2-clause license,
+ * "as is," without technical support, and WITHOUT ANY WARRANTY, without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE. You should have received a copy of the BSD 2-clause license along
+ * with libzbc. If not, see  <http://opensource.org/licenses/BSD-2-Clause>.
+ *
+ * Author: Damien Le Moal (damien.lemoal@wdc.com)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libzbc/zbc.h"
+#include "zbc_private.h"
+
+/**
+ * Expected byte 1 of the READ 16 and WRITE 16 CDBs for each combination
+ * of cache hints: DPO is always set, as for I/Os without hints.
+ */
+static struct zbc_test_cdb_flags {
+	const char	*name;
+	unsigned int	hints;
+	uint8_t		flags;
+} zbc_test_cdb_cases[] = {
+	{ "none",	0,				0x10 },
+	{ "dpo",	ZBC_IO_DPO,			0x10 },
+	{ "fua",	ZBC_IO_FUA,			0x18 },
+	{ "dpo-fua",	ZBC_IO_DPO | ZBC_IO_FUA,	0x18 },
+};
+
+int main(int argc, char **argv)
+{
+	struct zbc_io_hints hints;
+	unsigned int i;
+	uint8_t flags;
+	int ret = 0;
+
+	/* Check command line */
+	if (argc > 3) {
+		printf("Usage: %s [-v] [<dev>]\n"
+		       "  Check the DPO and FUA bits of the SCSI READ 16 and\n"
+		       "  WRITE 16 commands issued with and without cache hints\n"
+		       "Options:\n"
+		       "  -v : Verbose mode\n",
+		       argv[0]);
+		return 1;
+	}
+
+	if (argc > 1 && strcmp(argv[1], "-v") == 0)
+		zbc_set_log_level("debug");
+
+	for (i = 0; i < sizeof(zbc_test_cdb_cases) /
+		     sizeof(zbc_test_cdb_cases[0]); i++) {
+
+		memset(&hints, 0, sizeof(hints));
+		hints.zih_flags = zbc_test_cdb_cases[i].hints;
+		flags = zbc_scsi_rw_cdb_flags(&hints);
+
+		printf("[TEST][CDB_FLAGS],%s,0x%02x\n",
+		       zbc_test_cdb_cases[i].name, flags);
+
+		if (flags != zbc_test_cdb_cases[i].flags) {
+			fprintf(stderr,
+				"[TEST][ERROR],%s hints: CDB flags 0x%02x, "
+				"expected 0x%02x\n",
+				zbc_test_cdb_cases[i].name, flags,
+				zbc_test_cdb_cases[i].flags);
+			printf("[TEST][ERROR][SENSE_KEY],cdb-flags-mismatch\n");
+			printf("[TEST][ERROR][ASC_ASCQ],cdb-flags-mismatch\n");
+			ret = 1;
+		}
+	}
+
+	return ret;
+}
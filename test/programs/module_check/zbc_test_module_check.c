@@ -0,0 +1,877 @@
+/*
+ * This file is part of libzbc.
+ *
+ * Copyright (C) 2009-2014, HGST, Inc. All rights reserved.
+ * Copyright (C) 2016, Western Digital. All rights reserved.
+ *
+ * This software is distributed under the terms of the BSD 2-clause license,
+ * "as is," without technical support, and WITHOUT ANY WARRANTY, without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE. You should have received a copy of the BSD 2-clause license along
+ * with libzbc. If not, see  <http://opensource.org/licenses/BSD-2-Clause>.
+ *
+ * Author: Damien Le Moal (damien.lemoal@wdc.com)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+
+#include "libzbc/zbc.h"
+#include "libzbc/zbc_btree.h"
+#include "libzbc/zbc_hybrid.h"
+#include "libzbc/zbc_log.h"
+#include "libzbc/zbc_sb.h"
+#include "libzbc/zbc_slab.h"
+#include "libzbc/zbc_zsum.h"
+#include "zbc_private.h"
+
+/**
+ * Emulated device: 64 MiB with 1 MiB zones, the first 8 zones being
+ * conventional. Modules keep their metadata at the beginning of the
+ * conventional zones and their data in the sequential zones.
+ */
+#define ZBC_TEST_DEV_SIZE	(64ULL * 1024 * 1024)
+#define ZBC_TEST_ZONE_SECTORS	2048ULL
+#define ZBC_TEST_CONV_SECTORS	(8 * ZBC_TEST_ZONE_SECTORS)
+#define ZBC_TEST_SEQ_SECTOR	ZBC_TEST_CONV_SECTORS
+
+#define ZBC_TEST_BLOCK_SIZE	4096
+
+/**
+ * Step of the check being executed, reported on failure.
+ */
+static const char *zbc_test_step;
+
+#define zbc_test_check(cond, step)					\
+	do {								\
+		zbc_test_step = (step);					\
+		if (!(cond)) {						\
+			ret = -EIO;					\
+			goto out;					\
+		}							\
+	} while (0)
+
+#define zbc_test_call(call, step)					\
+	do {								\
+		zbc_test_step = (step);					\
+		ret = (call);						\
+		if (ret < 0)						\
+			goto out;					\
+	} while (0)
+
+/**
+ * Fill a buffer with a pattern depending on @seed.
+ */
+static void zbc_test_fill(void *buf, size_t len, unsigned int seed)
+{
+	uint32_t *p = buf;
+	size_t i;
+
+	for (i = 0; i < len / sizeof(uint32_t); i++)
+		p[i] = seed * 0x9e3779b9U + i;
+}
+
+/**
+ * Check that a buffer holds the pattern of @seed.
+ */
+static bool zbc_test_match(const void *buf, size_t len, unsigned int seed)
+{
+	const uint32_t *p = buf;
+	size_t i;
+
+	for (i = 0; i < len / sizeof(uint32_t); i++) {
+		if (p[i] != seed * 0x9e3779b9U + i)
+			return false;
+	}
+
+	return true;
+}
+
+static void *zbc_test_alloc(size_t size)
+{
+	void *buf;
+
+	if (posix_memalign(&buf, ZBC_TEST_BLOCK_SIZE, size))
+		return NULL;
+	memset(buf, 0, size);
+
+	return buf;
+}
+
+/*
+ * Superblock: update and commit, then check the committed data.
+ */
+#define ZBC_TEST_SB_LEN		256
+
+static uint64_t zbc_test_sb_version;
+
+static struct zbc_sb_params zbc_test_sb_params = {
+	.zkp_sector	= 0,
+};
+
+static int zbc_test_sb_write(struct zbc_device *dev, const char *path)
+{
+	uint32_t data[ZBC_TEST_SB_LEN / sizeof(uint32_t)];
+	struct zbc_sb *sb = NULL;
+	int ret;
+
+	zbc_test_call(zbc_sb_open(dev, &zbc_test_sb_params, &sb), "open");
+
+	zbc_test_fill(data, sizeof(data), 1);
+	zbc_test_call(zbc_sb_update(sb, data, sizeof(data),
+				    &zbc_test_sb_version), "update");
+	zbc_test_call(zbc_sb_commit(sb, zbc_test_sb_version), "commit");
+
+out:
+	if (sb)
+		zbc_sb_close(sb);
+
+	return ret;
+}
+
+static int zbc_test_sb_verify(struct zbc_device *dev, const char *path)
+{
+	uint32_t data[ZBC_TEST_SB_LEN / sizeof(uint32_t)];
+	struct zbc_sb *sb = NULL;
+	uint64_t version;
+	size_t len;
+	int ret;
+
+	zbc_test_call(zbc_sb_open(dev, &zbc_test_sb_params, &sb), "reopen");
+
+	len = zbc_sb_get(sb, data, sizeof(data), &version);
+	zbc_test_check(len == sizeof(data) &&
+		       version == zbc_test_sb_version, "version");
+	zbc_test_check(zbc_test_match(data, sizeof(data), 1), "data");
+
+out:
+	if (sb)
+		zbc_sb_close(sb);
+
+	return ret;
+}
+
+/*
+ * Slab allocator: format, allocate and write blocks, free some of them
+ * and sync, then check the data and the state of the blocks.
+ */
+#define ZBC_TEST_SLAB_NR_BLOCKS	32
+
+static uint64_t zbc_test_slab_sector[ZBC_TEST_SLAB_NR_BLOCKS];
+static size_t zbc_test_slab_size[ZBC_TEST_SLAB_NR_BLOCKS];
+
+static struct zbc_slab_params zbc_test_slab_params = {
+	.zcp_sector	= 0,
+	.zcp_nr_sectors	= ZBC_TEST_CONV_SECTORS,
+	.zcp_slab_size	= 64 * 1024,
+	.zcp_max_size	= 16 * 1024,
+};
+
+static inline bool zbc_test_slab_freed(unsigned int i)
+{
+	return (i % 4) == 3;
+}
+
+static int zbc_test_slab_write(struct zbc_device *dev, const char *path)
+{
+	struct zbc_slab_params params = zbc_test_slab_params;
+	struct zbc_slab *slab = NULL;
+	void *buf = NULL;
+	unsigned int i;
+	ssize_t size;
+	int ret;
+
+	/* A range never used must be formatted explicitly */
+	zbc_test_step = "open-unformatted";
+	ret = zbc_slab_open(dev, &params, &slab);
+	if (ret != -EINVAL) {
+		if (!ret)
+			zbc_slab_close(slab);
+		slab = NULL;
+		ret = -EIO;
+		goto out;
+	}
+
+	params.zcp_flags = ZBC_SLAB_FORMAT;
+	zbc_test_call(zbc_slab_open(dev, &params, &slab), "format");
+
+	buf = zbc_test_alloc(params.zcp_max_size);
+	zbc_test_check(buf, "alloc-buffer");
+
+	for (i = 0; i < ZBC_TEST_SLAB_NR_BLOCKS; i++) {
+		zbc_test_step = "alloc";
+		size = zbc_slab_alloc(slab, ZBC_TEST_BLOCK_SIZE << (i % 3),
+				      &zbc_test_slab_sector[i]);
+		if (size < 0) {
+			ret = size;
+			goto out;
+		}
+		zbc_test_slab_size[i] = size;
+		zbc_test_fill(buf, size, i);
+		zbc_test_call(zbc_slab_write(slab, zbc_test_slab_sector[i],
+					     buf), "write");
+	}
+
+	for (i = 0; i < ZBC_TEST_SLAB_NR_BLOCKS; i++) {
+		if (zbc_test_slab_freed(i))
+			zbc_test_call(zbc_slab_free(slab,
+						zbc_test_slab_sector[i]),
+				      "free");
+	}
+
+	zbc_test_call(zbc_slab_sync(slab), "sync");
+
+out:
+	if (slab)
+		zbc_slab_close(slab);
+	free(buf);
+
+	return ret;
+}
+
+static int zbc_test_slab_verify(struct zbc_device *dev, const char *path)
+{
+	struct zbc_slab *slab = NULL;
+	void *buf = NULL;
+	unsigned int i;
+	int ret;
+
+	zbc_test_call(zbc_slab_open(dev, &zbc_test_slab_params, &slab),
+		      "reopen");
+
+	buf = zbc_test_alloc(zbc_test_slab_params.zcp_max_size);
+	zbc_test_check(buf, "alloc-buffer");
+
+	for (i = 0; i < ZBC_TEST_SLAB_NR_BLOCKS; i++) {
+		if (zbc_test_slab_freed(i)) {
+			/* Freed blocks are not allocated anymore */
+			zbc_test_check(zbc_slab_read(slab,
+						     zbc_test_slab_sector[i],
+						     buf) == -EINVAL,
+				       "freed-block");
+			continue;
+		}
+		zbc_test_call(zbc_slab_read(slab, zbc_test_slab_sector[i],
+					    buf), "read");
+		zbc_test_check(zbc_test_match(buf, zbc_test_slab_size[i], i),
+			       "data");
+	}
+
+out:
+	if (slab)
+		zbc_slab_close(slab);
+	free(buf);
+
+	return ret;
+}
+
+/*
+ * B+tree: insert and delete keys and commit, then look up all keys and
+ * iterate over the tree.
+ */
+#define ZBC_TEST_BTREE_NR_KEYS	4096
+
+static struct zbc_btree_params zbc_test_btree_params = {
+	.ztp_sector	= ZBC_TEST_SEQ_SECTOR,
+	.ztp_nr_sectors	= 16 * ZBC_TEST_ZONE_SECTORS,
+	.ztp_root_sector = 0,
+};
+
+static inline uint64_t zbc_test_btree_key(unsigned int i)
+{
+	return (uint64_t)i * 7;
+}
+
+static inline uint64_t zbc_test_btree_val(unsigned int i)
+{
+	return (uint64_t)i * 0x9e3779b97f4a7c15ULL;
+}
+
+static inline bool zbc_test_btree_deleted(unsigned int i)
+{
+	return (i % 5) == 4;
+}
+
+static int zbc_test_btree_write(struct zbc_device *dev, const char *path)
+{
+	struct zbc_btree *tree = NULL;
+	unsigned int i;
+	uint64_t val;
+	int ret;
+
+	zbc_test_call(zbc_btree_open(dev, &zbc_test_btree_params, &tree),
+		      "open");
+
+	for (i = 0; i < ZBC_TEST_BTREE_NR_KEYS; i++) {
+		val = zbc_test_btree_val(i);
+		zbc_test_call(zbc_btree_put(tree, zbc_test_btree_key(i), &val),
+			      "put");
+	}
+
+	for (i = 0; i < ZBC_TEST_BTREE_NR_KEYS; i++) {
+		if (zbc_test_btree_deleted(i))
+			zbc_test_call(zbc_btree_delete(tree,
+						zbc_test_btree_key(i)),
+				      "delete");
+	}
+
+	zbc_test_call(zbc_btree_commit(tree), "commit");
+
+out:
+	if (tree)
+		zbc_btree_close(tree);
+
+	return ret;
+}
+
+static int zbc_test_btree_verify(struct zbc_device *dev, const char *path)
+{
+	struct zbc_btree *tree = NULL;
+	uint64_t key = 0, next, val;
+	unsigned int i, nr_keys = 0;
+	int ret;
+
+	zbc_test_call(zbc_btree_open(dev, &zbc_test_btree_params, &tree),
+		      "reopen");
+
+	for (i = 0; i < ZBC_TEST_BTREE_NR_KEYS; i++) {
+		ret = zbc_btree_get(tree, zbc_test_btree_key(i), &val);
+		if (zbc_test_btree_deleted(i)) {
+			zbc_test_check(ret == -ENOENT, "deleted-key");
+			continue;
+		}
+		zbc_test_check(!ret && val == zbc_test_btree_val(i), "get");
+		nr_keys++;
+	}
+
+	/* Iterate: all keys are found in order */
+	i = 0;
+	while (!(ret = zbc_btree_next(tree, key, &next, &val))) {
+		while (zbc_test_btree_deleted(i))
+			i++;
+		zbc_test_check(next == zbc_test_btree_key(i) &&
+			       val == zbc_test_btree_val(i), "next");
+		key = next + 1;
+		i++;
+		nr_keys--;
+	}
+	zbc_test_check(ret == -ENOENT && !nr_keys, "iterate");
+	ret = 0;
+
+out:
+	if (tree)
+		zbc_btree_close(tree);
+
+	return ret;
+}
+
+/*
+ * Log: append messages to 2 partitions and commit a consumer cursor,
+ * then fetch all messages and check the cursor.
+ */
+#define ZBC_TEST_LOG_NR_PARTS	2
+#define ZBC_TEST_LOG_NR_MSGS	2000
+#define ZBC_TEST_LOG_MSG_SIZE	256
+#define ZBC_TEST_LOG_BUF_SIZE	(256 * 1024)
+
+static uint64_t zbc_test_log_first[ZBC_TEST_LOG_NR_PARTS];
+static uint64_t zbc_test_log_cursor;
+
+static struct zbc_log_params zbc_test_log_params = {
+	.zlp_sector		= ZBC_TEST_SEQ_SECTOR,
+	.zlp_nr_sectors		= 16 * ZBC_TEST_ZONE_SECTORS,
+	.zlp_nr_partitions	= ZBC_TEST_LOG_NR_PARTS,
+	.zlp_nr_cursors		= 1,
+	.zlp_cursor_sector	= 0,
+	.zlp_batch_size		= 64 * 1024,
+};
+
+static inline size_t zbc_test_log_msg_len(unsigned int i)
+{
+	return 4 + (i % (ZBC_TEST_LOG_MSG_SIZE / 4)) * 4;
+}
+
+static int zbc_test_log_write(struct zbc_device *dev, const char *path)
+{
+	uint32_t msg[ZBC_TEST_LOG_MSG_SIZE / sizeof(uint32_t)];
+	struct zbc_log *log = NULL;
+	unsigned int i, part;
+	uint64_t offset;
+	int ret;
+
+	zbc_test_call(zbc_log_open(dev, &zbc_test_log_params, &log), "open");
+
+	for (i = 0; i < ZBC_TEST_LOG_NR_MSGS; i++) {
+		part = i % ZBC_TEST_LOG_NR_PARTS;
+		zbc_test_fill(msg, zbc_test_log_msg_len(i), i);
+		zbc_test_call(zbc_log_append(log, part, msg,
+					     zbc_test_log_msg_len(i), &offset),
+			      "append");
+		if (i < ZBC_TEST_LOG_NR_PARTS)
+			zbc_test_log_first[part] = offset;
+		if (i == ZBC_TEST_LOG_NR_MSGS / 2 + 1)
+			zbc_test_log_cursor = offset;
+	}
+
+	for (part = 0; part < ZBC_TEST_LOG_NR_PARTS; part++)
+		zbc_test_call(zbc_log_flush(log, part), "flush");
+
+	zbc_test_call(zbc_log_cursor_commit(log, 0, 1, zbc_test_log_cursor),
+		      "cursor-commit");
+
+out:
+	if (log)
+		zbc_log_close(log);
+
+	return ret;
+}
+
+static int zbc_test_log_verify(struct zbc_device *dev, const char *path)
+{
+	struct zbc_log_msg msgs[ZBC_TEST_LOG_BUF_SIZE / 512];
+	uint64_t first, next, offset;
+	struct zbc_log *log = NULL;
+	unsigned int i, k, n, part;
+	void *buf;
+	int ret;
+
+	buf = zbc_test_alloc(ZBC_TEST_LOG_BUF_SIZE);
+	zbc_test_check(buf, "alloc-buffer");
+
+	zbc_test_call(zbc_log_open(dev, &zbc_test_log_params, &log),
+		      "reopen");
+
+	for (part = 0; part < ZBC_TEST_LOG_NR_PARTS; part++) {
+
+		zbc_test_call(zbc_log_offsets(log, part, &first, &next),
+			      "offsets");
+		zbc_test_check(first == zbc_test_log_first[part] &&
+			       next - first ==
+			       ZBC_TEST_LOG_NR_MSGS / ZBC_TEST_LOG_NR_PARTS,
+			       "offsets");
+
+		/* Messages i, i + NR_PARTS, ... of the partition */
+		i = part;
+		offset = first;
+		while (offset < next) {
+			n = sizeof(msgs) / sizeof(msgs[0]);
+			zbc_test_call(zbc_log_fetch(log, part, offset, buf,
+						    ZBC_TEST_LOG_BUF_SIZE,
+						    msgs, &n), "fetch");
+			zbc_test_check(n, "fetch");
+			for (k = 0; k < n; k++) {
+				zbc_test_check(msgs[k].zlm_offset == offset &&
+					msgs[k].zlm_len ==
+					zbc_test_log_msg_len(i) &&
+					zbc_test_match(msgs[k].zlm_data,
+						       msgs[k].zlm_len, i),
+					"data");
+				offset++;
+				i += ZBC_TEST_LOG_NR_PARTS;
+			}
+		}
+	}
+
+	zbc_test_call(zbc_log_cursor_get(log, 0, 1, &offset), "cursor-get");
+	zbc_test_check(offset == zbc_test_log_cursor, "cursor");
+
+out:
+	if (log)
+		zbc_log_close(log);
+	free(buf);
+
+	return ret;
+}
+
+/*
+ * Zone summaries: fill and seal a zone and partially write another one,
+ * then recover the summaries and check the data.
+ */
+#define ZBC_TEST_ZSUM_NR_RECS	100
+#define ZBC_TEST_ZSUM_NR_OPEN	10
+#define ZBC_TEST_ZSUM_REC_SECTORS (ZBC_TEST_BLOCK_SIZE >> 9)
+
+static struct zbc_zsum_params zbc_test_zsum_params = {
+	.zmp_sector		= ZBC_TEST_SEQ_SECTOR,
+	.zmp_nr_sectors		= 4 * ZBC_TEST_ZONE_SECTORS,
+	.zmp_summary_size	= 4096,
+};
+
+static inline uint64_t zbc_test_zsum_zone(unsigned int z)
+{
+	return ZBC_TEST_SEQ_SECTOR + z * ZBC_TEST_ZONE_SECTORS;
+}
+
+static int zbc_test_zsum_write(struct zbc_device *dev, const char *path)
+{
+	struct zbc_zsum *zs = NULL;
+	unsigned int i, nr_recs;
+	uint64_t sum, z;
+	void *buf;
+	int ret;
+
+	buf = zbc_test_alloc(ZBC_TEST_BLOCK_SIZE);
+	zbc_test_check(buf, "alloc-buffer");
+
+	zbc_test_call(zbc_zsum_open(dev, &zbc_test_zsum_params, &zs), "open");
+
+	/* Zone 0 is sealed, zone 1 is left open */
+	for (z = 0; z < 2; z++) {
+		nr_recs = z ? ZBC_TEST_ZSUM_NR_OPEN : ZBC_TEST_ZSUM_NR_RECS;
+		for (i = 0; i < nr_recs; i++) {
+			sum = z * 1000 + i;
+			zbc_test_fill(buf, ZBC_TEST_BLOCK_SIZE, sum);
+			zbc_test_call(zbc_zsum_append(zs, zbc_test_zsum_zone(z),
+						buf, ZBC_TEST_ZSUM_REC_SECTORS,
+						&sum, sizeof(sum), NULL),
+				      "append");
+		}
+	}
+
+	zbc_test_call(zbc_zsum_finish(zs, zbc_test_zsum_zone(0)), "finish");
+
+out:
+	if (zs)
+		zbc_zsum_close(zs);
+	free(buf);
+
+	return ret;
+}
+
+struct zbc_test_zsum_rec {
+	struct zbc_device	*dev;
+	void			*buf;
+	unsigned int		nr_zones;
+};
+
+static int zbc_test_zsum_check_zone(struct zbc_zsum *zs,
+				    struct zbc_zsum_zone *zone,
+				    const void *summary, void *priv)
+{
+	struct zbc_test_zsum_rec *rec = priv;
+	const uint64_t *sum = summary;
+	unsigned int z, i, nr_recs;
+	ssize_t ret;
+
+	z = (zone->zsz_start - ZBC_TEST_SEQ_SECTOR) / ZBC_TEST_ZONE_SECTORS;
+	nr_recs = z ? ZBC_TEST_ZSUM_NR_OPEN : ZBC_TEST_ZSUM_NR_RECS;
+	if (z > 1 ||
+	    zone->zsz_state != (z ? ZBC_ZSUM_OPEN : ZBC_ZSUM_SEALED) ||
+	    zone->zsz_data_end - zone->zsz_data_start !=
+	    nr_recs * ZBC_TEST_ZSUM_REC_SECTORS)
+		return -EIO;
+
+	/* The summary of the open zone is lost and rebuilt from its data */
+	if (!z && zone->zsz_summary_len != nr_recs * sizeof(uint64_t))
+		return -EIO;
+
+	for (i = 0; i < nr_recs; i++) {
+		if (sum && sum[i] != z * 1000 + i)
+			return -EIO;
+		ret = zbc_pread(rec->dev, rec->buf, ZBC_TEST_ZSUM_REC_SECTORS,
+				zone->zsz_data_start +
+				i * ZBC_TEST_ZSUM_REC_SECTORS);
+		if (ret != ZBC_TEST_ZSUM_REC_SECTORS ||
+		    !zbc_test_match(rec->buf, ZBC_TEST_BLOCK_SIZE,
+				    z * 1000 + i))
+			return -EIO;
+	}
+
+	rec->nr_zones++;
+
+	return 0;
+}
+
+static int zbc_test_zsum_verify(struct zbc_device *dev, const char *path)
+{
+	struct zbc_test_zsum_rec rec = {
+		.dev = dev,
+	};
+	struct zbc_zsum *zs = NULL;
+	int ret;
+
+	rec.buf = zbc_test_alloc(ZBC_TEST_BLOCK_SIZE);
+	zbc_test_check(rec.buf, "alloc-buffer");
+
+	zbc_test_call(zbc_zsum_open(dev, &zbc_test_zsum_params, &zs),
+		      "reopen");
+	zbc_test_call(zbc_zsum_recover(zs, zbc_test_zsum_check_zone, &rec),
+		      "recover");
+	zbc_test_check(!ret && rec.nr_zones == 2, "recover");
+
+out:
+	if (zs)
+		zbc_zsum_close(zs);
+	free(rec.buf);
+
+	return ret;
+}
+
+/*
+ * Hybrid device: write blocks scattered over the zones and check that a
+ * write larger than the cache fails, then check the data in the cache,
+ * destage all zones and check the data on the backing device.
+ */
+#define ZBC_TEST_HY_CACHE_SIZE	(4 * 1024 * 1024)
+#define ZBC_TEST_HY_NR_ZONES	8
+#define ZBC_TEST_HY_NR_BLOCKS	64
+#define ZBC_TEST_HY_BLOCK_SECTORS (ZBC_TEST_BLOCK_SIZE >> 9)
+
+static char zbc_test_hy_cache_path[PATH_MAX];
+
+static struct zbc_hybrid_params zbc_test_hy_params = {
+	.zyp_cache_path	= zbc_test_hy_cache_path,
+	.zyp_sector	= ZBC_TEST_SEQ_SECTOR,
+	.zyp_nr_sectors	= ZBC_TEST_HY_NR_ZONES * ZBC_TEST_ZONE_SECTORS,
+};
+
+static inline uint64_t zbc_test_hy_sector(unsigned int i)
+{
+	uint64_t nr_blocks = ZBC_TEST_HY_NR_ZONES * ZBC_TEST_ZONE_SECTORS /
+		ZBC_TEST_HY_BLOCK_SECTORS;
+
+	return ZBC_TEST_SEQ_SECTOR +
+		(i * 37 % nr_blocks) * ZBC_TEST_HY_BLOCK_SECTORS;
+}
+
+static int zbc_test_hy_check(struct zbc_hybrid *hy, void *buf)
+{
+	unsigned int i;
+	ssize_t ret;
+
+	for (i = 0; i < ZBC_TEST_HY_NR_BLOCKS; i++) {
+		ret = zbc_hybrid_pread(hy, buf, ZBC_TEST_HY_BLOCK_SECTORS,
+				       zbc_test_hy_sector(i));
+		if (ret != ZBC_TEST_HY_BLOCK_SECTORS ||
+		    !zbc_test_match(buf, ZBC_TEST_BLOCK_SIZE, i))
+			return -EIO;
+	}
+
+	return 0;
+}
+
+static int zbc_test_hybrid_write(struct zbc_device *dev, const char *path)
+{
+	struct zbc_hybrid *hy = NULL;
+	struct zbc_hybrid_stats stats;
+	void *buf = NULL;
+	unsigned int i;
+	int fd, ret;
+
+	snprintf(zbc_test_hy_cache_path, sizeof(zbc_test_hy_cache_path),
+		 "%s.cache", path);
+	zbc_test_step = "create-cache";
+	fd = open(zbc_test_hy_cache_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		ret = -errno;
+		goto out;
+	}
+	ret = ftruncate(fd, ZBC_TEST_HY_CACHE_SIZE);
+	close(fd);
+	if (ret) {
+		ret = -errno;
+		goto out;
+	}
+
+	zbc_test_call(zbc_hybrid_open(dev, &zbc_test_hy_params, &hy), "open");
+
+	buf = zbc_test_alloc(ZBC_TEST_HY_CACHE_SIZE);
+	zbc_test_check(buf, "alloc-buffer");
+
+	for (i = 0; i < ZBC_TEST_HY_NR_BLOCKS; i++) {
+		zbc_test_fill(buf, ZBC_TEST_BLOCK_SIZE, i);
+		zbc_test_call(zbc_hybrid_pwrite(hy, buf,
+						ZBC_TEST_HY_BLOCK_SECTORS,
+						zbc_test_hy_sector(i)),
+			      "write");
+	}
+
+	/* A write larger than the cache must fail */
+	zbc_hybrid_get_stats(hy, &stats);
+	zbc_test_check(stats.zys_nr_blocks < ZBC_TEST_HY_CACHE_SIZE /
+		       ZBC_TEST_BLOCK_SIZE, "cache-size");
+	zbc_test_check(zbc_hybrid_pwrite(hy, buf,
+			(stats.zys_nr_blocks + 1) * ZBC_TEST_HY_BLOCK_SECTORS,
+			ZBC_TEST_SEQ_SECTOR) == -ENOSPC, "write-too-large");
+
+	zbc_test_call(zbc_hybrid_flush(hy), "flush");
+
+out:
+	if (hy)
+		zbc_hybrid_close(hy);
+	free(buf);
+
+	return ret;
+}
+
+static int zbc_test_hybrid_verify(struct zbc_device *dev, const char *path)
+{
+	struct zbc_hybrid *hy = NULL;
+	struct zbc_hybrid_stats stats;
+	void *buf;
+	int ret;
+
+	buf = zbc_test_alloc(ZBC_TEST_BLOCK_SIZE);
+	zbc_test_check(buf, "alloc-buffer");
+
+	/* The dirty blocks are read from the cache */
+	zbc_test_call(zbc_hybrid_open(dev, &zbc_test_hy_params, &hy),
+		      "reopen");
+	zbc_hybrid_get_stats(hy, &stats);
+	zbc_test_check(stats.zys_nr_dirty == ZBC_TEST_HY_NR_BLOCKS,
+		       "dirty-blocks");
+	zbc_test_call(zbc_test_hy_check(hy, buf), "cached-data");
+
+	/* After destaging all zones, the blocks are read from the device */
+	zbc_test_call(zbc_hybrid_destage(hy, 0), "destage");
+	zbc_hybrid_get_stats(hy, &stats);
+	zbc_test_check(ret > 0 && !stats.zys_nr_dirty, "destage");
+	zbc_test_call(zbc_test_hy_check(hy, buf), "destaged-data");
+	zbc_test_call(zbc_hybrid_close(hy), "close");
+	hy = NULL;
+
+	zbc_test_call(zbc_hybrid_open(dev, &zbc_test_hy_params, &hy),
+		      "reopen-destaged");
+	zbc_hybrid_get_stats(hy, &stats);
+	zbc_test_check(!stats.zys_nr_dirty, "dirty-blocks");
+	zbc_test_call(zbc_test_hy_check(hy, buf), "destaged-data");
+	zbc_hybrid_get_stats(hy, &stats);
+	zbc_test_check(stats.zys_read_misses == ZBC_TEST_HY_NR_BLOCKS &&
+		       !stats.zys_read_hits, "read-misses");
+
+out:
+	if (hy)
+		zbc_hybrid_close(hy);
+	unlink(zbc_test_hy_cache_path);
+	free(buf);
+
+	return ret;
+}
+
+static struct zbc_test_module {
+	const char	*name;
+	int		(*write)(struct zbc_device *dev, const char *path);
+	int		(*verify)(struct zbc_device *dev, const char *path);
+} zbc_test_modules[] = {
+	{ "hybrid",	zbc_test_hybrid_write,	zbc_test_hybrid_verify	},
+	{ "log",	zbc_test_log_write,	zbc_test_log_verify	},
+	{ "btree",	zbc_test_btree_write,	zbc_test_btree_verify	},
+	{ "sb",		zbc_test_sb_write,	zbc_test_sb_verify	},
+	{ "slab",	zbc_test_slab_write,	zbc_test_slab_verify	},
+	{ "zsum",	zbc_test_zsum_write,	zbc_test_zsum_verify	},
+};
+
+/**
+ * Create an emulated device backed by the regular file @path.
+ */
+static int zbc_test_create_dev(const char *path)
+{
+	struct zbc_device *dev;
+	int fd, ret;
+
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return -errno;
+	ret = ftruncate(fd, ZBC_TEST_DEV_SIZE);
+	close(fd);
+	if (ret)
+		return -errno;
+
+	ret = zbc_open(path, O_RDWR | ZBC_O_DRV_FAKE | ZBC_O_SETZONES, &dev);
+	if (ret)
+		return ret;
+
+	ret = zbc_set_zones(dev, ZBC_TEST_CONV_SECTORS, ZBC_TEST_ZONE_SECTORS);
+	zbc_close(dev);
+
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	struct zbc_test_module *m = NULL;
+	struct zbc_device *dev = NULL;
+	const char *module, *path;
+	unsigned int i;
+	int ret;
+
+	/* Check command line */
+	if (argc < 3 || argc > 4) {
+usage:
+		printf("Usage: %s [-v] <module> <file>\n"
+		       "  Write data with a module on an emulated device\n"
+		       "  backed by <file>, close and reopen the device and\n"
+		       "  check the data. <file> is created and overwritten.\n"
+		       "  <module> is one of: hybrid, log, btree, sb, slab,\n"
+		       "  zsum\n"
+		       "Options:\n"
+		       "  -v : Verbose mode\n",
+		       argv[0]);
+		return 1;
+	}
+
+	if (argc == 4) {
+		if (strcmp(argv[1], "-v") == 0) {
+			zbc_set_log_level("debug");
+		} else {
+			printf("Unknown option \"%s\"\n", argv[1]);
+			return 1;
+		}
+		module = argv[2];
+		path = argv[3];
+	} else {
+		module = argv[1];
+		path = argv[2];
+	}
+
+	for (i = 0; i < sizeof(zbc_test_modules) /
+		     sizeof(zbc_test_modules[0]); i++) {
+		if (strcmp(module, zbc_test_modules[i].name) == 0)
+			m = &zbc_test_modules[i];
+	}
+	if (!m)
+		goto usage;
+
+	zbc_test_step = "create-device";
+	ret = zbc_test_create_dev(path);
+	if (ret)
+		goto out;
+
+	zbc_test_step = "open-device";
+	ret = zbc_open(path, O_RDWR | ZBC_O_DRV_FAKE, &dev);
+	if (ret)
+		goto out;
+
+	ret = m->write(dev, path);
+	if (ret < 0)
+		goto out;
+
+	zbc_close(dev);
+	dev = NULL;
+
+	zbc_test_step = "reopen-device";
+	ret = zbc_open(path, O_RDWR | ZBC_O_DRV_FAKE, &dev);
+	if (ret)
+		goto out;
+
+	ret = m->verify(dev, path);
+
+out:
+	if (dev)
+		zbc_close(dev);
+
+	if (ret < 0) {
+		fprintf(stderr, "[TEST][ERROR],%s %s failed %d\n",
+			m->name, zbc_test_step, ret);
+		printf("[TEST][ERROR][SENSE_KEY],%s-check-failed\n", m->name);
+		printf("[TEST][ERROR][ASC_ASCQ],%s\n", zbc_test_step);
+		return 1;
+	}
+
+	return 0;
+}
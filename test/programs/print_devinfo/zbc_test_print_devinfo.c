@@ -43,7 +43,7 @@ static int zbc_get_last_zone(struct zbc_device *dev, struct zbc_zone *z)
 
 	memcpy(z, &zones[nr_zones - 1], sizeof(struct zbc_zone));
 
-	free(zones);
+	zbc_free(zones);
 
 	return 0;
 }
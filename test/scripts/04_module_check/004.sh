@@ -0,0 +1,37 @@
+#!/bin/bash
+#
+# This file is part of libzbc.
+#
+# Copyright (C) 2009-2014, HGST, Inc. All rights reserved.
+# Copyright (C) 2016, Western Digital. All rights reserved.
+#
+# This software is distributed under the terms of the BSD 2-clause license,
+# "as is," without technical support, and WITHOUT ANY WARRANTY, without
+# even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+# PURPOSE. You should have received a copy of the BSD 2-clause license along
+# with libzbc. If not, see  <http://opensource.org/licenses/BSD-2-Clause>.
+#
+
+. scripts/zbc_test_lib.sh
+
+zbc_test_init $0 "Superblock data after commit and reopen" $*
+
+# Set expected error code
+expected_sk=""
+expected_asc=""
+
+# The module runs on an emulated device backed by a file of the log directory
+module_dev="`dirname ${log_file}`/${case_num}.img"
+
+# Start testing
+zbc_test_run ${bin_path}/zbc_test_module_check sb ${module_dev}
+
+# Check result
+zbc_test_get_sk_ascq
+zbc_test_check_no_sk_ascq
+
+# Post process
+rm -f ${module_dev}
+
+# Check failed
+zbc_test_check_failed
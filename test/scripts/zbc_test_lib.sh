@@ -785,6 +785,30 @@ function zbc_test_check_zone_cond()
         fi
 }
 
+function zbc_test_check_no_alloc()
+{
+	local expected_sk=""
+	local expected_asc=""
+
+	local _IFS="${IFS}"
+	IFS=$',\n'
+	local alloc_line=`cat ${log_file} | grep -m 1 -F "[ALLOC_CALLS]"`
+	set -- ${alloc_line}
+	alloc_calls=${2}
+	IFS="$_IFS"
+
+	if [ -n "${sk}" -o -n "${asc}" ]; then
+		zbc_test_print_failed_sk "$*"
+	elif [ "${alloc_calls}" != "0" ]; then
+		zbc_test_print_res "${red}" "Failed"
+		echo "=> Expected no memory allocation, Got ${alloc_calls}" >> ${log_file} 2>&1
+		echo "            => Expected no memory allocation"
+		echo "               Got ${alloc_calls}"
+	else
+		zbc_test_print_passed
+	fi
+}
+
 function zbc_test_dump_zone_info()
 {
 	zbc_report_zones ${device} > ${dump_zone_info_file}
@@ -77,6 +77,9 @@ test_progs=( \
     zbc_test_finish_zone \
     zbc_test_read_zone \
     zbc_test_write_zone \
+    zbc_test_alloc_check \
+    zbc_test_cdb_flags \
+    zbc_test_module_check \
 )
 
 for p in ${test_progs[@]}; do
@@ -188,7 +191,7 @@ fi
 # Build run list
 function get_exec_list()
 {
-	for secnum in 00 01 02; do
+	for secnum in 00 01 02 03 04; do
 		for file in ${ZBC_TEST_SCR_PATH}/${secnum}*/*.sh; do
 			_IFS="${IFS}"
 			IFS='.'
@@ -330,6 +333,12 @@ for section in ${section_list[@]}; do
 	"02")
 		section_name="zone state machine"
 		;;
+	"03")
+		section_name="resource usage"
+		;;
+	"04")
+		section_name="module persistence"
+		;;
 	* )
 		echo "Unknown test section ${section}"
 		exit 1
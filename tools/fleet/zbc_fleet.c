@@ -0,0 +1,643 @@
+/*
+ * This file is part of libzbc.
+ *
+ * Copyright (C) 2009-2014, HGST, Inc. All rights reserved.
+ * Copyright (C) 2016, Western Digital. All rights reserved.
+ *
+ * This software is distributed under the terms of the
+ * GNU Lesser General Public License version 3, "as is," without technical
+ * support, and WITHOUT ANY WARRANTY, without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. You should have
+ * received a copy of the GNU Lesser General Public License along with libzbc.
+ * If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Damien Le Moal (damien.lemoal@wdc.com)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include <libzbc/zbc.h>
+
+/**
+ * Fleet operations.
+ */
+enum zbc_fleet_op {
+	ZBC_FLEET_REPORT,
+	ZBC_FLEET_RESET,
+	ZBC_FLEET_OPEN,
+	ZBC_FLEET_CLOSE,
+	ZBC_FLEET_FINISH,
+};
+
+static struct zbc_fleet_op_desc {
+	const char		*name;
+	enum zbc_zone_op	op;
+} zbc_fleet_ops[] = {
+	{ "report",	0 },
+	{ "reset",	ZBC_OP_RESET_ZONE },
+	{ "open",	ZBC_OP_OPEN_ZONE },
+	{ "close",	ZBC_OP_CLOSE_ZONE },
+	{ "finish",	ZBC_OP_FINISH_ZONE },
+};
+
+#define ZBC_FLEET_NR_OPS \
+	(sizeof(zbc_fleet_ops) / sizeof(zbc_fleet_ops[0]))
+
+/**
+ * Zone condition names accepted by the -c option.
+ */
+static struct zbc_fleet_cond {
+	const char		*name;
+	enum zbc_zone_condition	cond;
+} zbc_fleet_conds[] = {
+	{ "not_wp",	ZBC_ZC_NOT_WP },
+	{ "empty",	ZBC_ZC_EMPTY },
+	{ "imp_open",	ZBC_ZC_IMP_OPEN },
+	{ "exp_open",	ZBC_ZC_EXP_OPEN },
+	{ "closed",	ZBC_ZC_CLOSED },
+	{ "rdonly",	ZBC_ZC_RDONLY },
+	{ "full",	ZBC_ZC_FULL },
+	{ "offline",	ZBC_ZC_OFFLINE },
+};
+
+#define ZBC_FLEET_NR_CONDS \
+	(sizeof(zbc_fleet_conds) / sizeof(zbc_fleet_conds[0]))
+
+/**
+ * Zone index range.
+ */
+struct zbc_fleet_range {
+	unsigned long long	start;
+	unsigned long long	end;
+};
+
+/**
+ * Zone selection: a zone is selected if it matches one of the index
+ * ranges or sectors (any zone if there are none) and its condition is
+ * in the condition mask (any condition if the mask is 0).
+ */
+struct zbc_fleet_sel {
+	struct zbc_fleet_range	*ranges;
+	unsigned int		nr_ranges;
+	unsigned long long	*sectors;
+	unsigned int		nr_sectors;
+	unsigned int		cond_mask;
+	bool			all;
+};
+
+/**
+ * Per device state.
+ */
+struct zbc_fleet_dev {
+	char			*path;
+	pthread_t		thread;
+
+	unsigned int		nr_zones;
+	unsigned int		nr_sel;
+	unsigned int		nr_done;
+	unsigned int		nr_errors;
+	unsigned int		nr_cond[16];
+	bool			finished;
+
+	int			err;
+	char			err_msg[128];
+	unsigned long long	elapsed_ns;
+};
+
+static enum zbc_fleet_op fleet_op;
+static struct zbc_fleet_sel fleet_sel;
+static sem_t fleet_sem;
+
+static unsigned long long zbc_fleet_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Parse a comma separated list of zone index ranges ("0-15,20,100-").
+ */
+static int zbc_fleet_parse_ranges(struct zbc_fleet_sel *sel, char *str)
+{
+	char *tok, *end, *saveptr;
+	struct zbc_fleet_range *r;
+
+	for (tok = strtok_r(str, ",", &saveptr); tok;
+	     tok = strtok_r(NULL, ",", &saveptr)) {
+
+		r = realloc(sel->ranges,
+			    sizeof(*r) * (sel->nr_ranges + 1));
+		if (!r)
+			return -ENOMEM;
+		sel->ranges = r;
+		r = &sel->ranges[sel->nr_ranges];
+
+		r->start = strtoull(tok, &end, 10);
+		if (end == tok)
+			return -EINVAL;
+		if (*end == '-') {
+			tok = end + 1;
+			if (*tok == '\0') {
+				r->end = -1ULL;
+			} else {
+				r->end = strtoull(tok, &end, 10);
+				if (end == tok || *end || r->end < r->start)
+					return -EINVAL;
+			}
+		} else if (*end) {
+			return -EINVAL;
+		} else {
+			r->end = r->start;
+		}
+
+		sel->nr_ranges++;
+	}
+
+	return 0;
+}
+
+/**
+ * Parse a comma separated list of sectors.
+ */
+static int zbc_fleet_parse_sectors(struct zbc_fleet_sel *sel, char *str)
+{
+	char *tok, *end, *saveptr;
+	unsigned long long *s;
+
+	for (tok = strtok_r(str, ",", &saveptr); tok;
+	     tok = strtok_r(NULL, ",", &saveptr)) {
+		s = realloc(sel->sectors, sizeof(*s) * (sel->nr_sectors + 1));
+		if (!s)
+			return -ENOMEM;
+		sel->sectors = s;
+		s[sel->nr_sectors] = strtoull(tok, &end, 10);
+		if (end == tok || *end)
+			return -EINVAL;
+		sel->nr_sectors++;
+	}
+
+	return 0;
+}
+
+/**
+ * Parse a comma separated list of zone conditions.
+ */
+static int zbc_fleet_parse_conds(struct zbc_fleet_sel *sel, char *str)
+{
+	char *tok, *saveptr;
+	unsigned int i;
+
+	for (tok = strtok_r(str, ",", &saveptr); tok;
+	     tok = strtok_r(NULL, ",", &saveptr)) {
+		if (strcmp(tok, "open") == 0) {
+			sel->cond_mask |= (1U << ZBC_ZC_IMP_OPEN) |
+				(1U << ZBC_ZC_EXP_OPEN);
+			continue;
+		}
+		for (i = 0; i < ZBC_FLEET_NR_CONDS; i++) {
+			if (strcmp(tok, zbc_fleet_conds[i].name) == 0)
+				break;
+		}
+		if (i == ZBC_FLEET_NR_CONDS)
+			return -EINVAL;
+		sel->cond_mask |= 1U << zbc_fleet_conds[i].cond;
+	}
+
+	return 0;
+}
+
+static bool zbc_fleet_selected(struct zbc_fleet_sel *sel,
+			       struct zbc_zone *z, unsigned int idx)
+{
+	bool match = !sel->nr_ranges && !sel->nr_sectors;
+	unsigned int i;
+
+	for (i = 0; !match && i < sel->nr_ranges; i++) {
+		if (idx >= sel->ranges[i].start && idx <= sel->ranges[i].end)
+			match = true;
+	}
+
+	for (i = 0; !match && i < sel->nr_sectors; i++) {
+		if (sel->sectors[i] >= zbc_zone_start(z) &&
+		    sel->sectors[i] < zbc_zone_start(z) + zbc_zone_length(z))
+			match = true;
+	}
+
+	if (!match)
+		return false;
+
+	if (sel->cond_mask &&
+	    !(sel->cond_mask & (1U << zbc_zone_condition(z))))
+		return false;
+
+	/* Zone operations only apply to write pointer zones */
+	if (fleet_op != ZBC_FLEET_REPORT && zbc_zone_conventional(z))
+		return false;
+
+	return true;
+}
+
+static void zbc_fleet_error(struct zbc_fleet_dev *fd, int err,
+			    const char *fmt, unsigned long long sector)
+{
+	__atomic_fetch_add(&fd->nr_errors, 1, __ATOMIC_RELAXED);
+	if (fd->err)
+		return;
+	fd->err = err;
+	snprintf(fd->err_msg, sizeof(fd->err_msg), fmt, sector,
+		 strerror(-err));
+}
+
+/**
+ * Execute the operation on the selected zones of a device.
+ */
+static void zbc_fleet_dev_run(struct zbc_fleet_dev *fd)
+{
+	enum zbc_zone_op op = zbc_fleet_ops[fleet_op].op;
+	struct zbc_zone *zones = NULL, *z;
+	struct zbc_device *dev;
+	unsigned int nr_zones, i, nr_sel = 0;
+	bool *sel = NULL;
+	int ret;
+
+	ret = zbc_open(fd->path,
+		       fleet_op == ZBC_FLEET_REPORT ? O_RDONLY : O_RDWR, &dev);
+	if (ret) {
+		fd->err = ret;
+		snprintf(fd->err_msg, sizeof(fd->err_msg), "open failed (%s)",
+			 ret == -ENODEV ?
+			 "not a zoned block device" : strerror(-ret));
+		__atomic_fetch_add(&fd->nr_errors, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	ret = zbc_list_zones(dev, 0, ZBC_RO_ALL, &zones, &nr_zones);
+	if (ret) {
+		fd->err = ret;
+		snprintf(fd->err_msg, sizeof(fd->err_msg),
+			 "report zones failed (%s)", strerror(-ret));
+		__atomic_fetch_add(&fd->nr_errors, 1, __ATOMIC_RELAXED);
+		goto out;
+	}
+	fd->nr_zones = nr_zones;
+
+	sel = calloc(nr_zones, sizeof(bool));
+	if (!sel) {
+		zbc_fleet_error(fd, -ENOMEM, "zone %llu: %s", 0);
+		goto out;
+	}
+
+	for (i = 0; i < nr_zones; i++) {
+		if (zbc_fleet_selected(&fleet_sel, &zones[i], i)) {
+			sel[i] = true;
+			nr_sel++;
+		}
+	}
+	__atomic_store_n(&fd->nr_sel, nr_sel, __ATOMIC_RELAXED);
+
+	if (fleet_op == ZBC_FLEET_REPORT) {
+		for (i = 0; i < nr_zones; i++) {
+			if (!sel[i])
+				continue;
+			fd->nr_cond[zbc_zone_condition(&zones[i]) & 0x0f]++;
+			__atomic_fetch_add(&fd->nr_done, 1, __ATOMIC_RELAXED);
+		}
+		goto out;
+	}
+
+	/*
+	 * If all write pointer zones are selected, use a single
+	 * all zones command.
+	 */
+	if (fleet_sel.all && !fleet_sel.nr_ranges &&
+	    !fleet_sel.nr_sectors && !fleet_sel.cond_mask) {
+		ret = zbc_zone_operation(dev, 0, op, ZBC_OP_ALL_ZONES);
+		if (ret)
+			zbc_fleet_error(fd, ret, "all zones (%llu): %s", 0);
+		else
+			__atomic_store_n(&fd->nr_done, nr_sel,
+					 __ATOMIC_RELAXED);
+		goto out;
+	}
+
+	for (i = 0; i < nr_zones; i++) {
+		if (!sel[i])
+			continue;
+		z = &zones[i];
+		ret = zbc_zone_operation(dev, zbc_zone_start(z), op, 0);
+		if (ret)
+			zbc_fleet_error(fd, ret, "zone at sector %llu: %s",
+					zbc_zone_start(z));
+		__atomic_fetch_add(&fd->nr_done, 1, __ATOMIC_RELAXED);
+	}
+
+out:
+	free(sel);
+	zbc_free(zones);
+	zbc_close(dev);
+}
+
+static void *zbc_fleet_dev_thread(void *arg)
+{
+	struct zbc_fleet_dev *fd = arg;
+	unsigned long long start;
+
+	sem_wait(&fleet_sem);
+
+	start = zbc_fleet_time_ns();
+	zbc_fleet_dev_run(fd);
+	fd->elapsed_ns = zbc_fleet_time_ns() - start;
+
+	sem_post(&fleet_sem);
+	__atomic_store_n(&fd->finished, true, __ATOMIC_RELEASE);
+
+	return NULL;
+}
+
+/**
+ * Print a progress line and return the number of finished devices.
+ */
+static unsigned int zbc_fleet_progress(struct zbc_fleet_dev *devs,
+				       unsigned int nr_devs, bool print)
+{
+	unsigned long long nr_sel = 0, nr_done = 0, nr_errors = 0;
+	unsigned int i, nr_finished = 0;
+
+	for (i = 0; i < nr_devs; i++) {
+		nr_sel += __atomic_load_n(&devs[i].nr_sel, __ATOMIC_RELAXED);
+		nr_done += __atomic_load_n(&devs[i].nr_done, __ATOMIC_RELAXED);
+		nr_errors += __atomic_load_n(&devs[i].nr_errors,
+					     __ATOMIC_RELAXED);
+		if (__atomic_load_n(&devs[i].finished, __ATOMIC_ACQUIRE))
+			nr_finished++;
+	}
+
+	if (print) {
+		fprintf(stderr,
+			"\r    %u/%u devices, %llu/%llu zones, %llu errors   ",
+			nr_finished, nr_devs, nr_done, nr_sel, nr_errors);
+		fflush(stderr);
+	}
+
+	return nr_finished;
+}
+
+static void zbc_fleet_print_dev(struct zbc_fleet_dev *fd)
+{
+	unsigned int i;
+
+	printf("%s: %u zones, %u selected, %u done, %u errors, %llu.%03llu s\n",
+	       fd->path, fd->nr_zones, fd->nr_sel, fd->nr_done, fd->nr_errors,
+	       fd->elapsed_ns / 1000000000ULL,
+	       (fd->elapsed_ns / 1000000ULL) % 1000);
+
+	if (fd->err)
+		printf("    First error: %s\n", fd->err_msg);
+
+	if (fleet_op != ZBC_FLEET_REPORT || fd->err)
+		return;
+
+	for (i = 0; i < ZBC_FLEET_NR_CONDS; i++) {
+		if (!fd->nr_cond[zbc_fleet_conds[i].cond])
+			continue;
+		printf("    %-8s: %u zones\n", zbc_fleet_conds[i].name,
+		       fd->nr_cond[zbc_fleet_conds[i].cond]);
+	}
+}
+
+/**
+ * Add the devices matching a glob pattern.
+ */
+static int zbc_fleet_add_devs(const char *pattern,
+			      struct zbc_fleet_dev **devs,
+			      unsigned int *nr_devs)
+{
+	struct zbc_fleet_dev *d;
+	unsigned int i, j;
+	glob_t g;
+	int ret;
+
+	ret = glob(pattern, GLOB_NOCHECK, NULL, &g);
+	if (ret) {
+		fprintf(stderr, "Invalid device pattern \"%s\"\n", pattern);
+		return -EINVAL;
+	}
+
+	for (i = 0; i < g.gl_pathc; i++) {
+
+		/* Ignore duplicates */
+		for (j = 0; j < *nr_devs; j++) {
+			if (strcmp((*devs)[j].path, g.gl_pathv[i]) == 0)
+				break;
+		}
+		if (j < *nr_devs)
+			continue;
+
+		d = realloc(*devs, sizeof(*d) * (*nr_devs + 1));
+		if (!d) {
+			globfree(&g);
+			return -ENOMEM;
+		}
+		*devs = d;
+		d = &d[*nr_devs];
+		memset(d, 0, sizeof(*d));
+		d->path = strdup(g.gl_pathv[i]);
+		if (!d->path) {
+			globfree(&g);
+			return -ENOMEM;
+		}
+		(*nr_devs)++;
+	}
+
+	globfree(&g);
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct zbc_fleet_dev *devs = NULL;
+	unsigned int nr_devs = 0, nr_jobs = 0, nr_errors = 0;
+	bool progress = isatty(STDERR_FILENO);
+	unsigned int i;
+	int ret = 1;
+
+	/* Check command line */
+	if (argc < 3) {
+usage:
+		printf("Usage: %s [options] <op> <dev> [<dev> ...]\n"
+		       "  Execute a zone operation or report zones on all\n"
+		       "  the devices matching the <dev> patterns, in\n"
+		       "  parallel. <op> is one of report, reset, open,\n"
+		       "  close and finish. Zone operations require at\n"
+		       "  least one zone selection option.\n"
+		       "Options:\n"
+		       "  -v            : Verbose mode\n"
+		       "  -z <ranges>   : Select zones by index (e.g. 0-15,20,100-)\n"
+		       "  -s <sectors>  : Select the zones containing the sectors\n"
+		       "                  (comma separated list)\n"
+		       "  -c <conds>    : Select zones by condition (comma\n"
+		       "                  separated list of not_wp, empty,\n"
+		       "                  imp_open, exp_open, open, closed,\n"
+		       "                  rdonly, full and offline)\n"
+		       "  -a            : Select all zones\n"
+		       "  -j <num>      : Process at most <num> devices at a\n"
+		       "                  time (default: all)\n"
+		       "  -q            : Do not display progress\n",
+		       argv[0]);
+		return 1;
+	}
+
+	/* Parse options */
+	for (i = 1; i < (unsigned int)(argc - 1); i++) {
+
+		if (strcmp(argv[i], "-v") == 0) {
+
+			zbc_set_log_level("debug");
+
+		} else if (strcmp(argv[i], "-z") == 0) {
+
+			if (++i >= (unsigned int)argc - 1)
+				goto usage;
+			if (zbc_fleet_parse_ranges(&fleet_sel, argv[i])) {
+				fprintf(stderr, "Invalid zone ranges\n");
+				return 1;
+			}
+
+		} else if (strcmp(argv[i], "-s") == 0) {
+
+			if (++i >= (unsigned int)argc - 1)
+				goto usage;
+			if (zbc_fleet_parse_sectors(&fleet_sel, argv[i])) {
+				fprintf(stderr, "Invalid sector list\n");
+				return 1;
+			}
+
+		} else if (strcmp(argv[i], "-c") == 0) {
+
+			if (++i >= (unsigned int)argc - 1)
+				goto usage;
+			if (zbc_fleet_parse_conds(&fleet_sel, argv[i])) {
+				fprintf(stderr, "Invalid zone condition\n");
+				return 1;
+			}
+
+		} else if (strcmp(argv[i], "-a") == 0) {
+
+			fleet_sel.all = true;
+
+		} else if (strcmp(argv[i], "-j") == 0) {
+
+			if (++i >= (unsigned int)argc - 1)
+				goto usage;
+			nr_jobs = atoi(argv[i]);
+			if (!nr_jobs) {
+				fprintf(stderr, "Invalid number of jobs\n");
+				return 1;
+			}
+
+		} else if (strcmp(argv[i], "-q") == 0) {
+
+			progress = false;
+
+		} else if (argv[i][0] == '-') {
+
+			printf("Unknown option \"%s\"\n",
+			       argv[i]);
+			goto usage;
+
+		} else {
+
+			break;
+
+		}
+
+	}
+
+	if (i >= (unsigned int)argc - 1) {
+		fprintf(stderr, "No device specified\n");
+		return 1;
+	}
+
+	for (fleet_op = 0; fleet_op < ZBC_FLEET_NR_OPS; fleet_op++) {
+		if (strcmp(argv[i], zbc_fleet_ops[fleet_op].name) == 0)
+			break;
+	}
+	if (fleet_op == ZBC_FLEET_NR_OPS) {
+		fprintf(stderr, "Unknown operation \"%s\"\n", argv[i]);
+		return 1;
+	}
+
+	if (fleet_op != ZBC_FLEET_REPORT && !fleet_sel.all &&
+	    !fleet_sel.nr_ranges && !fleet_sel.nr_sectors &&
+	    !fleet_sel.cond_mask) {
+		fprintf(stderr, "No zone selected (use -a for all zones)\n");
+		return 1;
+	}
+
+	for (i++; i < (unsigned int)argc; i++) {
+		if (zbc_fleet_add_devs(argv[i], &devs, &nr_devs))
+			goto out;
+	}
+
+	if (!nr_jobs || nr_jobs > nr_devs)
+		nr_jobs = nr_devs;
+	sem_init(&fleet_sem, 0, nr_jobs);
+
+	/* One thread per device */
+	for (i = 0; i < nr_devs; i++) {
+		ret = pthread_create(&devs[i].thread, NULL,
+				     zbc_fleet_dev_thread, &devs[i]);
+		if (ret) {
+			fprintf(stderr, "Create thread for %s failed (%s)\n",
+				devs[i].path, strerror(ret));
+			devs[i].finished = true;
+			devs[i].thread = 0;
+			devs[i].err = -ret;
+			snprintf(devs[i].err_msg, sizeof(devs[i].err_msg),
+				 "thread creation failed");
+			__atomic_fetch_add(&devs[i].nr_errors, 1,
+					   __ATOMIC_RELAXED);
+		}
+	}
+
+	while (zbc_fleet_progress(devs, nr_devs, progress) < nr_devs)
+		usleep(200000);
+	if (progress)
+		fprintf(stderr, "\n");
+
+	for (i = 0; i < nr_devs; i++) {
+		if (devs[i].thread)
+			pthread_join(devs[i].thread, NULL);
+		zbc_fleet_print_dev(&devs[i]);
+		if (devs[i].nr_errors)
+			nr_errors++;
+	}
+
+	printf("%u devices, %u with errors\n", nr_devs, nr_errors);
+
+	ret = nr_errors ? 1 : 0;
+
+	sem_destroy(&fleet_sem);
+
+out:
+	for (i = 0; i < nr_devs; i++)
+		free(devs[i].path);
+	free(devs);
+	free(fleet_sel.ranges);
+	free(fleet_sel.sectors);
+
+	return ret;
+}
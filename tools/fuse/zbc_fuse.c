@@ -0,0 +1,810 @@
+/*
+ * This file is part of libzbc.
+ *
+ * Copyright (C) 2009-2014, HGST, Inc. All rights reserved.
+ * Copyright (C) 2016, Western Digital. All rights reserved.
+ *
+ * This software is distributed under the terms of the
+ * GNU Lesser General Public License version 3, "as is," without technical
+ * support, and WITHOUT ANY WARRANTY, without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. You should have
+ * received a copy of the GNU Lesser General Public License along with libzbc.
+ * If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Damien Le Moal (damien.lemoal@wdc.com)
+ */
+
+#define FUSE_USE_VERSION 31
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+
+#include <fuse.h>
+
+#include <libzbc/zbc.h>
+
+#include <zbc_private.h>
+
+/**
+ * Maximum size of FUSE write requests.
+ */
+#define ZBC_FUSE_MAX_WRITE	(1024 * 1024)
+
+/**
+ * Zone file.
+ */
+struct zbc_fuse_zone {
+	pthread_mutex_t		lock;
+	struct zbc_zone		zone;
+
+	/*
+	 * Data written to a sequential zone and not yet aligned to
+	 * the device physical block size.
+	 */
+	uint8_t			*tail;
+	size_t			tail_len;
+};
+
+/**
+ * Mounted device.
+ */
+struct zbc_fuse {
+	struct zbc_device	*dev;
+	struct zbc_device_info	info;
+	struct zbc_fuse_zone	*zones;
+	unsigned int		nr_zones;
+	int			name_width;
+	size_t			blksz;
+	size_t			lblksz;
+	time_t			mtime;
+
+	/* Device file for splice reads (-1 if not possible) */
+	int			fd;
+};
+
+static inline struct zbc_fuse *zbc_fuse_get(void)
+{
+	return fuse_get_context()->private_data;
+}
+
+/**
+ * Get the zone file of a path.
+ */
+static struct zbc_fuse_zone *zbc_fuse_lookup(struct zbc_fuse *zf,
+					     const char *path)
+{
+	unsigned long zno;
+	char *end;
+
+	if (*path != '/' || strlen(path + 1) != (size_t)zf->name_width ||
+	    path[1] < '0' || path[1] > '9')
+		return NULL;
+
+	zno = strtoul(path + 1, &end, 10);
+	if (*end || zno >= zf->nr_zones)
+		return NULL;
+
+	return &zf->zones[zno];
+}
+
+/**
+ * Get the size of a zone file. For sequential zones, this is the amount
+ * of data written to the zone.
+ */
+static uint64_t zbc_fuse_size(struct zbc_fuse_zone *z)
+{
+	struct zbc_zone *zone = &z->zone;
+
+	if (zbc_zone_conventional(zone) || zbc_zone_full(zone))
+		return zbc_zone_length(zone) << 9;
+
+	if (zbc_zone_offline(zone))
+		return 0;
+
+	return ((zbc_zone_wp(zone) - zbc_zone_start(zone)) << 9) + z->tail_len;
+}
+
+static int zbc_fuse_getattr(const char *path, struct stat *st,
+			    struct fuse_file_info *fi)
+{
+	struct zbc_fuse *zf = zbc_fuse_get();
+	struct zbc_fuse_zone *z;
+
+	memset(st, 0, sizeof(struct stat));
+	st->st_uid = getuid();
+	st->st_gid = getgid();
+	st->st_atime = st->st_mtime = st->st_ctime = zf->mtime;
+
+	if (strcmp(path, "/") == 0) {
+		st->st_mode = S_IFDIR | 0755;
+		st->st_nlink = 2;
+		return 0;
+	}
+
+	z = zbc_fuse_lookup(zf, path);
+	if (!z)
+		return -ENOENT;
+
+	st->st_mode = S_IFREG | 0644;
+	if (zbc_zone_rdonly(&z->zone) || zbc_zone_offline(&z->zone))
+		st->st_mode = S_IFREG | 0444;
+	st->st_nlink = 1;
+	st->st_blksize = zf->blksz;
+
+	pthread_mutex_lock(&z->lock);
+	st->st_size = zbc_fuse_size(z);
+	pthread_mutex_unlock(&z->lock);
+	st->st_blocks = (st->st_size + 511) >> 9;
+
+	return 0;
+}
+
+static int zbc_fuse_readdir(const char *path, void *buf,
+			    fuse_fill_dir_t filler, off_t offset,
+			    struct fuse_file_info *fi,
+			    enum fuse_readdir_flags flags)
+{
+	struct zbc_fuse *zf = zbc_fuse_get();
+	char name[32];
+	unsigned int i;
+
+	if (strcmp(path, "/") != 0)
+		return -ENOENT;
+
+	filler(buf, ".", NULL, 0, 0);
+	filler(buf, "..", NULL, 0, 0);
+	for (i = 0; i < zf->nr_zones; i++) {
+		snprintf(name, sizeof(name), "%0*u", zf->name_width, i);
+		if (filler(buf, name, NULL, 0, 0))
+			break;
+	}
+
+	return 0;
+}
+
+static int zbc_fuse_open(const char *path, struct fuse_file_info *fi)
+{
+	struct zbc_fuse *zf = zbc_fuse_get();
+	struct zbc_fuse_zone *z;
+
+	z = zbc_fuse_lookup(zf, path);
+	if (!z)
+		return -ENOENT;
+
+	if (zbc_zone_offline(&z->zone))
+		return -EIO;
+
+	if ((fi->flags & O_ACCMODE) != O_RDONLY &&
+	    zbc_zone_rdonly(&z->zone))
+		return -EROFS;
+
+	fi->direct_io = 1;
+
+	return 0;
+}
+
+/**
+ * Read from the device using an aligned bounce buffer.
+ */
+static int zbc_fuse_pread(struct zbc_fuse *zf, struct zbc_fuse_zone *z,
+			  uint8_t *buf, size_t size, uint64_t off)
+{
+	uint64_t start = off & ~((uint64_t)zf->lblksz - 1);
+	uint64_t end = (off + size + zf->lblksz - 1) &
+		~((uint64_t)zf->lblksz - 1);
+	uint8_t *rbuf;
+	ssize_t ret;
+
+	if (posix_memalign((void **)&rbuf, zf->blksz, end - start))
+		return -ENOMEM;
+
+	ret = zbc_pread(zf->dev, rbuf, (end - start) >> 9,
+			zbc_zone_start(&z->zone) + (start >> 9));
+	if (ret == (ssize_t)((end - start) >> 9))
+		memcpy(buf, rbuf + (off - start), size);
+	else if (ret >= 0)
+		ret = -EIO;
+
+	free(rbuf);
+
+	return ret < 0 ? ret : 0;
+}
+
+/**
+ * Get the readable range of a zone file: data up to *dev_end is on the
+ * device, data up to *size is in the zone tail buffer.
+ */
+static int zbc_fuse_read_limits(struct zbc_fuse_zone *z, size_t *size,
+				uint64_t off, uint64_t *dev_end)
+{
+	uint64_t fsize = zbc_fuse_size(z);
+
+	if (zbc_zone_offline(&z->zone))
+		return -EIO;
+
+	if (off >= fsize) {
+		*size = 0;
+		return 0;
+	}
+
+	if (*size > fsize - off)
+		*size = fsize - off;
+	*dev_end = fsize - z->tail_len;
+
+	return 0;
+}
+
+static int zbc_fuse_read(const char *path, char *buf, size_t size,
+			 off_t off, struct fuse_file_info *fi)
+{
+	struct zbc_fuse *zf = zbc_fuse_get();
+	struct zbc_fuse_zone *z;
+	uint64_t dev_end = 0;
+	size_t dev_size;
+	int ret;
+
+	z = zbc_fuse_lookup(zf, path);
+	if (!z)
+		return -ENOENT;
+
+	pthread_mutex_lock(&z->lock);
+	ret = zbc_fuse_read_limits(z, &size, off, &dev_end);
+	if (ret || !size) {
+		pthread_mutex_unlock(&z->lock);
+		return ret;
+	}
+	dev_size = (uint64_t)off < dev_end ? dev_end - off : 0;
+	if (dev_size > size)
+		dev_size = size;
+	if (dev_size < size)
+		memcpy(buf + dev_size,
+		       z->tail + (off + dev_size - dev_end),
+		       size - dev_size);
+	pthread_mutex_unlock(&z->lock);
+
+	/* Data below the write pointer does not change until a reset */
+	if (dev_size) {
+		ret = zbc_fuse_pread(zf, z, (uint8_t *)buf, dev_size, off);
+		if (ret)
+			return ret;
+	}
+
+	return size;
+}
+
+/**
+ * Read data below the write pointer with a file descriptor buffer, so that
+ * the FUSE library can splice it from the device file to the FUSE device.
+ */
+static int zbc_fuse_read_buf(const char *path, struct fuse_bufvec **bufp,
+			     size_t size, off_t off,
+			     struct fuse_file_info *fi)
+{
+	struct zbc_fuse *zf = zbc_fuse_get();
+	struct fuse_bufvec *bv;
+	struct zbc_fuse_zone *z;
+	uint64_t dev_end = 0;
+	int ret;
+
+	z = zbc_fuse_lookup(zf, path);
+	if (!z)
+		return -ENOENT;
+
+	bv = malloc(sizeof(struct fuse_bufvec));
+	if (!bv)
+		return -ENOMEM;
+	*bv = FUSE_BUFVEC_INIT(size);
+
+	if (zf->fd >= 0) {
+		pthread_mutex_lock(&z->lock);
+		ret = zbc_fuse_read_limits(z, &size, off, &dev_end);
+		pthread_mutex_unlock(&z->lock);
+		if (ret) {
+			free(bv);
+			return ret;
+		}
+		if (!size || off + size <= dev_end) {
+			bv->buf[0].size = size;
+			bv->buf[0].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+			bv->buf[0].fd = zf->fd;
+			bv->buf[0].pos = (zbc_zone_start(&z->zone) << 9) + off;
+			*bufp = bv;
+			return 0;
+		}
+	}
+
+	bv->buf[0].mem = malloc(size ? size : 1);
+	if (!bv->buf[0].mem) {
+		free(bv);
+		return -ENOMEM;
+	}
+
+	ret = zbc_fuse_read(path, bv->buf[0].mem, size, off, fi);
+	if (ret < 0) {
+		free(bv->buf[0].mem);
+		free(bv);
+		return ret;
+	}
+
+	bv->buf[0].size = ret;
+	*bufp = bv;
+
+	return 0;
+}
+
+/**
+ * Write to a conventional zone, reading partial first and last
+ * physical blocks.
+ */
+static int zbc_fuse_cnv_write(struct zbc_fuse *zf, struct zbc_fuse_zone *z,
+			      const uint8_t *buf, size_t size, uint64_t off)
+{
+	uint64_t zsize = zbc_zone_length(&z->zone) << 9;
+	uint64_t bmask = zf->blksz - 1;
+	uint64_t start, end;
+	uint8_t *wbuf;
+	ssize_t ret;
+
+	if (off >= zsize)
+		return -ENOSPC;
+	if (size > zsize - off)
+		size = zsize - off;
+
+	start = off & ~bmask;
+	end = (off + size + bmask) & ~bmask;
+	if (posix_memalign((void **)&wbuf, zf->blksz, end - start))
+		return -ENOMEM;
+
+	if (start != off) {
+		ret = zbc_fuse_pread(zf, z, wbuf, zf->blksz, start);
+		if (ret)
+			goto out;
+	}
+	if (end != off + size &&
+	    (start == off || end - zf->blksz != start)) {
+		ret = zbc_fuse_pread(zf, z, wbuf + (end - start - zf->blksz),
+				     zf->blksz, end - zf->blksz);
+		if (ret)
+			goto out;
+	}
+
+	memcpy(wbuf + (off - start), buf, size);
+
+	ret = zbc_pwrite(zf->dev, wbuf, (end - start) >> 9,
+			 zbc_zone_start(&z->zone) + (start >> 9));
+	if (ret == (ssize_t)((end - start) >> 9))
+		ret = size;
+	else if (ret >= 0)
+		ret = -EIO;
+
+out:
+	free(wbuf);
+
+	return ret;
+}
+
+/**
+ * Write the physical blocks of a sequential zone write buffer starting
+ * with the zone tail data, and keep the remainder as the new tail.
+ * Called with the zone locked.
+ */
+static int zbc_fuse_seq_commit(struct zbc_fuse *zf, struct zbc_fuse_zone *z,
+			       uint8_t *wbuf, size_t len)
+{
+	struct zbc_zone *zone = &z->zone;
+	size_t wlen = len & ~(zf->blksz - 1);
+	ssize_t ret;
+
+	if (wlen) {
+		ret = zbc_pwrite(zf->dev, wbuf, wlen >> 9, zbc_zone_wp(zone));
+		if (ret != (ssize_t)(wlen >> 9))
+			return ret < 0 ? ret : -EIO;
+		zone->zbz_write_pointer += wlen >> 9;
+		if (zbc_zone_wp(zone) ==
+		    zbc_zone_start(zone) + zbc_zone_length(zone))
+			zone->zbz_condition = ZBC_ZC_FULL;
+		else
+			zone->zbz_condition = ZBC_ZC_IMP_OPEN;
+	}
+
+	z->tail_len = len - wlen;
+	memcpy(z->tail, wbuf + wlen, z->tail_len);
+
+	return 0;
+}
+
+/**
+ * Write the tail data of a sequential zone padded with zeroes to
+ * a physical block. Called with the zone locked.
+ */
+static int zbc_fuse_seq_sync(struct zbc_fuse *zf, struct zbc_fuse_zone *z)
+{
+	uint8_t *wbuf;
+	int ret;
+
+	if (!z->tail_len)
+		return 0;
+
+	if (posix_memalign((void **)&wbuf, zf->blksz, zf->blksz))
+		return -ENOMEM;
+
+	memcpy(wbuf, z->tail, z->tail_len);
+	memset(wbuf + z->tail_len, 0, zf->blksz - z->tail_len);
+	ret = zbc_fuse_seq_commit(zf, z, wbuf, zf->blksz);
+
+	free(wbuf);
+
+	return ret;
+}
+
+static int zbc_fuse_write_buf(const char *path, struct fuse_bufvec *buf,
+			      off_t off, struct fuse_file_info *fi)
+{
+	struct zbc_fuse *zf = zbc_fuse_get();
+	size_t size = fuse_buf_size(buf);
+	struct fuse_bufvec dst = FUSE_BUFVEC_INIT(size);
+	struct zbc_fuse_zone *z;
+	uint64_t fsize, zsize;
+	uint8_t *wbuf;
+	ssize_t ret;
+
+	z = zbc_fuse_lookup(zf, path);
+	if (!z)
+		return -ENOENT;
+
+	if (zbc_zone_conventional(&z->zone)) {
+		wbuf = malloc(size ? size : 1);
+		if (!wbuf)
+			return -ENOMEM;
+		dst.buf[0].mem = wbuf;
+		ret = fuse_buf_copy(&dst, buf, 0);
+		if (ret > 0)
+			ret = zbc_fuse_cnv_write(zf, z, wbuf, ret, off);
+		free(wbuf);
+		return ret;
+	}
+
+	/* Sequential zones are append only */
+	pthread_mutex_lock(&z->lock);
+
+	zsize = zbc_zone_length(&z->zone) << 9;
+	fsize = zbc_fuse_size(z);
+	if ((uint64_t)off != fsize) {
+		ret = -EINVAL;
+		goto out;
+	}
+	if (fsize >= zsize) {
+		ret = -ENOSPC;
+		goto out;
+	}
+	if (size > zsize - fsize)
+		size = zsize - fsize;
+
+	/* Copy the request data right after the zone tail data */
+	if (posix_memalign((void **)&wbuf, zf->blksz,
+			   (z->tail_len + size + zf->blksz - 1) &
+			   ~(zf->blksz - 1))) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	memcpy(wbuf, z->tail, z->tail_len);
+	dst.buf[0].mem = wbuf + z->tail_len;
+	dst.buf[0].size = size;
+	ret = fuse_buf_copy(&dst, buf, 0);
+	if (ret > 0) {
+		size = ret;
+		ret = zbc_fuse_seq_commit(zf, z, wbuf, z->tail_len + size);
+		if (!ret)
+			ret = size;
+	}
+	free(wbuf);
+
+out:
+	pthread_mutex_unlock(&z->lock);
+
+	return ret;
+}
+
+static int zbc_fuse_truncate(const char *path, off_t size,
+			     struct fuse_file_info *fi)
+{
+	struct zbc_fuse *zf = zbc_fuse_get();
+	struct zbc_fuse_zone *z;
+	struct zbc_zone *zone;
+	int ret = 0;
+
+	z = zbc_fuse_lookup(zf, path);
+	if (!z)
+		return -ENOENT;
+	zone = &z->zone;
+
+	pthread_mutex_lock(&z->lock);
+
+	if ((uint64_t)size == zbc_fuse_size(z))
+		goto out;
+
+	if (zbc_zone_conventional(zone)) {
+		ret = -EPERM;
+		goto out;
+	}
+
+	if (size == 0) {
+		/* Truncating to 0 resets the zone */
+		ret = zbc_reset_zone(zf->dev, zbc_zone_start(zone), 0);
+		if (ret)
+			goto out;
+		zone->zbz_write_pointer = zbc_zone_start(zone);
+		zone->zbz_condition = ZBC_ZC_EMPTY;
+		z->tail_len = 0;
+	} else if ((uint64_t)size == zbc_zone_length(zone) << 9) {
+		/* Truncating to the zone size finishes the zone */
+		ret = zbc_fuse_seq_sync(zf, z);
+		if (!ret)
+			ret = zbc_finish_zone(zf->dev, zbc_zone_start(zone), 0);
+		if (ret)
+			goto out;
+		zone->zbz_write_pointer = zbc_zone_start(zone) +
+			zbc_zone_length(zone);
+		zone->zbz_condition = ZBC_ZC_FULL;
+	} else {
+		ret = -EPERM;
+	}
+
+out:
+	pthread_mutex_unlock(&z->lock);
+
+	return ret;
+}
+
+static int zbc_fuse_fsync(const char *path, int datasync,
+			  struct fuse_file_info *fi)
+{
+	struct zbc_fuse *zf = zbc_fuse_get();
+	struct zbc_fuse_zone *z;
+	int ret;
+
+	z = zbc_fuse_lookup(zf, path);
+	if (!z)
+		return -ENOENT;
+
+	pthread_mutex_lock(&z->lock);
+	ret = zbc_fuse_seq_sync(zf, z);
+	pthread_mutex_unlock(&z->lock);
+	if (ret)
+		return ret;
+
+	return zbc_flush(zf->dev);
+}
+
+
+static int zbc_fuse_statfs(const char *path, struct statvfs *st)
+{
+	struct zbc_fuse *zf = zbc_fuse_get();
+	struct zbc_fuse_zone *z;
+	uint64_t free_bytes = 0;
+	unsigned int i;
+
+	for (i = 0; i < zf->nr_zones; i++) {
+		z = &zf->zones[i];
+		if (zbc_zone_conventional(&z->zone))
+			continue;
+		pthread_mutex_lock(&z->lock);
+		free_bytes += (zbc_zone_length(&z->zone) << 9) -
+			zbc_fuse_size(z);
+		pthread_mutex_unlock(&z->lock);
+	}
+
+	memset(st, 0, sizeof(struct statvfs));
+	st->f_bsize = zf->blksz;
+	st->f_frsize = zf->blksz;
+	st->f_blocks = (zf->info.zbd_sectors << 9) / zf->blksz;
+	st->f_bfree = free_bytes / zf->blksz;
+	st->f_bavail = st->f_bfree;
+	st->f_files = zf->nr_zones;
+	st->f_namemax = zf->name_width;
+
+	return 0;
+}
+
+static void *zbc_fuse_init(struct fuse_conn_info *conn,
+			   struct fuse_config *cfg)
+{
+	struct zbc_fuse *zf = zbc_fuse_get();
+
+	/* Zone data is never cached by the kernel */
+	cfg->direct_io = 1;
+	cfg->kernel_cache = 0;
+	cfg->attr_timeout = 0;
+	cfg->entry_timeout = 0;
+
+	conn->max_write = ZBC_FUSE_MAX_WRITE;
+	conn->max_readahead = ZBC_FUSE_MAX_WRITE;
+	conn->want |= conn->capable &
+		(FUSE_CAP_SPLICE_READ | FUSE_CAP_SPLICE_WRITE |
+		 FUSE_CAP_SPLICE_MOVE);
+
+	return zf;
+}
+
+/**
+ * The tail data of sequential zones is kept across opens so that files
+ * can be appended to with successive opens, and is padded with zeroes
+ * and written only on fsync, zone finish or unmount.
+ */
+static void zbc_fuse_destroy(void *data)
+{
+	struct zbc_fuse *zf = data;
+	struct zbc_fuse_zone *z;
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < zf->nr_zones; i++) {
+		z = &zf->zones[i];
+		pthread_mutex_lock(&z->lock);
+		ret = zbc_fuse_seq_sync(zf, z);
+		pthread_mutex_unlock(&z->lock);
+		if (ret)
+			fprintf(stderr, "Write zone %u tail data failed %d\n",
+				i, ret);
+	}
+
+	zbc_flush(zf->dev);
+}
+
+static const struct fuse_operations zbc_fuse_ops = {
+	.init		= zbc_fuse_init,
+	.getattr	= zbc_fuse_getattr,
+	.readdir	= zbc_fuse_readdir,
+	.open		= zbc_fuse_open,
+	.read		= zbc_fuse_read,
+	.read_buf	= zbc_fuse_read_buf,
+	.write_buf	= zbc_fuse_write_buf,
+	.truncate	= zbc_fuse_truncate,
+	.fsync		= zbc_fuse_fsync,
+	.statfs		= zbc_fuse_statfs,
+	.destroy	= zbc_fuse_destroy,
+};
+
+int main(int argc, char **argv)
+{
+	struct zbc_fuse zf;
+	struct zbc_zone *zones = NULL;
+	unsigned int nr_zones, dev_idx, i;
+	char **fargv;
+	int fargc = 0;
+	int ret, flags = O_RDWR;
+	char *path;
+
+	memset(&zf, 0, sizeof(zf));
+	zf.fd = -1;
+
+	/* Parse options */
+	for (i = 1; i < (unsigned int)argc; i++) {
+
+		if (strcmp(argv[i], "-v") == 0) {
+
+			zbc_set_log_level("debug");
+
+		} else if (strcmp(argv[i], "-h") == 0) {
+
+			goto usage;
+
+		} else if (argv[i][0] == '-') {
+
+			fprintf(stderr, "Unknown option \"%s\"\n", argv[i]);
+			goto usage;
+
+		} else {
+
+			break;
+
+		}
+
+	}
+
+	if (i + 2 > (unsigned int)argc) {
+usage:
+		printf("Usage: %s [options] <dev> <mount point> [FUSE options]\n"
+		       "  Expose the zones of a device as files of a FUSE\n"
+		       "  file system. Sequential zones are append-only files\n"
+		       "  and truncating a sequential zone file to 0 resets\n"
+		       "  the zone.\n"
+		       "Options:\n"
+		       "    -v : Verbose mode\n"
+		       "FUSE options:\n"
+		       "    -f : Run in the foreground\n"
+		       "    -s : Single threaded operation\n"
+		       "    -o <opt> : FUSE mount options\n",
+		       argv[0]);
+		return 1;
+	}
+
+	dev_idx = i;
+	path = argv[dev_idx];
+
+	/* Open device */
+	ret = zbc_open(path, flags, &zf.dev);
+	if (ret != 0) {
+		fprintf(stderr, "zbc_open failed %d (%s)\n",
+			ret, strerror(-ret));
+		return 1;
+	}
+
+	zbc_get_device_info(zf.dev, &zf.info);
+	zf.blksz = zf.info.zbd_pblock_size;
+	zf.lblksz = zf.info.zbd_lblock_size;
+	zf.mtime = time(NULL);
+
+	ret = zbc_list_zones(zf.dev, 0, ZBC_RO_ALL, &zones, &nr_zones);
+	if (ret != 0) {
+		fprintf(stderr, "zbc_list_zones failed %d\n", ret);
+		ret = 1;
+		goto out;
+	}
+
+	zf.zones = calloc(nr_zones, sizeof(struct zbc_fuse_zone));
+	if (!zf.zones) {
+		fprintf(stderr, "No memory\n");
+		ret = 1;
+		goto out;
+	}
+	for (i = 0; i < nr_zones; i++) {
+		pthread_mutex_init(&zf.zones[i].lock, NULL);
+		zf.zones[i].zone = zones[i];
+		if (zbc_zone_sequential(&zones[i]) &&
+		    posix_memalign((void **)&zf.zones[i].tail, zf.blksz,
+				   zf.blksz)) {
+			fprintf(stderr, "No memory\n");
+			ret = 1;
+			goto out;
+		}
+	}
+	zf.nr_zones = nr_zones;
+	zf.name_width = snprintf(NULL, 0, "%u", nr_zones - 1);
+
+	/*
+	 * With the block device and emulation drivers, the zone data can
+	 * be read directly from the device file, unless the emulated device
+	 * data is striped across several files.
+	 */
+	if (zbc_file_io(zf.dev))
+		zf.fd = open(path, O_RDONLY | O_LARGEFILE);
+
+	/* FUSE arguments: program name, mount point and FUSE options */
+	fargv = calloc(argc, sizeof(char *));
+	if (!fargv) {
+		fprintf(stderr, "No memory\n");
+		ret = 1;
+		goto out;
+	}
+	fargv[fargc++] = argv[0];
+	for (i = dev_idx + 1; i < (unsigned int)argc; i++)
+		fargv[fargc++] = argv[i];
+
+	ret = fuse_main(fargc, fargv, &zbc_fuse_ops, &zf);
+
+	free(fargv);
+
+out:
+	if (zf.fd >= 0)
+		close(zf.fd);
+	if (zf.zones) {
+		for (i = 0; i < nr_zones; i++) {
+			free(zf.zones[i].tail);
+			pthread_mutex_destroy(&zf.zones[i].lock);
+		}
+		free(zf.zones);
+	}
+	zbc_free(zones);
+	zbc_close(zf.dev);
+
+	return ret;
+}
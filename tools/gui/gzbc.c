@@ -392,7 +392,7 @@ void dz_close(dz_dev_t *dzd)
 		return;
 
 	if (dzd->zbc_zones)
-		free(dzd->zbc_zones);
+		zbc_free(dzd->zbc_zones);
 
 	if (dzd->zones)
 	    free(dzd->zones);
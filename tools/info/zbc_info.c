@@ -22,12 +22,41 @@
 
 #include <libzbc/zbc.h>
 
+/**
+ * Print the timing of the backend drivers and phases of the last open.
+ */
+static void zbc_info_print_open_trace(void)
+{
+	struct zbc_open_trace t;
+	unsigned int i, j;
+
+	zbc_get_open_trace(&t);
+
+	printf("Open time: %.03F ms\n", (double)t.zot_ns / 1000000);
+
+	for (i = 0; i < t.zot_nr_drvs; i++) {
+		printf("    %-8s %10.03F ms  %s\n",
+		       t.zot_drvs[i].zod_name,
+		       (double)t.zot_drvs[i].zod_ns / 1000000,
+		       t.zot_drvs[i].zod_ret ?
+		       t.zot_drvs[i].zod_reason : "accepted");
+		for (j = 0; j < t.zot_nr_phases; j++) {
+			if (t.zot_phases[j].zop_drv != t.zot_drvs[i].zod_drv)
+				continue;
+			printf("        %-32s %10.03F ms%s\n",
+			       t.zot_phases[j].zop_name,
+			       (double)t.zot_phases[j].zop_ns / 1000000,
+			       t.zot_phases[j].zop_ret ? " (failed)" : "");
+		}
+	}
+}
+
 /***** Main *****/
 
 int main(int argc, char **argv)
 {
 	struct zbc_device_info info;
-	bool do_fake = false;
+	bool do_fake = false, do_trace = false;
 	int ret, i;
 
 	/* Check command line */
@@ -36,7 +65,9 @@ usage:
 		printf("Usage: %s [options] <dev>\n"
 		       "Options:\n"
 		       "    -v : Verbose mode\n"
-		       "    -e : Print information for an emulated device\n",
+		       "    -e : Print information for an emulated device\n"
+		       "    -t : Print the device open time of each backend\n"
+		       "         driver and open phase\n",
 		       argv[0]);
 		return 1;
 	}
@@ -52,6 +83,10 @@ usage:
 
 			do_fake = true;
 
+		} else if (strcmp(argv[i], "-t") == 0) {
+
+			do_trace = true;
+
 		} else if (argv[i][0] == '-') {
 
 			printf("Unknown option \"%s\"\n",
@@ -71,6 +106,8 @@ usage:
 
 	/* Open device */
 	ret = zbc_device_is_zoned(argv[i], do_fake, &info);
+	if (do_trace)
+		zbc_info_print_open_trace();
 	if (ret == 1) {
 		printf("Device %s:\n", argv[i]);
 		zbc_print_device_info(&info, stdout);
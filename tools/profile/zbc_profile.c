@@ -0,0 +1,240 @@
+/*
+ * This file is part of libzbc.
+ *
+ * Copyright (C) 2009-2014, HGST, Inc. All rights reserved.
+ * Copyright (C) 2016, Western Digital. All rights reserved.
+ *
+ * This software is distributed under the terms of the BSD 2-clause license,
+ * "as is," without technical support, and WITHOUT ANY WARRANTY, without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE. You should have received a copy of the BSD 2-clause license along
+ * with libzbc. If not, see  <http://opensource.org/licenses/BSD-2-Clause>.
+ *
+ * Author: Damien Le Moal (damien.lemoal@wdc.com)
+ */
+
+#define _GNU_SOURCE     /* O_DIRECT */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include <libzbc/zbc.h>
+#include <libzbc/zbc_profile.h>
+
+static void zbc_profile_progress(void *priv, unsigned int done,
+				 unsigned int total)
+{
+	fprintf(stderr, "\r    %u/%u zones sampled   ", done, total);
+	if (done == total)
+		fprintf(stderr, "\n");
+}
+
+static void zbc_profile_print(struct zbc_profile *prof)
+{
+	struct zbc_profile_sample *s;
+	unsigned int i;
+
+	printf("Profile: %u samples, %llu sectors, %u KiB I/Os\n",
+	       prof->zp_nr_samples,
+	       (unsigned long long)prof->zp_sectors,
+	       prof->zp_io_size / 1024);
+	printf("    %14s %6s %10s %10s %10s %10s\n",
+	       "Sector", "LBA %", "Read MB/s", "Read us", "Write MB/s",
+	       "Write us");
+
+	for (i = 0; i < prof->zp_nr_samples; i++) {
+		s = &prof->zp_samples[i];
+		printf("    %14llu %6.2f %10.1f %10u %10.1f %10u\n",
+		       (unsigned long long)s->zps_sector,
+		       prof->zp_sectors ?
+		       100.0 * (double)s->zps_sector / (double)prof->zp_sectors :
+		       0.0,
+		       (double)s->zps_read_kbps * 1024 / 1000000,
+		       s->zps_read_lat_us,
+		       (double)s->zps_write_kbps * 1024 / 1000000,
+		       s->zps_write_lat_us);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	struct zbc_profile_params params;
+	struct zbc_device_info info;
+	struct zbc_device *dev;
+	struct zbc_profile *prof = NULL;
+	char *path, *in = NULL, *out = NULL;
+	int flags = O_RDONLY | O_DIRECT;
+	bool quiet = false;
+	int i, ret;
+
+	memset(&params, 0, sizeof(params));
+
+	/* Check command line */
+	if (argc < 2) {
+usage:
+		printf("Usage: %s [options] <dev>\n"
+		       "       %s -i <file>\n"
+		       "  Measure the sequential throughput and I/O latency of\n"
+		       "  one zone out of every N zones of a device\n"
+		       "Options:\n"
+		       "    -v          : Verbose mode\n"
+		       "    -n <num>    : Sample one zone out of every <num>\n"
+		       "                  zones (default: about 256 samples)\n"
+		       "    -b <KiB>    : I/O size (default: 1024 KiB)\n"
+		       "    -s <MiB>    : Amount of data read and written per\n"
+		       "                  sampled zone (default: 32 MiB)\n"
+		       "    -w          : Also measure writes. This destroys\n"
+		       "                  the data of the sampled zones\n"
+		       "    -nodio      : Do not use direct I/Os\n"
+		       "    -q          : Do not display progress\n"
+		       "    -o <file>   : Save the profile to <file>\n"
+		       "    -i <file>   : Display the profile saved in <file>\n",
+		       argv[0], argv[0]);
+		return 1;
+	}
+
+	/* Parse options */
+	for (i = 1; i < argc; i++) {
+
+		if (strcmp(argv[i], "-v") == 0) {
+
+			zbc_set_log_level("debug");
+
+		} else if (strcmp(argv[i], "-n") == 0) {
+
+			if (++i >= argc)
+				goto usage;
+			params.zpp_zone_step = atoi(argv[i]);
+
+		} else if (strcmp(argv[i], "-b") == 0) {
+
+			if (++i >= argc)
+				goto usage;
+			params.zpp_io_size = (size_t)atol(argv[i]) * 1024;
+			if (!params.zpp_io_size) {
+				fprintf(stderr, "Invalid I/O size %s\n",
+					argv[i]);
+				return 1;
+			}
+
+		} else if (strcmp(argv[i], "-s") == 0) {
+
+			if (++i >= argc)
+				goto usage;
+			params.zpp_sample_size =
+				(size_t)atol(argv[i]) * 1024 * 1024;
+			if (!params.zpp_sample_size) {
+				fprintf(stderr, "Invalid sample size %s\n",
+					argv[i]);
+				return 1;
+			}
+
+		} else if (strcmp(argv[i], "-w") == 0) {
+
+			params.zpp_flags |= ZBC_PROFILE_WRITE;
+			flags = (flags & ~O_ACCMODE) | O_RDWR;
+
+		} else if (strcmp(argv[i], "-nodio") == 0) {
+
+			flags &= ~O_DIRECT;
+
+		} else if (strcmp(argv[i], "-q") == 0) {
+
+			quiet = true;
+
+		} else if (strcmp(argv[i], "-o") == 0) {
+
+			if (++i >= argc)
+				goto usage;
+			out = argv[i];
+
+		} else if (strcmp(argv[i], "-i") == 0) {
+
+			if (++i >= argc)
+				goto usage;
+			in = argv[i];
+
+		} else if (argv[i][0] == '-') {
+
+			fprintf(stderr, "Unknown option \"%s\"\n", argv[i]);
+			return 1;
+
+		} else {
+
+			break;
+
+		}
+
+	}
+
+	if (in) {
+		if (i != argc)
+			goto usage;
+		ret = zbc_profile_load(in, &prof);
+		if (ret) {
+			fprintf(stderr, "Load profile %s failed (%s)\n",
+				in, strerror(-ret));
+			return 1;
+		}
+		zbc_profile_print(prof);
+		zbc_profile_free(prof);
+		return 0;
+	}
+
+	if (i != argc - 1)
+		goto usage;
+	path = argv[i];
+
+	/* Open device */
+	ret = zbc_open(path, flags, &dev);
+	if (ret != 0) {
+		if (ret == -ENODEV)
+			fprintf(stderr,
+				"Open %s failed (not a zoned block device)\n",
+				path);
+		else
+			fprintf(stderr, "Open %s failed (%s)\n",
+				path, strerror(-ret));
+		return 1;
+	}
+
+	zbc_get_device_info(dev, &info);
+
+	printf("Device %s:\n", path);
+	zbc_print_device_info(&info, stdout);
+
+	if (!quiet && isatty(STDERR_FILENO))
+		params.zpp_progress = zbc_profile_progress;
+
+	ret = zbc_profile_run(dev, &params, &prof);
+	if (ret != 0) {
+		fprintf(stderr, "zbc_profile_run failed %d (%s)\n",
+			ret, strerror(-ret));
+		ret = 1;
+		goto out;
+	}
+
+	zbc_profile_print(prof);
+
+	if (out) {
+		ret = zbc_profile_save(prof, out);
+		if (ret != 0) {
+			fprintf(stderr, "Save profile to %s failed (%s)\n",
+				out, strerror(-ret));
+			ret = 1;
+			goto out;
+		}
+	}
+
+	ret = 0;
+
+out:
+	zbc_profile_free(prof);
+	zbc_close(dev);
+
+	return ret;
+}
@@ -372,7 +372,7 @@ out:
 		free(iobuf);
 
 	if (zones)
-		free(zones);
+		zbc_free(zones);
 
 	zbc_close(dev);
 
@@ -27,29 +27,46 @@
 int main(int argc, char **argv)
 {
 	struct zbc_device_info info;
+	struct zbc_age_params age;
 	struct zbc_device *dev;
-	long long conv_num, conv_sz, zone_sz;
+	long long conv_num, conv_sz, zone_sz, stripe_sz;
 	double conv_p;
 	int i, ret = -1;
 	char *path;
 
 	/* Check command line */
-	if (argc < 5) {
+	if (argc < 4) {
 usage:
 		printf("Usage: %s [options] <dev> <command> <command arguments>\n"
 		       "Options:\n"
-		       "  -v     : Verbose mode\n"
+		       "  -v          : Verbose mode\n"
+		       "  -seed <num> : Seed of the age command (default: 1)\n"
+		       "  -open <num> : Number of partially written zones to\n"
+		       "                explicitly open with the age command\n"
+		       "  -pattern    : Write pattern data in written zones\n"
+		       "                with the age command (default: sparse)\n"
 		       "Commands:\n"
 		       "  set_sz <conv zone size (MB)> <zone size (MiB)> :\n"
 		       "      Specify the total size in MiB of all conventional\n"
 		       "      zones and the size in MiB of zones\n"
 		       "  set_ps <conv zone size (%%)> <zone size (MiB)> :\n"
 		       "      Specify the percentage of the capacity to use for\n"
-		       "      conventional zones and the size in MiB of zones\n",
+		       "      conventional zones and the size in MiB of zones\n"
+		       "  age <full zones (%%)> <partial zones (%%)> :\n"
+		       "      Randomly set sequential zones to be full, partially\n"
+		       "      written or empty in a single metadata update\n"
+		       "  stripe <stripe size (KiB)> [<file> ...] :\n"
+		       "      Stripe the device data across the device file and\n"
+		       "      the files or block devices <file>, accessed in\n"
+		       "      parallel. The zones must be set again after this\n"
+		       "      command. Without any file, the striping is removed\n",
 		       argv[0]);
 		return 1;
 	}
 
+	memset(&age, 0, sizeof(age));
+	age.zap_seed = 1;
+
 	/* Parse options */
 	for (i = 1; i < argc - 3; i++) {
 
@@ -57,6 +74,24 @@ usage:
 
 			zbc_set_log_level("debug");
 
+		} else if (strcmp(argv[i], "-seed") == 0) {
+
+			if (i >= argc - 4)
+				goto usage;
+			i++;
+			age.zap_seed = strtoul(argv[i], NULL, 10);
+
+		} else if (strcmp(argv[i], "-open") == 0) {
+
+			if (i >= argc - 4)
+				goto usage;
+			i++;
+			age.zap_nr_open = strtoul(argv[i], NULL, 10);
+
+		} else if (strcmp(argv[i], "-pattern") == 0) {
+
+			age.zap_flags |= ZBC_AGE_PATTERN;
+
 		} else if (argv[i][0] == '-') {
 
 			fprintf(stderr, "Unknown option \"%s\"\n", argv[i]);
@@ -100,9 +135,79 @@ usage:
 	printf("\n");
 
 	/* Process command */
-	printf("Setting zones:\n");
 	i++;
 
+	if (strcmp(argv[i], "stripe") == 0) {
+
+		stripe_sz = strtoll(argv[i + 1], NULL, 10) * 1024;
+		if (stripe_sz <= 0 && i != argc - 2) {
+			fprintf(stderr, "Invalid stripe size %s\n",
+				argv[i + 1]);
+			ret = 1;
+			goto out;
+		}
+
+		ret = zbc_set_stripes(dev, stripe_sz, argc - i - 2,
+				      (const char **)&argv[i + 2]);
+		if (ret != 0) {
+			fprintf(stderr,
+				"zbc_set_stripes failed %d (%s)\n",
+				ret,
+				strerror(-ret));
+			ret = 1;
+			goto out;
+		}
+
+		zbc_get_device_info(dev, &info);
+		if (i == argc - 2)
+			printf("Striping removed\n");
+		else
+			printf("Data striped across %d files, %lld KiB stripes\n",
+			       argc - i - 1, stripe_sz / 1024);
+		printf("    Capacity: %llu sectors\n"
+		       "    Set the zones again with set_sz or set_ps\n",
+		       (unsigned long long)info.zbd_sectors);
+
+		goto out;
+
+	}
+
+	if (strcmp(argv[i], "age") == 0) {
+
+		if (i != argc - 3)
+			goto usage;
+
+		age.zap_full_pct = strtoul(argv[i + 1], NULL, 10);
+		age.zap_partial_pct = strtoul(argv[i + 2], NULL, 10);
+		if (age.zap_full_pct + age.zap_partial_pct > 100) {
+			fprintf(stderr, "Invalid zone percentages %s + %s\n",
+				argv[i + 1], argv[i + 2]);
+			ret = 1;
+			goto out;
+		}
+
+		printf("Aging zones:\n");
+		printf("    Full zones: %u %%\n", age.zap_full_pct);
+		printf("    Partially written zones: %u %% (%u open)\n",
+		       age.zap_partial_pct, age.zap_nr_open);
+		printf("    Data: %s\n",
+		       age.zap_flags & ZBC_AGE_PATTERN ? "pattern" : "sparse");
+
+		ret = zbc_age_zones(dev, &age);
+		if (ret != 0) {
+			fprintf(stderr,
+				"zbc_age_zones failed %d (%s)\n",
+				ret,
+				strerror(-ret));
+			ret = 1;
+		}
+
+		goto out;
+
+	}
+
+	printf("Setting zones:\n");
+
 	if (strcmp(argv[i], "set_sz") == 0) {
 
 		/*
@@ -0,0 +1,439 @@
+/*
+ * This file is part of libzbc.
+ *
+ * Copyright (C) 2009-2014, HGST, Inc. All rights reserved.
+ * Copyright (C) 2016, Western Digital. All rights reserved.
+ *
+ * This software is distributed under the terms of the
+ * GNU Lesser General Public License version 3, "as is," without technical
+ * support, and WITHOUT ANY WARRANTY, without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. You should have
+ * received a copy of the GNU Lesser General Public License along with libzbc.
+ * If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Damien Le Moal (damien.lemoal@wdc.com)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <libzbc/zbc.h>
+
+/**
+ * Maximum number of statistics segments monitored.
+ */
+#define ZBC_TOP_MAX_DEV		64
+
+/**
+ * Monitored device.
+ */
+struct zbc_top_dev {
+	char				name[256];
+	struct zbc_device_stats		*stats;
+	struct zbc_device_stats		prev;
+	bool				has_prev;
+	bool				seen;
+};
+
+static struct zbc_top_dev zdev[ZBC_TOP_MAX_DEV];
+
+/**
+ * Map a statistics segment read-only.
+ */
+static struct zbc_device_stats *zbc_top_map(const char *name)
+{
+	struct zbc_device_stats *stats;
+	char path[512];
+	struct stat st;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/%s", ZBC_STATS_DIR, name);
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st) < 0 ||
+	    st.st_size < (off_t)sizeof(struct zbc_device_stats)) {
+		close(fd);
+		return NULL;
+	}
+
+	stats = mmap(NULL, sizeof(struct zbc_device_stats),
+		     PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (stats == MAP_FAILED)
+		return NULL;
+
+	if (__atomic_load_n(&stats->zbs_magic, __ATOMIC_ACQUIRE) !=
+	    ZBC_STATS_MAGIC ||
+	    stats->zbs_version != ZBC_STATS_VERSION ||
+	    (kill(stats->zbs_pid, 0) < 0 && errno == ESRCH)) {
+		/* Not initialized yet, incompatible or stale */
+		munmap(stats, sizeof(struct zbc_device_stats));
+		return NULL;
+	}
+
+	return stats;
+}
+
+/**
+ * Remove a statistics segment left behind by a process that exited
+ * without closing its devices (e.g. a crash). Returns true if the
+ * segment process does not exist anymore.
+ */
+static bool zbc_top_stale(const char *name)
+{
+	char path[512];
+	int pid;
+
+	if (sscanf(name + strlen(ZBC_STATS_PREFIX), "%d-", &pid) != 1 ||
+	    pid <= 0)
+		return false;
+
+	if (kill(pid, 0) == 0 || errno != ESRCH)
+		return false;
+
+	snprintf(path, sizeof(path), "%s/%s", ZBC_STATS_DIR, name);
+	unlink(path);
+
+	return true;
+}
+
+/**
+ * Scan the statistics directory for new and removed segments.
+ */
+static void zbc_top_scan(void)
+{
+	struct zbc_top_dev *zd;
+	struct dirent *de;
+	DIR *dir;
+	int i;
+
+	for (i = 0; i < ZBC_TOP_MAX_DEV; i++)
+		zdev[i].seen = false;
+
+	dir = opendir(ZBC_STATS_DIR);
+	if (dir) {
+		while ((de = readdir(dir)) != NULL) {
+
+			if (strncmp(de->d_name, ZBC_STATS_PREFIX,
+				    strlen(ZBC_STATS_PREFIX)) != 0)
+				continue;
+
+			if (zbc_top_stale(de->d_name))
+				continue;
+
+			/* Already monitored ? */
+			zd = NULL;
+			for (i = 0; i < ZBC_TOP_MAX_DEV; i++) {
+				if (zdev[i].stats &&
+				    strcmp(zdev[i].name, de->d_name) == 0) {
+					zd = &zdev[i];
+					break;
+				}
+			}
+
+			if (!zd) {
+				for (i = 0; i < ZBC_TOP_MAX_DEV; i++) {
+					if (!zdev[i].stats) {
+						zd = &zdev[i];
+						break;
+					}
+				}
+				if (!zd)
+					break;
+				zd->stats = zbc_top_map(de->d_name);
+				if (!zd->stats)
+					continue;
+				snprintf(zd->name, sizeof(zd->name), "%s",
+					 de->d_name);
+				zd->has_prev = false;
+			}
+
+			zd->seen = true;
+
+		}
+		closedir(dir);
+	}
+
+	/* Drop segments that were removed or whose process exited */
+	for (i = 0; i < ZBC_TOP_MAX_DEV; i++) {
+		zd = &zdev[i];
+		if (!zd->stats)
+			continue;
+		if (zd->seen &&
+		    !(kill(zd->stats->zbs_pid, 0) < 0 && errno == ESRCH))
+			continue;
+		munmap(zd->stats, sizeof(struct zbc_device_stats));
+		zd->stats = NULL;
+	}
+}
+
+/**
+ * Get a latency percentile (upper bound, in microseconds) from a
+ * latency histogram.
+ */
+static unsigned long long zbc_top_lat_pct(unsigned long long *hist,
+					  unsigned long long nr, double pct)
+{
+	unsigned long long target, sum = 0;
+	int i;
+
+	if (!nr)
+		return 0;
+
+	target = (unsigned long long)((double)nr * pct / 100.0);
+	if (target >= nr)
+		target = nr - 1;
+
+	for (i = 0; i < ZBC_STAT_LAT_BUCKETS; i++) {
+		sum += hist[i];
+		if (sum > target)
+			return 1ULL << i;
+	}
+
+	return 1ULL << (ZBC_STAT_LAT_BUCKETS - 1);
+}
+
+/**
+ * Print a latency value.
+ */
+static void zbc_top_print_lat(unsigned long long us)
+{
+	if (us >= 10000000)
+		printf(" %8llus", us / 1000000);
+	else if (us >= 10000)
+		printf(" %7llums", us / 1000);
+	else
+		printf(" %7lluus", us);
+}
+
+/**
+ * Print a device statistics for the last interval.
+ */
+static void zbc_top_print(struct zbc_top_dev *zd, double interval)
+{
+	struct zbc_device_stats cur;
+	struct zbc_device_stats *prev = &zd->prev;
+	struct zbc_cmd_stats *c, *p;
+	unsigned long long hist[ZBC_STAT_LAT_BUCKETS];
+	unsigned long long nr, err, sect;
+	unsigned int nr_open;
+	char max_open[32];
+	int i, j;
+
+	memcpy(&cur, zd->stats, sizeof(struct zbc_device_stats));
+	if (!zd->has_prev)
+		memcpy(prev, &cur, sizeof(struct zbc_device_stats));
+
+	printf("[%u] %s: %s interface, %s zone model, %.03F GB\n",
+	       cur.zbs_pid, cur.zbs_filename,
+	       zbc_device_type_str(cur.zbs_type),
+	       zbc_device_model_str(cur.zbs_model),
+	       (double)(cur.zbs_sectors << 9) / 1000000000);
+
+	if (cur.zbs_max_nr_open == ZBC_NO_LIMIT)
+		strcpy(max_open, "unlimited");
+	else
+		sprintf(max_open, "%u", cur.zbs_max_nr_open);
+
+	if (cur.zbs_zones_time) {
+		nr_open = cur.zbs_zone_cond[ZBC_ZC_IMP_OPEN] +
+			cur.zbs_zone_cond[ZBC_ZC_EXP_OPEN];
+		printf("    Open zones: %u / %s (%u implicit, %u explicit)\n",
+		       nr_open, max_open,
+		       cur.zbs_zone_cond[ZBC_ZC_IMP_OPEN],
+		       cur.zbs_zone_cond[ZBC_ZC_EXP_OPEN]);
+		printf("    %u zones: %u not-wp, %u empty, %u closed, "
+		       "%u full, %u read-only, %u offline (%llu s ago)\n",
+		       cur.zbs_nr_zones,
+		       cur.zbs_zone_cond[ZBC_ZC_NOT_WP],
+		       cur.zbs_zone_cond[ZBC_ZC_EMPTY],
+		       cur.zbs_zone_cond[ZBC_ZC_CLOSED],
+		       cur.zbs_zone_cond[ZBC_ZC_FULL],
+		       cur.zbs_zone_cond[ZBC_ZC_RDONLY],
+		       cur.zbs_zone_cond[ZBC_ZC_OFFLINE],
+		       (unsigned long long)time(NULL) - cur.zbs_zones_time);
+	} else {
+		printf("    Open zones: ? / %s (no zone report yet)\n",
+		       max_open);
+	}
+
+	if (cur.zbs_qd_limit) {
+		printf("    Queue depth: limit %u, %u in flight, "
+		       "%.0f IOPS, %.2f MB/s, latency",
+		       cur.zbs_qd_limit, cur.zbs_qd_inflight,
+		       (double)cur.zbs_qd_iops,
+		       (double)(cur.zbs_qd_bw << 9) / 1000000);
+		zbc_top_print_lat(cur.zbs_qd_lat_ns / 1000);
+		printf(" (base");
+		zbc_top_print_lat(cur.zbs_qd_lat_min_ns / 1000);
+		printf("), %llu waits\n",
+		       (unsigned long long)(cur.zbs_qd_nr_waits -
+					    prev->zbs_qd_nr_waits));
+	}
+
+	printf("    %-8s %10s %10s %8s %9s %9s %9s %9s %12s\n",
+	       "Command", "IOPS", "MB/s", "Err/s",
+	       "avg", "p50", "p99", "p99.9", "Errors");
+
+	for (i = 0; i < ZBC_STAT_NR_CLASSES; i++) {
+
+		c = &cur.zbs_cmd[i];
+		p = &prev->zbs_cmd[i];
+		if (!c->zbs_nr_cmds)
+			continue;
+
+		nr = c->zbs_nr_cmds - p->zbs_nr_cmds;
+		err = c->zbs_nr_errors - p->zbs_nr_errors;
+		sect = c->zbs_sectors - p->zbs_sectors;
+		for (j = 0; j < ZBC_STAT_LAT_BUCKETS; j++)
+			hist[j] = c->zbs_lat_hist[j] - p->zbs_lat_hist[j];
+
+		printf("    %-8s %10.0f %10.2f %8.0f",
+		       zbc_stat_class_str(i),
+		       (double)nr / interval,
+		       (double)(sect << 9) / 1000000 / interval,
+		       (double)err / interval);
+		zbc_top_print_lat(nr ?
+			(c->zbs_lat_ns - p->zbs_lat_ns) / nr / 1000 : 0);
+		zbc_top_print_lat(zbc_top_lat_pct(hist, nr, 50));
+		zbc_top_print_lat(zbc_top_lat_pct(hist, nr, 99));
+		zbc_top_print_lat(zbc_top_lat_pct(hist, nr, 99.9));
+		printf(" %12llu\n",
+		       (unsigned long long)c->zbs_nr_errors);
+
+	}
+
+	printf("\n");
+
+	memcpy(prev, &cur, sizeof(struct zbc_device_stats));
+	zd->has_prev = true;
+}
+
+/***** Main *****/
+
+int main(int argc, char **argv)
+{
+	unsigned int interval = 1, count = 0, n = 0;
+	bool batch = false;
+	char *filter = NULL;
+	struct timespec ts;
+	time_t now;
+	int pid = 0, nr_dev, i;
+
+	/* Parse options */
+	for (i = 1; i < argc; i++) {
+
+		if (strcmp(argv[i], "-h") == 0) {
+
+			goto usage;
+
+		} else if (strcmp(argv[i], "-i") == 0) {
+
+			if (i >= (argc - 1))
+				goto usage;
+			i++;
+			interval = atoi(argv[i]);
+			if (!interval) {
+				fprintf(stderr, "Invalid interval\n");
+				return 1;
+			}
+
+		} else if (strcmp(argv[i], "-n") == 0) {
+
+			if (i >= (argc - 1))
+				goto usage;
+			i++;
+			count = atoi(argv[i]);
+
+		} else if (strcmp(argv[i], "-p") == 0) {
+
+			if (i >= (argc - 1))
+				goto usage;
+			i++;
+			pid = atoi(argv[i]);
+
+		} else if (strcmp(argv[i], "-b") == 0) {
+
+			batch = true;
+
+		} else if (argv[i][0] == '-') {
+
+			printf("Unknown option \"%s\"\n",
+			       argv[i]);
+			goto usage;
+
+		} else {
+
+			break;
+
+		}
+
+	}
+
+	if (i == (argc - 1)) {
+		filter = argv[i];
+	} else if (i != argc) {
+usage:
+		printf("Usage: %s [options] [<dev>]\n"
+		       "  Monitor devices used by running libzbc applications.\n"
+		       "  If <dev> is specified, only that device is shown.\n"
+		       "Options:\n"
+		       "    -h        : Display this help message and exit\n"
+		       "    -i <sec>  : Refresh interval in seconds (default: 1)\n"
+		       "    -n <num>  : Exit after <num> refreshes\n"
+		       "    -p <pid>  : Only show devices used by process <pid>\n"
+		       "    -b        : Batch mode (do not clear the screen)\n",
+		       argv[0]);
+		return 1;
+	}
+
+	while (1) {
+
+		zbc_top_scan();
+
+		if (!batch)
+			printf("\033[H\033[2J");
+		now = time(NULL);
+		printf("zbc_top - %s", ctime(&now));
+
+		nr_dev = 0;
+		for (i = 0; i < ZBC_TOP_MAX_DEV; i++) {
+			if (!zdev[i].stats)
+				continue;
+			if (pid && (int)zdev[i].stats->zbs_pid != pid)
+				continue;
+			if (filter &&
+			    strcmp(zdev[i].stats->zbs_filename, filter) != 0)
+				continue;
+			zbc_top_print(&zdev[i], interval);
+			nr_dev++;
+		}
+
+		if (!nr_dev)
+			printf("No device in use\n");
+
+		fflush(stdout);
+
+		n++;
+		if (count && n >= count)
+			break;
+
+		ts.tv_sec = interval;
+		ts.tv_nsec = 0;
+		nanosleep(&ts, NULL);
+
+	}
+
+	return 0;
+}
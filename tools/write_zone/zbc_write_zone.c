@@ -443,7 +443,7 @@ out:
 	if (iobuf)
 		free(iobuf);
 	if (zones)
-		free(zones);
+		zbc_free(zones);
 
 	return ret;
 }
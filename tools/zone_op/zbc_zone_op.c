@@ -233,7 +233,7 @@ usage:
 
 out:
 	if (zones)
-		free(zones);
+		zbc_free(zones);
 	zbc_close(dev);
 
 	return ret;